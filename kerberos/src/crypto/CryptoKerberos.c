@@ -64,7 +64,7 @@ SUCCESS:
 errno_t decryptKerberos(uint8_t* aad, size_t aadLength, uint8_t* ciphertext, size_t ciphertextLength, uint8_t** plaintext, size_t* plaintextLength)
 {
 	uint8_t *output;
-	uint32_t outputLength, outputOffset = 0;
+	size_t outputLength, outputOffset = 0;
 	errno_t result;
 	
 	result = initReadKerberos();
@@ -46,6 +46,8 @@ typedef struct {
 	/* Counter mode needs a buffer */
 	uint8_t buffer[MAX_BLOCK_SIZE];
 	uint8_t bufferOffset;
+	/* Number of counter blocks already consumed under the current IV */
+	uint64_t blockCount;
 } ctr_ctx_st;
 
 /* All values inside the structure are modified during execution */
@@ -88,20 +90,20 @@ errno_t decryptKerberos(uint8_t* /* aad */, size_t /* aadLength */, uint8_t* /*
 
 
 errno_t gcmInit(gcm_ctx_st* /* ctx */, uint8_t /* blockSize */, uint8_t /* dir */, uint8_t* /* nonce */, 
-									uint32_t /* nonceLength */, uint8_t /* tagSize */, void* /* blockCipherCtx */, 
+									size_t /* nonceLength */, uint8_t /* tagSize */, void* /* blockCipherCtx */, 
 									errno_t /*blockCipher*/(const uint8_t*, uint8_t *, void*));
 
-errno_t gcmUpdateAAD(gcm_ctx_st* /* ctx */, const uint8_t* /* input */, uint32_t /* inputLen */, uint32_t /* inputOffset */);
+errno_t gcmUpdateAAD(gcm_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */, size_t /* inputOffset */);
 
-errno_t gcmUpdate(gcm_ctx_st* /* ctx */, const uint8_t* /* input */, uint32_t /* inputLen */, uint32_t /* inputOffset */, uint8_t* /* output */, 
-										uint32_t /* outputLen */, uint32_t* /* outputOffset */);
+errno_t gcmUpdate(gcm_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */, size_t /* inputOffset */, uint8_t* /* output */, 
+										size_t /* outputLen */, size_t* /* outputOffset */);
 
-errno_t gcmFinal(gcm_ctx_st* /* ctx */, const uint8_t* /* input */, uint32_t /* inputLen */, uint32_t /* inputOffset */, uint8_t* /* output */, 
-									   uint32_t /* outputLen */, uint32_t* /* outputOffset */);
+errno_t gcmFinal(gcm_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */, size_t /* inputOffset */, uint8_t* /* output */, 
+									   size_t /* outputLen */, size_t* /* outputOffset */);
 
-errno_t gcmCalculateOutputSize(gcm_ctx_st* /* ctx */, uint32_t /* inputLen */, uint32_t* /* outputLen */);
+errno_t gcmCalculateOutputSize(gcm_ctx_st* /* ctx */, size_t /* inputLen */, size_t* /* outputLen */);
 
-errno_t gcmInitNonce(gcm_ctx_st* /* ctx */, uint8_t* /* nonce */, uint32_t /* nonceLength */);
+errno_t gcmInitNonce(gcm_ctx_st* /* ctx */, uint8_t* /* nonce */, size_t /* nonceLength */);
 
 errno_t gcmClearContext(gcm_ctx_st* /* ctx */);
 
@@ -0,0 +1,182 @@
+#ifndef SECURE_CHANNEL_H_
+#define SECURE_CHANNEL_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "errno.h"
+
+/*
+ * Entry points of libaes (CryptoAPI.h and util/secureutil.h) used by this
+ * library. libaes only installs CryptoAPI.h, whose internal includes are not
+ * available here, so the prototypes are kept in sync by hand. Lengths are
+ * size_t on both sides.
+ */
+
+errno_t initSecureChannel(uint8_t /* keyLength */,
+                          uint8_t /* ivLength */,
+                          uint8_t /* tagLen */,
+                          uint8_t* /* kLocal */,
+                          uint8_t* /* kExtern */,
+                          uint8_t* /* iLocal */,
+                          uint8_t* /* iExtern */);
+errno_t initSecureChannelWithAlgorithm(uint8_t /* algorithm */,
+                                       uint8_t /* keyLength */,
+                                       uint8_t /* ivLength */,
+                                       uint8_t /* tagLen */,
+                                       uint8_t* /* kLocal */,
+                                       uint8_t* /* kExtern */,
+                                       uint8_t* /* iLocal */,
+                                       uint8_t* /* iExtern */);
+errno_t clearSecureChannel();
+
+uint8_t getPreferredCryptoAlgorithm();
+
+errno_t sealWithKey(uint8_t /* algorithm */,
+                    uint8_t* /* key */,
+                    uint8_t /* keyLength */,
+                    uint8_t* /* iv */,
+                    uint8_t /* ivLength */,
+                    uint8_t /* tagLen */,
+                    uint8_t* /* aad */,
+                    size_t /* aadLength */,
+                    uint8_t* /* plaintext */,
+                    size_t /* plaintextLength */,
+                    uint8_t** /* ciphertext */,
+                    size_t* /* ciphertextLength */);
+errno_t openWithKey(uint8_t /* algorithm */,
+                    uint8_t* /* key */,
+                    uint8_t /* keyLength */,
+                    uint8_t* /* iv */,
+                    uint8_t /* ivLength */,
+                    uint8_t /* tagLen */,
+                    uint8_t* /* aad */,
+                    size_t /* aadLength */,
+                    uint8_t* /* ciphertext */,
+                    size_t /* ciphertextLength */,
+                    uint8_t** /* plaintext */,
+                    size_t* /* plaintextLength */);
+
+/* Messages a key seals before sealWithKeyTo refuses it (GCM_MAX_INVOCATIONS) */
+#define SEAL_MAX_INVOCATIONS 4294967296ULL
+
+errno_t sealWithKeyTo(uint8_t /* algorithm */,
+                      uint8_t* /* key */,
+                      uint8_t /* keyLength */,
+                      uint8_t* /* iv */,
+                      uint8_t /* ivLength */,
+                      uint8_t /* tagLen */,
+                      uint8_t* /* aad */,
+                      size_t /* aadLength */,
+                      uint8_t* /* plaintext */,
+                      size_t /* plaintextLength */,
+                      uint8_t* /* ciphertext */,
+                      size_t /* ciphertextCapacity */,
+                      size_t* /* ciphertextLength */,
+                      uint64_t* /* invocations */);
+errno_t openWithKeyTo(uint8_t /* algorithm */,
+                      uint8_t* /* key */,
+                      uint8_t /* keyLength */,
+                      uint8_t* /* iv */,
+                      uint8_t /* ivLength */,
+                      uint8_t /* tagLen */,
+                      uint8_t* /* aad */,
+                      size_t /* aadLength */,
+                      uint8_t* /* ciphertext */,
+                      size_t /* ciphertextLength */,
+                      uint8_t* /* plaintext */,
+                      size_t /* plaintextCapacity */,
+                      size_t* /* plaintextLength */);
+
+#define OPEN_STREAM_OUTPUT_OVERHEAD (16 + 16) /* MAX_TAG_SIZE + MAX_BLOCK_SIZE */
+
+typedef struct SOpenStream OpenStream;
+
+errno_t openStreamInit(uint8_t /* algorithm */,
+                       uint8_t* /* key */,
+                       uint8_t /* keyLength */,
+                       uint8_t* /* iv */,
+                       uint8_t /* ivLength */,
+                       uint8_t /* tagLen */,
+                       uint8_t* /* aad */,
+                       size_t /* aadLength */,
+                       OpenStream** /* stream */);
+errno_t openStreamUpdate(OpenStream* /* stream */,
+                         const uint8_t* /* input */,
+                         size_t /* inputLength */,
+                         uint8_t* /* output */,
+                         size_t /* outputCapacity */,
+                         size_t* /* outputLength */);
+errno_t openStreamFinal(OpenStream* /* stream */,
+                        uint8_t* /* output */,
+                        size_t /* outputCapacity */,
+                        size_t* /* outputLength */);
+void openStreamAbort(OpenStream* /* stream */);
+
+#define SEAL_STREAM_OUTPUT_OVERHEAD (16 + 16) /* MAX_TAG_SIZE + MAX_BLOCK_SIZE */
+
+typedef struct SSealStream SealStream;
+
+errno_t sealStreamInit(uint8_t /* algorithm */,
+                       uint8_t* /* key */,
+                       uint8_t /* keyLength */,
+                       uint8_t* /* iv */,
+                       uint8_t /* ivLength */,
+                       uint8_t /* tagLen */,
+                       uint8_t* /* aad */,
+                       size_t /* aadLength */,
+                       SealStream** /* stream */,
+                       uint64_t* /* invocations */);
+errno_t sealStreamUpdate(SealStream* /* stream */,
+                         const uint8_t* /* input */,
+                         size_t /* inputLength */,
+                         uint8_t* /* output */,
+                         size_t /* outputCapacity */,
+                         size_t* /* outputLength */);
+errno_t sealStreamFinal(SealStream* /* stream */,
+                        uint8_t* /* output */,
+                        size_t /* outputCapacity */,
+                        size_t* /* outputLength */);
+void sealStreamAbort(SealStream* /* stream */);
+
+errno_t deriveKey(uint8_t* /* key */,
+                  uint8_t /* keyLength */,
+                  const uint8_t* /* label */,
+                  uint8_t /* labelLength */,
+                  uint8_t* /* derived */,
+                  size_t /* derivedLength */);
+
+errno_t encryptTo(uint8_t* /* aad */,
+                  size_t /* aadLength */,
+                  uint8_t* /* plaintext */,
+                  size_t /* plaintextLength */,
+                  uint8_t** /* ciphertext */,
+                  size_t* /* ciphertextLength */);
+errno_t changeIvAndEncryptTo(uint8_t* /* ivExternal */,
+                             uint8_t /* ivExternalLength */,
+                             uint8_t* /* aad */,
+                             size_t /* aadLength */,
+                             uint8_t* /* plaintext */,
+                             size_t /* plaintextLength */,
+                             uint8_t** /* ciphertext */,
+                             size_t* /* ciphertextLength */);
+
+errno_t decryptTo(uint8_t* /* aad */,
+                  size_t /* aadLength */,
+                  uint8_t* /* ciphertext */,
+                  size_t /* ciphertextLength */,
+                  uint8_t** /* plaintext */,
+                  size_t* /* plaintextLength */);
+errno_t changeIvAndDecryptTo(uint8_t* /* ivInternal */,
+                             uint8_t /* ivInternalLength */,
+                             uint8_t* /* aad */,
+                             size_t /* aadLength */,
+                             uint8_t* /* ciphertext */,
+                             size_t /* ciphertextLength */,
+                             uint8_t** /* plaintext */,
+                             size_t* /* plaintextLength */);
+
+errno_t memset_s(void* /* v */, size_t /* smax */, uint8_t /* c */, size_t /* n */);
+errno_t getRandomBytes(uint8_t* /* output */, size_t /* outputLength */);
+
+#endif /* SECURE_CHANNEL_H_ */
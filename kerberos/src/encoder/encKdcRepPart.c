@@ -61,9 +61,9 @@ uint8_t setEncodedEncKdcPart(EncKdcPart* encKdcPart,
     }
     encOffset += sessionKeyOffset;
 
-    /* Check if encoded input has the correct size */
+    /* Check if encoded input has the correct size, optionally followed by the negotiated algorithm */
     size_t totalLength = encOffset + 2 * sizeof(uint64_t) + PRINCIPAL_NAME_LENGTH + NONCE_LENGTH;
-    if(totalLength != encodedLength) {
+    if(totalLength != encodedLength && totalLength + sizeof(uint8_t) != encodedLength) {
         eraseSessionKeys(&encKdcPart->sk);
         return MA_COMM_INVALID_PARAMETER;
     }
@@ -79,6 +79,15 @@ uint8_t setEncodedEncKdcPart(EncKdcPart* encKdcPart,
     encKdcPart->endtime = be64toh(encKdcPart->endtime);
     encOffset += sizeof(uint64_t);
 
+    if(encOffset < encodedLength) {
+        memcpy(&encKdcPart->sk.algorithm, encodedInput + encOffset, sizeof(uint8_t));
+        encOffset += sizeof(uint8_t);
+        if(checkSessionKeys(&encKdcPart->sk) != SUCCESSFULL_OPERATION) {
+            eraseSessionKeys(&encKdcPart->sk);
+            return MA_COMM_INVALID_PARAMETER;
+        }
+    }
+
     return MA_COMM_SUCCESS;
 }
 
@@ -14,7 +14,7 @@ errno_t encodeEncData(EncryptedData* encryptedData, uint8_t* iv, size_t ivLength
         goto FAIL;
     }
 
-    if(ivLength > IV_LENGTH || ciphertextLength == 0) {
+    if(ivLength > IV_LENGTH || ciphertextLength == 0 || ciphertextLength > MAX_ENC_DATA_CIPHERTEXT_LENGTH) {
         result = INVALID_PARAMETER;
         goto FAIL;
     }
@@ -97,8 +97,8 @@ uint8_t getEncodedEncDataOnBuffer(EncryptedData* encryptedData,
     *offset = 0;
     memcpy(buffer + *offset, &encryptedData->ivLength, sizeof(encryptedData->ivLength));
     *offset += sizeof(encryptedData->ivLength);
-    memcpy(buffer + *offset, &encryptedData->ciphertextLength, sizeof(encryptedData->ciphertextLength));
-    *offset += sizeof(encryptedData->ciphertextLength);
+    buffer[*offset] = (uint8_t) encryptedData->ciphertextLength;
+    *offset += sizeof(uint8_t);
     memcpy(buffer + *offset, encryptedData->iv, encryptedData->ivLength);
     *offset += encryptedData->ivLength;
     memcpy(buffer + *offset, encryptedData->ciphertext, encryptedData->ciphertextLength);
@@ -142,8 +142,8 @@ errno_t getEncodedEncData(EncryptedData* encryptedData, uint8_t** encodedOutput,
     offset = 0;
     memcpy(*encodedOutput + offset, &encryptedData->ivLength, sizeof(encryptedData->ivLength));
     offset += sizeof(encryptedData->ivLength);
-    memcpy(*encodedOutput + offset, &encryptedData->ciphertextLength, sizeof(encryptedData->ciphertextLength));
-    offset += sizeof(encryptedData->ciphertextLength);
+    (*encodedOutput)[offset] = (uint8_t) encryptedData->ciphertextLength;
+    offset += sizeof(uint8_t);
     memcpy(*encodedOutput + offset, encryptedData->iv, sizeof(uint8_t) * encryptedData->ivLength);
     offset += sizeof(uint8_t) * encryptedData->ivLength;
     memcpy(*encodedOutput + offset, encryptedData->ciphertext, sizeof(uint8_t) * encryptedData->ciphertextLength);
@@ -190,8 +190,8 @@ uint8_t setEncodedEncData(EncryptedData* encryptedData,
     encodedOffset += sizeof(encryptedData->ivLength);
 
     // cipher length
-    memcpy(&encryptedData->ciphertextLength, encodedInput + encodedOffset, sizeof(encryptedData->ciphertextLength));
-    encodedOffset += sizeof(encryptedData->ciphertextLength);
+    encryptedData->ciphertextLength = encodedInput[encodedOffset];
+    encodedOffset += sizeof(uint8_t);
 
     // iv
     encryptedData->iv = (uint8_t*) malloc(sizeof(uint8_t) * encryptedData->ivLength);
@@ -220,7 +220,7 @@ uint8_t decodeEncData(EncryptedData* encryptedData,
                       uint8_t** iv,
                       uint8_t* ivLength,
                       uint8_t** ciphertext,
-                      uint8_t* ciphertextLength) {
+                      size_t* ciphertextLength) {
     uint8_t result = MA_COMM_SUCCESS;
 
     // Input validation
@@ -257,6 +257,7 @@ uint8_t checkEncData(EncryptedData *encryptedData) {
     if ( (!encryptedData) ||
          (encryptedData->ivLength != IV_LENGTH) ||
          (encryptedData->ciphertextLength == 0) ||
+         (encryptedData->ciphertextLength > MAX_ENC_DATA_CIPHERTEXT_LENGTH) ||
          (!encryptedData->iv) ||
          (!encryptedData->ciphertext)) {
         return MA_COMM_INVALID_PARAMETER;
@@ -345,7 +346,7 @@ void dumpEncryptedData(EncryptedData *encryptedData, uint8_t indent) {
         return;
     }
 
-    uint8_t i = 0;
+    size_t i = 0;
     LOG("%*sEncrytedData:\n", indent, "");
     LOG("%*sivLength: %u\n", indent + 1, "", encryptedData->ivLength);
     LOG("%*siv: ", indent + 1, "");
@@ -353,7 +354,7 @@ void dumpEncryptedData(EncryptedData *encryptedData, uint8_t indent) {
         LOG("%02x", encryptedData->iv[i]);
     }
     LOG("\n");
-    LOG("%*scipherLength: %u\n", indent + 1, "", encryptedData->ciphertextLength);
+    LOG("%*scipherLength: %zu\n", indent + 1, "", encryptedData->ciphertextLength);
     LOG("%*scipherText: ", indent + 1, "");
     for(i = 0; i < encryptedData->ciphertextLength; ++i) {
         LOG("%02x", encryptedData->ciphertext[i]);
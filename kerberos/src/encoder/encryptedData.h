@@ -8,9 +8,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* The ciphertext length is serialized in a single byte */
+#define MAX_ENC_DATA_CIPHERTEXT_LENGTH  UINT8_MAX
+
 typedef struct {
     uint8_t ivLength;
-    uint8_t ciphertextLength;
+    size_t ciphertextLength;
     uint8_t *iv;
     uint8_t *ciphertext;
 } EncryptedData;
@@ -25,7 +28,7 @@ errno_t getEncodedEncData(EncryptedData* /* encryptedData */, uint8_t** /* encod
 errno_t setEncodedEncData(EncryptedData* /* encryptedData */, uint8_t* /* encodedInput */, size_t /* encodedLength */, size_t* /* offset */);
 
 errno_t decodeEncData(EncryptedData* /* encryptedData */, uint8_t** /* iv */, uint8_t* /* ivLength */,
-                uint8_t** /* ciphertext */, uint8_t* /* ciphertextLength */);
+                uint8_t** /* ciphertext */, size_t* /* ciphertextLength */);
 
 errno_t getEncodedLengthEncData(EncryptedData* /* encryptedData */, size_t* /* encodedLength */);
 
@@ -83,6 +83,7 @@ errno_t setEncodedError(Error* error, uint8_t* encodedInput, size_t encodedLengt
 	error->errorCode = encodedInput[encOffset];
 	encOffset += ERROR_CODE_LENGTH;
 	*offset = encOffset;
+	result = SUCCESSFULL_OPERATION;
 FAIL:
 	return result;
 }
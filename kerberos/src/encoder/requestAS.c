@@ -46,7 +46,8 @@ uint8_t getEncodedRequestAS(RequestAS* requestAS,
     *encodedOutput = (uint8_t*) malloc(MESSAGE_CODE_LENGTH +
                                 sizeof(requestAS->cname) +
                                 sizeof(requestAS->sname) +
-                                sizeof(requestAS->nonce));
+                                sizeof(requestAS->nonce) +
+                                sizeof(requestAS->algorithm));
     if(!*encodedOutput) {
         return MA_COMM_OUT_OF_MEMORY;
     }
@@ -60,6 +61,11 @@ uint8_t getEncodedRequestAS(RequestAS* requestAS,
     encOffset += sizeof(requestAS->sname);
     memcpy(*encodedOutput + encOffset, requestAS->nonce, sizeof(requestAS->nonce));
     encOffset += sizeof(requestAS->nonce);
+    /* AES-GCM is implied when the algorithm is missing, which keeps the original encoding */
+    if(requestAS->algorithm != SESSION_ALGORITHM_AES_GCM) {
+        memcpy(*encodedOutput + encOffset, &requestAS->algorithm, sizeof(requestAS->algorithm));
+        encOffset += sizeof(requestAS->algorithm);
+    }
     *encodedLength = encOffset;
 
     return MA_COMM_SUCCESS;
@@ -72,6 +78,7 @@ uint8_t initRequestAS(RequestAS* requestAs) {
     memset(requestAs->cname, 0, PRINCIPAL_NAME_LENGTH);
     memset(requestAs->sname, 0, PRINCIPAL_NAME_LENGTH);
     memset(requestAs->nonce, 0, NONCE_LENGTH);
+    requestAs->algorithm = SESSION_ALGORITHM_AES_GCM;
 
     return MA_COMM_SUCCESS;
 }
@@ -115,5 +122,6 @@ void dumpRequestAS(RequestAS *requestAs, uint8_t indent) {
         LOG("%02x", requestAs->nonce[i]);
     }
     LOG("\n");
+    LOG("%*salgorithm: %u\n", indent + 1, "", requestAs->algorithm);
 }
 
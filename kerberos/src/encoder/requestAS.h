@@ -2,6 +2,7 @@
 #define REQUEST_AS_
 
 #include "constants.h"
+#include "sessionKey.h"
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -16,6 +17,7 @@ typedef struct {
     uint8_t cname[PRINCIPAL_NAME_LENGTH];
     uint8_t sname[PRINCIPAL_NAME_LENGTH];
     uint8_t nonce[NONCE_LENGTH];
+    uint8_t algorithm;    /* AEAD proposed for the session, see SESSION_ALGORITHM_* */
 } RequestAS;
 
 /* Fills the request */
@@ -98,6 +98,7 @@ errno_t getEncodedSessionKeys(SessionKeys* sessionKeys, uint8_t** encodedOutput,
     offset += sizeof(uint8_t) * sessionKeys->keyLength;
     memcpy(*encodedOutput + offset, sessionKeys->ivSC, sizeof(uint8_t) * sessionKeys->ivLength);
     offset += sizeof(uint8_t) * sessionKeys->ivLength;
+    *encodedLength = offset;
 
 FAIL:
     return result;
@@ -238,6 +239,12 @@ errno_t checkSessionKeys(SessionKeys* sessionKeys)
         goto FAIL;
     }
 
+    if(sessionKeys->algorithm != SESSION_ALGORITHM_AES_GCM &&
+        sessionKeys->algorithm != SESSION_ALGORITHM_CHACHA20_POLY1305) {
+        result = INVALID_PARAMETER;
+        goto FAIL;
+    }
+
     if(sessionKeys->keyCS == NULL || sessionKeys->keySC == NULL) {
         result = INVALID_PARAMETER;
         goto FAIL;
@@ -289,7 +296,7 @@ uint8_t eraseSessionKeys(SessionKeys* sessionKeys) {
     }
 
     sessionKeys->keyLength = 0;
-
+    sessionKeys->algorithm = SESSION_ALGORITHM_AES_GCM;
 
     return MA_COMM_SUCCESS;
 }
@@ -302,6 +309,7 @@ uint8_t copySessionKeys(SessionKeys* src, SessionKeys* dst) {
 
     initSessionKeys(dst);
 
+    dst->algorithm = src->algorithm;
     dst->keyLength = src->keyLength;
     dst->ivLength = src->ivLength;
     dst->keyCS = (uint8_t*) malloc(sizeof(uint8_t) * src->keyLength);
@@ -328,6 +336,7 @@ uint8_t initSessionKeys(SessionKeys* sessionKeys) {
         return MA_COMM_INVALID_PARAMETER;
     }
 
+    sessionKeys->algorithm = SESSION_ALGORITHM_AES_GCM;
     sessionKeys->ivLength = 0;
     sessionKeys->keyLength = 0;
     sessionKeys->ivCS = NULL;
@@ -345,6 +354,7 @@ void dumpSessionKeys(SessionKeys* sessionKeys, uint8_t indent) {
 
     uint8_t i = 0;
     LOG("%*sSessionKeys:\n", indent, "");
+    LOG("%*salgorithm: %u\n", indent + 1, "", sessionKeys->algorithm);
     LOG("%*sivLength: %u\n", indent + 1, "", sessionKeys->ivLength);
     LOG("%*sivCS: ", indent + 1, "");
     for(i = 0; i < sessionKeys->ivLength; ++i) {
@@ -8,7 +8,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* AEAD used by the secure channel, same identifiers as libaes */
+#define SESSION_ALGORITHM_AES_GCM               0
+#define SESSION_ALGORITHM_CHACHA20_POLY1305     1
+
 typedef struct {
+    uint8_t algorithm;
     uint8_t keyLength;
     uint8_t ivLength;
     uint8_t *keyCS;
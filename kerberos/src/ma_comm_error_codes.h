@@ -8,6 +8,7 @@
 #define MA_COMM_INVALID_PARAMETER		1
 #define MA_COMM_OUT_OF_MEMORY			2
 #define MA_COMM_INVALID_STATE			3
+#define MA_COMM_BUFFER_TOO_SMALL		4
 
 
 #endif /* KERBEROS_SRC_MA_COMM_ERROR_CODES_H_ */
@@ -1,41 +1,140 @@
 #include "ma_communication.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/stat.h>
 #include <curl/curl.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "protocol/protocol.h"
 #include "logger/logger.h"
 #include "ma_comm_error_codes.h"
 #include "crypto/codes.h"
+#include "crypto/SecureChannel.h"
+#include "protocol/communication.h"
+#include "protocol/async-communication.h"
+#include "protocol/utils.h"
 
 #define IV_LENGTH 12
-#define MUTUAL_AUTH_HEADER_LENGTH 80
+#define MUTUAL_AUTH_HEADER_PREFIX "ma-session-id: "
+// the prefix, two hex digits per session id byte and the terminator
+#define MUTUAL_AUTH_HEADER_LENGTH (sizeof(MUTUAL_AUTH_HEADER_PREFIX) + 2 * SESSION_ID_LENGTH)
+// bounds of the delay between two background renewals
+#define RENEWAL_MIN_DELAY_MS 1000
+#define RENEWAL_RETRY_DELAY_MS 5000
+// a sealed session is far smaller, anything bigger is not a cache
+#define SESSION_CACHE_MAX_SIZE 4096
+// plaintext read from the source and sealed at once by a streamed upload
+#define UPLOAD_CHUNK_SIZE (64 * 1024)
+// big endian length in front of each record of a record batch
+#define RECORD_LENGTH_SIZE 4
+// how long and how much ma_communication_send_record gathers by default
+#define RECORD_DEFAULT_MAX_DELAY_MS 5
+#define RECORD_DEFAULT_MAX_BATCH_SIZE (16 * 1024)
+
+// older libcurl fail the reused h2c connections ("Error in the HTTP2 framing layer")
+#define PRIOR_KNOWLEDGE_MIN_CURL_VERSION 0x080100
 
 typedef struct SCommContext {
     uint8_t isSecureChannelEnabled;
     uint8_t initCurl;
     void* pKerberosContext;
-    char mutualAuthHeader[MUTUAL_AUTH_HEADER_LENGTH];
 } CommContext;
 
+/*
+ * Session used to send messages. A channel is immutable once published and
+ * reference counted: senders take a reference and seal and open with their
+ * own AEAD contexts, so concurrent sends share no cipher state, and a renewal
+ * publishes a new channel while the requests in flight finish on the old one.
+ * Only sealInvocations changes, atomically, counting the messages sealed
+ * under keyCS: libaes refuses to seal past SEAL_MAX_INVOCATIONS, and the
+ * channel is then renewed as an expired one.
+ */
+typedef struct SSendChannel {
+    uint32_t references;
+    uint64_t sealInvocations;
+    SessionSnapshot session;
+    char mutualAuthHeader[MUTUAL_AUTH_HEADER_LENGTH];
+} SendChannel;
+
+static const char hexDigits[] = "0123456789abcdef";
 static int initialized = 0;
 static CommContext internalContext;
+// published channel, swapped atomically; acquirers are counted per epoch
+// parity so that a replaced channel is only released after a grace period
+static SendChannel *pSendChannel = NULL;
+static uint32_t sendChannelEpoch = 0;
+static uint32_t sendChannelAcquirers[2] = { 0, 0 };
+// single flight handshake, everything below is guarded by channelMutex
+static pthread_mutex_t channelMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t handshakeDone = PTHREAD_COND_INITIALIZER;
+static uint8_t handshakeInProgress = 0;
+static uint8_t lastHandshakeResult = MA_COMM_SUCCESS;
+static uint64_t handshakeGeneration = 0;
+static uint64_t handshakeCount = 0;
+static uint64_t coalescedWaits = 0;
+// retries made by the running asynchronous handshake
+static uint32_t asyncHandshakeRetries = 0;
+static char *sessionCachePath = NULL;
+// requests sent once the running handshake completes
+static struct SAsyncSend *pWaitingSends = NULL;
+static struct SAsyncSend *pWaitingSendsTail = NULL;
+// background renewal, guarded by renewalMutex
+static pthread_mutex_t renewalMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t renewalWakeup = PTHREAD_COND_INITIALIZER;
+static pthread_t renewalThread;
+static uint8_t renewalRunning = 0;
+static uint8_t renewalStop = 0;
+static uint8_t renewalPercent = 0;
+static uint8_t renewalJitterPercent = 0;
+// warm up run by ma_communication_init, guarded by warmUpMutex
+static pthread_mutex_t warmUpMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t warmUpEnabled = 0;
+static uint8_t warmUpKeepConnections = 0;
+static char **warmUpApiUrls = NULL;
+static size_t warmUpApiUrlCount = 0;
+static pthread_t warmUpThread;
+static uint8_t warmUpRunning = 0;
+static uint8_t warmUpStop = 0;
+// record batches still gathering messages, guarded by recordMutex
+static pthread_mutex_t recordMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t recordsSent = PTHREAD_COND_INITIALIZER;
+static uint32_t recordMaxDelayMs = RECORD_DEFAULT_MAX_DELAY_MS;
+static size_t recordMaxBatchSize = RECORD_DEFAULT_MAX_BATCH_SIZE;
+static struct SRecordBatch *pOpenRecordBatches = NULL;
+
+/* URLs warmed up by the background thread, which frees them */
+typedef struct SWarmUpJob {
+    char **urls;
+    size_t urlCount;
+    uint8_t keepConnections;
+} WarmUpJob;
+
+static uint8_t publishSendChannel();
+
+static void replaceSendChannel(SendChannel *pChannel);
+
+static void finishHandshake(uint8_t result);
 
-uint8_t concatIvWithCipheredData(uint8_t *iv,
-                                 size_t ivLength,
-                                 uint8_t *cipherData,
-                                 size_t cipherDataLength,
-                                 uint8_t **concatData,
-                                 size_t *concatDataLength);
+static void stopSessionRenewal();
 
-uint8_t rebuildMutualAuthenticationHeader();
+static void releaseSendChannel(SendChannel *pChannel);
+
+static void loadSessionCache();
+
+static void startWarmUp(const char *urlRequestAS, const char *urlRequestAP);
+
+static void stopWarmUp();
 
 void initCommContext(CommContext *pContext) {
     pContext->isSecureChannelEnabled = 0;
     pContext->initCurl = 0;
     pContext->pKerberosContext = NULL;
-    memset(pContext->mutualAuthHeader, 0, MUTUAL_AUTH_HEADER_LENGTH);
 }
 
 uint8_t ma_communication_init(uint8_t initCurl,
@@ -65,6 +164,10 @@ uint8_t ma_communication_init(uint8_t initCurl,
     }
 
     initCommContext(&internalContext);
+    pthread_mutex_lock(&channelMutex);
+    handshakeCount = 0;
+    coalescedWaits = 0;
+    pthread_mutex_unlock(&channelMutex);
 
     internalContext.initCurl = initCurl;
     internalContext.isSecureChannelEnabled = enableSecureChannel;
@@ -85,8 +188,16 @@ uint8_t ma_communication_init(uint8_t initCurl,
     if (internalContext.initCurl) {
         curl_global_init(CURL_GLOBAL_ALL);
     }
+    if (communication_share_init() != MA_COMM_SUCCESS) {
+        LOG("Fail to share the caches between the handles\n");
+    }
+
+    pthread_mutex_lock(&channelMutex);
+    loadSessionCache();
+    pthread_mutex_unlock(&channelMutex);
 
     initialized = 1;
+    startWarmUp(urlRequestAS, urlRequestAP);
     LOG("MA comm initialized\n");
     return MA_COMM_SUCCESS;
 }
@@ -97,229 +208,3169 @@ uint8_t ma_communication_deinit() {
         return MA_COMM_INVALID_STATE;
     }
 
+    stopSessionRenewal();
+    stopWarmUp();
+    async_communication_stop();
+    communication_pool_deinit();
+    communication_share_deinit();
+
+    // no sender may pick the session up once its protocol context is gone
+    pthread_mutex_lock(&channelMutex);
+    replaceSendChannel(NULL);
+    free(sessionCachePath);
+    sessionCachePath = NULL;
+    pthread_mutex_unlock(&channelMutex);
+
     if (internalContext.initCurl) {
         curl_global_cleanup();
     }
-
     kerberos_protocol_deinit(&internalContext.pKerberosContext);
-    memset(internalContext.mutualAuthHeader, 0, MUTUAL_AUTH_HEADER_LENGTH);
 
     LOG("MA comm deinitialized\n");
     return MA_COMM_SUCCESS;
 }
 
-uint8_t ma_communication_send(const char *url,
-                              char * httpMethod,
-                              struct curl_slist **headers,
-                              unsigned char* content,
-                              size_t contentSize,
-                              uint32_t *httpStatusCode,
-                              unsigned char** pResponse,
-                              size_t *responseSize) {
+uint8_t ma_communication_set_connection_pool(uint32_t handlesPerHost,
+                                             uint32_t idleTimeout,
+                                             uint8_t tcpKeepAlive,
+                                             uint8_t tcpNoDelay) {
+    ConnectionPoolConfig config;
 
-    int32_t result = 0;
-    uint8_t* pContentToSend = content;
-    size_t contentToSendSize = contentSize;
-    *httpStatusCode = 0;
-    if ((!url) || (!content) || (!responseSize) ) {
-        if (*headers) {
-            curl_slist_free_all(*headers);
-            *headers = NULL;
-        }
-        LOG("Invalid parameter\n");
+    if (idleTimeout == 0) {
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    config.handlesPerHost = handlesPerHost;
+    config.idleTimeout = idleTimeout;
+    config.tcpKeepAlive = tcpKeepAlive;
+    config.keepAliveIdle = POOL_DEFAULT_KEEPALIVE_IDLE;
+    config.keepAliveInterval = POOL_DEFAULT_KEEPALIVE_INTERVAL;
+    config.tcpNoDelay = tcpNoDelay;
+    communication_pool_configure(&config);
+
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Checks the libcurl the process runs with, rather than the one it was built
+ * against, as it is a shared library.
+ */
+static uint8_t curlSupportsPriorKnowledge() {
+    const curl_version_info_data *pVersion = curl_version_info(CURLVERSION_NOW);
+
+    return (pVersion->features & CURL_VERSION_HTTP2) &&
+           (pVersion->version_num >= PRIOR_KNOWLEDGE_MIN_CURL_VERSION);
+}
+
+uint8_t ma_communication_set_http2(uint8_t enable,
+                                   uint8_t priorKnowledge,
+                                   uint32_t maxConcurrentStreams,
+                                   uint32_t maxConnectionsPerHost) {
+    MultiplexConfig config;
+
+    if (maxConcurrentStreams == 0) {
         return MA_COMM_INVALID_PARAMETER;
     }
 
     if (!initialized) {
-        if (*headers) {
-            curl_slist_free_all(*headers);
-            *headers = NULL;
-        }
         LOG("MA communication is not initialized\n");
         return MA_COMM_INVALID_STATE;
     }
 
-    if (!kerberos_protocol_is_mutual_authenticated(internalContext.pKerberosContext)) {
-        LOG("The application is not mutual authenticated\n");
-        result = kerberos_protocol_execute_handshake(internalContext.pKerberosContext);
-        if (result != MA_COMM_SUCCESS) {
-            if (*headers) {
-                curl_slist_free_all(*headers);
-                *headers = NULL;
-            }
-            LOG("Fail to execute kerberos handshake. Error %d\n", result);
-            return MA_COMM_INVALID_STATE;
+    if (enable && priorKnowledge && !curlSupportsPriorKnowledge()) {
+        LOG("HTTP/2 with prior knowledge is not supported by this libcurl\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    config.enabled = (enable != 0);
+    config.priorKnowledge = (priorKnowledge != 0);
+    config.maxConcurrentStreams = maxConcurrentStreams;
+    config.maxHostConnections = maxConnectionsPerHost;
+    async_communication_configure(&config);
+
+    // the multiplexed requests are driven by the worker thread
+    if (config.enabled) {
+        return async_communication_start();
+    }
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t ma_communication_set_handshake_admission(uint32_t maxRetries,
+                                                 uint32_t backoffBaseMs,
+                                                 uint32_t backoffMaxMs,
+                                                 uint32_t startDelayMaxMs) {
+    HandshakeAdmissionConfig config;
+
+    if (backoffBaseMs > backoffMaxMs) {
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    config.maxRetries = maxRetries;
+    config.backoffBaseMs = backoffBaseMs;
+    config.backoffMaxMs = backoffMaxMs;
+    config.startDelayMaxMs = startDelayMaxMs;
+    kerberos_protocol_configure_admission(&config);
+
+    return MA_COMM_SUCCESS;
+}
+
+static void freeHeaders(struct curl_slist **headers) {
+    if (*headers) {
+        curl_slist_free_all(*headers);
+        *headers = NULL;
+    }
+}
+
+static void retainSendChannel(SendChannel *pChannel) {
+    __atomic_fetch_add(&pChannel->references, 1, __ATOMIC_RELAXED);
+}
+
+static void releaseSendChannel(SendChannel *pChannel) {
+    if ( (pChannel) &&
+         (__atomic_sub_fetch(&pChannel->references, 1, __ATOMIC_ACQ_REL) == 0) ) {
+        memset_s(pChannel, sizeof(SendChannel), 0, sizeof(SendChannel));
+        free(pChannel);
+    }
+}
+
+/* MA_COMM_TRUE once the keys of the channel sealed all the messages they may */
+static uint8_t isChannelExhausted(SendChannel *pChannel) {
+    return (__atomic_load_n(&pChannel->sealInvocations, __ATOMIC_RELAXED) >= SEAL_MAX_INVOCATIONS) ?
+        MA_COMM_TRUE : MA_COMM_FALSE;
+}
+
+/*
+ * Takes a reference on the published channel if its session can be used,
+ * otherwise returns NULL. No lock is taken: the acquirer is counted in its
+ * epoch while it loads the pointer and takes the reference, and
+ * replaceSendChannel waits for these counts before releasing a channel.
+ */
+static SendChannel* acquireSendChannel() {
+    SendChannel *pChannel = NULL;
+    uint32_t parity = __atomic_load_n(&sendChannelEpoch, __ATOMIC_SEQ_CST) & 1;
+
+    __atomic_fetch_add(&sendChannelAcquirers[parity], 1, __ATOMIC_SEQ_CST);
+    pChannel = __atomic_load_n(&pSendChannel, __ATOMIC_SEQ_CST);
+    if (pChannel) {
+        retainSendChannel(pChannel);
+    }
+    __atomic_fetch_sub(&sendChannelAcquirers[parity], 1, __ATOMIC_RELEASE);
+
+    if ( (pChannel) &&
+         ( (!kerberos_protocol_is_session_valid(&pChannel->session)) ||
+           (isChannelExhausted(pChannel)) ) ) {
+        releaseSendChannel(pChannel);
+        pChannel = NULL;
+    }
+    return pChannel;
+}
+
+/*
+ * Publishes pChannel, taking over its reference, and drops the reference of
+ * the previous one once no acquirer can still be loading it. Both epoch
+ * parities are flipped and drained in turn, so acquirers that arrive
+ * meanwhile never delay it. Publishers must be serialized by the caller.
+ */
+static void replaceSendChannel(SendChannel *pChannel) {
+    SendChannel *pPrevious = NULL;
+    uint32_t parity = 0;
+    uint8_t phase = 0;
+
+    pPrevious = __atomic_exchange_n(&pSendChannel, pChannel, __ATOMIC_SEQ_CST);
+    for (phase = 0; phase < 2; ++phase) {
+        parity = __atomic_fetch_add(&sendChannelEpoch, 1, __ATOMIC_SEQ_CST) & 1;
+        while (__atomic_load_n(&sendChannelAcquirers[parity], __ATOMIC_ACQUIRE) != 0) {
+            sched_yield();
         }
-        rebuildMutualAuthenticationHeader();
-    } else {
+    }
+    releaseSendChannel(pPrevious);
+}
+
+/*
+ * Makes the established session the one used by the senders. Must be called
+ * with channelMutex held or by the owner of the running handshake.
+ */
+static uint8_t publishSendChannel() {
+    SendChannel *pChannel = NULL;
+    uint8_t result = 0;
+    uint32_t j = 0;
+    uint32_t i = 0;
+
+    pChannel = (SendChannel*) calloc(1, sizeof(SendChannel));
+    if (!pChannel) {
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+    pChannel->references = 1;
+    result = kerberos_protocol_get_session(internalContext.pKerberosContext, &pChannel->session);
+    if (result != MA_COMM_SUCCESS) {
+        releaseSendChannel(pChannel);
+        return result;
+    }
+
+    // built once per session, every send links this very string
+    j = sizeof(MUTUAL_AUTH_HEADER_PREFIX) - 1;
+    memcpy(pChannel->mutualAuthHeader, MUTUAL_AUTH_HEADER_PREFIX, j);
+    for (i = 0; i < SESSION_ID_LENGTH; ++i, j += 2) {
+        pChannel->mutualAuthHeader[j] = hexDigits[pChannel->session.sessionId[i] >> 4];
+        pChannel->mutualAuthHeader[j + 1] = hexDigits[pChannel->session.sessionId[i] & 0x0F];
+    }
+    pChannel->mutualAuthHeader[j] = '\0';
+
+    replaceSendChannel(pChannel);
+
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Writes the established session to the cache file, through a temporary file
+ * renamed over it so that a crash never leaves a truncated cache. Must be
+ * called with channelMutex held.
+ */
+static void saveSessionCache() {
+    uint8_t *blob = NULL;
+    size_t blobLength = 0;
+    char *tmpPath = NULL;
+    size_t pathLength = 0;
+    int fd = -1;
+    ssize_t written = 0;
+
+    if (!sessionCachePath) {
+        return;
+    }
+
+    if (kerberos_protocol_export_session(internalContext.pKerberosContext,
+                                         &blob,
+                                         &blobLength) != MA_COMM_SUCCESS) {
+        LOG("Fail to export the session\n");
+        return;
+    }
+
+    pathLength = strlen(sessionCachePath) + sizeof(".tmp");
+    tmpPath = (char*) malloc(pathLength);
+    if (!tmpPath) {
+        goto CLEAN_UP;
+    }
+    snprintf(tmpPath, pathLength, "%s.tmp", sessionCachePath);
+
+    fd = open(tmpPath, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    if (fd < 0) {
+        LOG("Fail to create the session cache %s\n", tmpPath);
+        goto CLEAN_UP;
+    }
+    written = write(fd, blob, blobLength);
+    if ( (close(fd) != 0) || (written < 0) || ((size_t) written != blobLength) ) {
+        LOG("Fail to write the session cache %s\n", tmpPath);
+        unlink(tmpPath);
+        goto CLEAN_UP;
+    }
+    if (rename(tmpPath, sessionCachePath) != 0) {
+        LOG("Fail to replace the session cache %s\n", sessionCachePath);
+        unlink(tmpPath);
+    }
+
+CLEAN_UP:
+    free(tmpPath);
+    free(blob);
+}
+
+/*
+ * Restores the session kept in the cache file, if any and still valid, and
+ * publishes it. Must be called with channelMutex held and no handshake
+ * running.
+ */
+static void loadSessionCache() {
+    uint8_t blob[SESSION_CACHE_MAX_SIZE];
+    size_t blobLength = 0;
+    uint8_t result = MA_COMM_SUCCESS;
+    FILE *file = NULL;
+
+    if (!sessionCachePath) {
+        return;
+    }
+
+    file = fopen(sessionCachePath, "rb");
+    if (!file) {
+        LOG("No session cache in %s\n", sessionCachePath);
+        return;
+    }
+    blobLength = fread(blob, 1, SESSION_CACHE_MAX_SIZE, file);
+    fclose(file);
+
+    result = kerberos_protocol_import_session(internalContext.pKerberosContext, blob, blobLength);
+    memset_s(blob, SESSION_CACHE_MAX_SIZE, 0, SESSION_CACHE_MAX_SIZE);
+    if (result == MA_COMM_SUCCESS) {
+        result = kerberos_protocol_install_secure_channel(internalContext.pKerberosContext);
+    }
+    if (result == MA_COMM_SUCCESS) {
+        result = publishSendChannel();
+    }
+    if (result != MA_COMM_SUCCESS) {
+        LOG("The session cache cannot be used, a handshake will be run\n");
+        return;
+    }
+    LOG("Session restored from %s\n", sessionCachePath);
+}
+
+/*
+ * Runs the handshake whose ownership the caller took by setting
+ * handshakeInProgress, then releases it.
+ */
+static uint8_t runOwnedHandshake() {
+    uint8_t result = 0;
+
+    result = kerberos_protocol_execute_handshake(internalContext.pKerberosContext);
+    if (result == MA_COMM_SUCCESS) {
+        result = publishSendChannel();
+    }
+    if (result == MA_COMM_SUCCESS) {
+        pthread_mutex_lock(&channelMutex);
+        saveSessionCache();
+        pthread_mutex_unlock(&channelMutex);
+    }
+    if (result != MA_COMM_SUCCESS) {
+        LOG("Fail to execute kerberos handshake. Error %d\n", result);
+        result = MA_COMM_INVALID_STATE;
+    }
+    finishHandshake(result);
+
+    return result;
+}
+
+/* Waits for the running handshake, must be called with channelMutex held */
+static uint8_t waitForHandshake() {
+    uint64_t generation = handshakeGeneration;
+
+    while (handshakeInProgress && (generation == handshakeGeneration)) {
+        pthread_cond_wait(&handshakeDone, &channelMutex);
+    }
+    return lastHandshakeResult;
+}
+
+/*
+ * Returns a reference on the channel to send with in *ppChannel, running the
+ * handshake first if the session is not established. Only one handshake runs
+ * at a time: a sender that finds one running, synchronous or asynchronous,
+ * waits for it and takes its result instead of starting another. A valid
+ * session is used without taking any lock.
+ */
+static uint8_t ensureMutualAuthentication(SendChannel **ppChannel) {
+    uint8_t result = MA_COMM_SUCCESS;
+
+    *ppChannel = acquireSendChannel();
+    if (*ppChannel) {
+        return MA_COMM_SUCCESS;
+    }
+
+    pthread_mutex_lock(&channelMutex);
+    if (handshakeInProgress) {
+        coalescedWaits++;
+        result = waitForHandshake();
+        pthread_mutex_unlock(&channelMutex);
+    } else if ( (kerberos_protocol_is_mutual_authenticated(internalContext.pKerberosContext)) &&
+                ( (!pSendChannel) || (!isChannelExhausted(pSendChannel)) ) ) {
+        // an exhausted channel holds the keys of the context, which must not
+        // be published again: they are replaced by a handshake
         LOG("The application is mutual authenticated\n");
+        result = publishSendChannel();
+        pthread_mutex_unlock(&channelMutex);
+    } else {
+        // run it without channelMutex, so asynchronous sends can queue meanwhile
+        handshakeInProgress = 1;
+        handshakeCount++;
+        pthread_mutex_unlock(&channelMutex);
+
+        LOG("The application is not mutual authenticated\n");
+        result = runOwnedHandshake();
     }
 
-    if ( (internalContext.isSecureChannelEnabled) && (contentSize > 0) ){
-        LOG("Ciphering the content\n");
-        uint8_t *cipherContent = NULL;
-        size_t cipherContentSize = 0;
-
-        //todo change this call to a secure random generator
-        uint8_t iv[IV_LENGTH];
-        generateRandom(iv, IV_LENGTH);
-
-        //encrypt
-        result = changeIvAndEncryptTo(iv,
-                                      IV_LENGTH,
-                                      NULL,
-                                      0,
-                                      content,
-                                      contentSize,
-                                      &cipherContent,
-                                      &cipherContentSize);
-        if (result != SUCCESSFULL_OPERATION) {
-            if (*headers) {
-                curl_slist_free_all(*headers);
-                *headers = NULL;
-            }
-            LOG("Fail to encrypt content\n");
-            return MA_COMM_INVALID_STATE;
+    if (result == MA_COMM_SUCCESS) {
+        *ppChannel = acquireSendChannel();
+        if (!*ppChannel) {
+            result = MA_COMM_INVALID_STATE;
         }
+    }
+    return result;
+}
 
-        // concatenate iv with the ciphered data
-        result = concatIvWithCipheredData(iv,
-                                          IV_LENGTH,
-                                          cipherContent,
-                                          cipherContentSize,
-                                          &pContentToSend,
-                                          &contentToSendSize);
-        free(cipherContent);
-        if (result != MA_COMM_SUCCESS) {
-            if (*headers) {
-                curl_slist_free_all(*headers);
-                *headers = NULL;
-            }
-            LOG("Fail to allocate memory\n");
-            return MA_COMM_OUT_OF_MEMORY;
-        }
+/*
+ * Size of the body encryptContent builds for contentSize bytes of content:
+ * [ivLength][iv][ciphertext||tag] when the secure channel is enabled,
+ * otherwise the content itself.
+ */
+static size_t getBodySize(SendChannel *pChannel, size_t contentSize) {
+    if ( (!internalContext.isSecureChannelEnabled) || (contentSize == 0) ) {
+        return contentSize;
     }
+    return 1 + IV_LENGTH + contentSize + (size_t) pChannel->session.tagLen / 8;
+}
 
-    // set the headers
-    *headers = curl_slist_append(*headers, internalContext.mutualAuthHeader);
-
-    // send the message
-    uint8_t* pResponseAux = NULL;
-    size_t responseSizeAux = 0;
-
-    result = send_message(url,
-                          httpMethod,
-                          headers,
-                          pContentToSend,
-                          contentToSendSize,
-                          httpStatusCode,
-                          &pResponseAux,
-                          &responseSizeAux);
-    if (internalContext.isSecureChannelEnabled) {
-        free(pContentToSend);
+/*
+ * Writes the body to send into pBody, which holds getBodySize bytes: the
+ * header goes first and the content is sealed straight behind it.
+ */
+static uint8_t encryptContentTo(SendChannel *pChannel,
+                                uint8_t *content,
+                                size_t contentSize,
+                                uint8_t *pBody,
+                                size_t bodyCapacity,
+                                size_t *pBodySize) {
+    int32_t result = 0;
+    size_t cipherContentSize = 0;
+
+    LOG("Ciphering the content\n");
+
+    pBody[0] = IV_LENGTH;
+    if (getRandomBytes(&pBody[1], IV_LENGTH) != SUCCESSFULL_OPERATION) {
+        LOG("Fail to generate the IV\n");
+        return MA_COMM_INVALID_STATE;
     }
 
+    result = sealWithKeyTo(pChannel->session.algorithm,
+                           pChannel->session.keyCS,
+                           pChannel->session.keyLength,
+                           &pBody[1],
+                           IV_LENGTH,
+                           pChannel->session.tagLen,
+                           NULL,
+                           0,
+                           content,
+                           contentSize,
+                           &pBody[1 + IV_LENGTH],
+                           bodyCapacity - 1 - IV_LENGTH,
+                           &cipherContentSize,
+                           &pChannel->sealInvocations);
     if (result != SUCCESSFULL_OPERATION) {
-        LOG("Fail to send message\n");
+        LOG("Fail to encrypt content\n");
         return MA_COMM_INVALID_STATE;
     }
 
-    if ( (internalContext.isSecureChannelEnabled) && (responseSizeAux > 0) ) {
-        LOG("Deciphering the response\n");
-        uint8_t *plainContent = NULL;
-        size_t plainContentSize = 0;
+    *pBodySize = 1 + IV_LENGTH + cipherContentSize;
+    return MA_COMM_SUCCESS;
+}
 
-        // retrieve the iv
-        size_t offset = 0;
-        uint8_t ivLength = pResponseAux[0];
-        offset += 1;
-        uint8_t* iv = NULL;
-        iv = (uint8_t*) malloc(ivLength);
-        if (!iv) {
-            free(pResponseAux);
-            LOG("Fail to allocate memory\n");
-            return MA_COMM_OUT_OF_MEMORY;
-        }
+/*
+ * Builds the body to send: [ivLength][iv][ciphertext||tag] when the secure
+ * channel is enabled, otherwise the content itself. *pBody is content only
+ * when no secure channel is used, else it must be freed by the caller.
+ */
+static uint8_t encryptContent(SendChannel *pChannel,
+                              uint8_t *content,
+                              size_t contentSize,
+                              uint8_t **pBody,
+                              size_t *pBodySize) {
+    uint8_t result = 0;
+    size_t bodyCapacity = getBodySize(pChannel, contentSize);
 
-        memcpy(iv, &pResponseAux[offset], ivLength);
-        offset += ivLength;
-
-        // decrypt
-        result = changeIvAndDecryptTo(iv,
-                                      ivLength,
-                                      NULL,
-                                      0,
-                                      &pResponseAux[offset],
-                                      responseSizeAux - offset,
-                                      &plainContent,
-                                      &plainContentSize);
-        free(iv);
-        free(pResponseAux);
-        if (result != SUCCESSFULL_OPERATION) {
-            LOG("Fail to decrypt response\n");
-            return MA_COMM_INVALID_STATE;
-        }
-        pResponseAux = plainContent;
-        responseSizeAux = plainContentSize;
+    *pBody = content;
+    *pBodySize = contentSize;
+    if ( (!internalContext.isSecureChannelEnabled) || (contentSize == 0) ){
+        return MA_COMM_SUCCESS;
     }
 
-    *pResponse = pResponseAux;
-    *responseSize = responseSizeAux;
+    // a single allocation, the content is sealed in place behind the header
+    *pBody = (uint8_t*) malloc(bodyCapacity);
+    if (!*pBody) {
+        LOG("Fail to allocate memory\n");
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+    result = encryptContentTo(pChannel, content, contentSize, *pBody, bodyCapacity, pBodySize);
+    if (result != MA_COMM_SUCCESS) {
+        free(*pBody);
+        *pBody = content;
+        return result;
+    }
 
     return MA_COMM_SUCCESS;
 }
 
-uint8_t concatIvWithCipheredData(uint8_t *iv,
-                                 size_t ivLength,
-                                 uint8_t *cipherData,
-                                 size_t cipherDataLength,
-                                 uint8_t **concatData,
-                                 size_t *concatDataLength) {
-
-    size_t finalContentSize = cipherDataLength + ivLength + 1;
-    size_t offset = 0;
+/*
+ * As encryptContent, building the body in the calling thread's request
+ * arena, which the caller gives back with communication_arena_release once
+ * the request is over. pArena is left empty when no secure channel is used.
+ */
+static uint8_t encryptContentInArena(SendChannel *pChannel,
+                                     uint8_t *content,
+                                     size_t contentSize,
+                                     BufferStruct *pArena,
+                                     uint8_t **pBody,
+                                     size_t *pBodySize) {
+    uint8_t result = 0;
+    size_t bodyCapacity = getBodySize(pChannel, contentSize);
 
-    if (ivLength > 255) {
-        return MA_COMM_INVALID_PARAMETER;
+    pArena->pData = NULL;
+    *pBody = content;
+    *pBodySize = contentSize;
+    if ( (!internalContext.isSecureChannelEnabled) || (contentSize == 0) ){
+        return MA_COMM_SUCCESS;
     }
 
-    uint8_t* finalContent = malloc(finalContentSize);
-    if (!finalContent) {
+    if (communication_arena_acquire(pArena, bodyCapacity) != MA_COMM_SUCCESS) {
+        LOG("Fail to allocate memory\n");
         return MA_COMM_OUT_OF_MEMORY;
     }
+    result = encryptContentTo(pChannel, content, contentSize,
+                              (uint8_t*) pArena->pData, bodyCapacity, pBodySize);
+    if (result != MA_COMM_SUCCESS) {
+        communication_arena_release(pArena);
+        return result;
+    }
+
+    *pBody = (uint8_t*) pArena->pData;
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Size of the plaintext of a [ivLength][iv][ciphertext||tag] response, which
+ * is also the buffer its decryption needs.
+ */
+static uint8_t getResponsePlainSize(SendChannel *pChannel,
+                                    uint8_t *pResponse,
+                                    size_t responseSize,
+                                    size_t *pPlainSize) {
+    size_t overhead = 1 + (size_t) pChannel->session.tagLen / 8;
+
+    if ( (responseSize < overhead) || (responseSize - overhead < pResponse[0]) ) {
+        LOG("Invalid response\n");
+        return MA_COMM_INVALID_STATE;
+    }
+    *pPlainSize = responseSize - overhead - pResponse[0];
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Deciphers a [ivLength][iv][ciphertext||tag] response into pPlain, which
+ * holds plainCapacity bytes. The response is left to the caller.
+ */
+static uint8_t openResponseTo(SendChannel *pChannel,
+                              uint8_t *pResponse,
+                              size_t responseSize,
+                              uint8_t *pPlain,
+                              size_t plainCapacity,
+                              size_t *pPlainSize) {
+    int32_t result = 0;
+    uint8_t ivLength = pResponse[0];
 
-    finalContent[0] = ivLength;
-    offset += 1;
-    memcpy(&finalContent[offset], iv, ivLength);
-    offset += IV_LENGTH;
-    memcpy(&finalContent[offset], cipherData, cipherDataLength);
-    offset += cipherDataLength;
+    LOG("Deciphering the response\n");
 
-    *concatData = finalContent;
-    *concatDataLength = finalContentSize;
+    result = openWithKeyTo(pChannel->session.algorithm,
+                           pChannel->session.keySC,
+                           pChannel->session.keyLength,
+                           &pResponse[1],
+                           ivLength,
+                           pChannel->session.tagLen,
+                           NULL,
+                           0,
+                           &pResponse[1 + ivLength],
+                           responseSize - 1 - ivLength,
+                           pPlain,
+                           plainCapacity,
+                           pPlainSize);
+    if (result != SUCCESSFULL_OPERATION) {
+        LOG("Fail to decrypt response\n");
+        return MA_COMM_INVALID_STATE;
+    }
     return MA_COMM_SUCCESS;
 }
 
-uint8_t rebuildMutualAuthenticationHeader() {
+/*
+ * Deciphers a [ivLength][iv][ciphertext||tag] response over its own
+ * ciphertext, then moves the plaintext to the start of the buffer.
+ */
+static uint8_t openResponseInPlace(SendChannel *pChannel,
+                                   uint8_t *pResponse,
+                                   size_t responseSize,
+                                   size_t *pPlainSize) {
+    uint8_t result = 0;
+    size_t plainSize = 0;
+    uint8_t *pCipher = NULL;
 
-    uint8_t sessionId[SESSION_ID_LENGTH];
-    memset(internalContext.mutualAuthHeader, 0, MUTUAL_AUTH_HEADER_LENGTH);
+    result = getResponsePlainSize(pChannel, pResponse, responseSize, &plainSize);
+    if (result != MA_COMM_SUCCESS) {
+        return result;
+    }
+    pCipher = &pResponse[1 + pResponse[0]];
+    result = openResponseTo(pChannel, pResponse, responseSize, pCipher, plainSize, &plainSize);
+    if (result != MA_COMM_SUCCESS) {
+        return result;
+    }
 
-    kerberos_protocol_get_session_id(internalContext.pKerberosContext,
-                                     SESSION_ID_LENGTH,
-                                     sessionId);
-    uint32_t j = 0;
-    uint32_t i = 0;
-    //todo do the error checking
-    j = snprintf(internalContext.mutualAuthHeader,
-                 MUTUAL_AUTH_HEADER_LENGTH,
-                 "ma-session-id: ");
-    for (i = 0; i < SESSION_ID_LENGTH; ++i, j+=2) {
-        snprintf(&internalContext.mutualAuthHeader[j],
-                 MUTUAL_AUTH_HEADER_LENGTH,
-                 "%02x",
-                 sessionId[i]);
+    memmove(pResponse, pCipher, plainSize);
+    *pPlainSize = plainSize;
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Deciphers a [ivLength][iv][ciphertext||tag] response in place when the
+ * secure channel is enabled. The response is always consumed: either freed
+ * or returned as *pPlain.
+ */
+static uint8_t decryptResponse(SendChannel *pChannel,
+                               uint8_t *pResponse,
+                               size_t responseSize,
+                               uint8_t **pPlain,
+                               size_t *pPlainSize) {
+    uint8_t result = 0;
+    size_t plainContentSize = 0;
+
+    *pPlain = pResponse;
+    *pPlainSize = responseSize;
+    if ( (!internalContext.isSecureChannelEnabled) || (responseSize == 0) ) {
+        return MA_COMM_SUCCESS;
     }
 
+    result = openResponseInPlace(pChannel, pResponse, responseSize, &plainContentSize);
+    if (result != MA_COMM_SUCCESS) {
+        free(pResponse);
+        *pPlain = NULL;
+        *pPlainSize = 0;
+        return result;
+    }
+
+    *pPlainSize = plainContentSize;
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Response deciphered as it arrives. The [ivLength][iv] header is gathered
+ * first, then each chunk is opened into pScratch and handed to the sink; the
+ * tag is checked once the transfer is over. Algorithms libaes cannot open
+ * incrementally are gathered in buffered and opened at the end.
+ */
+typedef struct SResponseStream {
+    SendChannel *pChannel;
+    ma_communication_sink sink;
+    void *userdata;
+    uint8_t header[1 + UINT8_MAX];
+    size_t headerSize;
+    OpenStream *pOpen;
+    uint8_t *pScratch;
+    size_t scratchCapacity;
+    BufferStruct buffered;
+    uint8_t isBuffered;
+    uint8_t sinkStopped;
+} ResponseStream;
+
+static uint8_t deliverPlain(ResponseStream *pStream, uint8_t *pPlain, size_t plainSize) {
+    if (plainSize == 0) {
+        return MA_COMM_SUCCESS;
+    }
+    if (pStream->sink(pPlain, plainSize, pStream->userdata) != 0) {
+        pStream->sinkStopped = 1;
+        return MA_COMM_INVALID_STATE;
+    }
+    return MA_COMM_SUCCESS;
+}
+
+/* Grows the scratch buffer, doubling it, to hold required bytes */
+static uint8_t reserveScratch(ResponseStream *pStream, size_t required) {
+    uint8_t *pScratch = NULL;
+    size_t capacity = pStream->scratchCapacity;
+
+    if (required <= capacity) {
+        return MA_COMM_SUCCESS;
+    }
+    capacity = (capacity > 0) ? capacity : INITIAL_BUFFER_SIZE;
+    while (capacity < required) {
+        capacity *= 2;
+    }
+    pScratch = (uint8_t*) realloc(pStream->pScratch, capacity);
+    if (!pScratch) {
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+    pStream->pScratch = pScratch;
+    pStream->scratchCapacity = capacity;
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Starts opening the response once its header is complete. When the
+ * session's algorithm cannot be opened incrementally, the response is
+ * gathered instead, header included.
+ */
+static uint8_t startResponseStream(ResponseStream *pStream) {
+    SendChannel *pChannel = pStream->pChannel;
+
+    if (openStreamInit(pChannel->session.algorithm,
+                       pChannel->session.keySC,
+                       pChannel->session.keyLength,
+                       &pStream->header[1],
+                       pStream->header[0],
+                       pChannel->session.tagLen,
+                       NULL,
+                       0,
+                       &pStream->pOpen) == SUCCESSFULL_OPERATION) {
+        return MA_COMM_SUCCESS;
+    }
+
+    pStream->pOpen = NULL;
+    if (communication_buffer_acquire(&pStream->buffered) != MA_COMM_SUCCESS) {
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+    pStream->isBuffered = 1;
+    if (process_chuck(pStream->header, 1, pStream->headerSize, &pStream->buffered) != pStream->headerSize) {
+        return MA_COMM_OUT_OF_MEMORY;
+    }
     return MA_COMM_SUCCESS;
 }
+
+/* curl write callback of the streamed sends */
+static size_t streamResponseChunk(void *pContent, size_t size, size_t nmemb, void *pUserPtr) {
+    ResponseStream *pStream = (ResponseStream*) pUserPtr;
+    size_t realSize = size * nmemb;
+    uint8_t *pData = (uint8_t*) pContent;
+    size_t length = realSize;
+    size_t missing = 0;
+    size_t plainSize = 0;
+
+    if (!internalContext.isSecureChannelEnabled) {
+        return (deliverPlain(pStream, pData, length) == MA_COMM_SUCCESS) ? realSize : 0;
+    }
+
+    // gather [ivLength][iv] before anything can be opened
+    if ( (!pStream->pOpen) && (!pStream->isBuffered) && (length > 0) ) {
+        if (pStream->headerSize == 0) {
+            pStream->header[pStream->headerSize++] = *pData++;
+            length--;
+        }
+        missing = 1 + (size_t) pStream->header[0] - pStream->headerSize;
+        if (missing > length) {
+            missing = length;
+        }
+        memcpy(&pStream->header[pStream->headerSize], pData, missing);
+        pStream->headerSize += missing;
+        pData += missing;
+        length -= missing;
+        if (pStream->headerSize < 1 + (size_t) pStream->header[0]) {
+            return realSize;
+        }
+        if (startResponseStream(pStream) != MA_COMM_SUCCESS) {
+            LOG("Fail to start deciphering the response\n");
+            return 0;
+        }
+    }
+
+    if (pStream->isBuffered) {
+        return (process_chuck(pData, 1, length, &pStream->buffered) == length) ? realSize : 0;
+    }
+    if ( (reserveScratch(pStream, length + OPEN_STREAM_OUTPUT_OVERHEAD) != MA_COMM_SUCCESS) ||
+         (openStreamUpdate(pStream->pOpen,
+                           pData,
+                           length,
+                           pStream->pScratch,
+                           pStream->scratchCapacity,
+                           &plainSize) != SUCCESSFULL_OPERATION) ) {
+        LOG("Fail to decipher the response\n");
+        return 0;
+    }
+    return (deliverPlain(pStream, pStream->pScratch, plainSize) == MA_COMM_SUCCESS) ? realSize : 0;
+}
+
+/* Whether the response received so far is the server rejecting the session */
+static uint8_t isStreamRejected(ResponseStream *pStream) {
+    // a rejection is shorter than any [ivLength][iv] header it could start
+    return ( (internalContext.isSecureChannelEnabled) &&
+             (!pStream->pOpen) &&
+             (!pStream->isBuffered) &&
+             (kerberos_protocol_is_session_rejected(pStream->header, pStream->headerSize)) );
+}
+
+/* Drops what was received, keeping the scratch buffer for a replay */
+static void resetResponseStream(ResponseStream *pStream) {
+    if (pStream->pOpen) {
+        openStreamAbort(pStream->pOpen);
+        pStream->pOpen = NULL;
+    }
+    if (pStream->isBuffered) {
+        communication_buffer_release(&pStream->buffered);
+        pStream->isBuffered = 0;
+    }
+    pStream->headerSize = 0;
+}
+
+/* Checks the tag, or opens the gathered response, and delivers the rest */
+static uint8_t finishResponseStream(ResponseStream *pStream) {
+    uint8_t result = MA_COMM_SUCCESS;
+    uint8_t *pPlain = NULL;
+    size_t plainSize = 0;
+    OpenStream *pOpen = pStream->pOpen;
+
+    if ( (!internalContext.isSecureChannelEnabled) || (pStream->headerSize == 0) ) {
+        return MA_COMM_SUCCESS;
+    }
+
+    if (pOpen) {
+        pStream->pOpen = NULL;
+        result = reserveScratch(pStream, OPEN_STREAM_OUTPUT_OVERHEAD);
+        if (result != MA_COMM_SUCCESS) {
+            openStreamAbort(pOpen);
+            return result;
+        }
+        if (openStreamFinal(pOpen, pStream->pScratch, pStream->scratchCapacity, &plainSize) != SUCCESSFULL_OPERATION) {
+            LOG("Fail to decrypt response\n");
+            return MA_COMM_INVALID_STATE;
+        }
+        return deliverPlain(pStream, pStream->pScratch, plainSize);
+    }
+
+    if (!pStream->isBuffered) {
+        LOG("Invalid response\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    result = getResponsePlainSize(pStream->pChannel,
+                                  (uint8_t*) pStream->buffered.pData,
+                                  pStream->buffered.size,
+                                  &plainSize);
+    if (result == MA_COMM_SUCCESS) {
+        pPlain = (uint8_t*) malloc((plainSize > 0) ? plainSize : 1);
+        if (!pPlain) {
+            result = MA_COMM_OUT_OF_MEMORY;
+        }
+    }
+    if (result == MA_COMM_SUCCESS) {
+        result = openResponseTo(pStream->pChannel,
+                                (uint8_t*) pStream->buffered.pData,
+                                pStream->buffered.size,
+                                pPlain,
+                                plainSize,
+                                &plainSize);
+    }
+    if (result == MA_COMM_SUCCESS) {
+        result = deliverPlain(pStream, pPlain, plainSize);
+    }
+    free(pPlain);
+    return result;
+}
+
+/*
+ * Replaces the session the server rejected, whose reference is taken from
+ * *ppChannel, and returns a reference on the new one. Senders rejected
+ * together run a single handshake: one runs it while the others wait, and a
+ * sender that finds the channel already replaced uses the new one.
+ */
+static uint8_t renewRejectedSession(SendChannel **ppChannel) {
+    SendChannel *pRejected = *ppChannel;
+    uint8_t result = MA_COMM_SUCCESS;
+
+    *ppChannel = NULL;
+    pthread_mutex_lock(&channelMutex);
+    if (handshakeInProgress) {
+        coalescedWaits++;
+        result = waitForHandshake();
+        pthread_mutex_unlock(&channelMutex);
+    } else if (__atomic_load_n(&pSendChannel, __ATOMIC_SEQ_CST) != pRejected) {
+        // the reference held on pRejected keeps its address from being reused
+        pthread_mutex_unlock(&channelMutex);
+    } else {
+        handshakeInProgress = 1;
+        handshakeCount++;
+        pthread_mutex_unlock(&channelMutex);
+
+        LOG("The server rejected the session\n");
+        result = runOwnedHandshake();
+    }
+    releaseSendChannel(pRejected);
+
+    if (result == MA_COMM_SUCCESS) {
+        *ppChannel = acquireSendChannel();
+        if (!*ppChannel) {
+            result = MA_COMM_INVALID_STATE;
+        }
+    }
+    return result;
+}
+
+/*
+ * Appends the session header of pChannel to the caller's headers for one
+ * transfer, through pSessionHeader, a node the caller keeps until the
+ * transfer is over. Returns the list to send; *ppLast goes back to
+ * unlinkSessionHeader afterwards.
+ */
+static struct curl_slist* linkSessionHeader(SendChannel *pChannel,
+                                            struct curl_slist *headers,
+                                            struct curl_slist *pSessionHeader,
+                                            struct curl_slist **ppLast) {
+    struct curl_slist *pLast = headers;
+
+    // the channel owns the header
+    pSessionHeader->data = pChannel->mutualAuthHeader;
+    pSessionHeader->next = NULL;
+    while ( (pLast) && (pLast->next) ) {
+        pLast = pLast->next;
+    }
+    *ppLast = pLast;
+    if (!pLast) {
+        return pSessionHeader;
+    }
+    pLast->next = pSessionHeader;
+    return headers;
+}
+
+static void unlinkSessionHeader(struct curl_slist *pLast) {
+    if (pLast) {
+        pLast->next = NULL;
+    }
+}
+
+/*
+ * Encrypts and sends content over pChannel, with its session header after
+ * the caller's ones. The headers are kept, so the request can be replayed.
+ * The response is handed to pStream if there is one, else received in a
+ * buffer of the thread's pool.
+ */
+static uint8_t sendOverChannel(SendChannel *pChannel,
+                               const char *url,
+                               char *httpMethod,
+                               struct curl_slist *headers,
+                               unsigned char *content,
+                               size_t contentSize,
+                               uint32_t *httpStatusCode,
+                               ResponseStream *pStream,
+                               BufferStruct *pResponse) {
+    uint8_t result = 0;
+    uint8_t* pContentToSend = NULL;
+    size_t contentToSendSize = 0;
+    BufferStruct arena;
+    struct curl_slist sessionHeader;
+    struct curl_slist *pLast = NULL;
+
+    result = encryptContentInArena(pChannel, content, contentSize, &arena,
+                                   &pContentToSend, &contentToSendSize);
+    if (result != MA_COMM_SUCCESS) {
+        return result;
+    }
+
+    headers = linkSessionHeader(pChannel, headers, &sessionHeader, &pLast);
+
+    if (pStream) {
+        pStream->pChannel = pChannel;
+        result = send_request_with_writer(url,
+                                          httpMethod,
+                                          headers,
+                                          pContentToSend,
+                                          contentToSendSize,
+                                          httpStatusCode,
+                                          streamResponseChunk,
+                                          (void *)pStream);
+    } else {
+        result = send_request(url,
+                              httpMethod,
+                              headers,
+                              pContentToSend,
+                              contentToSendSize,
+                              httpStatusCode,
+                              pResponse);
+    }
+    unlinkSessionHeader(pLast);
+    communication_arena_release(&arena);
+
+    if (result != SUCCESSFULL_OPERATION) {
+        LOG("Fail to send message\n");
+        return MA_COMM_INVALID_STATE;
+    }
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Sends content over the session, establishing it first if needed, and
+ * replays the request once if the server rejects the session. Returns the
+ * undeciphered response in a pooled buffer, or hands it to pStream if there
+ * is one, and a reference on the channel that opens it. The headers are
+ * always consumed.
+ */
+static uint8_t sendWithSession(const char *url,
+                               char *httpMethod,
+                               struct curl_slist **headers,
+                               unsigned char *content,
+                               size_t contentSize,
+                               uint32_t *httpStatusCode,
+                               ResponseStream *pStream,
+                               BufferStruct *pResponse,
+                               SendChannel **ppChannel) {
+    uint8_t isRejected = 0;
+    uint8_t result = 0;
+
+    *ppChannel = NULL;
+    result = ensureMutualAuthentication(ppChannel);
+    if (result != MA_COMM_SUCCESS) {
+        freeHeaders(headers);
+        return result;
+    }
+
+    result = sendOverChannel(*ppChannel,
+                             url,
+                             httpMethod,
+                             *headers,
+                             content,
+                             contentSize,
+                             httpStatusCode,
+                             pStream,
+                             pResponse);
+
+    // the server no longer accepts the session, or its keys sealed as much as
+    // they may: renew it and replay once, encrypted again under the new keys
+    // with a fresh IV
+    if (result == MA_COMM_SUCCESS) {
+        isRejected = (pStream) ?
+            isStreamRejected(pStream) :
+            ( (internalContext.isSecureChannelEnabled) &&
+              (kerberos_protocol_is_session_rejected((uint8_t*) pResponse->pData, pResponse->size)) );
+        if (isRejected) {
+            if (pStream) {
+                resetResponseStream(pStream);
+            } else {
+                communication_buffer_release(pResponse);
+            }
+        }
+    } else {
+        isRejected = isChannelExhausted(*ppChannel);
+    }
+    if (isRejected) {
+        result = renewRejectedSession(ppChannel);
+        if (result == MA_COMM_SUCCESS) {
+            result = sendOverChannel(*ppChannel,
+                                     url,
+                                     httpMethod,
+                                     *headers,
+                                     content,
+                                     contentSize,
+                                     httpStatusCode,
+                                     pStream,
+                                     pResponse);
+        }
+    }
+    freeHeaders(headers);
+
+    if (result != MA_COMM_SUCCESS) {
+        releaseSendChannel(*ppChannel);
+        *ppChannel = NULL;
+    }
+    return result;
+}
+
+/*
+ * Deciphers a response received in a pooled buffer into a plain allocation
+ * the caller owns. The buffer is always consumed.
+ */
+static uint8_t takeResponse(SendChannel *pChannel,
+                            BufferStruct *pReceived,
+                            uint8_t **pResponse,
+                            size_t *pResponseSize) {
+    uint8_t result = 0;
+    uint8_t* pPlain = NULL;
+    size_t plainSize = 0;
+
+    if ( (!internalContext.isSecureChannelEnabled) || (pReceived->size == 0) ) {
+        // nothing to decipher, the caller takes the buffer over
+        *pResponse = (uint8_t*) pReceived->pData;
+        *pResponseSize = pReceived->size;
+        return MA_COMM_SUCCESS;
+    }
+
+    // the pool would not keep the buffer: open it in place and hand it over
+    if (pReceived->capacity > MAX_POOLED_BUFFER_SIZE) {
+        result = openResponseInPlace(pChannel, (uint8_t*) pReceived->pData, pReceived->size, &plainSize);
+        if (result != MA_COMM_SUCCESS) {
+            communication_buffer_release(pReceived);
+            return result;
+        }
+        *pResponse = (uint8_t*) pReceived->pData;
+        *pResponseSize = plainSize;
+        return MA_COMM_SUCCESS;
+    }
+
+    result = getResponsePlainSize(pChannel, (uint8_t*) pReceived->pData, pReceived->size, &plainSize);
+    if (result == MA_COMM_SUCCESS) {
+        pPlain = (uint8_t*) malloc((plainSize > 0) ? plainSize : 1);
+        if (!pPlain) {
+            result = MA_COMM_OUT_OF_MEMORY;
+        }
+    }
+    if (result == MA_COMM_SUCCESS) {
+        result = openResponseTo(pChannel, (uint8_t*) pReceived->pData, pReceived->size,
+                                pPlain, plainSize, &plainSize);
+    }
+    communication_buffer_release(pReceived);
+    if (result != MA_COMM_SUCCESS) {
+        free(pPlain);
+        return result;
+    }
+
+    *pResponse = pPlain;
+    *pResponseSize = plainSize;
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t ma_communication_send(const char *url,
+                              char * httpMethod,
+                              struct curl_slist **headers,
+                              unsigned char* content,
+                              size_t contentSize,
+                              uint32_t *httpStatusCode,
+                              unsigned char** pResponse,
+                              size_t *responseSize) {
+
+    int32_t result = 0;
+    SendChannel *pChannel = NULL;
+    BufferStruct response;
+    *httpStatusCode = 0;
+    if ((!url) || (!content) || (!responseSize) ) {
+        freeHeaders(headers);
+        LOG("Invalid parameter\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    if (!initialized) {
+        freeHeaders(headers);
+        LOG("MA communication is not initialized\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    result = sendWithSession(url, httpMethod, headers, content, contentSize,
+                             httpStatusCode, NULL, &response, &pChannel);
+    if (result != MA_COMM_SUCCESS) {
+        return result;
+    }
+
+    result = takeResponse(pChannel, &response, pResponse, responseSize);
+    releaseSendChannel(pChannel);
+
+    return result;
+}
+
+uint8_t ma_communication_send_to(const char *url,
+                                 char * httpMethod,
+                                 struct curl_slist **headers,
+                                 unsigned char* content,
+                                 size_t contentSize,
+                                 uint32_t *httpStatusCode,
+                                 unsigned char* response,
+                                 size_t responseCapacity,
+                                 size_t *responseSize) {
+    uint8_t result = 0;
+    SendChannel *pChannel = NULL;
+    BufferStruct received;
+    size_t plainSize = 0;
+
+    *httpStatusCode = 0;
+    if ( (!url) || (!content) || (!response) || (!responseSize) ) {
+        freeHeaders(headers);
+        LOG("Invalid parameter\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+    *responseSize = 0;
+
+    if (!initialized) {
+        freeHeaders(headers);
+        LOG("MA communication is not initialized\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    result = sendWithSession(url, httpMethod, headers, content, contentSize,
+                             httpStatusCode, NULL, &received, &pChannel);
+    if (result != MA_COMM_SUCCESS) {
+        return result;
+    }
+
+    plainSize = received.size;
+    if ( (internalContext.isSecureChannelEnabled) && (received.size > 0) ) {
+        result = getResponsePlainSize(pChannel, (uint8_t*) received.pData, received.size, &plainSize);
+    }
+    if ( (result == MA_COMM_SUCCESS) && (plainSize > responseCapacity) ) {
+        LOG("The response does not fit in the buffer\n");
+        *responseSize = plainSize;
+        result = MA_COMM_BUFFER_TOO_SMALL;
+    }
+    if (result == MA_COMM_SUCCESS) {
+        if ( (internalContext.isSecureChannelEnabled) && (received.size > 0) ) {
+            result = openResponseTo(pChannel, (uint8_t*) received.pData, received.size,
+                                    response, responseCapacity, responseSize);
+        } else {
+            memcpy(response, received.pData, received.size);
+            *responseSize = received.size;
+        }
+    }
+    communication_buffer_release(&received);
+    releaseSendChannel(pChannel);
+
+    return result;
+}
+
+uint8_t ma_communication_send_stream(const char *url,
+                                     char * httpMethod,
+                                     struct curl_slist **headers,
+                                     unsigned char* content,
+                                     size_t contentSize,
+                                     uint32_t *httpStatusCode,
+                                     ma_communication_sink sink,
+                                     void* userdata) {
+    uint8_t result = 0;
+    SendChannel *pChannel = NULL;
+    ResponseStream stream;
+
+    *httpStatusCode = 0;
+    if ( (!url) || (!content) || (!sink) ) {
+        freeHeaders(headers);
+        LOG("Invalid parameter\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    if (!initialized) {
+        freeHeaders(headers);
+        LOG("MA communication is not initialized\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    memset(&stream, 0, sizeof(stream));
+    stream.sink = sink;
+    stream.userdata = userdata;
+
+    result = sendWithSession(url, httpMethod, headers, content, contentSize,
+                             httpStatusCode, &stream, NULL, &pChannel);
+    if (result == MA_COMM_SUCCESS) {
+        result = finishResponseStream(&stream);
+    }
+    if (stream.sinkStopped) {
+        LOG("The sink stopped the transfer\n");
+        result = MA_COMM_INVALID_STATE;
+    }
+
+    resetResponseStream(&stream);
+    free(stream.pScratch);
+    releaseSendChannel(pChannel);
+
+    return result;
+}
+
+static uint8_t writeToFd(const unsigned char *data, size_t size, void *userdata) {
+    int fd = *((int*) userdata);
+    ssize_t written = 0;
+
+    while (size > 0) {
+        written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG("Fail to write the response\n");
+            return 1;
+        }
+        data += written;
+        size -= (size_t) written;
+    }
+    return 0;
+}
+
+uint8_t ma_communication_send_to_fd(const char *url,
+                                    char * httpMethod,
+                                    struct curl_slist **headers,
+                                    unsigned char* content,
+                                    size_t contentSize,
+                                    uint32_t *httpStatusCode,
+                                    int fd) {
+    if (fd < 0) {
+        freeHeaders(headers);
+        LOG("Invalid parameter\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    return ma_communication_send_stream(url, httpMethod, headers, content, contentSize,
+                                        httpStatusCode, writeToFd, &fd);
+}
+
+/*
+ * Body of a streamed upload, [ivLength][iv][ciphertext||tag]. A worker
+ * thread reads the source and seals the next chunk into one buffer while
+ * curl sends the other, so encryption overlaps the transfer.
+ */
+typedef struct SUploadChunk {
+    uint8_t *pData;
+    size_t size;
+    size_t offset;      // bytes already handed to curl
+    uint8_t isReady;    // filled by the worker, owned by curl until drained
+    uint8_t isLast;
+} UploadChunk;
+
+typedef struct SUploadStream {
+    ma_communication_source source;
+    void *userdata;
+    SealStream *pSeal;
+    uint8_t *pPlain;
+    size_t headerSize;
+    UploadChunk chunks[2];
+    uint8_t consumed;   // chunk curl reads from
+    uint8_t failed;     // the source or the encryption failed
+    uint8_t cancelled;  // the transfer is over, the worker must stop
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    pthread_t worker;
+} UploadStream;
+
+/* Fills one chunk: reads the source and seals what it gave */
+static uint8_t produceUploadChunk(UploadStream *pUpload, UploadChunk *pChunk, uint8_t isFirst) {
+    uint8_t *pTarget = NULL;
+    size_t readSize = 0;
+    size_t sealedSize = 0;
+
+    pChunk->size = (isFirst) ? pUpload->headerSize : 0;
+    pChunk->offset = 0;
+    pTarget = (pUpload->pSeal) ? pUpload->pPlain : &pChunk->pData[pChunk->size];
+    if (pUpload->source(pTarget, UPLOAD_CHUNK_SIZE, &readSize, pUpload->userdata) != 0) {
+        LOG("The source failed\n");
+        return MA_COMM_INVALID_STATE;
+    }
+    if (readSize > UPLOAD_CHUNK_SIZE) {
+        LOG("The source overflowed its buffer\n");
+        return MA_COMM_INVALID_STATE;
+    }
+    pChunk->isLast = (readSize == 0);
+
+    if (!pUpload->pSeal) {
+        pChunk->size += readSize;
+        return MA_COMM_SUCCESS;
+    }
+    if (readSize > 0) {
+        if (sealStreamUpdate(pUpload->pSeal,
+                             pUpload->pPlain,
+                             readSize,
+                             &pChunk->pData[pChunk->size],
+                             UPLOAD_CHUNK_SIZE + SEAL_STREAM_OUTPUT_OVERHEAD,
+                             &sealedSize) != SUCCESSFULL_OPERATION) {
+            LOG("Fail to encrypt content\n");
+            return MA_COMM_INVALID_STATE;
+        }
+    } else {
+        // the tag closes the body
+        errno_t sealResult = sealStreamFinal(pUpload->pSeal,
+                                             &pChunk->pData[pChunk->size],
+                                             UPLOAD_CHUNK_SIZE + SEAL_STREAM_OUTPUT_OVERHEAD,
+                                             &sealedSize);
+        pUpload->pSeal = NULL;
+        if (sealResult != SUCCESSFULL_OPERATION) {
+            LOG("Fail to encrypt content\n");
+            return MA_COMM_INVALID_STATE;
+        }
+    }
+    pChunk->size += sealedSize;
+    return MA_COMM_SUCCESS;
+}
+
+static void* uploadWorker(void *pArg) {
+    UploadStream *pUpload = (UploadStream*) pArg;
+    UploadChunk *pChunk = NULL;
+    uint8_t index = 0;
+    uint8_t isFirst = 1;
+    uint8_t result = MA_COMM_SUCCESS;
+
+    for (;;) {
+        pChunk = &pUpload->chunks[index];
+        pthread_mutex_lock(&pUpload->mutex);
+        while ( (pChunk->isReady) && (!pUpload->cancelled) ) {
+            pthread_cond_wait(&pUpload->changed, &pUpload->mutex);
+        }
+        if (pUpload->cancelled) {
+            pthread_mutex_unlock(&pUpload->mutex);
+            break;
+        }
+        pthread_mutex_unlock(&pUpload->mutex);
+
+        // curl does not touch a chunk that is not ready
+        result = produceUploadChunk(pUpload, pChunk, isFirst);
+        isFirst = 0;
+
+        pthread_mutex_lock(&pUpload->mutex);
+        if (result != MA_COMM_SUCCESS) {
+            pUpload->failed = 1;
+        } else {
+            pChunk->isReady = 1;
+        }
+        pthread_cond_broadcast(&pUpload->changed);
+        pthread_mutex_unlock(&pUpload->mutex);
+        if ( (result != MA_COMM_SUCCESS) || (pChunk->isLast) ) {
+            break;
+        }
+        index ^= 1;
+    }
+    return NULL;
+}
+
+/* curl read callback of the streamed uploads */
+static size_t readUploadChunk(char *pBuffer, size_t size, size_t nitems, void *pUserPtr) {
+    UploadStream *pUpload = (UploadStream*) pUserPtr;
+    UploadChunk *pChunk = NULL;
+    size_t length = size * nitems;
+
+    pthread_mutex_lock(&pUpload->mutex);
+    for (;;) {
+        pChunk = &pUpload->chunks[pUpload->consumed];
+        if (pUpload->failed) {
+            pthread_mutex_unlock(&pUpload->mutex);
+            return CURL_READFUNC_ABORT;
+        }
+        if (!pChunk->isReady) {
+            pthread_cond_wait(&pUpload->changed, &pUpload->mutex);
+        } else if (pChunk->offset < pChunk->size) {
+            break;
+        } else if (pChunk->isLast) {
+            pthread_mutex_unlock(&pUpload->mutex);
+            return 0;
+        } else {
+            // drained, the worker may fill it again
+            pChunk->isReady = 0;
+            pUpload->consumed ^= 1;
+            pthread_cond_broadcast(&pUpload->changed);
+        }
+    }
+    pthread_mutex_unlock(&pUpload->mutex);
+
+    if (length > pChunk->size - pChunk->offset) {
+        length = pChunk->size - pChunk->offset;
+    }
+    memcpy(pBuffer, &pChunk->pData[pChunk->offset], length);
+    pChunk->offset += length;
+    return length;
+}
+
+/*
+ * Prepares the upload of the source's content over pChannel and starts its
+ * worker. Returns MA_COMM_INVALID_PARAMETER, with nothing to release, when
+ * the session's algorithm cannot be sealed incrementally.
+ */
+static uint8_t startUpload(UploadStream *pUpload, SendChannel *pChannel) {
+    uint8_t iv[IV_LENGTH];
+    size_t chunkCapacity = 0;
+
+    if (internalContext.isSecureChannelEnabled) {
+        if (getRandomBytes(iv, IV_LENGTH) != SUCCESSFULL_OPERATION) {
+            LOG("Fail to generate the IV\n");
+            return MA_COMM_INVALID_STATE;
+        }
+        if (sealStreamInit(pChannel->session.algorithm,
+                           pChannel->session.keyCS,
+                           pChannel->session.keyLength,
+                           iv,
+                           IV_LENGTH,
+                           pChannel->session.tagLen,
+                           NULL,
+                           0,
+                           &pUpload->pSeal,
+                           &pChannel->sealInvocations) != SUCCESSFULL_OPERATION) {
+            pUpload->pSeal = NULL;
+            return (isChannelExhausted(pChannel)) ? MA_COMM_INVALID_STATE : MA_COMM_INVALID_PARAMETER;
+        }
+        pUpload->headerSize = 1 + IV_LENGTH;
+        pUpload->pPlain = (uint8_t*) malloc(UPLOAD_CHUNK_SIZE);
+    }
+
+    chunkCapacity = pUpload->headerSize + UPLOAD_CHUNK_SIZE + SEAL_STREAM_OUTPUT_OVERHEAD;
+    pUpload->chunks[0].pData = (uint8_t*) malloc(chunkCapacity);
+    pUpload->chunks[1].pData = (uint8_t*) malloc(chunkCapacity);
+    if ( (!pUpload->chunks[0].pData) ||
+         (!pUpload->chunks[1].pData) ||
+         ( (pUpload->pSeal) && (!pUpload->pPlain) ) ) {
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+    if (pUpload->pSeal) {
+        pUpload->chunks[0].pData[0] = IV_LENGTH;
+        memcpy(&pUpload->chunks[0].pData[1], iv, IV_LENGTH);
+    }
+
+    pthread_mutex_init(&pUpload->mutex, NULL);
+    pthread_cond_init(&pUpload->changed, NULL);
+    if (pthread_create(&pUpload->worker, NULL, uploadWorker, pUpload) != 0) {
+        pthread_cond_destroy(&pUpload->changed);
+        pthread_mutex_destroy(&pUpload->mutex);
+        LOG("Fail to start the upload worker\n");
+        return MA_COMM_INVALID_STATE;
+    }
+    return MA_COMM_SUCCESS;
+}
+
+/* Stops the worker of a started upload */
+static void stopUpload(UploadStream *pUpload) {
+    pthread_mutex_lock(&pUpload->mutex);
+    pUpload->cancelled = 1;
+    pthread_cond_broadcast(&pUpload->changed);
+    pthread_mutex_unlock(&pUpload->mutex);
+    pthread_join(pUpload->worker, NULL);
+    pthread_cond_destroy(&pUpload->changed);
+    pthread_mutex_destroy(&pUpload->mutex);
+}
+
+static void freeUpload(UploadStream *pUpload) {
+    sealStreamAbort(pUpload->pSeal);
+    pUpload->pSeal = NULL;
+    free(pUpload->pPlain);
+    free(pUpload->chunks[0].pData);
+    free(pUpload->chunks[1].pData);
+}
+
+/* Reads the whole source, for the sessions that cannot be sealed incrementally */
+static uint8_t gatherSource(ma_communication_source source,
+                            void *userdata,
+                            BufferStruct *pContent) {
+    size_t readSize = 0;
+
+    do {
+        if ( (communication_buffer_reserve(pContent, pContent->size + UPLOAD_CHUNK_SIZE) != MA_COMM_SUCCESS) ||
+             (source((uint8_t*) &pContent->pData[pContent->size], UPLOAD_CHUNK_SIZE, &readSize, userdata) != 0) ||
+             (readSize > UPLOAD_CHUNK_SIZE) ) {
+            LOG("Fail to read the source\n");
+            return MA_COMM_INVALID_STATE;
+        }
+        pContent->size += readSize;
+    } while (readSize > 0);
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t ma_communication_send_from_source(const char *url,
+                                          char * httpMethod,
+                                          struct curl_slist **headers,
+                                          ma_communication_source source,
+                                          void* userdata,
+                                          size_t contentSize,
+                                          uint32_t *httpStatusCode,
+                                          unsigned char** pResponse,
+                                          size_t *responseSize) {
+    uint8_t result = 0;
+    SendChannel *pChannel = NULL;
+    UploadStream upload;
+    BufferStruct received;
+    struct curl_slist sessionHeader;
+    struct curl_slist *pLast = NULL;
+    struct curl_slist *pHeaders = NULL;
+    curl_off_t uploadLength = -1;
+
+    *httpStatusCode = 0;
+    if ( (!url) || (!source) || (!pResponse) || (!responseSize) ) {
+        freeHeaders(headers);
+        LOG("Invalid parameter\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    if (!initialized) {
+        freeHeaders(headers);
+        LOG("MA communication is not initialized\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    result = ensureMutualAuthentication(&pChannel);
+    if (result != MA_COMM_SUCCESS) {
+        freeHeaders(headers);
+        return result;
+    }
+
+    memset(&upload, 0, sizeof(upload));
+    upload.source = source;
+    upload.userdata = userdata;
+    result = startUpload(&upload, pChannel);
+    if ( (result == MA_COMM_INVALID_STATE) && (isChannelExhausted(pChannel)) ) {
+        result = renewRejectedSession(&pChannel);
+        if (result == MA_COMM_SUCCESS) {
+            result = startUpload(&upload, pChannel);
+        }
+    }
+    if (result == MA_COMM_INVALID_PARAMETER) {
+        // sealed at once, and replayable, through the buffered path
+        releaseSendChannel(pChannel);
+        memset(&received, 0, sizeof(received));
+        result = gatherSource(source, userdata, &received);
+        if (result == MA_COMM_SUCCESS) {
+            result = ma_communication_send(url, httpMethod, headers, (uint8_t*) received.pData,
+                                           received.size, httpStatusCode, pResponse, responseSize);
+        } else {
+            freeHeaders(headers);
+        }
+        free(received.pData);
+        return result;
+    }
+    if (result != MA_COMM_SUCCESS) {
+        freeUpload(&upload);
+        releaseSendChannel(pChannel);
+        freeHeaders(headers);
+        return result;
+    }
+
+    if (contentSize != MA_COMM_UNKNOWN_CONTENT_SIZE) {
+        uploadLength = (curl_off_t) contentSize;
+        if (upload.headerSize > 0) {
+            uploadLength += (curl_off_t) (upload.headerSize + pChannel->session.tagLen / 8);
+        }
+    }
+
+    pHeaders = linkSessionHeader(pChannel, *headers, &sessionHeader, &pLast);
+    result = send_request_with_reader(url,
+                                      httpMethod,
+                                      pHeaders,
+                                      readUploadChunk,
+                                      (void *)&upload,
+                                      uploadLength,
+                                      httpStatusCode,
+                                      &received);
+    unlinkSessionHeader(pLast);
+    freeHeaders(headers);
+    stopUpload(&upload);
+    freeUpload(&upload);
+    if (result != MA_COMM_SUCCESS) {
+        LOG("Fail to send message\n");
+        releaseSendChannel(pChannel);
+        return MA_COMM_INVALID_STATE;
+    }
+
+    // the source is consumed, the request cannot be replayed: the session is
+    // renewed for the next ones and the caller is told to send again
+    if ( (internalContext.isSecureChannelEnabled) &&
+         (kerberos_protocol_is_session_rejected((uint8_t*) received.pData, received.size)) ) {
+        communication_buffer_release(&received);
+        renewRejectedSession(&pChannel);
+        releaseSendChannel(pChannel);
+        return MA_COMM_INVALID_STATE;
+    }
+
+    result = takeResponse(pChannel, &received, pResponse, responseSize);
+    releaseSendChannel(pChannel);
+
+    return result;
+}
+
+static uint8_t readFromFd(unsigned char *buffer, size_t capacity, size_t *size, void *userdata) {
+    int fd = *((int*) userdata);
+    ssize_t readSize = 0;
+
+    do {
+        readSize = read(fd, buffer, capacity);
+    } while ( (readSize < 0) && (errno == EINTR) );
+    if (readSize < 0) {
+        LOG("Fail to read the content\n");
+        return 1;
+    }
+    *size = (size_t) readSize;
+    return 0;
+}
+
+uint8_t ma_communication_send_from_fd(const char *url,
+                                      char * httpMethod,
+                                      struct curl_slist **headers,
+                                      int fd,
+                                      uint32_t *httpStatusCode,
+                                      unsigned char** pResponse,
+                                      size_t *responseSize) {
+    struct stat fileStat;
+    off_t position = 0;
+    size_t contentSize = MA_COMM_UNKNOWN_CONTENT_SIZE;
+
+    if (fd < 0) {
+        freeHeaders(headers);
+        LOG("Invalid parameter\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    // a regular file announces its length, anything else is sent chunked
+    if ( (fstat(fd, &fileStat) == 0) && (S_ISREG(fileStat.st_mode)) ) {
+        position = lseek(fd, 0, SEEK_CUR);
+        if ( (position >= 0) && (position <= fileStat.st_size) ) {
+            contentSize = (size_t) (fileStat.st_size - position);
+        }
+    }
+
+    return ma_communication_send_from_source(url, httpMethod, headers, readFromFd, &fd,
+                                             contentSize, httpStatusCode, pResponse, responseSize);
+}
+
+/* One request of a batch, while it is sent */
+typedef struct SBatchTransfer {
+    ma_communication_request *pRequest;
+    uint8_t *pBody;
+    size_t bodySize;
+    struct curl_slist sessionHeader;
+    struct curl_slist *pLast;
+    BufferStruct response;
+    uint8_t toSend;
+    uint8_t received;
+} BatchTransfer;
+
+/*
+ * Seals the bodies of the transfers to send back to back in a single
+ * allocation, returned in *ppBodies for the caller to free. A transfer that
+ * cannot be sealed gets its result and is not sent.
+ */
+static uint8_t sealBatch(SendChannel *pChannel,
+                         BatchTransfer *pTransfers,
+                         size_t count,
+                         uint8_t **ppBodies) {
+    uint8_t *pNext = NULL;
+    size_t total = 0;
+    size_t capacity = 0;
+    size_t i = 0;
+
+    *ppBodies = NULL;
+    for (i = 0; i < count; ++i) {
+        if (pTransfers[i].toSend) {
+            total += getBodySize(pChannel, pTransfers[i].pRequest->contentSize);
+        }
+    }
+    if ( (internalContext.isSecureChannelEnabled) && (total > 0) ) {
+        *ppBodies = (uint8_t*) malloc(total);
+        if (!*ppBodies) {
+            LOG("Fail to allocate memory\n");
+            return MA_COMM_OUT_OF_MEMORY;
+        }
+    }
+
+    pNext = *ppBodies;
+    for (i = 0; i < count; ++i) {
+        ma_communication_request *pRequest = pTransfers[i].pRequest;
+
+        if (!pTransfers[i].toSend) {
+            continue;
+        }
+        pTransfers[i].pBody = pRequest->content;
+        pTransfers[i].bodySize = pRequest->contentSize;
+        if ( (!internalContext.isSecureChannelEnabled) || (pRequest->contentSize == 0) ) {
+            continue;
+        }
+
+        capacity = getBodySize(pChannel, pRequest->contentSize);
+        pRequest->result = encryptContentTo(pChannel,
+                                            pRequest->content,
+                                            pRequest->contentSize,
+                                            pNext,
+                                            capacity,
+                                            &pTransfers[i].bodySize);
+        if (pRequest->result != MA_COMM_SUCCESS) {
+            pTransfers[i].toSend = 0;
+        }
+        pTransfers[i].pBody = pNext;
+        pNext += capacity;
+    }
+
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Sends the sealed transfers together through the worker's multi handle,
+ * over pooled or multiplexed connections, or one after the other when the
+ * worker cannot run them. Sets the result and status of each transfer.
+ */
+static void runBatch(SendChannel *pChannel,
+                     BatchTransfer *pTransfers,
+                     size_t count,
+                     CURL **pCurlHandlers,
+                     CURLcode *pCodes) {
+    size_t started = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+    for (i = 0; i < count; ++i) {
+        BatchTransfer *pTransfer = &pTransfers[i];
+        struct curl_slist *headers = NULL;
+        CURL *pCurlHandler = NULL;
+
+        if (!pTransfer->toSend) {
+            continue;
+        }
+        pCurlHandler = communication_acquire_handle(pTransfer->pRequest->url);
+        if (!pCurlHandler) {
+            LOG("Fail to create the curl handler\n");
+            pTransfer->pRequest->result = MA_COMM_INVALID_STATE;
+            pTransfer->toSend = 0;
+            continue;
+        }
+
+        headers = linkSessionHeader(pChannel,
+                                    pTransfer->pRequest->headers,
+                                    &pTransfer->sessionHeader,
+                                    &pTransfer->pLast);
+        memset(&pTransfer->response, 0, sizeof(BufferStruct));
+        communication_prepare_request(pCurlHandler,
+                                      pTransfer->pRequest->url,
+                                      pTransfer->pRequest->httpMethod,
+                                      headers,
+                                      pTransfer->pBody,
+                                      pTransfer->bodySize,
+                                      &pTransfer->response);
+        pCurlHandlers[started++] = pCurlHandler;
+    }
+
+    if (async_communication_perform_all(pCurlHandlers, pCodes, started) != MA_COMM_SUCCESS) {
+        for (j = 0; j < started; ++j) {
+            pCodes[j] = curl_easy_perform(pCurlHandlers[j]);
+        }
+    }
+
+    // the handles were started in the order of the transfers to send
+    for (i = 0, j = 0; i < count; ++i) {
+        BatchTransfer *pTransfer = &pTransfers[i];
+        ma_communication_request *pRequest = pTransfer->pRequest;
+        long responseCode = 0;
+
+        if (!pTransfer->toSend) {
+            continue;
+        }
+        pTransfer->toSend = 0;
+        unlinkSessionHeader(pTransfer->pLast);
+        pTransfer->response.pCurlHandler = NULL;
+        if (pCodes[j] == CURLE_OK) {
+            curl_easy_getinfo(pCurlHandlers[j], CURLINFO_RESPONSE_CODE, &responseCode);
+            pRequest->httpStatusCode = (uint32_t) responseCode;
+            pRequest->result = MA_COMM_SUCCESS;
+            pTransfer->received = 1;
+            communication_release_handle(pRequest->url, pCurlHandlers[j]);
+        } else {
+            LOG("send message failed: %s\n", curl_easy_strerror(pCodes[j]));
+            pRequest->result = MA_COMM_INVALID_STATE;
+            curl_easy_cleanup(pCurlHandlers[j]);
+            free(pTransfer->response.pData);
+            memset(&pTransfer->response, 0, sizeof(BufferStruct));
+        }
+        j++;
+    }
+}
+
+/*
+ * Marks the transfers whose response says that the server rejected the
+ * session to be sent again, and returns how many there are.
+ */
+static size_t collectRejected(BatchTransfer *pTransfers, size_t count) {
+    size_t rejected = 0;
+    size_t i = 0;
+
+    if (!internalContext.isSecureChannelEnabled) {
+        return 0;
+    }
+    for (i = 0; i < count; ++i) {
+        BatchTransfer *pTransfer = &pTransfers[i];
+
+        if ( (pTransfer->received) &&
+             (kerberos_protocol_is_session_rejected((uint8_t*) pTransfer->response.pData,
+                                                    pTransfer->response.size)) ) {
+            free(pTransfer->response.pData);
+            memset(&pTransfer->response, 0, sizeof(BufferStruct));
+            pTransfer->received = 0;
+            pTransfer->toSend = 1;
+            rejected++;
+        }
+    }
+    return rejected;
+}
+
+/*
+ * Deciphers the responses received with pChannel in place and hands them to
+ * the requests.
+ */
+static void openBatch(SendChannel *pChannel, BatchTransfer *pTransfers, size_t count) {
+    size_t i = 0;
+
+    for (i = 0; i < count; ++i) {
+        BatchTransfer *pTransfer = &pTransfers[i];
+        ma_communication_request *pRequest = pTransfer->pRequest;
+        size_t plainSize = pTransfer->response.size;
+
+        if (!pTransfer->received) {
+            continue;
+        }
+        pTransfer->received = 0;
+        if ( (internalContext.isSecureChannelEnabled) && (pTransfer->response.size > 0) ) {
+            pRequest->result = openResponseInPlace(pChannel,
+                                                   (uint8_t*) pTransfer->response.pData,
+                                                   pTransfer->response.size,
+                                                   &plainSize);
+        }
+        if (pRequest->result != MA_COMM_SUCCESS) {
+            free(pTransfer->response.pData);
+            continue;
+        }
+        pRequest->response = (unsigned char*) pTransfer->response.pData;
+        pRequest->responseSize = plainSize;
+    }
+}
+
+uint8_t ma_communication_send_batch(ma_communication_request *requests, size_t count) {
+    uint8_t result = MA_COMM_SUCCESS;
+    SendChannel *pChannel = NULL;
+    BatchTransfer *pTransfers = NULL;
+    CURL **pCurlHandlers = NULL;
+    CURLcode *pCodes = NULL;
+    uint8_t *pBodies = NULL;
+    uint8_t pass = 0;
+    size_t i = 0;
+
+    if ( (!requests) && (count > 0) ) {
+        LOG("Invalid parameter\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+    for (i = 0; i < count; ++i) {
+        requests[i].result = MA_COMM_INVALID_STATE;
+        requests[i].httpStatusCode = 0;
+        requests[i].response = NULL;
+        requests[i].responseSize = 0;
+        if ( (!requests[i].url) ||
+             (!requests[i].httpMethod) ||
+             ( (!requests[i].content) && (requests[i].contentSize > 0) ) ) {
+            requests[i].result = MA_COMM_INVALID_PARAMETER;
+            result = MA_COMM_INVALID_PARAMETER;
+        }
+    }
+    if (result != MA_COMM_SUCCESS) {
+        LOG("Invalid parameter\n");
+        goto CLEAN_UP;
+    }
+
+    if (!initialized) {
+        LOG("MA communication is not initialized\n");
+        result = MA_COMM_INVALID_STATE;
+        goto CLEAN_UP;
+    }
+    if (count == 0) {
+        goto CLEAN_UP;
+    }
+
+    pTransfers = (BatchTransfer*) calloc(count, sizeof(BatchTransfer));
+    pCurlHandlers = (CURL**) calloc(count, sizeof(CURL*));
+    pCodes = (CURLcode*) calloc(count, sizeof(CURLcode));
+    if ( (!pTransfers) || (!pCurlHandlers) || (!pCodes) ) {
+        result = MA_COMM_OUT_OF_MEMORY;
+        goto CLEAN_UP;
+    }
+    for (i = 0; i < count; ++i) {
+        pTransfers[i].pRequest = &requests[i];
+        pTransfers[i].toSend = 1;
+    }
+
+    result = ensureMutualAuthentication(&pChannel);
+    if (result != MA_COMM_SUCCESS) {
+        goto CLEAN_UP;
+    }
+    // the batch runs on the worker's connections, or one request at a time
+    // if it cannot be started
+    if (async_communication_start() != MA_COMM_SUCCESS) {
+        LOG("The batch is sent sequentially\n");
+    }
+
+    // the requests the server rejects the session of are sent once more,
+    // under the renewed session
+    for (pass = 0; pass < 2; ++pass) {
+        size_t rejected = 0;
+
+        result = sealBatch(pChannel, pTransfers, count, &pBodies);
+        if (result != MA_COMM_SUCCESS) {
+            break;
+        }
+        runBatch(pChannel, pTransfers, count, pCurlHandlers, pCodes);
+        free(pBodies);
+        pBodies = NULL;
+
+        if (pass == 0) {
+            rejected = collectRejected(pTransfers, count);
+        }
+        // opened before the renewal releases the channel they were sealed with
+        openBatch(pChannel, pTransfers, count);
+        if (rejected == 0) {
+            break;
+        }
+        result = renewRejectedSession(&pChannel);
+        if (result != MA_COMM_SUCCESS) {
+            break;
+        }
+    }
+    // the requests left could not be sealed, or their session renewed
+    for (i = 0; i < count; ++i) {
+        if (pTransfers[i].toSend) {
+            requests[i].result = result;
+        }
+    }
+
+    result = MA_COMM_SUCCESS;
+    for (i = 0; (i < count) && (result == MA_COMM_SUCCESS); ++i) {
+        result = requests[i].result;
+    }
+
+CLEAN_UP:
+    for (i = 0; i < count; ++i) {
+        freeHeaders(&requests[i].headers);
+    }
+    releaseSendChannel(pChannel);
+    free(pCodes);
+    free(pCurlHandlers);
+    free(pTransfers);
+
+    return result;
+}
+
+/* A message of a record batch, kept by its sender while it waits */
+typedef struct SPendingRecord {
+    unsigned char *content;
+    size_t contentSize;
+    uint8_t result;
+    uint32_t httpStatusCode;
+    unsigned char *response;
+    size_t responseSize;
+    uint8_t isSent;
+    struct SPendingRecord *pNext;
+} PendingRecord;
+
+/*
+ * Messages to one URL gathered into a single request. The sender that opens
+ * the batch keeps it, closes it once it is full or its delay is over, and
+ * sends it for everyone.
+ */
+typedef struct SRecordBatch {
+    const char *url;
+    PendingRecord *pFirst;
+    PendingRecord *pLast;
+    uint32_t count;
+    size_t size;
+    pthread_cond_t full;
+    struct SRecordBatch *pNext;
+} RecordBatch;
+
+static void putRecordLength(uint8_t *pLength, uint32_t length) {
+    pLength[0] = (uint8_t) (length >> 24);
+    pLength[1] = (uint8_t) (length >> 16);
+    pLength[2] = (uint8_t) (length >> 8);
+    pLength[3] = (uint8_t) length;
+}
+
+static uint32_t getRecordLength(const uint8_t *pLength) {
+    return ((uint32_t) pLength[0] << 24) |
+           ((uint32_t) pLength[1] << 16) |
+           ((uint32_t) pLength[2] << 8) |
+           ((uint32_t) pLength[3]);
+}
+
+/*
+ * Size of the record of contentSize bytes in a batch body. Unlike a body,
+ * an empty record is sealed too, so that it carries its index.
+ */
+static size_t getRecordSize(SendChannel *pChannel, size_t contentSize) {
+    if (!internalContext.isSecureChannelEnabled) {
+        return RECORD_LENGTH_SIZE + contentSize;
+    }
+    return RECORD_LENGTH_SIZE + 1 + IV_LENGTH + contentSize + (size_t) pChannel->session.tagLen / 8;
+}
+
+/*
+ * Writes the record at index of its batch into pRecord, which holds
+ * getRecordSize bytes: the length of the body, then the body built as
+ * encryptContentTo does, with the index as additional data so that the
+ * records of a batch cannot be swapped. Empty records are sealed as well.
+ */
+static uint8_t sealRecord(SendChannel *pChannel,
+                          uint32_t index,
+                          uint8_t *content,
+                          size_t contentSize,
+                          uint8_t *pRecord,
+                          size_t *pRecordSize) {
+    int32_t result = 0;
+    uint8_t aad[RECORD_LENGTH_SIZE];
+    uint8_t *pBody = &pRecord[RECORD_LENGTH_SIZE];
+    size_t bodySize = getRecordSize(pChannel, contentSize) - RECORD_LENGTH_SIZE;
+    size_t cipherContentSize = 0;
+
+    if (!internalContext.isSecureChannelEnabled) {
+        if (contentSize > 0) {
+            memcpy(pBody, content, contentSize);
+        }
+    } else {
+        putRecordLength(aad, index);
+        pBody[0] = IV_LENGTH;
+        if (getRandomBytes(&pBody[1], IV_LENGTH) != SUCCESSFULL_OPERATION) {
+            LOG("Fail to generate the IV\n");
+            return MA_COMM_INVALID_STATE;
+        }
+
+        result = sealWithKeyTo(pChannel->session.algorithm,
+                               pChannel->session.keyCS,
+                               pChannel->session.keyLength,
+                               &pBody[1],
+                               IV_LENGTH,
+                               pChannel->session.tagLen,
+                               aad,
+                               RECORD_LENGTH_SIZE,
+                               content,
+                               contentSize,
+                               &pBody[1 + IV_LENGTH],
+                               bodySize - 1 - IV_LENGTH,
+                               &cipherContentSize,
+                               &pChannel->sealInvocations);
+        if (result != SUCCESSFULL_OPERATION) {
+            LOG("Fail to encrypt record\n");
+            return MA_COMM_INVALID_STATE;
+        }
+        bodySize = 1 + IV_LENGTH + cipherContentSize;
+    }
+
+    putRecordLength(pRecord, (uint32_t) bodySize);
+    *pRecordSize = RECORD_LENGTH_SIZE + bodySize;
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Deciphers the body of the response record at index into an allocation
+ * the caller owns, NULL if the content is empty. Over the secure channel
+ * the body always holds at least the IV and the tag.
+ */
+static uint8_t openRecord(SendChannel *pChannel,
+                          uint32_t index,
+                          uint8_t *pBody,
+                          size_t bodySize,
+                          unsigned char **pPlain,
+                          size_t *pPlainSize) {
+    int32_t result = 0;
+    uint8_t aad[RECORD_LENGTH_SIZE];
+    size_t plainSize = bodySize;
+
+    *pPlain = NULL;
+    *pPlainSize = 0;
+    if (!internalContext.isSecureChannelEnabled) {
+        if (bodySize == 0) {
+            return MA_COMM_SUCCESS;
+        }
+    } else {
+        if (bodySize < 1 + IV_LENGTH + (size_t) pChannel->session.tagLen / 8) {
+            LOG("Invalid record\n");
+            return MA_COMM_INVALID_STATE;
+        }
+        result = getResponsePlainSize(pChannel, pBody, bodySize, &plainSize);
+        if (result != MA_COMM_SUCCESS) {
+            return result;
+        }
+    }
+
+    *pPlain = (unsigned char*) malloc((plainSize > 0) ? plainSize : 1);
+    if (!*pPlain) {
+        LOG("Fail to allocate memory\n");
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+    if (!internalContext.isSecureChannelEnabled) {
+        memcpy(*pPlain, pBody, bodySize);
+        *pPlainSize = bodySize;
+        return MA_COMM_SUCCESS;
+    }
+
+    putRecordLength(aad, index);
+    result = openWithKeyTo(pChannel->session.algorithm,
+                           pChannel->session.keySC,
+                           pChannel->session.keyLength,
+                           &pBody[1],
+                           pBody[0],
+                           pChannel->session.tagLen,
+                           aad,
+                           RECORD_LENGTH_SIZE,
+                           &pBody[1 + pBody[0]],
+                           bodySize - 1 - pBody[0],
+                           *pPlain,
+                           plainSize,
+                           pPlainSize);
+    if (result != SUCCESSFULL_OPERATION) {
+        LOG("Fail to decrypt record\n");
+        free(*pPlain);
+        *pPlain = NULL;
+        *pPlainSize = 0;
+        return MA_COMM_INVALID_STATE;
+    }
+    // an empty content was authenticated all the same, the caller gets NULL
+    if (*pPlainSize == 0) {
+        free(*pPlain);
+        *pPlain = NULL;
+    }
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Seals the records of the batch back to back in the calling thread's
+ * request arena, which the caller gives back with communication_arena_release.
+ */
+static uint8_t sealRecords(SendChannel *pChannel,
+                           RecordBatch *pBatch,
+                           BufferStruct *pArena,
+                           size_t *pBodySize) {
+    PendingRecord *pRecord = NULL;
+    uint8_t *pNext = NULL;
+    size_t capacity = 0;
+    size_t recordSize = 0;
+    uint32_t index = 0;
+    uint8_t result = 0;
+
+    for (pRecord = pBatch->pFirst; pRecord; pRecord = pRecord->pNext) {
+        capacity += getRecordSize(pChannel, pRecord->contentSize);
+    }
+    if (communication_arena_acquire(pArena, capacity) != MA_COMM_SUCCESS) {
+        LOG("Fail to allocate memory\n");
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+
+    pNext = (uint8_t*) pArena->pData;
+    for (pRecord = pBatch->pFirst; pRecord; pRecord = pRecord->pNext) {
+        result = sealRecord(pChannel, index++, pRecord->content, pRecord->contentSize,
+                            pNext, &recordSize);
+        if (result != MA_COMM_SUCCESS) {
+            communication_arena_release(pArena);
+            return result;
+        }
+        pNext += recordSize;
+    }
+
+    *pBodySize = (size_t) (pNext - (uint8_t*) pArena->pData);
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Hands the records of the response back to the senders of the batch, in
+ * the order they were sent. A response that does not hold exactly one
+ * record per message fails them all.
+ */
+static void openRecords(SendChannel *pChannel,
+                        RecordBatch *pBatch,
+                        BufferStruct *pResponse,
+                        uint32_t httpStatusCode) {
+    PendingRecord *pRecord = NULL;
+    uint8_t *pNext = (uint8_t*) pResponse->pData;
+    size_t left = pResponse->size;
+    uint32_t length = 0;
+    uint32_t index = 0;
+
+    for (index = 0; index < pBatch->count; ++index) {
+        if (left < RECORD_LENGTH_SIZE) {
+            break;
+        }
+        length = getRecordLength(pNext);
+        if (left - RECORD_LENGTH_SIZE < length) {
+            break;
+        }
+        pNext += RECORD_LENGTH_SIZE + length;
+        left -= RECORD_LENGTH_SIZE + length;
+    }
+    if ( (index < pBatch->count) || (left > 0) ) {
+        LOG("Invalid record batch response\n");
+        for (pRecord = pBatch->pFirst; pRecord; pRecord = pRecord->pNext) {
+            pRecord->httpStatusCode = httpStatusCode;
+            pRecord->result = MA_COMM_INVALID_STATE;
+        }
+        return;
+    }
+
+    pNext = (uint8_t*) pResponse->pData;
+    index = 0;
+    for (pRecord = pBatch->pFirst; pRecord; pRecord = pRecord->pNext) {
+        length = getRecordLength(pNext);
+        pRecord->httpStatusCode = httpStatusCode;
+        pRecord->result = openRecord(pChannel,
+                                     index++,
+                                     &pNext[RECORD_LENGTH_SIZE],
+                                     length,
+                                     &pRecord->response,
+                                     &pRecord->responseSize);
+        pNext += RECORD_LENGTH_SIZE + length;
+    }
+}
+
+/*
+ * Sends a closed batch as a single request over the session, establishing
+ * it first if needed, and replays it once if the server rejects the
+ * session, as sendWithSession does. Every record gets its result.
+ */
+static void sendRecordBatch(RecordBatch *pBatch) {
+    uint8_t result = 0;
+    uint8_t pass = 0;
+    uint32_t httpStatusCode = 0;
+    size_t bodySize = 0;
+    SendChannel *pChannel = NULL;
+    PendingRecord *pRecord = NULL;
+    BufferStruct arena;
+    BufferStruct response;
+    struct curl_slist sessionHeader;
+    struct curl_slist *pLast = NULL;
+    struct curl_slist *headers = NULL;
+
+    result = ensureMutualAuthentication(&pChannel);
+    for (pass = 0; (pass < 2) && (result == MA_COMM_SUCCESS); ++pass) {
+        result = sealRecords(pChannel, pBatch, &arena, &bodySize);
+        if ( (result != MA_COMM_SUCCESS) && (pass == 0) && (isChannelExhausted(pChannel)) ) {
+            result = renewRejectedSession(&pChannel);
+            continue;
+        }
+        if (result != MA_COMM_SUCCESS) {
+            break;
+        }
+        headers = linkSessionHeader(pChannel, NULL, &sessionHeader, &pLast);
+        result = send_request(pBatch->url,
+                              HTTP_METHOD_POST,
+                              headers,
+                              (uint8_t*) arena.pData,
+                              bodySize,
+                              &httpStatusCode,
+                              &response);
+        unlinkSessionHeader(pLast);
+        communication_arena_release(&arena);
+        if (result != SUCCESSFULL_OPERATION) {
+            LOG("Fail to send record batch\n");
+            result = MA_COMM_INVALID_STATE;
+            break;
+        }
+
+        // the whole batch was sealed under the rejected session
+        if ( (pass == 0) &&
+             (internalContext.isSecureChannelEnabled) &&
+             (kerberos_protocol_is_session_rejected((uint8_t*) response.pData, response.size)) ) {
+            communication_buffer_release(&response);
+            result = renewRejectedSession(&pChannel);
+            continue;
+        }
+
+        openRecords(pChannel, pBatch, &response, httpStatusCode);
+        communication_buffer_release(&response);
+        releaseSendChannel(pChannel);
+        return;
+    }
+
+    for (pRecord = pBatch->pFirst; pRecord; pRecord = pRecord->pNext) {
+        pRecord->httpStatusCode = httpStatusCode;
+        pRecord->result = (result != MA_COMM_SUCCESS) ? result : MA_COMM_INVALID_STATE;
+    }
+    releaseSendChannel(pChannel);
+}
+
+uint8_t ma_communication_set_record_batching(uint32_t maxDelayMs, size_t maxBatchSize) {
+    if (maxBatchSize == 0) {
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    pthread_mutex_lock(&recordMutex);
+    recordMaxDelayMs = maxDelayMs;
+    recordMaxBatchSize = maxBatchSize;
+    pthread_mutex_unlock(&recordMutex);
+
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t ma_communication_send_record(const char *url,
+                                     unsigned char *content,
+                                     size_t contentSize,
+                                     uint32_t *httpStatusCode,
+                                     unsigned char **pResponse,
+                                     size_t *responseSize) {
+    PendingRecord record;
+    RecordBatch ownBatch;
+    RecordBatch *pBatch = NULL;
+    RecordBatch **ppBatch = NULL;
+    PendingRecord *pRecord = NULL;
+    struct timespec deadline;
+
+    if ( (!url) || ( (!content) && (contentSize > 0) ) ||
+         (!httpStatusCode) || (!pResponse) || (!responseSize) ||
+         (contentSize > UINT32_MAX - (1 + IV_LENGTH + UINT8_MAX / 8)) ) {
+        LOG("Invalid parameter\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+    *httpStatusCode = 0;
+    *pResponse = NULL;
+    *responseSize = 0;
+
+    if (!initialized) {
+        LOG("MA communication is not initialized\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    memset(&record, 0, sizeof(PendingRecord));
+    record.content = content;
+    record.contentSize = contentSize;
+
+    pthread_mutex_lock(&recordMutex);
+    for (pBatch = pOpenRecordBatches; pBatch; pBatch = pBatch->pNext) {
+        if (strcmp(pBatch->url, url) == 0) {
+            break;
+        }
+    }
+
+    if (pBatch) {
+        pBatch->pLast->pNext = &record;
+        pBatch->pLast = &record;
+        pBatch->count++;
+        pBatch->size += RECORD_LENGTH_SIZE + contentSize;
+        if (pBatch->size >= recordMaxBatchSize) {
+            pthread_cond_signal(&pBatch->full);
+        }
+        // the sender that opened the batch sends it for everyone
+        while (!record.isSent) {
+            pthread_cond_wait(&recordsSent, &recordMutex);
+        }
+        pthread_mutex_unlock(&recordMutex);
+    } else {
+        pBatch = &ownBatch;
+        pBatch->url = url;
+        pBatch->pFirst = &record;
+        pBatch->pLast = &record;
+        pBatch->count = 1;
+        pBatch->size = RECORD_LENGTH_SIZE + contentSize;
+        pthread_cond_init(&pBatch->full, NULL);
+        pBatch->pNext = pOpenRecordBatches;
+        pOpenRecordBatches = pBatch;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += recordMaxDelayMs / 1000;
+        deadline.tv_nsec += (recordMaxDelayMs % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while ( (pBatch->size < recordMaxBatchSize) &&
+                (pthread_cond_timedwait(&pBatch->full, &recordMutex, &deadline) == 0) ) {
+        }
+
+        // closed: the messages that come next open a new batch
+        for (ppBatch = &pOpenRecordBatches; *ppBatch != pBatch; ppBatch = &(*ppBatch)->pNext) {
+        }
+        *ppBatch = pBatch->pNext;
+        pthread_mutex_unlock(&recordMutex);
+
+        LOG("Sending %u records\n", (unsigned int) pBatch->count);
+        sendRecordBatch(pBatch);
+
+        pthread_mutex_lock(&recordMutex);
+        for (pRecord = pBatch->pFirst; pRecord; pRecord = pRecord->pNext) {
+            pRecord->isSent = 1;
+        }
+        pthread_cond_broadcast(&recordsSent);
+        pthread_mutex_unlock(&recordMutex);
+        pthread_cond_destroy(&pBatch->full);
+    }
+
+    *httpStatusCode = record.httpStatusCode;
+    *pResponse = record.response;
+    *responseSize = record.responseSize;
+    return record.result;
+}
+
+typedef struct SAsyncSend {
+    ma_communication_callback callback;
+    void *userdata;
+    // session the request was sealed with, its response is opened with it too
+    SendChannel *pChannel;
+    // copy of the request while it waits for the handshake
+    char *url;
+    char *method;
+    struct curl_slist *headers;
+    uint8_t *content;
+    size_t contentSize;
+    struct SAsyncSend *pNext;
+} AsyncSend;
+
+static void freeAsyncSend(AsyncSend *pSend) {
+    releaseSendChannel(pSend->pChannel);
+    freeHeaders(&pSend->headers);
+    free(pSend->content);
+    free(pSend->method);
+    free(pSend->url);
+    free(pSend);
+}
+
+/* Runs on the worker thread (or in the event loop) once the HTTP exchange is over */
+static void completeAsyncSend(uint8_t result,
+                              uint32_t httpStatusCode,
+                              uint8_t *pResponse,
+                              size_t responseSize,
+                              void *pUserData) {
+    AsyncSend *pSend = (AsyncSend*) pUserData;
+    uint8_t *pPlain = NULL;
+    size_t plainSize = 0;
+
+    if (result == MA_COMM_SUCCESS) {
+        result = decryptResponse(pSend->pChannel, pResponse, responseSize, &pPlain, &plainSize);
+    } else {
+        LOG("Fail to send message\n");
+    }
+    if (result != MA_COMM_SUCCESS) {
+        pPlain = NULL;
+        plainSize = 0;
+    }
+
+    pSend->callback(result, httpStatusCode, pPlain, plainSize, pSend->userdata);
+    freeAsyncSend(pSend);
+}
+
+/*
+ * Encrypts the content with pSend->pChannel and queues the request on the
+ * transport. On success pSend belongs to the transport and the headers were
+ * consumed.
+ */
+static uint8_t submitAsyncSend(AsyncSend *pSend,
+                               const char *url,
+                               const char *httpMethod,
+                               struct curl_slist **headers,
+                               uint8_t *content,
+                               size_t contentSize) {
+    int32_t result = 0;
+    uint8_t* pContentToSend = NULL;
+    size_t contentToSendSize = 0;
+
+    result = encryptContent(pSend->pChannel, content, contentSize, &pContentToSend, &contentToSendSize);
+    if (result != MA_COMM_SUCCESS) {
+        return result;
+    }
+
+    // the caller keeps the ownership of content, so the body must be a copy
+    if ( (pContentToSend == content) && (contentSize > 0) ) {
+        pContentToSend = (uint8_t*) malloc(contentSize);
+        if (!pContentToSend) {
+            return MA_COMM_OUT_OF_MEMORY;
+        }
+        memcpy(pContentToSend, content, contentSize);
+    } else if (pContentToSend == content) {
+        pContentToSend = NULL;
+    }
+
+    // set the headers
+    *headers = curl_slist_append(*headers, pSend->pChannel->mutualAuthHeader);
+
+    result = async_communication_submit(url,
+                                        httpMethod,
+                                        *headers,
+                                        pContentToSend,
+                                        contentToSendSize,
+                                        completeAsyncSend,
+                                        pSend);
+    *headers = NULL;
+    if (result != MA_COMM_SUCCESS) {
+        LOG("Fail to queue message\n");
+    }
+    return result;
+}
+
+/*
+ * Ends the running handshake: the senders waiting for it are woken up and
+ * the queued requests are sent, or fail with the handshake's result.
+ */
+static void finishHandshake(uint8_t result) {
+    AsyncSend *pWaiting = NULL;
+    SendChannel *pChannel = NULL;
+
+    pthread_mutex_lock(&channelMutex);
+    handshakeInProgress = 0;
+    lastHandshakeResult = result;
+    handshakeGeneration++;
+    pWaiting = pWaitingSends;
+    pWaitingSends = NULL;
+    pWaitingSendsTail = NULL;
+    pthread_cond_broadcast(&handshakeDone);
+    pthread_mutex_unlock(&channelMutex);
+
+    if (result == MA_COMM_SUCCESS) {
+        pChannel = acquireSendChannel();
+        if (!pChannel) {
+            result = MA_COMM_INVALID_STATE;
+        }
+    }
+
+    while (pWaiting) {
+        AsyncSend *pSend = pWaiting;
+        uint8_t sendResult = result;
+        pWaiting = pSend->pNext;
+        pSend->pNext = NULL;
+
+        if (sendResult == MA_COMM_SUCCESS) {
+            uint8_t *content = pSend->content;
+            pSend->content = NULL;
+            retainSendChannel(pChannel);
+            pSend->pChannel = pChannel;
+            sendResult = submitAsyncSend(pSend,
+                                         pSend->url,
+                                         pSend->method,
+                                         &pSend->headers,
+                                         content,
+                                         pSend->contentSize);
+            free(content);
+            if (sendResult == MA_COMM_SUCCESS) {
+                continue;
+            }
+        }
+        pSend->callback(sendResult, 0, NULL, 0, pSend->userdata);
+        freeAsyncSend(pSend);
+    }
+    releaseSendChannel(pChannel);
+}
+
+static uint8_t submitHandshakeLeg(const char *url, uint8_t *request, size_t requestLength);
+
+/*
+ * Begins an attempt of the asynchronous handshake, whose ownership the
+ * caller took by setting handshakeInProgress, and sends its RequestAS.
+ * Runs as a scheduled task when the attempt is delayed.
+ */
+static void beginAsyncHandshake(uint8_t result, void *pUserData) {
+    const char *url = NULL;
+    uint8_t *request = NULL;
+    size_t requestLength = 0;
+    (void) pUserData;
+
+    if (result == MA_COMM_SUCCESS) {
+        pthread_mutex_lock(&channelMutex);
+        result = kerberos_protocol_begin_handshake(internalContext.pKerberosContext,
+                                                   &url,
+                                                   &request,
+                                                   &requestLength);
+        pthread_mutex_unlock(&channelMutex);
+    }
+    if (result == MA_COMM_SUCCESS) {
+        result = submitHandshakeLeg(url, request, requestLength);
+    }
+    if (result != MA_COMM_SUCCESS) {
+        LOG("Fail to start kerberos handshake. Error %d\n", result);
+        finishHandshake(MA_COMM_INVALID_STATE);
+    }
+}
+
+/*
+ * Begins the asynchronous handshake after delayMs, on the thread driving
+ * the requests, as kerberos_protocol_execute_handshake would sleep first.
+ */
+static void scheduleAsyncHandshake(uint32_t delayMs) {
+    if (delayMs == 0) {
+        beginAsyncHandshake(MA_COMM_SUCCESS, NULL);
+        return;
+    }
+    LOG("Delaying the handshake by %u ms\n", delayMs);
+    if (async_communication_schedule(delayMs, beginAsyncHandshake, NULL) != MA_COMM_SUCCESS) {
+        finishHandshake(MA_COMM_INVALID_STATE);
+    }
+}
+
+static void completeHandshakeLeg(uint8_t result,
+                                 uint32_t httpStatusCode,
+                                 uint8_t *pResponse,
+                                 size_t responseSize,
+                                 void *pUserData) {
+    const char *url = NULL;
+    uint8_t *request = NULL;
+    size_t requestLength = 0;
+    uint8_t sendFailed = (result != MA_COMM_SUCCESS);
+    uint8_t retry = MA_COMM_FALSE;
+    uint32_t delay = 0;
+    (void) pUserData;
+
+    if (result == MA_COMM_SUCCESS) {
+        pthread_mutex_lock(&channelMutex);
+        result = kerberos_protocol_continue_handshake(internalContext.pKerberosContext,
+                                                      pResponse,
+                                                      responseSize,
+                                                      &url,
+                                                      &request,
+                                                      &requestLength);
+        if ( (result == MA_COMM_SUCCESS) && (!request) ) {
+            result = kerberos_protocol_install_secure_channel(internalContext.pKerberosContext);
+            if (result == MA_COMM_SUCCESS) {
+                result = publishSendChannel();
+            }
+            if (result == MA_COMM_SUCCESS) {
+                saveSessionCache();
+            }
+        }
+        pthread_mutex_unlock(&channelMutex);
+    } else {
+        LOG("Fail to send the handshake request\n");
+    }
+    free(pResponse);
+
+    if ( (result == MA_COMM_SUCCESS) && (request) ) {
+        result = submitHandshakeLeg(url, request, requestLength);
+        if (result == MA_COMM_SUCCESS) {
+            return;
+        }
+    }
+
+    if (result != MA_COMM_SUCCESS) {
+        // the same backoff as the blocking handshakes
+        pthread_mutex_lock(&channelMutex);
+        retry = kerberos_protocol_retry_handshake(internalContext.pKerberosContext,
+                                                  asyncHandshakeRetries,
+                                                  sendFailed,
+                                                  httpStatusCode,
+                                                  &delay);
+        if (retry == MA_COMM_TRUE) {
+            asyncHandshakeRetries++;
+        }
+        pthread_mutex_unlock(&channelMutex);
+        if (retry == MA_COMM_TRUE) {
+            LOG("Retrying the handshake in %u ms\n", delay);
+            scheduleAsyncHandshake(delay);
+            return;
+        }
+
+        LOG("Fail to execute kerberos handshake. Error %d\n", result);
+        result = MA_COMM_INVALID_STATE;
+    }
+    finishHandshake(result);
+}
+
+static uint8_t submitHandshakeLeg(const char *url, uint8_t *request, size_t requestLength) {
+    struct curl_slist *headers = curl_slist_append(NULL, HANDSHAKE_CONTENT_TYPE);
+
+    return async_communication_submit(url,
+                                      "POST",
+                                      headers,
+                                      request,
+                                      requestLength,
+                                      completeHandshakeLeg,
+                                      NULL);
+}
+
+/*
+ * Keeps a copy of the request until the handshake completes and takes the
+ * ownership of the handshake if it is not running yet. Must be called with
+ * channelMutex held; *pStartHandshake tells the caller to schedule it, after
+ * *pStartDelay, once the mutex is released.
+ */
+static uint8_t queueUntilAuthenticated(AsyncSend *pSend,
+                                       const char *url,
+                                       const char *httpMethod,
+                                       struct curl_slist **headers,
+                                       uint8_t *content,
+                                       size_t contentSize,
+                                       uint8_t *pStartHandshake,
+                                       uint32_t *pStartDelay) {
+    pSend->url = strdup(url);
+    pSend->method = strdup(httpMethod);
+    if (contentSize > 0) {
+        pSend->content = (uint8_t*) malloc(contentSize);
+        if (pSend->content) {
+            memcpy(pSend->content, content, contentSize);
+        }
+    }
+    if ( (!pSend->url) || (!pSend->method) || ( (contentSize > 0) && (!pSend->content) ) ) {
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+    pSend->contentSize = contentSize;
+
+    if (!handshakeInProgress) {
+        LOG("The application is not mutual authenticated\n");
+        handshakeInProgress = 1;
+        handshakeCount++;
+        asyncHandshakeRetries = 0;
+        *pStartDelay = kerberos_protocol_get_start_delay(internalContext.pKerberosContext);
+        *pStartHandshake = 1;
+    } else {
+        coalescedWaits++;
+    }
+
+    pSend->headers = *headers;
+    *headers = NULL;
+    if (pWaitingSendsTail) {
+        pWaitingSendsTail->pNext = pSend;
+    } else {
+        pWaitingSends = pSend;
+    }
+    pWaitingSendsTail = pSend;
+
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t ma_communication_send_async(const char *url,
+                                    char * httpMethod,
+                                    struct curl_slist **headers,
+                                    unsigned char* content,
+                                    size_t contentSize,
+                                    ma_communication_callback callback,
+                                    void *userdata) {
+    int32_t result = 0;
+    AsyncSend *pSend = NULL;
+    uint8_t authenticated = 0;
+    uint8_t startHandshake = 0;
+    uint32_t startDelay = 0;
+
+    if ( (!url) || (!httpMethod) || ( (!content) && (contentSize > 0) ) || (!callback) ) {
+        freeHeaders(headers);
+        LOG("Invalid parameter\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    if (!initialized) {
+        freeHeaders(headers);
+        LOG("MA communication is not initialized\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    result = async_communication_start();
+    if (result != MA_COMM_SUCCESS) {
+        freeHeaders(headers);
+        return result;
+    }
+
+    pSend = (AsyncSend*) calloc(1, sizeof(AsyncSend));
+    if (!pSend) {
+        freeHeaders(headers);
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+    pSend->callback = callback;
+    pSend->userdata = userdata;
+
+    pSend->pChannel = acquireSendChannel();
+    authenticated = (pSend->pChannel != NULL);
+    if (!authenticated) {
+        pthread_mutex_lock(&channelMutex);
+        // the handshake may have completed since the channel was acquired
+        pSend->pChannel = acquireSendChannel();
+        authenticated = (pSend->pChannel != NULL);
+    }
+    if (!authenticated) {
+        // never block the caller: the request waits for the handshake,
+        // which runs over the asynchronous transport too
+        result = queueUntilAuthenticated(pSend,
+                                         url,
+                                         httpMethod,
+                                         headers,
+                                         content,
+                                         contentSize,
+                                         &startHandshake,
+                                         &startDelay);
+        pthread_mutex_unlock(&channelMutex);
+    }
+
+    if (authenticated) {
+        result = submitAsyncSend(pSend, url, httpMethod, headers, content, contentSize);
+    }
+    if (result != MA_COMM_SUCCESS) {
+        freeHeaders(headers);
+        freeAsyncSend(pSend);
+        return result;
+    }
+
+    if (startHandshake) {
+        // from here on, failures are reported through the callbacks
+        scheduleAsyncHandshake(startDelay);
+    }
+
+    return MA_COMM_SUCCESS;
+}
+
+/*
+ * Negotiates a new session while the current one, if any, keeps serving the
+ * senders. Joins the handshake already running instead of starting another.
+ */
+static uint8_t renewSession() {
+    uint8_t result = 0;
+
+    pthread_mutex_lock(&channelMutex);
+    if (handshakeInProgress) {
+        result = waitForHandshake();
+        pthread_mutex_unlock(&channelMutex);
+        return result;
+    }
+    handshakeInProgress = 1;
+    handshakeCount++;
+    pthread_mutex_unlock(&channelMutex);
+
+    LOG("Renewing the session\n");
+    return runOwnedHandshake();
+}
+
+/* Milliseconds until the published session must be renewed */
+static uint64_t nextRenewalDelay() {
+    SendChannel *pChannel = acquireSendChannel();
+    uint64_t now = 0;
+    uint64_t delay = RENEWAL_RETRY_DELAY_MS;
+    uint64_t jitter = 0;
+    uint64_t randomBits = 0;
+
+    if (pChannel) {
+        getAdjustedUTC(pChannel->session.offset, &now);
+        // the session has just been negotiated, so what is left is its lifetime
+        delay = (now < pChannel->session.expireTimestamp) ?
+                (pChannel->session.expireTimestamp - now) / 100 * renewalPercent : 0;
+        jitter = delay / 100 * renewalJitterPercent;
+        if ( (jitter > 0) &&
+             (getRandomBytes((uint8_t*) &randomBits, sizeof(randomBits)) == SUCCESSFULL_OPERATION) ) {
+            delay = delay - jitter + randomBits % (2 * jitter + 1);
+        }
+    }
+    releaseSendChannel(pChannel);
+
+    return (delay < RENEWAL_MIN_DELAY_MS) ? RENEWAL_MIN_DELAY_MS : delay;
+}
+
+static void* renewalWorker(void *pArg) {
+    struct timespec deadline;
+    SendChannel *pChannel = NULL;
+    uint64_t delay = 0;
+    (void) pArg;
+
+    // a session restored from the cache is renewed on schedule, not right away
+    pChannel = acquireSendChannel();
+    if (pChannel) {
+        delay = nextRenewalDelay();
+    }
+    releaseSendChannel(pChannel);
+
+    pthread_mutex_lock(&renewalMutex);
+    while (!renewalStop) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += delay / 1000;
+        deadline.tv_nsec += (delay % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while ( (!renewalStop) &&
+                (pthread_cond_timedwait(&renewalWakeup, &renewalMutex, &deadline) == 0) ) {
+        }
+        if (renewalStop) {
+            break;
+        }
+        pthread_mutex_unlock(&renewalMutex);
+
+        delay = (renewSession() == MA_COMM_SUCCESS) ? nextRenewalDelay() : RENEWAL_RETRY_DELAY_MS;
+        LOG("Next session renewal in %llu ms\n", (unsigned long long) delay);
+
+        pthread_mutex_lock(&renewalMutex);
+    }
+    pthread_mutex_unlock(&renewalMutex);
+
+    return NULL;
+}
+
+uint8_t ma_communication_start_session_renewal(uint8_t renewAtPercent,
+                                               uint8_t jitterPercent) {
+    uint8_t result = MA_COMM_SUCCESS;
+
+    if ( (renewAtPercent == 0) || (renewAtPercent >= 100) || (jitterPercent >= 100) ) {
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    if (!initialized) {
+        LOG("MA communication is not initialized\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&renewalMutex);
+    if (renewalRunning) {
+        result = MA_COMM_INVALID_STATE;
+    } else {
+        renewalPercent = renewAtPercent;
+        renewalJitterPercent = jitterPercent;
+        renewalStop = 0;
+        if (pthread_create(&renewalThread, NULL, renewalWorker, NULL) != 0) {
+            result = MA_COMM_INVALID_STATE;
+        } else {
+            renewalRunning = 1;
+        }
+    }
+    pthread_mutex_unlock(&renewalMutex);
+
+    return result;
+}
+
+static void stopSessionRenewal() {
+    pthread_mutex_lock(&renewalMutex);
+    if (!renewalRunning) {
+        pthread_mutex_unlock(&renewalMutex);
+        return;
+    }
+    renewalStop = 1;
+    pthread_cond_signal(&renewalWakeup);
+    pthread_mutex_unlock(&renewalMutex);
+
+    pthread_join(renewalThread, NULL);
+    pthread_mutex_lock(&renewalMutex);
+    renewalRunning = 0;
+    pthread_mutex_unlock(&renewalMutex);
+}
+
+static void freeUrls(char **urls, size_t urlCount) {
+    size_t i = 0;
+
+    if (!urls) {
+        return;
+    }
+    for (i = 0; i < urlCount; ++i) {
+        free(urls[i]);
+    }
+    free(urls);
+}
+
+static void* warmUpWorker(void *pArg) {
+    WarmUpJob *pJob = (WarmUpJob*) pArg;
+    uint8_t stop = 0;
+    size_t i = 0;
+
+    for (i = 0; (i < pJob->urlCount) && (!stop); ++i) {
+        LOG("Warming up %s\n", pJob->urls[i]);
+        communication_warm_up(pJob->urls[i], pJob->keepConnections);
+
+        pthread_mutex_lock(&warmUpMutex);
+        stop = warmUpStop;
+        pthread_mutex_unlock(&warmUpMutex);
+    }
+
+    freeUrls(pJob->urls, pJob->urlCount);
+    free(pJob);
+    return NULL;
+}
+
+/*
+ * Starts warming up the AS, AP and configured API hosts in the background,
+ * if ma_communication_set_warm_up asked for it. A failure only means that
+ * the first requests pay for the setup.
+ */
+static void startWarmUp(const char *urlRequestAS, const char *urlRequestAP) {
+    WarmUpJob *pJob = NULL;
+    size_t i = 0;
+
+    pthread_mutex_lock(&warmUpMutex);
+    if ( (!warmUpEnabled) || (warmUpRunning) ) {
+        goto CLEAN_UP;
+    }
+
+    pJob = (WarmUpJob*) calloc(1, sizeof(WarmUpJob));
+    if (!pJob) {
+        goto CLEAN_UP;
+    }
+    pJob->keepConnections = warmUpKeepConnections;
+    pJob->urls = (char**) calloc(2 + warmUpApiUrlCount, sizeof(char*));
+    if (!pJob->urls) {
+        goto FAIL;
+    }
+    pJob->urls[pJob->urlCount++] = strdup(urlRequestAS);
+    pJob->urls[pJob->urlCount++] = strdup(urlRequestAP);
+    for (i = 0; i < warmUpApiUrlCount; ++i) {
+        pJob->urls[pJob->urlCount++] = strdup(warmUpApiUrls[i]);
+    }
+    for (i = 0; i < pJob->urlCount; ++i) {
+        if (!pJob->urls[i]) {
+            goto FAIL;
+        }
+    }
+
+    warmUpStop = 0;
+    if (pthread_create(&warmUpThread, NULL, warmUpWorker, pJob) != 0) {
+        LOG("Fail to create the warm up thread\n");
+        goto FAIL;
+    }
+    warmUpRunning = 1;
+    goto CLEAN_UP;
+
+FAIL:
+    freeUrls(pJob->urls, pJob->urlCount);
+    free(pJob);
+CLEAN_UP:
+    pthread_mutex_unlock(&warmUpMutex);
+}
+
+/* Waits for the warm up, which stops after the transfer in progress */
+static void stopWarmUp() {
+    uint8_t running = 0;
+
+    pthread_mutex_lock(&warmUpMutex);
+    running = warmUpRunning;
+    warmUpStop = 1;
+    pthread_mutex_unlock(&warmUpMutex);
+
+    if (running) {
+        pthread_join(warmUpThread, NULL);
+    }
+
+    pthread_mutex_lock(&warmUpMutex);
+    warmUpRunning = 0;
+    pthread_mutex_unlock(&warmUpMutex);
+}
+
+uint8_t ma_communication_set_warm_up(uint8_t enable,
+                                     uint8_t keepConnections,
+                                     const char **apiUrls,
+                                     size_t apiUrlCount) {
+    char **urls = NULL;
+    size_t i = 0;
+
+    if ( (!apiUrls) && (apiUrlCount > 0) ) {
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    if (apiUrlCount > 0) {
+        urls = (char**) calloc(apiUrlCount, sizeof(char*));
+        if (!urls) {
+            return MA_COMM_OUT_OF_MEMORY;
+        }
+        for (i = 0; i < apiUrlCount; ++i) {
+            urls[i] = (apiUrls[i]) ? strdup(apiUrls[i]) : NULL;
+            if (!urls[i]) {
+                freeUrls(urls, apiUrlCount);
+                return (apiUrls[i]) ? MA_COMM_OUT_OF_MEMORY : MA_COMM_INVALID_PARAMETER;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&warmUpMutex);
+    freeUrls(warmUpApiUrls, warmUpApiUrlCount);
+    warmUpApiUrls = urls;
+    warmUpApiUrlCount = apiUrlCount;
+    warmUpEnabled = (enable != 0);
+    warmUpKeepConnections = (keepConnections != 0);
+    pthread_mutex_unlock(&warmUpMutex);
+
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t ma_communication_set_session_cache(const char *path) {
+    char *pathCopy = NULL;
+
+    if (path) {
+        pathCopy = strdup(path);
+        if (!pathCopy) {
+            return MA_COMM_OUT_OF_MEMORY;
+        }
+    }
+
+    pthread_mutex_lock(&channelMutex);
+    free(sessionCachePath);
+    sessionCachePath = pathCopy;
+    // a running handshake or an established session is newer than the cache
+    if ( (initialized) &&
+         (!handshakeInProgress) &&
+         (!kerberos_protocol_is_mutual_authenticated(internalContext.pKerberosContext)) ) {
+        loadSessionCache();
+    }
+    pthread_mutex_unlock(&channelMutex);
+
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t ma_communication_get_handshake_stats(uint64_t *handshakes,
+                                             uint64_t *pCoalescedWaits) {
+    if ( (!handshakes) || (!pCoalescedWaits) ) {
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    pthread_mutex_lock(&channelMutex);
+    *handshakes = handshakeCount;
+    *pCoalescedWaits = coalescedWaits;
+    pthread_mutex_unlock(&channelMutex);
+
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t ma_communication_get_admission_stats(uint64_t *retried) {
+    if (!retried) {
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    kerberos_protocol_get_admission_stats(retried);
+
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t ma_communication_set_event_loop(ma_communication_socket_callback socketCallback,
+                                        ma_communication_timer_callback timerCallback,
+                                        void* userdata) {
+    if (!initialized) {
+        LOG("MA communication is not initialized\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    return async_communication_start_external(socketCallback, timerCallback, userdata);
+}
+
+uint8_t ma_communication_socket_action(int fd, int events) {
+    return async_communication_socket_action(fd, events);
+}
+
+uint8_t ma_communication_timeout() {
+    return async_communication_timeout();
+}
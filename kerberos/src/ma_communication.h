@@ -57,10 +57,84 @@ uint8_t ma_communication_init(uint8_t initCurl,
  */
 uint8_t ma_communication_deinit();
 
+/**
+ * @brief Configures the pool of keep-alive connections shared by the
+ * handshake and ma_communication_send. Requests to the same scheme, host and
+ * port reuse an idle connection instead of paying DNS, TCP and TLS setup
+ * again. It can be called at any time; the default keeps 4 handles per host
+ * for 60 seconds with TCP keepalive and TCP_NODELAY enabled.
+ * @param[in] handlesPerHost the number of idle connections kept per host,
+ *               0 disables the pool
+ * @param[in] idleTimeout the seconds an idle connection is kept
+ * @param[in] tcpKeepAlive enables TCP keepalive probes on pooled connections
+ *               (0 to false, non-zero otherwise)
+ * @param[in] tcpNoDelay disables the Nagle's algorithm
+ *               (0 to false, non-zero otherwise)
+ * @return 0 on success, otherwise non-zero
+ */
+uint8_t ma_communication_set_connection_pool(uint32_t handlesPerHost,
+                                             uint32_t idleTimeout,
+                                             uint8_t tcpKeepAlive,
+                                             uint8_t tcpNoDelay);
+
+/**
+ * @brief Multiplexes the requests over HTTP/2: the buffered sends
+ * (ma_communication_send, ma_communication_send_to and the handshake) and
+ * ma_communication_send_async share the library's worker thread and one
+ * connection per host, each request being a stream of it, instead of a
+ * connection per sending thread. The streaming sends keep their own
+ * connection. It must be called after ma_communication_init and starts the
+ * worker thread; in the event loop mode only the asynchronous requests are
+ * multiplexed. A host that does not speak HTTP/2 is talked HTTP/1.1 to.
+ * @param[in] enable 0 to go back to a connection per request, non-zero to
+ *               multiplex
+ * @param[in] priorKnowledge speaks HTTP/2 to http:// URLs right away (h2c),
+ *               https:// URLs negotiate it through ALPN anyway
+ *               (0 to false, non-zero otherwise). It needs libcurl 8.1.0 or
+ *               later built with HTTP/2, older ones fail the reused h2c
+ *               connections, and is refused otherwise
+ * @param[in] maxConcurrentStreams the streams opened at once on a connection,
+ *               the other requests open another connection, or wait for a
+ *               stream to finish once maxConnectionsPerHost are open
+ * @param[in] maxConnectionsPerHost the connections opened to a host, 0 for
+ *               no limit
+ * @return 0 on success, MA_COMM_INVALID_PARAMETER when priorKnowledge is
+ * asked of a libcurl that does not support it, otherwise non-zero
+ */
+uint8_t ma_communication_set_http2(uint8_t enable,
+                                   uint8_t priorKnowledge,
+                                   uint32_t maxConcurrentStreams,
+                                   uint32_t maxConnectionsPerHost);
+
+/**
+ * @brief Configures the admission control of the handshakes, blocking or
+ * asynchronous, so that many devices booting together do not overload the
+ * KDC. A process runs a single handshake at a time, the other senders wait
+ * for its result. It can be called at any time; the default retries 3 times
+ * from 100 ms up to 10 seconds and starts right away.
+ * @param[in] maxRetries the retries after a network error, an HTTP 5xx or a
+ *               KRB_ERR_GENERIC reply
+ * @param[in] backoffBaseMs the delay before the first retry, doubled by each
+ *               following one and randomized down to half of it
+ * @param[in] backoffMaxMs the bound of the retry delay
+ * @param[in] startDelayMaxMs the first handshake waits a random delay up to
+ *               this, 0 to start right away
+ * @return 0 on success, otherwise non-zero
+ */
+uint8_t ma_communication_set_handshake_admission(uint32_t maxRetries,
+                                                 uint32_t backoffBaseMs,
+                                                 uint32_t backoffMaxMs,
+                                                 uint32_t startDelayMaxMs);
+
 /**
  * @brief Sends a message and waits for the answer. Internally it checks if
  * the kerberos handshake is done, if not, it makes the handshake. It also
- * encrypts the request and decrypts the result.
+ * encrypts the request and decrypts the result. It can be called from
+ * several threads; when the session has to be (re)established, a single
+ * handshake runs and the other senders wait for its result. If the server
+ * answers that the session expired (KRB_AP_ERR_TKT_EXPIRED or
+ * KRB_AP_ERR_SKEW), the session is renewed and the request is encrypted
+ * again and resent once, within the same call.
  * @param[in] url the URL target to send the message
  * @param[in] httpMethod the HTTP desirable, you can use the HTTP_METHOD_ defines
  * @param[in] headers a pointer to a libcurl header structure
@@ -84,4 +158,421 @@ uint8_t ma_communication_send(const char *url,
                               unsigned char** pResponse,
                               size_t *responseSize);
 
+/**
+ * @brief As ma_communication_send, but the response is written to a buffer
+ * of the caller instead of being allocated. The response is received in a
+ * buffer reused by the calling thread and deciphered straight into response.
+ * @param[in] url the URL target to send the message
+ * @param[in] httpMethod the HTTP desirable, you can use the HTTP_METHOD_ defines
+ * @param[in] headers a pointer to a libcurl header structure
+ * @param[in] content the message's content
+ * @param[in] contentSize the message context's size
+ * @param[out] httpStatusCode the HTTP status code
+ * @param[out] response the buffer the response is written to
+ * @param[in] responseCapacity the size of the response buffer
+ * @param[out] responseSize the responses's size. On MA_COMM_BUFFER_TOO_SMALL,
+ *               the size the response needs; the request is not resent
+ * @return 0 on success, MA_COMM_BUFFER_TOO_SMALL if the response does not fit,
+ * otherwise non-zero
+ * @warning: the library take control of the header pointer, you do not
+ * need to take care of it anymore.
+ */
+uint8_t ma_communication_send_to(const char *url,
+                                 char * httpMethod,
+                                 struct curl_slist **headers,
+                                 unsigned char* content,
+                                 size_t contentSize,
+                                 uint32_t *httpStatusCode,
+                                 unsigned char* response,
+                                 size_t responseCapacity,
+                                 size_t *responseSize);
+
+/**
+ * @brief Receives the response of ma_communication_send_stream, deciphered
+ * chunk by chunk as it arrives.
+ * @param[in] data the next bytes of the response, only valid during the call
+ * @param[in] size the number of bytes in data
+ * @param[in] userdata the pointer given to ma_communication_send_stream
+ * @return 0 to go on, non-zero to stop the transfer
+ */
+typedef uint8_t (*ma_communication_sink)(const unsigned char* data,
+                                         size_t size,
+                                         void* userdata);
+
+/**
+ * @brief As ma_communication_send, but the response is deciphered as it is
+ * received and handed to the sink, so a large download takes a constant
+ * amount of memory and its decryption overlaps the transfer. The tag is
+ * checked once the whole response has been received.
+ * @param[in] url the URL target to send the message
+ * @param[in] httpMethod the HTTP desirable, you can use the HTTP_METHOD_ defines
+ * @param[in] headers a pointer to a libcurl header structure
+ * @param[in] content the message's content
+ * @param[in] contentSize the message context's size
+ * @param[out] httpStatusCode the HTTP status code
+ * @param[in] sink the function the response is written to
+ * @param[in] userdata a pointer handed to the sink
+ * @return 0 on success, otherwise non-zero, including when the sink stopped
+ * the transfer
+ * @warning: the sink sees the response before its tag is checked; whatever
+ * it received must be discarded when the function does not return 0.
+ * @warning: the library take control of the header pointer, you do not
+ * need to take care of it anymore.
+ */
+uint8_t ma_communication_send_stream(const char *url,
+                                     char * httpMethod,
+                                     struct curl_slist **headers,
+                                     unsigned char* content,
+                                     size_t contentSize,
+                                     uint32_t *httpStatusCode,
+                                     ma_communication_sink sink,
+                                     void* userdata);
+
+/**
+ * @brief As ma_communication_send_stream, writing the response to a file
+ * descriptor.
+ * @param[in] url the URL target to send the message
+ * @param[in] httpMethod the HTTP desirable, you can use the HTTP_METHOD_ defines
+ * @param[in] headers a pointer to a libcurl header structure
+ * @param[in] content the message's content
+ * @param[in] contentSize the message context's size
+ * @param[out] httpStatusCode the HTTP status code
+ * @param[in] fd the descriptor the response is written to
+ * @return 0 on success, otherwise non-zero, including when a write fails
+ * @warning: the response is written before its tag is checked; what was
+ * written must be discarded when the function does not return 0.
+ * @warning: the library take control of the header pointer, you do not
+ * need to take care of it anymore.
+ */
+uint8_t ma_communication_send_to_fd(const char *url,
+                                    char * httpMethod,
+                                    struct curl_slist **headers,
+                                    unsigned char* content,
+                                    size_t contentSize,
+                                    uint32_t *httpStatusCode,
+                                    int fd);
+
+/* contentSize of ma_communication_send_from_source when it is not known */
+#define MA_COMM_UNKNOWN_CONTENT_SIZE ((size_t) -1)
+
+/**
+ * @brief Provides the content of ma_communication_send_from_source, chunk by
+ * chunk.
+ * @param[out] buffer where the next bytes of the content are written
+ * @param[in] capacity the size of buffer
+ * @param[out] size the number of bytes written, 0 once the content is over
+ * @param[in] userdata the pointer given to ma_communication_send_from_source
+ * @return 0 on success, non-zero to abort the request
+ */
+typedef uint8_t (*ma_communication_source)(unsigned char* buffer,
+                                           size_t capacity,
+                                           size_t* size,
+                                           void* userdata);
+
+/**
+ * @brief As ma_communication_send, but the content is pulled from a source
+ * and encrypted chunk by chunk as it is uploaded, so it never has to be
+ * held in memory. A worker thread reads and encrypts the next chunk while
+ * the current one is being sent.
+ * @param[in] url the URL target to send the message
+ * @param[in] httpMethod the HTTP desirable, you can use the HTTP_METHOD_ defines
+ * @param[in] headers a pointer to a libcurl header structure
+ * @param[in] source the function the content is read from. It is called
+ *               from the library's worker thread
+ * @param[in] userdata a pointer handed to the source
+ * @param[in] contentSize the content's size, or MA_COMM_UNKNOWN_CONTENT_SIZE
+ *               to send it chunked. A known size must be exact
+ * @param[out] httpStatusCode the HTTP status code
+ * @param[out] response the response to your message
+ * @param[out] responseSize the responses's size
+ * @return 0 on success, otherwise non-zero
+ * @warning: the content is consumed, so the request is not resent when the
+ * server rejects the session: the session is renewed and the call fails.
+ * @warning: the library take control of the header pointer, you do not
+ * need to take care of it anymore.
+ */
+uint8_t ma_communication_send_from_source(const char *url,
+                                          char * httpMethod,
+                                          struct curl_slist **headers,
+                                          ma_communication_source source,
+                                          void* userdata,
+                                          size_t contentSize,
+                                          uint32_t *httpStatusCode,
+                                          unsigned char** pResponse,
+                                          size_t *responseSize);
+
+/**
+ * @brief As ma_communication_send_from_source, reading the content from a
+ * file descriptor until its end. The content of a regular file is sent from
+ * the current offset with its length, anything else is sent chunked.
+ * @param[in] url the URL target to send the message
+ * @param[in] httpMethod the HTTP desirable, you can use the HTTP_METHOD_ defines
+ * @param[in] headers a pointer to a libcurl header structure
+ * @param[in] fd the descriptor the content is read from
+ * @param[out] httpStatusCode the HTTP status code
+ * @param[out] response the response to your message
+ * @param[out] responseSize the responses's size
+ * @return 0 on success, otherwise non-zero
+ * @warning: the library take control of the header pointer, you do not
+ * need to take care of it anymore.
+ */
+uint8_t ma_communication_send_from_fd(const char *url,
+                                      char * httpMethod,
+                                      struct curl_slist **headers,
+                                      int fd,
+                                      uint32_t *httpStatusCode,
+                                      unsigned char** pResponse,
+                                      size_t *responseSize);
+
+/**
+ * @brief A request of ma_communication_send_batch, with its outcome.
+ */
+typedef struct SMaCommunicationRequest {
+    const char *url;                /* [in] the URL target to send the message */
+    char *httpMethod;               /* [in] the HTTP method, see the HTTP_METHOD_ defines */
+    struct curl_slist *headers;     /* [in] libcurl headers, taken by the library */
+    unsigned char *content;         /* [in] the message's content, left to the caller */
+    size_t contentSize;             /* [in] the message content's size */
+    uint8_t result;                 /* [out] 0 on success, otherwise non-zero */
+    uint32_t httpStatusCode;        /* [out] the HTTP status code */
+    unsigned char *response;        /* [out] the decrypted response, to be freed by
+                                       the caller; NULL on failure or if empty */
+    size_t responseSize;            /* [out] the response's size */
+} ma_communication_request;
+
+/**
+ * @brief Sends independent requests at once and waits for all the answers.
+ * The requests are sealed together under the current session, establishing
+ * it first if needed, and run concurrently by the library's worker thread,
+ * over its pooled connections or, with ma_communication_set_http2, as
+ * streams of a multiplexed one. When called from a completion callback or
+ * in the event loop mode, they are sent one after the other instead. The
+ * requests whose session the server rejects are sent once more, under the
+ * renewed session, as ma_communication_send does.
+ * @param[in,out] requests the requests, each one getting its own result,
+ *               HTTP status code and response
+ * @param[in] count the number of requests
+ * @return 0 if every request succeeded, otherwise the result of the first
+ * one that failed
+ * @warning: the library take control of the headers of every request, you
+ * do not need to take care of them anymore.
+ */
+uint8_t ma_communication_send_batch(ma_communication_request *requests, size_t count);
+
+/**
+ * @brief Sets how ma_communication_send_record gathers messages. A batch is
+ * sent once it holds maxBatchSize bytes of content, or maxDelayMs after its
+ * first message, whichever comes first. The defaults are 5 ms and 16 KiB.
+ * @param[in] maxDelayMs the longest a message waits for others, 0 to send
+ *               only the messages that arrive while a batch is sent
+ * @param[in] maxBatchSize the content size that closes a batch, not 0
+ * @return 0 on success, otherwise non-zero
+ */
+uint8_t ma_communication_set_record_batching(uint32_t maxDelayMs, size_t maxBatchSize);
+
+/**
+ * @brief Sends a small message as one record of a batch, to share the cost of
+ * an HTTP request with the other messages sent to the same URL around the
+ * same time, see ma_communication_set_record_batching. The batch is POSTed
+ * as a body of records, each one a 4 byte big endian length followed by the
+ * message as ma_communication_send encrypts it, with the index of the record
+ * in the batch, 4 bytes big endian, as additional authenticated data. Empty
+ * messages are sealed too, their record holding the IV and the tag. The
+ * server answers with one record per message, in the same order and under
+ * the same format, and each sender gets its own one back. The session is
+ * handled as ma_communication_send does.
+ * @param[in] url the URL of the record endpoint
+ * @param[in] content the message's content, left to the caller
+ * @param[in] contentSize the message content's size
+ * @param[out] httpStatusCode the HTTP status code of the batch
+ * @param[out] response the decrypted response record, to be freed by the
+ *               caller; NULL on failure or if empty
+ * @param[out] responseSize the responses's size
+ * @return 0 on success, otherwise non-zero
+ * @warning: the call blocks until the batch is answered, so it must not be
+ * made from a completion callback or in the event loop mode.
+ */
+uint8_t ma_communication_send_record(const char *url,
+                                     unsigned char* content,
+                                     size_t contentSize,
+                                     uint32_t *httpStatusCode,
+                                     unsigned char** pResponse,
+                                     size_t *responseSize);
+
+/**
+ * @brief Callback of ma_communication_send_async. It runs on the library's
+ * worker thread, so it must not block for long.
+ * @param[in] result 0 on success, otherwise non-zero
+ * @param[in] httpStatusCode the HTTP status code
+ * @param[in] response the decrypted response, NULL on failure. The callback
+ *               owns it and must free it
+ * @param[in] responseSize the response's size
+ * @param[in] userdata the pointer given to ma_communication_send_async
+ */
+typedef void (*ma_communication_callback)(uint8_t result,
+                                          uint32_t httpStatusCode,
+                                          unsigned char* response,
+                                          size_t responseSize,
+                                          void* userdata);
+
+/**
+ * @brief Sends a message without waiting for the answer. The request is
+ * driven, along with every other asynchronous request, by a worker thread
+ * owned by the library (or by your event loop, see
+ * ma_communication_set_event_loop), which decrypts the response and calls the
+ * callback. If the kerberos handshake is not done, the request waits for it
+ * and the handshake itself runs asynchronously, so this function never
+ * blocks on the network.
+ * @param[in] url the URL target to send the message
+ * @param[in] httpMethod the HTTP desirable, you can use the HTTP_METHOD_ defines
+ * @param[in] headers a pointer to a libcurl header structure
+ * @param[in] content the message's content
+ * @param[in] contentSize the message context's size
+ * @param[in] callback the function called when the request completes
+ * @param[in] userdata a pointer handed to the callback
+ * @return 0 if the request was queued, otherwise non-zero. The callback is
+ * only called when the request was queued.
+ * @warning: the content can be released as soon as the function returns.
+ * @warning: the library take control of the header pointer, you do not
+ * need to take care of it anymore.
+ * @warning: requests still in flight on ma_communication_deinit complete
+ * with an error.
+ */
+uint8_t ma_communication_send_async(const char *url,
+                                    char * httpMethod,
+                                    struct curl_slist **headers,
+                                    unsigned char* content,
+                                    size_t contentSize,
+                                    ma_communication_callback callback,
+                                    void* userdata);
+
+/**
+ * @brief Event loop callback telling which events to watch on a socket.
+ * @param[in] fd the socket
+ * @param[in] what CURL_POLL_IN, CURL_POLL_OUT, CURL_POLL_INOUT or
+ *               CURL_POLL_REMOVE to stop watching it
+ * @param[in] userdata the pointer given to ma_communication_set_event_loop
+ * @return 0
+ */
+typedef int (*ma_communication_socket_callback)(int fd, int what, void* userdata);
+
+/**
+ * @brief Event loop callback setting the single timer of the library.
+ * @param[in] timeoutMs the time until ma_communication_timeout must be called,
+ *               0 to call it as soon as possible, -1 to delete the timer
+ * @param[in] userdata the pointer given to ma_communication_set_event_loop
+ * @return 0
+ */
+typedef int (*ma_communication_timer_callback)(long timeoutMs, void* userdata);
+
+/**
+ * @brief Drives the asynchronous requests, handshake included, from your own
+ * event loop (epoll, libuv, ...) instead of the library's worker thread. It
+ * must be called after ma_communication_init and before the first
+ * ma_communication_send_async.
+ * @param[in] socketCallback called to watch, change or stop watching a socket
+ * @param[in] timerCallback called to set or delete the timer
+ * @param[in] userdata a pointer handed to the callbacks
+ * @return 0 on success, otherwise non-zero
+ * @warning: in this mode ma_communication_send_async and the driver functions
+ * must be called on the loop thread, and the completion callbacks run inside
+ * ma_communication_socket_action and ma_communication_timeout. The blocking
+ * ma_communication_send must not be used on the loop thread.
+ */
+uint8_t ma_communication_set_event_loop(ma_communication_socket_callback socketCallback,
+                                        ma_communication_timer_callback timerCallback,
+                                        void* userdata);
+
+/**
+ * @brief Reports that a socket given to the socket callback is ready.
+ * @param[in] fd the socket
+ * @param[in] events a combination of CURL_CSELECT_IN, CURL_CSELECT_OUT and
+ *               CURL_CSELECT_ERR
+ * @return 0 on success, otherwise non-zero
+ */
+uint8_t ma_communication_socket_action(int fd, int events);
+
+/**
+ * @brief Reports that the timer set by the timer callback expired.
+ * @return 0 on success, otherwise non-zero
+ */
+uint8_t ma_communication_timeout();
+
+/**
+ * @brief Starts a background thread that runs the kerberos handshake right
+ * away, unless a session was restored from the session cache, and then
+ * renews the session before it expires, so ma_communication_send
+ * does not pay the handshake round trips after init or on expiry. The new
+ * session replaces the current one atomically: sends never wait for a
+ * renewal, and requests in flight finish with the keys they started with.
+ * The thread is stopped by ma_communication_deinit.
+ * @param[in] renewAtPercent the percentage of the session lifetime after which
+ *               it is renewed, from 1 to 99
+ * @param[in] jitterPercent spreads each renewal time randomly by up to this
+ *               percentage of it, so that many instances started together do
+ *               not renew together, from 0 to 99
+ * @return 0 on success, otherwise non-zero
+ * @warning: with ma_communication_set_event_loop, asynchronous requests
+ * waiting for a session would be started from the renewal thread, so submit
+ * them only once the first handshake completed (see
+ * ma_communication_get_handshake_stats).
+ */
+uint8_t ma_communication_start_session_renewal(uint8_t renewAtPercent,
+                                               uint8_t jitterPercent);
+
+/**
+ * @brief Reads the handshake counters since ma_communication_init.
+ * @param[out] handshakes the number of handshakes started
+ * @param[out] coalescedWaits the number of sends, synchronous or not, that
+ *               found a handshake running and waited for it instead of
+ *               starting their own
+ * @return 0 on success, otherwise non-zero
+ */
+uint8_t ma_communication_get_handshake_stats(uint64_t *handshakes,
+                                             uint64_t *coalescedWaits);
+
+/**
+ * @brief Reads the admission control counters since the process started.
+ * @param[out] retried the number of handshake retries after a transient
+ *               failure
+ * @return 0 on success, otherwise non-zero
+ */
+uint8_t ma_communication_get_admission_stats(uint64_t *retried);
+
+/**
+ * @brief Warms up the hosts of urlRequestAS, urlRequestAP and apiUrls when
+ * ma_communication_init is called next, on a background thread, so that
+ * the handshake and the first requests do not pay for DNS and TLS. Every
+ * handle of the library shares its DNS cache and TLS sessions, so what the
+ * warm up gets is reused by all the sending threads, as are the connections
+ * it keeps, through the connection pool.
+ * @param[in] enable 0 to not warm up, non-zero otherwise
+ * @param[in] keepConnections 0 to only resolve the hosts and negotiate TLS,
+ *               non-zero to also send a HEAD request to each URL and keep
+ *               its connection open for the following requests
+ * @param[in] apiUrls the URLs of the API the application will send to, can
+ *               be NULL if apiUrlCount is 0. They are copied and kept until
+ *               the next call.
+ * @param[in] apiUrlCount the number of apiUrls
+ * @return 0 on success, otherwise non-zero
+ */
+uint8_t ma_communication_set_warm_up(uint8_t enable,
+                                     uint8_t keepConnections,
+                                     const char **apiUrls,
+                                     size_t apiUrlCount);
+
+/**
+ * @brief Keeps the established session in a file, so that a restarted process
+ * reuses it instead of running the kerberos handshake again. The session is
+ * written after every handshake, sealed with a key derived from the shared
+ * key, and read back by ma_communication_init, or right away if already
+ * initialized. A missing, corrupted or expired cache only means that the
+ * next send runs the handshake.
+ * @param[in] path the cache file, created with owner only permissions, or
+ *               NULL to stop using it. It is kept until
+ *               ma_communication_deinit.
+ * @return 0 on success, otherwise non-zero
+ */
+uint8_t ma_communication_set_session_cache(const char *path);
+
 #endif /* KERBEROS_SRC_MA_COMMUNICATION_H_ */
@@ -0,0 +1,757 @@
+#include "async-communication.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "communication.h"
+#include "logger/logger.h"
+#include "ma_comm_error_codes.h"
+
+#define WORKER_POLL_TIMEOUT 1000
+
+/* Transfers of a blocking sender, prepared by the caller who waits for them */
+typedef struct SBlockingTransfer {
+    size_t pending;
+    pthread_cond_t finished;
+} BlockingTransfer;
+
+typedef struct SAsyncRequest {
+    char *url;
+    char *method;
+    struct curl_slist *headers;
+    uint8_t *body;
+    size_t bodyLength;
+    BufferStruct buffer;
+    CURL *pCurlHandler;
+    AsyncCompletion completion;
+    void *pUserData;
+    // set for a blocking transfer, whose handle belongs to the caller
+    BlockingTransfer *pBlocking;
+    CURLcode code;
+    struct SAsyncRequest *pPrevious;
+    struct SAsyncRequest *pNext;
+} AsyncRequest;
+
+typedef struct SScheduledTask {
+    uint64_t dueMs;
+    AsyncTask task;
+    void *pUserData;
+    struct SScheduledTask *pNext;
+} ScheduledTask;
+
+typedef struct SAsyncWorker {
+    pthread_mutex_t mutex;
+    pthread_t thread;
+    CURLM *pMultiHandler;
+    uint8_t running;
+    uint8_t stopping;
+    // driven by the application's event loop instead of the worker thread
+    uint8_t externalLoop;
+    AsyncSocketCallback socketCallback;
+    AsyncTimerCallback timerCallback;
+    void *pLoopUserData;
+    // HTTP/2 multiplexing, applied by the worker when configDirty is set
+    MultiplexConfig multiplex;
+    uint8_t configDirty;
+    // submitted, not yet added to the multi handle (guarded by mutex)
+    AsyncRequest *pPending;
+    AsyncRequest *pPendingTail;
+    // added to the multi handle (owned by the worker thread)
+    AsyncRequest *pActive;
+    // scheduled tasks, the earliest first (guarded by mutex)
+    ScheduledTask *pTasks;
+    // when curl's own timer expires in the event loop mode, 0 for never
+    uint64_t curlTimerDueMs;
+} AsyncWorker;
+
+static AsyncWorker worker = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ * Applies the multiplexing limits to the multi handle. Runs on the thread
+ * driving it, or before it is driven.
+ */
+static void applyMultiplexConfig(const MultiplexConfig *pConfig) {
+    curl_multi_setopt(worker.pMultiHandler,
+                      CURLMOPT_PIPELINING,
+                      pConfig->enabled ? (long) CURLPIPE_MULTIPLEX : (long) CURLPIPE_NOTHING);
+    curl_multi_setopt(worker.pMultiHandler,
+                      CURLMOPT_MAX_HOST_CONNECTIONS,
+                      pConfig->enabled ? (long) pConfig->maxHostConnections : 0L);
+    curl_multi_setopt(worker.pMultiHandler,
+                      CURLMOPT_MAX_CONCURRENT_STREAMS,
+                      (long) pConfig->maxConcurrentStreams);
+}
+
+/*
+ * Asks for HTTP/2 on a handle about to join the multi handle, and makes it
+ * wait for a stream on an existing connection rather than open a new one.
+ */
+static void applyMultiplexOptions(CURL *pCurlHandler, const MultiplexConfig *pConfig) {
+    if (!pConfig->enabled) {
+        return;
+    }
+    curl_easy_setopt(pCurlHandler,
+                     CURLOPT_HTTP_VERSION,
+                     pConfig->priorKnowledge ?
+                         (long) CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE :
+                         (long) CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(pCurlHandler, CURLOPT_PIPEWAIT, 1L);
+}
+
+/*
+ * Ends a blocking transfer, and wakes up its caller once all of them are
+ * over. The caller may free the request as soon as the mutex is released.
+ */
+static void finishBlocking(AsyncRequest *pRequest, CURLcode code) {
+    BlockingTransfer *pBlocking = pRequest->pBlocking;
+
+    pthread_mutex_lock(&worker.mutex);
+    pRequest->code = code;
+    pBlocking->pending--;
+    if (pBlocking->pending == 0) {
+        pthread_cond_broadcast(&pBlocking->finished);
+    }
+    pthread_mutex_unlock(&worker.mutex);
+}
+
+static void freeRequest(AsyncRequest *pRequest) {
+    if (pRequest->headers) {
+        curl_slist_free_all(pRequest->headers);
+    }
+    free(pRequest->buffer.pData);
+    free(pRequest->body);
+    free(pRequest->method);
+    free(pRequest->url);
+    free(pRequest);
+}
+
+/*
+ * Hands the response to the completion and frees the request. Runs on the
+ * worker thread, except for requests drained by async_communication_stop.
+ */
+static void completeRequest(AsyncRequest *pRequest, uint8_t result, uint32_t httpStatusCode) {
+    uint8_t *pResponse = NULL;
+    size_t responseSize = 0;
+
+    // the blocking transfer belongs to its caller
+    if (pRequest->pBlocking) {
+        finishBlocking(pRequest, (result == MA_COMM_SUCCESS) ? CURLE_OK : CURLE_ABORTED_BY_CALLBACK);
+        return;
+    }
+
+    if (result == MA_COMM_SUCCESS) {
+        pResponse = (uint8_t*) pRequest->buffer.pData;
+        responseSize = pRequest->buffer.size;
+        pRequest->buffer.pData = NULL;
+    }
+
+    pRequest->completion(result, httpStatusCode, pResponse, responseSize, pRequest->pUserData);
+    freeRequest(pRequest);
+}
+
+static void unlinkActive(AsyncRequest *pRequest) {
+    if (pRequest->pPrevious) {
+        pRequest->pPrevious->pNext = pRequest->pNext;
+    } else {
+        worker.pActive = pRequest->pNext;
+    }
+    if (pRequest->pNext) {
+        pRequest->pNext->pPrevious = pRequest->pPrevious;
+    }
+    pRequest->pPrevious = NULL;
+    pRequest->pNext = NULL;
+}
+
+static void startRequest(AsyncRequest *pRequest, const MultiplexConfig *pMultiplex) {
+    // a blocking transfer comes with its handle already prepared
+    if (!pRequest->pBlocking) {
+        pRequest->pCurlHandler = communication_acquire_handle(pRequest->url);
+        if (!pRequest->pCurlHandler) {
+            LOG("Fail to create the curl handler\n");
+            completeRequest(pRequest, MA_COMM_INVALID_STATE, 0);
+            return;
+        }
+
+        communication_prepare_request(pRequest->pCurlHandler,
+                                      pRequest->url,
+                                      pRequest->method,
+                                      pRequest->headers,
+                                      pRequest->body,
+                                      pRequest->bodyLength,
+                                      &pRequest->buffer);
+    }
+    applyMultiplexOptions(pRequest->pCurlHandler, pMultiplex);
+    curl_easy_setopt(pRequest->pCurlHandler, CURLOPT_PRIVATE, pRequest);
+
+    if (curl_multi_add_handle(worker.pMultiHandler, pRequest->pCurlHandler) != CURLM_OK) {
+        LOG("Fail to add the request to the multi handler\n");
+        if (!pRequest->pBlocking) {
+            curl_easy_cleanup(pRequest->pCurlHandler);
+        }
+        completeRequest(pRequest, MA_COMM_INVALID_STATE, 0);
+        return;
+    }
+
+    pRequest->pNext = worker.pActive;
+    if (worker.pActive) {
+        worker.pActive->pPrevious = pRequest;
+    }
+    worker.pActive = pRequest;
+}
+
+static void finishRequest(AsyncRequest *pRequest, CURLcode code) {
+    uint32_t httpStatusCode = 0;
+    uint8_t result = MA_COMM_SUCCESS;
+
+    unlinkActive(pRequest);
+    curl_multi_remove_handle(worker.pMultiHandler, pRequest->pCurlHandler);
+
+    // the caller reads the status and gives the handle back itself
+    if (pRequest->pBlocking) {
+        finishBlocking(pRequest, code);
+        return;
+    }
+
+    if (code == CURLE_OK) {
+        long responseCode = 0;
+        curl_easy_getinfo(pRequest->pCurlHandler, CURLINFO_RESPONSE_CODE, &responseCode);
+        httpStatusCode = (uint32_t) responseCode;
+        LOG("http status code: %u\n", httpStatusCode);
+        communication_release_handle(pRequest->url, pRequest->pCurlHandler);
+    } else {
+        LOG("send message failed: %s\n", curl_easy_strerror(code));
+        curl_easy_cleanup(pRequest->pCurlHandler);
+        result = MA_COMM_INVALID_STATE;
+    }
+    pRequest->pCurlHandler = NULL;
+
+    completeRequest(pRequest, result, httpStatusCode);
+}
+
+static void processCompletions() {
+    CURLMsg *pMessage = NULL;
+    int messagesLeft = 0;
+
+    while ((pMessage = curl_multi_info_read(worker.pMultiHandler, &messagesLeft))) {
+        if (pMessage->msg == CURLMSG_DONE) {
+            AsyncRequest *pRequest = NULL;
+            CURL *pCurlHandler = pMessage->easy_handle;
+            CURLcode code = pMessage->data.result;
+            curl_easy_getinfo(pCurlHandler, CURLINFO_PRIVATE, (char**) &pRequest);
+            finishRequest(pRequest, code);
+        }
+    }
+}
+
+static void abortActiveRequests() {
+    while (worker.pActive) {
+        AsyncRequest *pRequest = worker.pActive;
+        unlinkActive(pRequest);
+        curl_multi_remove_handle(worker.pMultiHandler, pRequest->pCurlHandler);
+        if (!pRequest->pBlocking) {
+            curl_easy_cleanup(pRequest->pCurlHandler);
+        }
+        completeRequest(pRequest, MA_COMM_INVALID_STATE, 0);
+    }
+}
+
+static uint64_t monotonicMs() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * Detaches the tasks due at nowMs, or all of them when all is set. Must be
+ * called with worker.mutex held.
+ */
+static ScheduledTask* takeTasks(uint64_t nowMs, uint8_t all) {
+    ScheduledTask *pDue = worker.pTasks;
+    ScheduledTask *pLast = NULL;
+
+    while ( (worker.pTasks) && ( (all) || (worker.pTasks->dueMs <= nowMs) ) ) {
+        pLast = worker.pTasks;
+        worker.pTasks = worker.pTasks->pNext;
+    }
+    if (!pLast) {
+        return NULL;
+    }
+    pLast->pNext = NULL;
+    return pDue;
+}
+
+static void runTasks(ScheduledTask *pTasks, uint8_t result) {
+    while (pTasks) {
+        ScheduledTask *pNext = pTasks->pNext;
+        pTasks->task(result, pTasks->pUserData);
+        free(pTasks);
+        pTasks = pNext;
+    }
+}
+
+static void runAllTasks(uint8_t result) {
+    ScheduledTask *pTasks = NULL;
+
+    pthread_mutex_lock(&worker.mutex);
+    pTasks = takeTasks(0, 1);
+    pthread_mutex_unlock(&worker.mutex);
+    runTasks(pTasks, result);
+}
+
+/* How long the worker may wait for network activity before a task is due */
+static int pollTimeout() {
+    uint64_t nowMs = monotonicMs();
+    int timeout = WORKER_POLL_TIMEOUT;
+
+    pthread_mutex_lock(&worker.mutex);
+    if ( (worker.pTasks) && (worker.pTasks->dueMs < nowMs + WORKER_POLL_TIMEOUT) ) {
+        timeout = (worker.pTasks->dueMs > nowMs) ? (int) (worker.pTasks->dueMs - nowMs) : 0;
+    }
+    pthread_mutex_unlock(&worker.mutex);
+    return timeout;
+}
+
+static void* workerLoop(void *pArg) {
+    int runningHandles = 0;
+    (void) pArg;
+
+    for (;;) {
+        AsyncRequest *pPending = NULL;
+        ScheduledTask *pDue = NULL;
+        uint8_t stopping = 0;
+        uint8_t configDirty = 0;
+        MultiplexConfig multiplex;
+
+        pthread_mutex_lock(&worker.mutex);
+        pPending = worker.pPending;
+        worker.pPending = NULL;
+        worker.pPendingTail = NULL;
+        stopping = worker.stopping;
+        if (!stopping) {
+            pDue = takeTasks(monotonicMs(), 0);
+        }
+        multiplex = worker.multiplex;
+        configDirty = worker.configDirty;
+        worker.configDirty = 0;
+        pthread_mutex_unlock(&worker.mutex);
+
+        if (configDirty) {
+            applyMultiplexConfig(&multiplex);
+        }
+
+        while (pPending) {
+            AsyncRequest *pNext = pPending->pNext;
+            pPending->pNext = NULL;
+            if (stopping) {
+                completeRequest(pPending, MA_COMM_INVALID_STATE, 0);
+            } else {
+                startRequest(pPending, &multiplex);
+            }
+            pPending = pNext;
+        }
+
+        if (stopping) {
+            break;
+        }
+
+        // what they submit is started on the next turn
+        runTasks(pDue, MA_COMM_SUCCESS);
+
+        curl_multi_perform(worker.pMultiHandler, &runningHandles);
+        processCompletions();
+
+        curl_multi_poll(worker.pMultiHandler, NULL, 0, pollTimeout(), NULL);
+    }
+
+    // abort whatever is still in flight or waiting
+    abortActiveRequests();
+    runAllTasks(MA_COMM_INVALID_STATE);
+
+    return NULL;
+}
+
+static int forwardSocket(CURL *pCurlHandler, curl_socket_t fd, int what, void *pUserPtr, void *pSocketPtr) {
+    (void) pCurlHandler;
+    (void) pUserPtr;
+    (void) pSocketPtr;
+    return worker.socketCallback((int) fd, what, worker.pLoopUserData);
+}
+
+/*
+ * Gives the loop the earliest of curl's timer and the scheduled tasks. Runs
+ * on the loop thread.
+ */
+static int armLoopTimer() {
+    uint64_t nowMs = monotonicMs();
+    uint64_t dueMs = worker.curlTimerDueMs;
+
+    pthread_mutex_lock(&worker.mutex);
+    if ( (worker.pTasks) && ( (dueMs == 0) || (worker.pTasks->dueMs < dueMs) ) ) {
+        dueMs = worker.pTasks->dueMs;
+    }
+    pthread_mutex_unlock(&worker.mutex);
+
+    if (dueMs == 0) {
+        return worker.timerCallback(-1, worker.pLoopUserData);
+    }
+    return worker.timerCallback((dueMs > nowMs) ? (long) (dueMs - nowMs) : 0L, worker.pLoopUserData);
+}
+
+static void setCurlTimer(long timeoutMs) {
+    worker.curlTimerDueMs = (timeoutMs < 0) ? 0 : monotonicMs() + (uint64_t) timeoutMs;
+}
+
+static int forwardTimer(CURLM *pMultiHandler, long timeoutMs, void *pUserPtr) {
+    (void) pMultiHandler;
+    (void) pUserPtr;
+    setCurlTimer(timeoutMs);
+    return armLoopTimer();
+}
+
+uint8_t async_communication_start_external(AsyncSocketCallback socketCallback,
+                                           AsyncTimerCallback timerCallback,
+                                           void* pUserData) {
+    uint8_t result = MA_COMM_SUCCESS;
+
+    if ( (!socketCallback) || (!timerCallback) ) {
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    pthread_mutex_lock(&worker.mutex);
+    if (worker.running) {
+        LOG("The asynchronous communication is already running\n");
+        result = MA_COMM_INVALID_STATE;
+        goto CLEAN_UP;
+    }
+
+    worker.pMultiHandler = curl_multi_init();
+    if (!worker.pMultiHandler) {
+        result = MA_COMM_INVALID_STATE;
+        goto CLEAN_UP;
+    }
+
+    applyMultiplexConfig(&worker.multiplex);
+    worker.configDirty = 0;
+    worker.socketCallback = socketCallback;
+    worker.timerCallback = timerCallback;
+    worker.pLoopUserData = pUserData;
+    curl_multi_setopt(worker.pMultiHandler, CURLMOPT_SOCKETFUNCTION, forwardSocket);
+    curl_multi_setopt(worker.pMultiHandler, CURLMOPT_TIMERFUNCTION, forwardTimer);
+    worker.curlTimerDueMs = 0;
+    worker.stopping = 0;
+    worker.externalLoop = 1;
+    worker.running = 1;
+
+CLEAN_UP:
+    pthread_mutex_unlock(&worker.mutex);
+    return result;
+}
+
+uint8_t async_communication_socket_action(int fd, int events) {
+    int runningHandles = 0;
+
+    if ( (!worker.running) || (!worker.externalLoop) ) {
+        return MA_COMM_INVALID_STATE;
+    }
+
+    curl_multi_socket_action(worker.pMultiHandler, (curl_socket_t) fd, events, &runningHandles);
+    processCompletions();
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t async_communication_timeout() {
+    ScheduledTask *pDue = NULL;
+    long timeoutMs = -1;
+    uint8_t result = 0;
+
+    if ( (!worker.running) || (!worker.externalLoop) ) {
+        return MA_COMM_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&worker.mutex);
+    pDue = takeTasks(monotonicMs(), 0);
+    pthread_mutex_unlock(&worker.mutex);
+    runTasks(pDue, MA_COMM_SUCCESS);
+
+    result = async_communication_socket_action(CURL_SOCKET_TIMEOUT, 0);
+
+    // curl only reports changes of its timer, which the tasks may have hidden
+    curl_multi_timeout(worker.pMultiHandler, &timeoutMs);
+    setCurlTimer(timeoutMs);
+    armLoopTimer();
+    return result;
+}
+
+uint8_t async_communication_start() {
+    uint8_t result = MA_COMM_SUCCESS;
+
+    pthread_mutex_lock(&worker.mutex);
+    if (worker.running) {
+        goto CLEAN_UP;
+    }
+
+    worker.pMultiHandler = curl_multi_init();
+    if (!worker.pMultiHandler) {
+        result = MA_COMM_INVALID_STATE;
+        goto CLEAN_UP;
+    }
+
+    applyMultiplexConfig(&worker.multiplex);
+    worker.configDirty = 0;
+    worker.stopping = 0;
+    if (pthread_create(&worker.thread, NULL, workerLoop, NULL) != 0) {
+        LOG("Fail to create the communication worker\n");
+        curl_multi_cleanup(worker.pMultiHandler);
+        worker.pMultiHandler = NULL;
+        result = MA_COMM_INVALID_STATE;
+        goto CLEAN_UP;
+    }
+    worker.running = 1;
+
+CLEAN_UP:
+    pthread_mutex_unlock(&worker.mutex);
+    return result;
+}
+
+void async_communication_stop() {
+    pthread_mutex_lock(&worker.mutex);
+    if (!worker.running) {
+        pthread_mutex_unlock(&worker.mutex);
+        return;
+    }
+    worker.stopping = 1;
+    if (worker.externalLoop) {
+        pthread_mutex_unlock(&worker.mutex);
+
+        abortActiveRequests();
+        runAllTasks(MA_COMM_INVALID_STATE);
+
+        pthread_mutex_lock(&worker.mutex);
+        curl_multi_cleanup(worker.pMultiHandler);
+        worker.pMultiHandler = NULL;
+        worker.externalLoop = 0;
+        worker.running = 0;
+        worker.stopping = 0;
+        pthread_mutex_unlock(&worker.mutex);
+        return;
+    }
+    curl_multi_wakeup(worker.pMultiHandler);
+    pthread_mutex_unlock(&worker.mutex);
+
+    pthread_join(worker.thread, NULL);
+
+    pthread_mutex_lock(&worker.mutex);
+    curl_multi_cleanup(worker.pMultiHandler);
+    worker.pMultiHandler = NULL;
+    worker.running = 0;
+    worker.stopping = 0;
+    pthread_mutex_unlock(&worker.mutex);
+}
+
+uint8_t async_communication_submit(const char* url,
+                                   const char* method,
+                                   struct curl_slist* headers,
+                                   uint8_t* body,
+                                   size_t bodyLength,
+                                   AsyncCompletion completion,
+                                   void* pUserData) {
+    AsyncRequest *pRequest = NULL;
+
+    pRequest = (AsyncRequest*) calloc(1, sizeof(AsyncRequest));
+    if (!pRequest) {
+        if (headers) {
+            curl_slist_free_all(headers);
+        }
+        free(body);
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+
+    pRequest->headers = headers;
+    pRequest->body = body;
+    pRequest->bodyLength = bodyLength;
+    pRequest->completion = completion;
+    pRequest->pUserData = pUserData;
+    pRequest->url = strdup(url);
+    pRequest->method = strdup(method);
+    pRequest->buffer.pData = (char*) malloc(INITIAL_BUFFER_SIZE);
+    pRequest->buffer.capacity = INITIAL_BUFFER_SIZE;
+    if ( (!pRequest->url) || (!pRequest->method) || (!pRequest->buffer.pData) ) {
+        freeRequest(pRequest);
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+
+    pthread_mutex_lock(&worker.mutex);
+    if ( (!worker.running) || (worker.stopping) ) {
+        pthread_mutex_unlock(&worker.mutex);
+        freeRequest(pRequest);
+        LOG("The communication worker is not running\n");
+        return MA_COMM_INVALID_STATE;
+    }
+    if (worker.externalLoop) {
+        MultiplexConfig multiplex = worker.multiplex;
+        // we are on the loop thread, curl reports the new sockets and
+        // timeout through the callbacks
+        pthread_mutex_unlock(&worker.mutex);
+        startRequest(pRequest, &multiplex);
+        return MA_COMM_SUCCESS;
+    }
+    if (worker.pPendingTail) {
+        worker.pPendingTail->pNext = pRequest;
+    } else {
+        worker.pPending = pRequest;
+    }
+    worker.pPendingTail = pRequest;
+    curl_multi_wakeup(worker.pMultiHandler);
+    pthread_mutex_unlock(&worker.mutex);
+
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t async_communication_schedule(uint32_t delayMs, AsyncTask task, void* pUserData) {
+    ScheduledTask *pTask = NULL;
+    ScheduledTask **ppNext = NULL;
+    uint8_t externalLoop = 0;
+
+    if (!task) {
+        return MA_COMM_INVALID_PARAMETER;
+    }
+    pTask = (ScheduledTask*) calloc(1, sizeof(ScheduledTask));
+    if (!pTask) {
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+    pTask->dueMs = monotonicMs() + delayMs;
+    pTask->task = task;
+    pTask->pUserData = pUserData;
+
+    pthread_mutex_lock(&worker.mutex);
+    if ( (!worker.running) || (worker.stopping) ) {
+        pthread_mutex_unlock(&worker.mutex);
+        free(pTask);
+        LOG("The communication worker is not running\n");
+        return MA_COMM_INVALID_STATE;
+    }
+    // after the tasks due at the same time, so they run in order
+    ppNext = &worker.pTasks;
+    while ( (*ppNext) && ((*ppNext)->dueMs <= pTask->dueMs) ) {
+        ppNext = &(*ppNext)->pNext;
+    }
+    pTask->pNext = *ppNext;
+    *ppNext = pTask;
+    externalLoop = worker.externalLoop;
+    if (!externalLoop) {
+        curl_multi_wakeup(worker.pMultiHandler);
+    }
+    pthread_mutex_unlock(&worker.mutex);
+
+    // we are on the loop thread in the external mode
+    if (externalLoop) {
+        armLoopTimer();
+    }
+    return MA_COMM_SUCCESS;
+}
+
+void async_communication_configure(const MultiplexConfig* pConfig) {
+    uint8_t applyNow = 0;
+
+    if (!pConfig) {
+        return;
+    }
+
+    pthread_mutex_lock(&worker.mutex);
+    worker.multiplex = *pConfig;
+    // the loop thread is the caller in the external mode
+    applyNow = (worker.running) && (worker.externalLoop);
+    worker.configDirty = (worker.running) && (!applyNow);
+    if (worker.configDirty) {
+        curl_multi_wakeup(worker.pMultiHandler);
+    }
+    pthread_mutex_unlock(&worker.mutex);
+
+    if (applyNow) {
+        applyMultiplexConfig(pConfig);
+    }
+}
+
+/*
+ * Queues the prepared requests on the worker and waits for all of them.
+ * multiplexedOnly refuses them when multiplexing is off.
+ */
+static uint8_t performBlocking(AsyncRequest *pRequests, size_t count, uint8_t multiplexedOnly) {
+    BlockingTransfer blocking;
+    size_t i = 0;
+
+    blocking.pending = count;
+    pthread_cond_init(&blocking.finished, NULL);
+
+    pthread_mutex_lock(&worker.mutex);
+    // a completion sending again would wait for its own thread
+    if ( ( (multiplexedOnly) && (!worker.multiplex.enabled) ) ||
+         (!worker.running) ||
+         (worker.stopping) ||
+         (worker.externalLoop) ||
+         (pthread_equal(worker.thread, pthread_self())) ) {
+        pthread_mutex_unlock(&worker.mutex);
+        pthread_cond_destroy(&blocking.finished);
+        return MA_COMM_INVALID_STATE;
+    }
+    for (i = 0; i < count; ++i) {
+        pRequests[i].pBlocking = &blocking;
+        if (worker.pPendingTail) {
+            worker.pPendingTail->pNext = &pRequests[i];
+        } else {
+            worker.pPending = &pRequests[i];
+        }
+        worker.pPendingTail = &pRequests[i];
+    }
+    curl_multi_wakeup(worker.pMultiHandler);
+
+    while (blocking.pending > 0) {
+        pthread_cond_wait(&blocking.finished, &worker.mutex);
+    }
+    pthread_mutex_unlock(&worker.mutex);
+    pthread_cond_destroy(&blocking.finished);
+
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t async_communication_perform_multiplexed(CURL* pCurlHandler, CURLcode* pCode) {
+    AsyncRequest request;
+    uint8_t result = 0;
+
+    memset(&request, 0, sizeof(AsyncRequest));
+    request.pCurlHandler = pCurlHandler;
+
+    result = performBlocking(&request, 1, 1);
+    if (result == MA_COMM_SUCCESS) {
+        *pCode = request.code;
+    }
+    return result;
+}
+
+uint8_t async_communication_perform_all(CURL** pCurlHandlers, CURLcode* pCodes, size_t count) {
+    AsyncRequest *pRequests = NULL;
+    uint8_t result = 0;
+    size_t i = 0;
+
+    if (count == 0) {
+        return MA_COMM_SUCCESS;
+    }
+    pRequests = (AsyncRequest*) calloc(count, sizeof(AsyncRequest));
+    if (!pRequests) {
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < count; ++i) {
+        pRequests[i].pCurlHandler = pCurlHandlers[i];
+    }
+
+    result = performBlocking(pRequests, count, 0);
+    if (result == MA_COMM_SUCCESS) {
+        for (i = 0; i < count; ++i) {
+            pCodes[i] = pRequests[i].code;
+        }
+    }
+    free(pRequests);
+    return result;
+}
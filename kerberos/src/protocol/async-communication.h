@@ -0,0 +1,116 @@
+#ifndef ASYNC_COMMUNICATION_H_
+#define ASYNC_COMMUNICATION_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <curl/curl.h>
+
+/*
+ * Called on the worker thread when a request completes. On success the
+ * response belongs to the callee, which must free it.
+ */
+typedef void (*AsyncCompletion)(uint8_t /* result */,
+                                uint32_t /* httpStatusCode */,
+                                uint8_t* /* pResponse */,
+                                size_t /* responseSize */,
+                                void* /* pUserData */);
+
+/*
+ * Called on the thread driving the requests when a scheduled task is due,
+ * with MA_COMM_SUCCESS, or with MA_COMM_INVALID_STATE when the communication
+ * stops first.
+ */
+typedef void (*AsyncTask)(uint8_t /* result */, void* /* pUserData */);
+
+typedef struct SMultiplexConfig {
+    uint8_t enabled;                // multiplexes the requests over HTTP/2
+    uint8_t priorKnowledge;         // speaks HTTP/2 on http:// URLs without upgrade (h2c)
+    uint32_t maxConcurrentStreams;  // streams opened at once on a connection
+    uint32_t maxHostConnections;    // connections per host, 0 for no limit
+} MultiplexConfig;
+
+/*
+ * Event loop callbacks, see CURLMOPT_SOCKETFUNCTION and CURLMOPT_TIMERFUNCTION.
+ * what is one of the CURL_POLL_* values and timeoutMs is -1 to remove the timer.
+ */
+typedef int (*AsyncSocketCallback)(int /* fd */, int /* what */, void* /* pUserData */);
+typedef int (*AsyncTimerCallback)(long /* timeoutMs */, void* /* pUserData */);
+
+/*
+ * Starts the worker thread that drives every asynchronous request through a
+ * single curl multi handle. Calling it again while running (in either mode)
+ * does nothing.
+ */
+uint8_t async_communication_start();
+
+/*
+ * Drives the requests from the application's event loop instead of a worker
+ * thread. The loop is told which sockets to watch and when to time out
+ * through the callbacks, and reports back through
+ * async_communication_socket_action and async_communication_timeout. In this
+ * mode every call, submissions included, must be made on the loop thread,
+ * and completions run inside the driver calls.
+ */
+uint8_t async_communication_start_external(AsyncSocketCallback /* socketCallback */,
+                                           AsyncTimerCallback /* timerCallback */,
+                                           void* /* pUserData */);
+
+/* Reports readiness (CURL_CSELECT_* flags) of a socket given to the socket callback */
+uint8_t async_communication_socket_action(int /* fd */, int /* events */);
+
+/* Reports that the timeout given to the timer callback expired */
+uint8_t async_communication_timeout();
+
+/*
+ * Stops the worker thread. Requests still queued or in flight complete with
+ * MA_COMM_INVALID_STATE before it returns.
+ */
+void async_communication_stop();
+
+/*
+ * Queues a request on the worker thread. It takes ownership of headers and
+ * body, even when it fails, and copies url and method. The completion is
+ * called exactly once if the submission succeeds.
+ */
+uint8_t async_communication_submit(const char* /* url */,
+                                   const char* /* method */,
+                                   struct curl_slist* /* headers */,
+                                   uint8_t* /* body */,
+                                   size_t /* bodyLength */,
+                                   AsyncCompletion /* completion */,
+                                   void* /* pUserData */);
+
+/*
+ * Runs task once delayMs elapsed, on the worker thread or, in the event loop
+ * mode, inside the driver calls: the timer given to the loop covers the
+ * tasks too. The task is called exactly once if scheduling succeeds, before
+ * async_communication_stop returns at the latest.
+ */
+uint8_t async_communication_schedule(uint32_t /* delayMs */,
+                                     AsyncTask /* task */,
+                                     void* /* pUserData */);
+
+/*
+ * Configures the HTTP/2 multiplexing of the multi handle. It applies to the
+ * requests started afterwards, and to the running worker on its next turn.
+ */
+void async_communication_configure(const MultiplexConfig* /* pConfig */);
+
+/*
+ * Runs a prepared easy handle on the worker's multi handle, so that it
+ * shares a multiplexed connection with the other requests, and waits for it.
+ * The handle stays the caller's. Returns MA_COMM_INVALID_STATE, without
+ * running it, when multiplexing is off, the worker is not running as a
+ * thread or the caller is the worker itself; the caller performs it then.
+ */
+uint8_t async_communication_perform_multiplexed(CURL* /* pCurlHandler */, CURLcode* /* pCode */);
+
+/*
+ * Runs prepared easy handles together on the worker's multi handle, over
+ * its connections whether multiplexing is on or not, and waits for all of
+ * them. Returns MA_COMM_INVALID_STATE, without running them, when the
+ * worker is not running as a thread or the caller is the worker itself.
+ */
+uint8_t async_communication_perform_all(CURL** /* pCurlHandlers */, CURLcode* /* pCodes */, size_t /* count */);
+
+#endif /* ASYNC_COMMUNICATION_H_ */
@@ -1,29 +1,474 @@
 #include "communication.h"
 
 #include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
 
+#include "async-communication.h"
 #include "logger/logger.h"
 #include "ma_comm_error_codes.h"
 
-#define INITIAL_BUFFER_SIZE 1024
+#define HOST_KEY_LENGTH 256
 
-typedef struct SBufferStruct {
-  char *pData;
-  size_t size;
-} BufferStruct;
+/*
+ * Idle curl handles, most recently used first. An easy handle keeps its
+ * connection cache across curl_easy_reset, so reusing it for the same
+ * scheme://host:port skips DNS, TCP and TLS setup.
+ */
+typedef struct SPooledHandle {
+    CURL *pCurlHandler;
+    char hostKey[HOST_KEY_LENGTH];
+    time_t lastUsed;
+    struct SPooledHandle *pNext;
+} PooledHandle;
+
+/*
+ * Buffers kept per thread for the synchronous sends: the response buffer,
+ * and the request arena that holds the transient buffers of one request.
+ */
+typedef struct SThreadBuffers {
+    BufferStruct response;
+    BufferStruct arena;
+} ThreadBuffers;
+
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static PooledHandle *pIdleHandles = NULL;
+// entries of the handles in use, so that releasing a handle does not allocate
+static PooledHandle *pSpareEntries = NULL;
+static pthread_key_t bufferPoolKey;
+/*
+ * DNS cache and TLS sessions shared by every handle, so a thread (or the
+ * worker) reuses what another one resolved or negotiated. Connections are
+ * not shared: libcurl does not support a shared connection cache used by
+ * concurrent threads, they move between threads with their pooled handle.
+ * Set by communication_share_init, read with poolMutex held.
+ */
+static CURLSH *pShare = NULL;
+static pthread_mutex_t shareLocks[CURL_LOCK_DATA_LAST];
+static pthread_once_t bufferPoolOnce = PTHREAD_ONCE_INIT;
+static ConnectionPoolConfig poolConfig = {
+    POOL_DEFAULT_HANDLES_PER_HOST,
+    POOL_DEFAULT_IDLE_TIMEOUT,
+    1,
+    POOL_DEFAULT_KEEPALIVE_IDLE,
+    POOL_DEFAULT_KEEPALIVE_INTERVAL,
+    1
+};
+
+/*
+ * Extracts "scheme://host:port" from url. Returns 0 if the url has no scheme
+ * or the key does not fit, in which case the handle is not pooled.
+ */
+static uint8_t getHostKey(const char* url, char* hostKey) {
+    const char* pHost = strstr(url, "://");
+    size_t length = 0;
+
+    if (!pHost) {
+        return 0;
+    }
+    pHost += 3;
+    length = (pHost - url) + strcspn(pHost, "/?#");
+    if (length >= HOST_KEY_LENGTH) {
+        return 0;
+    }
+
+    memcpy(hostKey, url, length);
+    hostKey[length] = '\0';
+    return 1;
+}
+
+/*
+ * Unlinks the handles idle for longer than the timeout, or over the per host
+ * limit, into pExpired. Must be called with poolMutex held.
+ */
+static PooledHandle* collectExpiredHandles(time_t now) {
+    PooledHandle *pExpired = NULL;
+    PooledHandle **ppEntry = &pIdleHandles;
+
+    while (*ppEntry) {
+        PooledHandle *pEntry = *ppEntry;
+        uint32_t sameHost = 0;
+        PooledHandle *pOther = NULL;
+
+        for (pOther = pIdleHandles; pOther != pEntry; pOther = pOther->pNext) {
+            if (strcmp(pOther->hostKey, pEntry->hostKey) == 0) {
+                sameHost++;
+            }
+        }
+
+        if ( (now - pEntry->lastUsed >= (time_t) poolConfig.idleTimeout) ||
+             (sameHost >= poolConfig.handlesPerHost) ) {
+            *ppEntry = pEntry->pNext;
+            pEntry->pNext = pExpired;
+            pExpired = pEntry;
+        } else {
+            ppEntry = &pEntry->pNext;
+        }
+    }
+
+    return pExpired;
+}
+
+static void freeHandles(PooledHandle *pEntry) {
+    while (pEntry) {
+        PooledHandle *pNext = pEntry->pNext;
+        curl_easy_cleanup(pEntry->pCurlHandler);
+        free(pEntry);
+        pEntry = pNext;
+    }
+}
+
+static void freeEntries(PooledHandle *pEntry) {
+    while (pEntry) {
+        PooledHandle *pNext = pEntry->pNext;
+        free(pEntry);
+        pEntry = pNext;
+    }
+}
+
+static void lockShare(CURL *pCurlHandler, curl_lock_data data, curl_lock_access access, void *pUserPtr) {
+    (void) pCurlHandler;
+    (void) access;
+    (void) pUserPtr;
+    pthread_mutex_lock(&shareLocks[data]);
+}
+
+static void unlockShare(CURL *pCurlHandler, curl_lock_data data, void *pUserPtr) {
+    (void) pCurlHandler;
+    (void) pUserPtr;
+    pthread_mutex_unlock(&shareLocks[data]);
+}
+
+uint8_t communication_share_init() {
+    CURLSH *pNewShare = NULL;
+    uint32_t i = 0;
+
+    pthread_mutex_lock(&poolMutex);
+    if (pShare) {
+        pthread_mutex_unlock(&poolMutex);
+        return MA_COMM_SUCCESS;
+    }
+    pthread_mutex_unlock(&poolMutex);
+
+    pNewShare = curl_share_init();
+    if (!pNewShare) {
+        return MA_COMM_INVALID_STATE;
+    }
+    for (i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+        pthread_mutex_init(&shareLocks[i], NULL);
+    }
+    curl_share_setopt(pNewShare, CURLSHOPT_LOCKFUNC, lockShare);
+    curl_share_setopt(pNewShare, CURLSHOPT_UNLOCKFUNC, unlockShare);
+    if ( (curl_share_setopt(pNewShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK) ||
+         (curl_share_setopt(pNewShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK) ) {
+        curl_share_cleanup(pNewShare);
+        return MA_COMM_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&poolMutex);
+    pShare = pNewShare;
+    pthread_mutex_unlock(&poolMutex);
+
+    return MA_COMM_SUCCESS;
+}
+
+void communication_share_deinit() {
+    CURLSH *pOldShare = NULL;
+
+    pthread_mutex_lock(&poolMutex);
+    pOldShare = pShare;
+    pShare = NULL;
+    pthread_mutex_unlock(&poolMutex);
+
+    // every handle must be cleaned up by now, or the share is kept
+    if ( (pOldShare) && (curl_share_cleanup(pOldShare) != CURLSHE_OK) ) {
+        LOG("The share is still in use\n");
+    }
+}
+
+static void applyPoolOptions(CURL *pCurlHandler, const ConnectionPoolConfig *pConfig, CURLSH *pShareToUse) {
+    if (pShareToUse) {
+        curl_easy_setopt(pCurlHandler, CURLOPT_SHARE, pShareToUse);
+    }
+    if (pConfig->tcpKeepAlive) {
+        curl_easy_setopt(pCurlHandler, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(pCurlHandler, CURLOPT_TCP_KEEPIDLE, (long) pConfig->keepAliveIdle);
+        curl_easy_setopt(pCurlHandler, CURLOPT_TCP_KEEPINTVL, (long) pConfig->keepAliveInterval);
+    }
+    curl_easy_setopt(pCurlHandler, CURLOPT_TCP_NODELAY, pConfig->tcpNoDelay ? 1L : 0L);
+    // let curl drop pooled connections that the server has probably closed
+    curl_easy_setopt(pCurlHandler, CURLOPT_MAXAGE_CONN, (long) pConfig->idleTimeout);
+}
+
+void communication_pool_configure(const ConnectionPoolConfig* pConfig) {
+    PooledHandle *pExpired = NULL;
+
+    if (!pConfig) {
+        return;
+    }
+
+    pthread_mutex_lock(&poolMutex);
+    poolConfig = *pConfig;
+    pExpired = collectExpiredHandles(time(NULL));
+    pthread_mutex_unlock(&poolMutex);
+
+    freeHandles(pExpired);
+}
+
+void communication_pool_deinit() {
+    PooledHandle *pIdle = NULL;
+    PooledHandle *pSpare = NULL;
+
+    pthread_mutex_lock(&poolMutex);
+    pIdle = pIdleHandles;
+    pIdleHandles = NULL;
+    pSpare = pSpareEntries;
+    pSpareEntries = NULL;
+    pthread_mutex_unlock(&poolMutex);
+
+    freeHandles(pIdle);
+    freeEntries(pSpare);
+}
+
+CURL* communication_acquire_handle(const char* url) {
+    char hostKey[HOST_KEY_LENGTH];
+    CURL *pCurlHandler = NULL;
+    PooledHandle *pExpired = NULL;
+    PooledHandle *pReused = NULL;
+    PooledHandle **ppEntry = NULL;
+    ConnectionPoolConfig config;
+    CURLSH *pShareToUse = NULL;
+
+    pthread_mutex_lock(&poolMutex);
+    pExpired = collectExpiredHandles(time(NULL));
+    if (getHostKey(url, hostKey)) {
+        for (ppEntry = &pIdleHandles; *ppEntry; ppEntry = &(*ppEntry)->pNext) {
+            if (strcmp((*ppEntry)->hostKey, hostKey) == 0) {
+                pReused = *ppEntry;
+                *ppEntry = pReused->pNext;
+                // the entry waits for the handle to be released
+                pCurlHandler = pReused->pCurlHandler;
+                pReused->pNext = pSpareEntries;
+                pSpareEntries = pReused;
+                break;
+            }
+        }
+    }
+    config = poolConfig;
+    pShareToUse = pShare;
+    pthread_mutex_unlock(&poolMutex);
+
+    freeHandles(pExpired);
+
+    if (pReused) {
+        LOG("reusing pooled connection to %s\n", hostKey);
+    } else {
+        pCurlHandler = curl_easy_init();
+        if (!pCurlHandler) {
+            return NULL;
+        }
+    }
+
+    applyPoolOptions(pCurlHandler, &config, pShareToUse);
+    return pCurlHandler;
+}
+
+void communication_release_handle(const char* url, CURL* pCurlHandler) {
+    char hostKey[HOST_KEY_LENGTH];
+    PooledHandle *pEntry = NULL;
+    PooledHandle *pExpired = NULL;
+
+    if (!pCurlHandler) {
+        return;
+    }
+    if (!getHostKey(url, hostKey)) {
+        curl_easy_cleanup(pCurlHandler);
+        return;
+    }
+
+    // drop the request options but keep the connection and DNS caches
+    curl_easy_reset(pCurlHandler);
+
+    pthread_mutex_lock(&poolMutex);
+    pEntry = pSpareEntries;
+    if (pEntry) {
+        pSpareEntries = pEntry->pNext;
+    }
+    pthread_mutex_unlock(&poolMutex);
+
+    // only the first release of a new handle allocates its entry
+    if (!pEntry) {
+        pEntry = (PooledHandle*) malloc(sizeof(PooledHandle));
+        if (!pEntry) {
+            curl_easy_cleanup(pCurlHandler);
+            return;
+        }
+    }
+    memcpy(pEntry->hostKey, hostKey, strlen(hostKey) + 1);
+    pEntry->pCurlHandler = pCurlHandler;
+    pEntry->lastUsed = time(NULL);
+
+    pthread_mutex_lock(&poolMutex);
+    pEntry->pNext = pIdleHandles;
+    pIdleHandles = pEntry;
+    // the new entry is first, so handles over the limit are the oldest ones
+    pExpired = collectExpiredHandles(pEntry->lastUsed);
+    pthread_mutex_unlock(&poolMutex);
+
+    freeHandles(pExpired);
+}
+
+static void freeThreadBuffers(void *pData) {
+    ThreadBuffers *pBuffers = (ThreadBuffers*) pData;
+
+    free(pBuffers->response.pData);
+    free(pBuffers->arena.pData);
+    free(pBuffers);
+}
+
+static void createBufferPoolKey() {
+    pthread_key_create(&bufferPoolKey, freeThreadBuffers);
+}
+
+/* Returns the calling thread's buffers, creating them if create is set */
+static ThreadBuffers* getThreadBuffers(uint8_t create) {
+    ThreadBuffers *pBuffers = NULL;
+
+    pthread_once(&bufferPoolOnce, createBufferPoolKey);
+    pBuffers = (ThreadBuffers*) pthread_getspecific(bufferPoolKey);
+    if ( (!pBuffers) && (create) ) {
+        pBuffers = (ThreadBuffers*) calloc(1, sizeof(ThreadBuffers));
+        if ( (pBuffers) && (pthread_setspecific(bufferPoolKey, pBuffers) != 0) ) {
+            free(pBuffers);
+            pBuffers = NULL;
+        }
+    }
+    return pBuffers;
+}
+
+/* Moves the pooled buffer, if any, to pBuffer, else allocates initialSize bytes */
+static uint8_t takePooledBuffer(BufferStruct *pPooled, BufferStruct *pBuffer, size_t initialSize) {
+    if ( (pPooled) && (pPooled->pData) ) {
+        *pBuffer = *pPooled;
+        pPooled->pData = NULL;
+        pPooled->capacity = 0;
+    } else {
+        pBuffer->pData = (char*) malloc(initialSize);
+        if (!pBuffer->pData) {
+            return MA_COMM_OUT_OF_MEMORY;
+        }
+        pBuffer->capacity = initialSize;
+    }
+    pBuffer->size = 0;
+    pBuffer->pCurlHandler = NULL;
+
+    return MA_COMM_SUCCESS;
+}
+
+/* Keeps pBuffer in pPooled if it is free and the buffer not too big, else frees it */
+static void givePooledBuffer(BufferStruct *pPooled, BufferStruct *pBuffer) {
+    if ( (pPooled) && (!pPooled->pData) && (pBuffer->capacity <= MAX_POOLED_BUFFER_SIZE) ) {
+        pPooled->pData = pBuffer->pData;
+        pPooled->capacity = pBuffer->capacity;
+    } else {
+        free(pBuffer->pData);
+    }
+    pBuffer->pData = NULL;
+    pBuffer->size = 0;
+    pBuffer->capacity = 0;
+}
+
+uint8_t communication_buffer_acquire(BufferStruct *pBuffer) {
+    ThreadBuffers *pBuffers = getThreadBuffers(0);
+
+    return takePooledBuffer((pBuffers) ? &pBuffers->response : NULL, pBuffer, INITIAL_BUFFER_SIZE);
+}
+
+void communication_buffer_release(BufferStruct *pBuffer) {
+    ThreadBuffers *pBuffers = NULL;
+
+    if (!pBuffer->pData) {
+        return;
+    }
+    pBuffers = getThreadBuffers(pBuffer->capacity <= MAX_POOLED_BUFFER_SIZE);
+    givePooledBuffer((pBuffers) ? &pBuffers->response : NULL, pBuffer);
+}
+
+uint8_t communication_arena_acquire(BufferStruct *pArena, size_t required) {
+    ThreadBuffers *pBuffers = getThreadBuffers(0);
+    uint8_t result = 0;
+
+    result = takePooledBuffer((pBuffers) ? &pBuffers->arena : NULL, pArena, INITIAL_BUFFER_SIZE);
+    if (result != MA_COMM_SUCCESS) {
+        return result;
+    }
+    result = communication_buffer_reserve(pArena, required);
+    if (result != MA_COMM_SUCCESS) {
+        free(pArena->pData);
+        pArena->pData = NULL;
+        pArena->capacity = 0;
+    }
+    return result;
+}
+
+void communication_arena_release(BufferStruct *pArena) {
+    ThreadBuffers *pBuffers = NULL;
+
+    if (!pArena->pData) {
+        return;
+    }
+    pBuffers = getThreadBuffers(pArena->capacity <= MAX_POOLED_BUFFER_SIZE);
+    givePooledBuffer((pBuffers) ? &pBuffers->arena : NULL, pArena);
+}
+
+/* Grows the buffer geometrically until it holds required bytes */
+uint8_t communication_buffer_reserve(BufferStruct *pBuffer, size_t required) {
+    size_t capacity = (pBuffer->capacity > 0) ? pBuffer->capacity : INITIAL_BUFFER_SIZE;
+    char *pData = NULL;
+
+    if (required <= pBuffer->capacity) {
+        return MA_COMM_SUCCESS;
+    }
+    while (capacity < required) {
+        if (capacity > SIZE_MAX / 2) {
+            capacity = required;
+            break;
+        }
+        capacity *= 2;
+    }
+
+    pData = (char*) realloc(pBuffer->pData, capacity);
+    if (!pData) {
+        return MA_COMM_OUT_OF_MEMORY;
+    }
+    pBuffer->pData = pData;
+    pBuffer->capacity = capacity;
+
+    return MA_COMM_SUCCESS;
+}
 
 size_t process_chuck(void *pContent, size_t size, size_t nmemb, void *pUserPtr) {
     size_t realSize = size * nmemb;
     BufferStruct *pBuffer = (BufferStruct *)pUserPtr;
+    size_t required = pBuffer->size + realSize;
+    curl_off_t contentLength = -1;
+
+    // the whole body is allocated at once when its length is announced
+    if ( (pBuffer->size == 0) &&
+         (pBuffer->pCurlHandler) &&
+         (curl_easy_getinfo(pBuffer->pCurlHandler,
+                            CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                            &contentLength) == CURLE_OK) &&
+         (contentLength > (curl_off_t) required) &&
+         (contentLength <= MAX_PRESIZED_BUFFER_SIZE) ) {
+        required = (size_t) contentLength;
+    }
 
     // check if there is sufficient space in our buffer
-    if (pBuffer->size + realSize > INITIAL_BUFFER_SIZE) {
-        pBuffer->pData = realloc(pBuffer->pData, pBuffer->size + realSize);
-        if(!pBuffer->pData) {
-          // out of memory!
-          LOG("not enough memory (realloc returned NULL)\n");
-          return 0;
-        }
+    if (communication_buffer_reserve(pBuffer, required) != MA_COMM_SUCCESS) {
+        // out of memory!
+        LOG("not enough memory (realloc returned NULL)\n");
+        return 0;
     }
 
     // update the buffer's content and size
@@ -33,74 +478,128 @@ size_t process_chuck(void *pContent, size_t size, size_t nmemb, void *pUserPtr)
     return realSize;
 }
 
+void communication_prepare_transfer(CURL *pCurlHandler,
+                                    const char* url,
+                                    const char *method,
+                                    struct curl_slist *headers,
+                                    uint8_t* encodedInput,
+                                    size_t encodedLength,
+                                    communication_writer writer,
+                                    void *pWriterData) {
+    // set the http method
+    curl_easy_setopt(pCurlHandler, CURLOPT_CUSTOMREQUEST, method);
+
+    // set the headers
+    if (headers) {
+        curl_easy_setopt(pCurlHandler, CURLOPT_HTTPHEADER, headers);
+    }
+
+    // prepare the request
+    curl_easy_setopt(pCurlHandler, CURLOPT_URL, url);
+    if (encodedLength > 0) {
+        curl_easy_setopt(pCurlHandler, CURLOPT_POSTFIELDSIZE, encodedLength);
+        curl_easy_setopt(pCurlHandler, CURLOPT_POSTFIELDS, encodedInput);
+    }
+    curl_easy_setopt(pCurlHandler, CURLOPT_WRITEFUNCTION, writer);
+    curl_easy_setopt(pCurlHandler, CURLOPT_WRITEDATA, pWriterData);
+}
+
+void communication_prepare_request(CURL *pCurlHandler,
+                                   const char* url,
+                                   const char *method,
+                                   struct curl_slist *headers,
+                                   uint8_t* encodedInput,
+                                   size_t encodedLength,
+                                   BufferStruct *pBuffer) {
+    pBuffer->pCurlHandler = pCurlHandler;
+    communication_prepare_transfer(pCurlHandler,
+                                   url,
+                                   method,
+                                   headers,
+                                   encodedInput,
+                                   encodedLength,
+                                   process_chuck,
+                                   (void *)pBuffer);
+}
+
+void communication_prepare_upload(CURL *pCurlHandler,
+                                  communication_reader reader,
+                                  void *pReaderData,
+                                  curl_off_t uploadLength) {
+    // the body is pulled from reader, sent chunked when its length is unknown
+    curl_easy_setopt(pCurlHandler, CURLOPT_POST, 1L);
+    curl_easy_setopt(pCurlHandler, CURLOPT_READFUNCTION, reader);
+    curl_easy_setopt(pCurlHandler, CURLOPT_READDATA, pReaderData);
+    curl_easy_setopt(pCurlHandler, CURLOPT_POSTFIELDSIZE_LARGE, uploadLength);
+}
+
 /*
- * Sends binary data to the Kerberos service.
- * Upon receipt of a reply, the callback method specified in loader.addEventListener is called
+ * Runs one request on a pooled handle, handing the response body to writer.
+ * The body is encodedInput, or pulled from reader if there is one. pBuffer,
+ * if any, is the BufferStruct behind pWriterData, linked to the handle for
+ * the length of the transfer.
  */
-uint8_t send_message(const char* url,
-                     const char *method,
-                     struct curl_slist **headers,
-                     uint8_t* encodedInput,
-                     size_t encodedLength,
-                     uint32_t* httpStatusCode,
-                     uint8_t** pResponse,
-                     size_t* pResponseSize) {
+static uint8_t performRequest(const char* url,
+                              const char *method,
+                              struct curl_slist *headers,
+                              uint8_t* encodedInput,
+                              size_t encodedLength,
+                              communication_reader reader,
+                              void *pReaderData,
+                              curl_off_t uploadLength,
+                              uint32_t* httpStatusCode,
+                              communication_writer writer,
+                              void *pWriterData,
+                              BufferStruct *pBuffer) {
     CURLcode res;
-    BufferStruct buffer;
     uint8_t result = 0;
     CURL *pCurlHandler = NULL;
 
-    // initialize output parameters
-    *pResponseSize = 0;
-    *pResponse = NULL;
-
-    // initialize the buffer with INITIAL_BUFFER_SIZE
-    buffer.size = 0;
-    buffer.pData = (char*) malloc(INITIAL_BUFFER_SIZE);
-    if (!buffer.pData) {
-        goto FAIL;
-    }
-
     // initialize the curl handler
-    pCurlHandler = curl_easy_init();
+    pCurlHandler = communication_acquire_handle(url);
     if(!pCurlHandler){
         goto FAIL;
     }
 
-    // set the http method
-    curl_easy_setopt(pCurlHandler, CURLOPT_CUSTOMREQUEST, method);
-
-    // set the headers
-    if (*headers) {
-        curl_easy_setopt(pCurlHandler, CURLOPT_HTTPHEADER, *headers);
+    communication_prepare_transfer(pCurlHandler,
+                                   url,
+                                   method,
+                                   headers,
+                                   encodedInput,
+                                   encodedLength,
+                                   writer,
+                                   pWriterData);
+    if (reader) {
+        communication_prepare_upload(pCurlHandler, reader, pReaderData, uploadLength);
     }
-
-    // prepare the request
-    curl_easy_setopt(pCurlHandler, CURLOPT_URL, url);
-    if (encodedLength > 0) {
-        curl_easy_setopt(pCurlHandler, CURLOPT_POSTFIELDSIZE, encodedLength);
-        curl_easy_setopt(pCurlHandler, CURLOPT_POSTFIELDS, encodedInput);
+    if (pBuffer) {
+        pBuffer->pCurlHandler = pCurlHandler;
     }
-    curl_easy_setopt(pCurlHandler, CURLOPT_WRITEFUNCTION, process_chuck);
-    curl_easy_setopt(pCurlHandler, CURLOPT_WRITEDATA, (void *)&buffer);
 
-    res = curl_easy_perform(pCurlHandler);
+    // a buffered exchange may share a multiplexed HTTP/2 connection; the
+    // streamed ones stay on their own, their callbacks would stall the others
+    if ( (!pBuffer) ||
+         (reader) ||
+         (async_communication_perform_multiplexed(pCurlHandler, &res) != MA_COMM_SUCCESS) ) {
+        res = curl_easy_perform(pCurlHandler);
+    }
+    if (pBuffer) {
+        pBuffer->pCurlHandler = NULL;
+    }
     if (res != CURLE_OK) {
         LOG("send message failed: %s\n", curl_easy_strerror(res));
         goto FAIL;
     } else {
-        curl_easy_getinfo (pCurlHandler, CURLINFO_RESPONSE_CODE, httpStatusCode);
+        // curl writes a long, wider than *httpStatusCode
+        long responseCode = 0;
+        curl_easy_getinfo (pCurlHandler, CURLINFO_RESPONSE_CODE, &responseCode);
+        *httpStatusCode = (uint32_t) responseCode;
         LOG("http status code: %u\n", *httpStatusCode);
-        *pResponseSize = buffer.size;
-        *pResponse = buffer.pData;
         goto SUCCESS;
     }
 
 FAIL:
     result = MA_COMM_INVALID_STATE;
-    if (buffer.pData) {
-        free(buffer.pData);
-    }
     goto CLEAN_UP;
 
 SUCCESS:
@@ -108,8 +607,171 @@ SUCCESS:
 
 CLEAN_UP:
     if (pCurlHandler) {
+        if (result == MA_COMM_SUCCESS) {
+            communication_release_handle(url, pCurlHandler);
+        } else {
+            // the connection may be in a bad state, do not pool it
+            curl_easy_cleanup(pCurlHandler);
+        }
+    }
+
+    return result;
+}
+
+uint8_t communication_warm_up(const char* url, uint8_t keepConnection) {
+    CURL *pCurlHandler = NULL;
+    CURLcode res;
+
+    pCurlHandler = communication_acquire_handle(url);
+    if (!pCurlHandler) {
+        return MA_COMM_INVALID_STATE;
+    }
+
+    curl_easy_setopt(pCurlHandler, CURLOPT_URL, url);
+    curl_easy_setopt(pCurlHandler, CURLOPT_TIMEOUT_MS, (long) WARM_UP_TIMEOUT_MS);
+    if (keepConnection) {
+        // a HEAD leaves a connection that the next transfers can take
+        curl_easy_setopt(pCurlHandler, CURLOPT_NOBODY, 1L);
+    } else {
+        // resolves and negotiates TLS without sending anything
+        curl_easy_setopt(pCurlHandler, CURLOPT_CONNECT_ONLY, 1L);
+    }
+
+    res = curl_easy_perform(pCurlHandler);
+    if ( (res == CURLE_OK) && (keepConnection) ) {
+        // the connection stays with the handle, in the pool of its host
+        communication_release_handle(url, pCurlHandler);
+    } else {
+        // a connect only connection cannot be reused by another transfer
         curl_easy_cleanup(pCurlHandler);
     }
+    if (res != CURLE_OK) {
+        LOG("warm up of %s failed: %s\n", url, curl_easy_strerror(res));
+        return MA_COMM_INVALID_STATE;
+    }
+
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t send_request(const char* url,
+                     const char *method,
+                     struct curl_slist *headers,
+                     uint8_t* encodedInput,
+                     size_t encodedLength,
+                     uint32_t* httpStatusCode,
+                     BufferStruct* pResponse) {
+    uint8_t result = 0;
+
+    // take the thread's pooled buffer, or one of INITIAL_BUFFER_SIZE
+    if (communication_buffer_acquire(pResponse) != MA_COMM_SUCCESS) {
+        return MA_COMM_INVALID_STATE;
+    }
+
+    result = performRequest(url,
+                            method,
+                            headers,
+                            encodedInput,
+                            encodedLength,
+                            NULL,
+                            NULL,
+                            0,
+                            httpStatusCode,
+                            process_chuck,
+                            (void *)pResponse,
+                            pResponse);
+    if (result != MA_COMM_SUCCESS) {
+        communication_buffer_release(pResponse);
+    }
+
+    return result;
+}
+
+uint8_t send_request_with_writer(const char* url,
+                                 const char *method,
+                                 struct curl_slist *headers,
+                                 uint8_t* encodedInput,
+                                 size_t encodedLength,
+                                 uint32_t* httpStatusCode,
+                                 communication_writer writer,
+                                 void *pWriterData) {
+    return performRequest(url,
+                          method,
+                          headers,
+                          encodedInput,
+                          encodedLength,
+                          NULL,
+                          NULL,
+                          0,
+                          httpStatusCode,
+                          writer,
+                          pWriterData,
+                          NULL);
+}
+
+uint8_t send_request_with_reader(const char* url,
+                                 const char *method,
+                                 struct curl_slist *headers,
+                                 communication_reader reader,
+                                 void *pReaderData,
+                                 curl_off_t uploadLength,
+                                 uint32_t* httpStatusCode,
+                                 BufferStruct* pResponse) {
+    uint8_t result = 0;
+
+    if (communication_buffer_acquire(pResponse) != MA_COMM_SUCCESS) {
+        return MA_COMM_INVALID_STATE;
+    }
+
+    result = performRequest(url,
+                            method,
+                            headers,
+                            NULL,
+                            0,
+                            reader,
+                            pReaderData,
+                            uploadLength,
+                            httpStatusCode,
+                            process_chuck,
+                            (void *)pResponse,
+                            pResponse);
+    if (result != MA_COMM_SUCCESS) {
+        communication_buffer_release(pResponse);
+    }
+
+    return result;
+}
+
+/*
+ * Sends binary data to the Kerberos service.
+ * Upon receipt of a reply, the callback method specified in loader.addEventListener is called
+ */
+uint8_t send_message(const char* url,
+                     const char *method,
+                     struct curl_slist **headers,
+                     uint8_t* encodedInput,
+                     size_t encodedLength,
+                     uint32_t* httpStatusCode,
+                     uint8_t** pResponse,
+                     size_t* pResponseSize) {
+    uint8_t result = 0;
+    BufferStruct buffer;
+
+    // initialize output parameters
+    *pResponseSize = 0;
+    *pResponse = NULL;
+
+    result = send_request(url,
+                          method,
+                          *headers,
+                          encodedInput,
+                          encodedLength,
+                          httpStatusCode,
+                          &buffer);
+    if (result == MA_COMM_SUCCESS) {
+        // the caller takes the buffer over, it does not go back to the pool
+        *pResponse = (uint8_t*) buffer.pData;
+        *pResponseSize = buffer.size;
+    }
     if (*headers) {
         curl_slist_free_all(*headers);
         *headers = NULL;
@@ -5,6 +5,182 @@
 #include <string.h>
 #include <curl/curl.h>
 
+// connection pool defaults
+#define POOL_DEFAULT_HANDLES_PER_HOST   4
+#define POOL_DEFAULT_IDLE_TIMEOUT       60
+#define POOL_DEFAULT_KEEPALIVE_IDLE     30
+#define POOL_DEFAULT_KEEPALIVE_INTERVAL 15
+
+// bound of one warm up transfer, which ma_communication_deinit may wait for
+#define WARM_UP_TIMEOUT_MS 5000
+
+#define INITIAL_BUFFER_SIZE 1024
+// announced Content-Length up to which a response buffer is allocated at once
+#define MAX_PRESIZED_BUFFER_SIZE (16 * 1024 * 1024)
+// biggest response buffer kept by the per thread pool
+#define MAX_POOLED_BUFFER_SIZE (1024 * 1024)
+
+typedef struct SBufferStruct {
+  char *pData;
+  size_t size;
+  size_t capacity;
+  CURL *pCurlHandler;   // transfer filling the buffer, to read its Content-Length
+} BufferStruct;
+
+// curl write callback: returning less than size * nmemb aborts the transfer
+typedef size_t (*communication_writer)(void* /* pContent */, size_t /* size */, size_t /* nmemb */, void* /* pUserPtr */);
+
+// curl read callback: fills the buffer with up to size * nitems bytes, 0 at the end
+typedef size_t (*communication_reader)(char* /* pBuffer */, size_t /* size */, size_t /* nitems */, void* /* pUserPtr */);
+
+typedef struct SConnectionPoolConfig {
+    uint32_t handlesPerHost;    // idle handles kept per host, 0 disables the pool
+    uint32_t idleTimeout;       // seconds an idle handle (and its connection) is kept
+    uint8_t tcpKeepAlive;       // enables TCP keepalive probes
+    uint32_t keepAliveIdle;     // seconds before the first keepalive probe
+    uint32_t keepAliveInterval; // seconds between keepalive probes
+    uint8_t tcpNoDelay;         // disables Nagle's algorithm
+} ConnectionPoolConfig;
+
+/*
+ * Configures the connection pool. Idle handles over the new limits are
+ * released on the next acquire/release.
+ */
+void communication_pool_configure(const ConnectionPoolConfig* /* pConfig */);
+
+/* Releases every idle handle kept by the pool */
+void communication_pool_deinit();
+
+/*
+ * Creates the share, DNS cache and TLS sessions, every handle is given by
+ * communication_acquire_handle. Must be called after curl_global_init.
+ */
+uint8_t communication_share_init();
+
+/* Releases the share, once every handle using it was cleaned up */
+void communication_share_deinit();
+
+/*
+ * Resolves the host of url and negotiates TLS with it through the share, so
+ * that the first request skips both. With keepConnection, a HEAD request is
+ * sent and its handle pooled with the connection for the following requests.
+ */
+uint8_t communication_warm_up(const char* /* url */, uint8_t /* keepConnection */);
+
+/*
+ * Returns a handle for the host of url, reusing an idle one (and its warm
+ * connection) when there is one. The handle comes with the pool's TCP options
+ * set and must go back through communication_release_handle.
+ */
+CURL* communication_acquire_handle(const char* /* url */);
+
+/* Gives a handle back to the pool, or cleans it up if the pool is full */
+void communication_release_handle(const char* /* url */, CURL* /* pCurlHandler */);
+
+/*
+ * Takes the calling thread's pooled buffer, or allocates a new one of
+ * INITIAL_BUFFER_SIZE bytes. The buffer comes back empty.
+ */
+uint8_t communication_buffer_acquire(BufferStruct* /* pBuffer */);
+
+/*
+ * Gives a buffer back to the calling thread's pool, or frees it if the pool
+ * already holds one or it is bigger than MAX_POOLED_BUFFER_SIZE.
+ */
+void communication_buffer_release(BufferStruct* /* pBuffer */);
+
+/*
+ * Takes the calling thread's request arena, which holds the transient
+ * buffers of one request such as its encrypted body, grown to required
+ * bytes. Once warm, a request of the same size does not allocate.
+ */
+uint8_t communication_arena_acquire(BufferStruct* /* pArena */, size_t /* required */);
+
+/* Gives the arena back to the calling thread, as communication_buffer_release */
+void communication_arena_release(BufferStruct* /* pArena */);
+
+/* Grows the buffer, doubling its capacity, until it holds required bytes */
+uint8_t communication_buffer_reserve(BufferStruct* /* pBuffer */, size_t /* required */);
+
+/* curl write callback that appends the received data to a BufferStruct */
+size_t process_chuck(void* /* pContent */, size_t /* size */, size_t /* nmemb */, void* /* pUserPtr */);
+
+/*
+ * Sets the method, headers, url and body of a request, whose response body
+ * is handed to writer as it arrives. headers and encodedInput must outlive
+ * the transfer.
+ */
+void communication_prepare_transfer(CURL* /* pCurlHandler */,
+                                    const char* /* url */,
+                                    const char* /* method */,
+                                    struct curl_slist* /* headers */,
+                                    uint8_t* /* encodedInput */,
+                                    size_t /* encodedLength */,
+                                    communication_writer /* writer */,
+                                    void* /* pWriterData */);
+
+/*
+ * Makes a prepared request pull its body from reader instead. An
+ * uploadLength of -1 sends it chunked.
+ */
+void communication_prepare_upload(CURL* /* pCurlHandler */,
+                                  communication_reader /* reader */,
+                                  void* /* pReaderData */,
+                                  curl_off_t /* uploadLength */);
+
+/*
+ * Sets the method, headers, url, body and response buffer of a request.
+ * headers and encodedInput must outlive the transfer.
+ */
+void communication_prepare_request(CURL* /* pCurlHandler */,
+                                   const char* /* url */,
+                                   const char* /* method */,
+                                   struct curl_slist* /* headers */,
+                                   uint8_t* /* encodedInput */,
+                                   size_t /* encodedLength */,
+                                   BufferStruct* /* pBuffer */);
+
+/*
+ * Sends a request and waits for its response, received in a buffer of the
+ * thread's pool that the caller gives back with communication_buffer_release
+ * or takes over. The headers are left to the caller, so the same list can be
+ * sent again.
+ */
+uint8_t send_request(const char* url,
+                     const char *method,
+                     struct curl_slist *headers,
+                     uint8_t* encodedInput,
+                     size_t encodedLength,
+                     uint32_t* httpStatusCode,
+                     BufferStruct* pResponse);
+
+/*
+ * As send_request, handing the response body to writer chunk by chunk
+ * instead of gathering it. A writer that stops the transfer fails the call.
+ */
+uint8_t send_request_with_writer(const char* url,
+                                 const char *method,
+                                 struct curl_slist *headers,
+                                 uint8_t* encodedInput,
+                                 size_t encodedLength,
+                                 uint32_t* httpStatusCode,
+                                 communication_writer writer,
+                                 void *pWriterData);
+
+/*
+ * As send_request, pulling the body from reader as curl sends it. An
+ * uploadLength of -1 sends it chunked.
+ */
+uint8_t send_request_with_reader(const char* url,
+                                 const char *method,
+                                 struct curl_slist *headers,
+                                 communication_reader reader,
+                                 void *pReaderData,
+                                 curl_off_t uploadLength,
+                                 uint32_t* httpStatusCode,
+                                 BufferStruct* pResponse);
+
+/* As send_request, returning the response as a plain allocation, then frees *headers */
 uint8_t send_message(const char* url,
                      const char *method,
                      struct curl_slist **headers,
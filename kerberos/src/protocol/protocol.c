@@ -1,5 +1,8 @@
 #include "protocol.h"
 
+#include <pthread.h>
+#include <time.h>
+
 #include "encoder/authenticator.h"
 #include "encoder/error.h"
 #include "encoder/replyAP.h"
@@ -12,28 +15,21 @@
 #include "encoder/constants.h"
 #include "communication.h"
 #include "secure-util.h"
+#include "utils.h"
+#include "crypto/SecureChannel.h"
 #include "endian.h"
 
 #include "logger/logger.h"
 #include "ma_comm_error_codes.h"
 
-typedef enum {
-    NOT_INITIALIZED,
-    WAIT_REPLY_AS,
-    WAIT_REPLY_AP,
-    ESTABLISHED_CHANNEL
-} ProtocolState;
+// Sealed cache of an established session
+#define SESSION_CACHE_VERSION     1
+#define SESSION_CACHE_LABEL       "session-cache"
+#define SESSION_CACHE_IV_LENGTH   12
 
-// All the necessary information to establish a secure channel
-// is kept in the Kerberos context
+// Everything negotiated by a handshake
 typedef struct {
-    char* urlRequestAS;    /* URI of Kerberos Request AS rest interface. */
-    char* urlRequestAP;    /* URI of Kerberos Request AP rest interface. */
-    ProtocolState state;        /* State of the Kerberos protocol */
-    uint8_t sharedKey[SHARED_KEY_LENGTH];            /* Pre-shared key with Kerberos AS */
-    uint8_t tagLen;                /* Size of the tags */
-    uint8_t cname[PRINCIPAL_NAME_LENGTH];    /* ID of this application instance */
-    uint8_t sname[PRINCIPAL_NAME_LENGTH];    /* ID of the server application */
+    ProtocolState state;        /* Progress of the handshake */
     uint8_t nonce[NONCE_LENGTH];
     Ticket ticket;
     SessionKeys sessionKeys;    /* Parameters used to create a secure channel */
@@ -42,8 +38,37 @@ typedef struct {
     uint64_t expireTimestamp;
     errno_t errorCode;
     uint8_t sessionId[SESSION_ID_LENGTH];    /*The session information generated after RequestAS*/
+} KerberosSession;
+
+// All the necessary information to establish a secure channel
+// is kept in the Kerberos context
+typedef struct {
+    char* urlRequestAS;    /* URI of Kerberos Request AS rest interface. */
+    char* urlRequestAP;    /* URI of Kerberos Request AP rest interface. */
+    uint8_t sharedKey[SHARED_KEY_LENGTH];            /* Pre-shared key with Kerberos AS */
+    uint8_t tagLen;                /* Size of the tags */
+    uint8_t algorithm;             /* AEAD proposed to the AS for the session */
+    uint8_t cname[PRINCIPAL_NAME_LENGTH];    /* ID of this application instance */
+    uint8_t sname[PRINCIPAL_NAME_LENGTH];    /* ID of the server application */
+    KerberosSession handshake;     /* Session being negotiated */
+    KerberosSession session;       /* Last established session, kept while a new one is negotiated */
+    uint8_t startDelayed;          /* The random start delay has been waited */
 } KerberosContext;
 
+// Admission control of the handshakes, shared by every context
+static pthread_mutex_t admissionMutex = PTHREAD_MUTEX_INITIALIZER;
+static HandshakeAdmissionConfig admissionConfig = {
+    HANDSHAKE_DEFAULT_MAX_RETRIES,
+    HANDSHAKE_DEFAULT_BACKOFF_BASE_MS,
+    HANDSHAKE_DEFAULT_BACKOFF_MAX_MS,
+    0
+};
+static uint64_t retriedHandshakes = 0;
+
+
+void session_init(KerberosSession* pSession);
+
+void session_erase(KerberosSession* pSession);
 
 void context_init(KerberosContext* pContext);
 
@@ -67,19 +92,32 @@ uint8_t context_set_client_server_parameters(KerberosContext *pContext,
 
 uint8_t generateNonce(KerberosContext *pContext);
 
-/* Upon receipt of a message, executes the action related to the current state */
+/*
+ * Upon receipt of a message, executes the action related to the current state.
+ * The next message to send, if any, is returned in encodedOutput.
+ */
 uint8_t processState(KerberosContext *pContext,
                       uint8_t* encodedInput,
-                      size_t encodedInputLength);
+                      size_t encodedInputLength,
+                      uint8_t** encodedOutput,
+                      size_t* encodedOutputLength);
 
 /**
  * @brief Updates the state machine by performing a transition
  **/
 void goNextState(KerberosContext *pContext);
 
+/* Replaces the established session by the one just negotiated */
+void commitSession(KerberosContext *pContext);
+
 uint8_t processReply(KerberosContext* pContext,
                   size_t encodedInputLength,
-                  uint8_t* encodedInput);
+                  uint8_t* encodedInput,
+                  uint8_t** encodedOutput,
+                  size_t* encodedOutputLength);
+
+/* URL the message produced by the last transition must be sent to */
+const char* getRequestUrl(KerberosContext *pContext);
 
 /* Check if the received message is an error */
 uint8_t checkIfError(KerberosContext* pContext,
@@ -116,9 +154,6 @@ uint8_t kerberos_protocol_init(const char* urlRequestAS,
     KerberosContext* pKerberosContext = NULL;
     uint8_t result = MA_COMM_SUCCESS;
 
-    // Initializing the random number generator.
-    srand(time(NULL));
-
     pKerberosContext = (KerberosContext*) malloc(sizeof(KerberosContext));
     if (!pKerberosContext) {
         LOG("Fail to alloc kerberos context\n");
@@ -180,22 +215,41 @@ uint8_t kerberos_protocol_deinit(void** pContext) {
 
 char* protocolStateToString(ProtocolState state);
 
+void session_init(KerberosSession* pSession) {
+    pSession->state = NOT_INITIALIZED;
+    memset(pSession->nonce, 0, NONCE_LENGTH);
+    initTicket(&pSession->ticket);
+    initSessionKeys(&pSession->sessionKeys);
+    pSession->timestamp = 0;
+    pSession->offset = 0;
+    pSession->expireTimestamp = 0;
+    pSession->errorCode = SUCCESSFULL_OPERATION;
+    memset(pSession->sessionId, 0, SESSION_ID_LENGTH);
+}
+
+void session_erase(KerberosSession* pSession) {
+    pSession->state = NOT_INITIALIZED;
+    memset_s(pSession->nonce, NONCE_LENGTH, 0, NONCE_LENGTH);
+    eraseTicket(&pSession->ticket);
+    eraseSessionKeys(&pSession->sessionKeys);
+    pSession->timestamp = 0;
+    pSession->offset = 0;
+    pSession->expireTimestamp = 0;
+    pSession->errorCode = SUCCESSFULL_OPERATION;
+    memset_s(pSession->sessionId, SESSION_ID_LENGTH, 0, SESSION_ID_LENGTH);
+}
+
 void context_init(KerberosContext* pContext) {
     pContext->urlRequestAS = NULL;
     pContext->urlRequestAP = NULL;
-    pContext->state = NOT_INITIALIZED;
     memset(pContext->sharedKey, 0, SHARED_KEY_LENGTH);
     pContext->tagLen = 128;    // todo remove this magic number
+    pContext->algorithm = getPreferredCryptoAlgorithm();
     memset(pContext->cname, 0, PRINCIPAL_NAME_LENGTH);
     memset(pContext->sname, 0, PRINCIPAL_NAME_LENGTH);
-    memset(pContext->nonce, 0, NONCE_LENGTH);
-    initTicket(&pContext->ticket);
-    initSessionKeys(&pContext->sessionKeys);
-    pContext->timestamp = 0;
-    pContext->offset = 0;
-    pContext->expireTimestamp = 0;
-    pContext->errorCode = SUCCESSFULL_OPERATION;
-    memset(pContext->nonce, 0, SESSION_ID_LENGTH);
+    session_init(&pContext->handshake);
+    session_init(&pContext->session);
+    pContext->startDelayed = 0;
 }
 
 void context_deinit(KerberosContext* pContext) {
@@ -207,19 +261,13 @@ void context_deinit(KerberosContext* pContext) {
         free(pContext->urlRequestAP);
         pContext->urlRequestAP = NULL;
     }
-    pContext->state = NOT_INITIALIZED;
     memset(pContext->sharedKey, 0, SHARED_KEY_LENGTH);
     pContext->tagLen = 0;
+    pContext->algorithm = SESSION_ALGORITHM_AES_GCM;
     memset(pContext->cname, 0, PRINCIPAL_NAME_LENGTH);
     memset(pContext->sname, 0, PRINCIPAL_NAME_LENGTH);
-    memset(pContext->nonce, 0, NONCE_LENGTH);
-    eraseTicket(&pContext->ticket);
-    eraseSessionKeys(&pContext->sessionKeys);
-    pContext->timestamp = 0;
-    pContext->offset = 0;
-    pContext->expireTimestamp = 0;
-    pContext->errorCode = SUCCESSFULL_OPERATION;
-    memset(pContext->nonce, 0, SESSION_ID_LENGTH);
+    session_erase(&pContext->handshake);
+    session_erase(&pContext->session);
 }
 
 uint8_t context_set_urls(KerberosContext* pContext,
@@ -307,42 +355,311 @@ uint8_t generateNonce(KerberosContext *pContext) {
     uint8_t result = 0;
 
     // Get secure random number to be the nonce
-    //todo: change it to a real secure random method
-    result= generateRandom(pContext->nonce, NONCE_LENGTH);
+    result= generateRandom(pContext->handshake.nonce, NONCE_LENGTH);
     if (result != SUCCESSFULL_OPERATION) {
         return MA_COMM_INVALID_STATE;
     }
     return MA_COMM_SUCCESS;
 }
 
-uint8_t kerberos_protocol_execute_handshake(void* pContext) {
+uint8_t kerberos_protocol_begin_handshake(void* pContext,
+                                         const char** url,
+                                         uint8_t** request,
+                                         size_t* requestLength) {
     uint8_t result = 0;
     KerberosContext* pKerberosContext = NULL;
 
-    if (!pContext) {
+    if ( (!pContext) || (!url) || (!request) || (!requestLength) ) {
         LOG("Invalid kerberos context\n");
         return MA_COMM_INVALID_PARAMETER;
     }
 
     pKerberosContext = (KerberosContext*) pContext;
 
-    // reset handshake related attributes
+    // reset handshake related attributes, the established session is kept
+    // until the new one replaces it
+    session_erase(&pKerberosContext->handshake);
     result = generateNonce(pKerberosContext);
     if (result != MA_COMM_SUCCESS) {
         LOG("Fail to generate nonce\n");
         return MA_COMM_INVALID_STATE;
     }
-    pKerberosContext->state = NOT_INITIALIZED;
 
-    result = processState(pKerberosContext, NULL, 0);
+    result = processState(pKerberosContext, NULL, 0, request, requestLength);
+    if (result != MA_COMM_SUCCESS) {
+        LOG("Fail to start kerberos handshake. Error: %u\n",
+            pKerberosContext->handshake.errorCode);
+        return MA_COMM_INVALID_STATE;
+    }
+
+    *url = getRequestUrl(pKerberosContext);
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t kerberos_protocol_continue_handshake(void* pContext,
+                                            uint8_t* reply,
+                                            size_t replyLength,
+                                            const char** url,
+                                            uint8_t** request,
+                                            size_t* requestLength) {
+    uint8_t result = 0;
+    KerberosContext* pKerberosContext = NULL;
+
+    if ( (!pContext) || (!url) || (!request) || (!requestLength) ) {
+        LOG("Invalid kerberos context\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    pKerberosContext = (KerberosContext*) pContext;
+    *url = NULL;
+
+    if ( (pKerberosContext->handshake.state != WAIT_REPLY_AS) &&
+         (pKerberosContext->handshake.state != WAIT_REPLY_AP) ) {
+        LOG("There is no handshake in progress\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    result = processReply(pKerberosContext, replyLength, reply, request, requestLength);
     if (result != MA_COMM_SUCCESS) {
         LOG("Fail to execute kerberos handshake. Error: %u\n",
-            pKerberosContext->errorCode);
-        result = MA_COMM_INVALID_STATE;
+            pKerberosContext->handshake.errorCode);
+        return MA_COMM_INVALID_STATE;
+    }
+
+    if (*request) {
+        *url = getRequestUrl(pKerberosContext);
+    }
+    return MA_COMM_SUCCESS;
+}
+
+static void sleepMs(uint32_t milliseconds) {
+    struct timespec delay;
+
+    delay.tv_sec = milliseconds / 1000;
+    delay.tv_nsec = (milliseconds % 1000) * 1000000L;
+    while (nanosleep(&delay, &delay) != 0) {
+    }
+}
+
+/* Draws a number in [0, bound] from the OS entropy pool, 0 if it cannot be read */
+static uint64_t randomUpTo(uint64_t bound) {
+    uint64_t value = 0;
+
+    if (getRandomBytes((uint8_t*) &value, sizeof(value)) != SUCCESSFULL_OPERATION) {
+        return 0;
+    }
+    return value % (bound + 1);
+}
+
+/*
+ * Delay before the given retry: backoffBaseMs doubled per previous retry,
+ * bounded by backoffMaxMs, then drawn in [delay / 2, delay] so that the
+ * retries of many clients do not align.
+ */
+static uint32_t backoffDelay(const HandshakeAdmissionConfig* pConfig, uint32_t retry) {
+    uint64_t delay = pConfig->backoffBaseMs;
+
+    while ( (retry > 0) && (delay < pConfig->backoffMaxMs) ) {
+        delay <<= 1;
+        retry--;
+    }
+    if (delay > pConfig->backoffMaxMs) {
+        delay = pConfig->backoffMaxMs;
+    }
+    return (uint32_t) (delay / 2 + randomUpTo(delay - delay / 2));
+}
+
+uint32_t kerberos_protocol_get_start_delay(void* pContext) {
+    KerberosContext *pKerberosContext = (KerberosContext*) pContext;
+    uint32_t startDelayMaxMs = 0;
+
+    if ( (!pKerberosContext) || (pKerberosContext->startDelayed) ) {
+        return 0;
+    }
+    pKerberosContext->startDelayed = 1;
+
+    pthread_mutex_lock(&admissionMutex);
+    startDelayMaxMs = admissionConfig.startDelayMaxMs;
+    pthread_mutex_unlock(&admissionMutex);
+
+    // spread the first handshakes of devices that boot together
+    return (uint32_t) randomUpTo(startDelayMaxMs);
+}
+
+uint8_t kerberos_protocol_retry_handshake(void* pContext,
+                                          uint32_t retry,
+                                          uint8_t sendFailed,
+                                          uint32_t httpStatusCode,
+                                          uint32_t* delayMs) {
+    KerberosContext *pKerberosContext = (KerberosContext*) pContext;
+    uint8_t result = MA_COMM_FALSE;
+
+    if ( (!pKerberosContext) || (!delayMs) ) {
+        return MA_COMM_FALSE;
+    }
+    if ( (!sendFailed) && (httpStatusCode < 500) &&
+         (pKerberosContext->handshake.errorCode != KRB_ERR_GENERIC) ) {
+        return MA_COMM_FALSE;
+    }
+
+    pthread_mutex_lock(&admissionMutex);
+    if (retry < admissionConfig.maxRetries) {
+        *delayMs = backoffDelay(&admissionConfig, retry);
+        retriedHandshakes++;
+        result = MA_COMM_TRUE;
+    }
+    pthread_mutex_unlock(&admissionMutex);
+
+    return result;
+}
+
+/*
+ * Runs one handshake attempt. *sendFailed is set when a request could not
+ * be sent, and *httpStatusCode tells the status of the last reply.
+ */
+static uint8_t runHandshake(void* pContext, uint8_t* sendFailed, uint32_t* httpStatusCode) {
+    uint8_t result = 0;
+    const char* url = NULL;
+    uint8_t *encodedOutput = NULL;
+    size_t encodedOutputLength = 0;
+    uint8_t* pResponse = NULL;
+    size_t responseSize = 0;
+    struct curl_slist *pSlist = NULL;
+
+    *sendFailed = 0;
+    *httpStatusCode = 0;
+    result = kerberos_protocol_begin_handshake(pContext,
+                                               &url,
+                                               &encodedOutput,
+                                               &encodedOutputLength);
+
+    while ( (result == MA_COMM_SUCCESS) && (encodedOutput) ) {
+        LOG("Sending %s\n", url);
+        pSlist = curl_slist_append(NULL, HANDSHAKE_CONTENT_TYPE);
+        result = send_message(url,
+                              "POST",
+                              &pSlist,
+                              encodedOutput,
+                              encodedOutputLength,
+                              httpStatusCode,
+                              &pResponse,
+                              &responseSize);
+        free(encodedOutput);
+        encodedOutput = NULL;
+        if (result != MA_COMM_SUCCESS) {
+            LOG("Fail to send the handshake request\n");
+            ((KerberosContext*) pContext)->handshake.state = NOT_INITIALIZED;
+            *sendFailed = 1;
+            result = MA_COMM_INVALID_STATE;
+            break;
+        }
+
+        result = kerberos_protocol_continue_handshake(pContext,
+                                                      pResponse,
+                                                      responseSize,
+                                                      &url,
+                                                      &encodedOutput,
+                                                      &encodedOutputLength);
+        free(pResponse);
+        pResponse = NULL;
+    }
+
+    if (result == MA_COMM_SUCCESS) {
+        result = kerberos_protocol_install_secure_channel(pContext);
+    }
+
+    return result;
+}
+
+uint8_t kerberos_protocol_execute_handshake(void* pContext) {
+    uint8_t result = 0;
+    uint8_t sendFailed = 0;
+    uint32_t httpStatusCode = 0;
+    uint32_t retry = 0;
+    uint32_t delay = 0;
+
+    if (!pContext) {
+        LOG("invalid kerberos context\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    delay = kerberos_protocol_get_start_delay(pContext);
+    if (delay > 0) {
+        LOG("Delaying the first handshake by %u ms\n", delay);
+        sleepMs(delay);
     }
+
+    for (retry = 0; ; ++retry) {
+        result = runHandshake(pContext, &sendFailed, &httpStatusCode);
+        if ( (result == MA_COMM_SUCCESS) ||
+             (kerberos_protocol_retry_handshake(pContext, retry, sendFailed, httpStatusCode, &delay) != MA_COMM_TRUE) ) {
+            break;
+        }
+        LOG("Retrying the handshake in %u ms\n", delay);
+        sleepMs(delay);
+    }
+
     return result;
 }
 
+void kerberos_protocol_configure_admission(const HandshakeAdmissionConfig* pConfig) {
+    if (!pConfig) {
+        return;
+    }
+
+    pthread_mutex_lock(&admissionMutex);
+    admissionConfig = *pConfig;
+    pthread_mutex_unlock(&admissionMutex);
+}
+
+void kerberos_protocol_get_admission_stats(uint64_t* retried) {
+    pthread_mutex_lock(&admissionMutex);
+    if (retried) {
+        *retried = retriedHandshakes;
+    }
+    pthread_mutex_unlock(&admissionMutex);
+}
+
+uint8_t kerberos_protocol_install_secure_channel(void* pContext) {
+    KerberosContext *pKerberosContext = NULL;
+    SessionKeys *pKeys = NULL;
+    errno_t result = 0;
+
+    if (!pContext) {
+        LOG("invalid kerberos context\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+    pKerberosContext = (KerberosContext*) pContext;
+    pKeys = &pKerberosContext->session.sessionKeys;
+
+    if (pKerberosContext->session.state != ESTABLISHED_CHANNEL) {
+        LOG("Channel is not established\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    result = initSecureChannelWithAlgorithm(pKeys->algorithm,
+                                            pKeys->keyLength,
+                                            pKeys->ivLength,
+                                            pKerberosContext->tagLen,
+                                            pKeys->keyCS,
+                                            pKeys->keySC,
+                                            pKeys->ivCS,
+                                            pKeys->ivSC);
+    if (result != SUCCESSFULL_OPERATION) {
+        LOG("Fail to initialize crypto\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t kerberos_protocol_get_handshake_state(void* pContext) {
+    if (!pContext) {
+        return NOT_INITIALIZED;
+    }
+    return ((KerberosContext*) pContext)->handshake.state;
+}
+
 uint8_t kerberos_protocol_is_mutual_authenticated(void* pContext) {
     KerberosContext *pKerberosContext = NULL;
 
@@ -352,23 +669,301 @@ uint8_t kerberos_protocol_is_mutual_authenticated(void* pContext) {
     }
     pKerberosContext = (KerberosContext*) pContext;
 
-    if (pKerberosContext->state != ESTABLISHED_CHANNEL) {
-        LOG("Channel is not established (%d)\n", pKerberosContext->state);
+    if (pKerberosContext->session.state != ESTABLISHED_CHANNEL) {
+        LOG("Channel is not established (%d)\n", pKerberosContext->handshake.state);
         return MA_COMM_FALSE;
     }
 
     uint64_t currServerTime = 0;
-    getAdjustedUTC(pKerberosContext->offset, &currServerTime);
-    if (currServerTime > pKerberosContext->expireTimestamp) {
+    getAdjustedUTC(pKerberosContext->session.offset, &currServerTime);
+    if (currServerTime > pKerberosContext->session.expireTimestamp) {
         LOG("Authentication has been expired\n");
         return MA_COMM_FALSE;
     }
 
     LOG("Remaining %llu ms to expire the mutual authentication\n",
-            pKerberosContext->expireTimestamp - currServerTime);
+            pKerberosContext->session.expireTimestamp - currServerTime);
     return MA_COMM_TRUE;
 }
 
+/* Key sealing the session cache, derived from the key shared with the AS */
+static uint8_t deriveCacheKey(KerberosContext *pContext, uint8_t *cacheKey) {
+    if (deriveKey(pContext->sharedKey,
+                  SHARED_KEY_LENGTH,
+                  (const uint8_t*) SESSION_CACHE_LABEL,
+                  sizeof(SESSION_CACHE_LABEL) - 1,
+                  cacheKey,
+                  SHARED_KEY_LENGTH) != SUCCESSFULL_OPERATION) {
+        return MA_COMM_INVALID_STATE;
+    }
+    return MA_COMM_SUCCESS;
+}
+
+/* The cache is only accepted by the principals it was written for */
+static void getCacheAad(KerberosContext *pContext, uint8_t *aad) {
+    memcpy(aad, pContext->cname, PRINCIPAL_NAME_LENGTH);
+    memcpy(aad + PRINCIPAL_NAME_LENGTH, pContext->sname, PRINCIPAL_NAME_LENGTH);
+}
+
+uint8_t kerberos_protocol_export_session(void* pContext,
+                                         uint8_t** blob,
+                                         size_t* blobLength) {
+    KerberosContext *pKerberosContext = NULL;
+    KerberosSession *pSession = NULL;
+    uint8_t result = MA_COMM_SUCCESS;
+    uint8_t *encodedKeys = NULL;
+    size_t encodedKeysLength = 0;
+    size_t ticketLength = 0;
+    uint8_t *plain = NULL;
+    size_t plainLength = 0;
+    size_t offset = 0;
+    uint8_t *sealed = NULL;
+    size_t sealedLength = 0;
+    uint64_t value = 0;
+    uint8_t cacheKey[SHARED_KEY_LENGTH];
+    uint8_t aad[2 * PRINCIPAL_NAME_LENGTH];
+    uint8_t iv[SESSION_CACHE_IV_LENGTH];
+
+    if ( (!pContext) || (!blob) || (!blobLength) ) {
+        LOG("invalid kerberos context\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+    pKerberosContext = (KerberosContext*) pContext;
+    pSession = &pKerberosContext->session;
+
+    if (pSession->state != ESTABLISHED_CHANNEL) {
+        LOG("Channel is not established\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    if ( (getEncodedSessionKeys(&pSession->sessionKeys, &encodedKeys, &encodedKeysLength) != SUCCESSFULL_OPERATION) ||
+         (getEncodedLengthTicket(&pSession->ticket, &ticketLength) != MA_COMM_SUCCESS) ) {
+        LOG("Fail to serialize the session\n");
+        result = MA_COMM_INVALID_STATE;
+        goto FAIL;
+    }
+
+    // version, session id, algorithm, offset, expiration, session keys, ticket
+    plainLength = 1 + SESSION_ID_LENGTH + 1 + 2 * sizeof(uint64_t) + encodedKeysLength + ticketLength;
+    plain = (uint8_t*) malloc(plainLength);
+    if (!plain) {
+        result = MA_COMM_OUT_OF_MEMORY;
+        goto FAIL;
+    }
+    plain[offset++] = SESSION_CACHE_VERSION;
+    memcpy(plain + offset, pSession->sessionId, SESSION_ID_LENGTH);
+    offset += SESSION_ID_LENGTH;
+    plain[offset++] = pSession->sessionKeys.algorithm;
+    value = htobe64(pSession->offset);
+    memcpy(plain + offset, &value, sizeof(uint64_t));
+    offset += sizeof(uint64_t);
+    value = htobe64(pSession->expireTimestamp);
+    memcpy(plain + offset, &value, sizeof(uint64_t));
+    offset += sizeof(uint64_t);
+    memcpy(plain + offset, encodedKeys, encodedKeysLength);
+    offset += encodedKeysLength;
+    if (getEncodedTicketOnBuffer(&pSession->ticket, plainLength - offset, plain + offset, &ticketLength) != MA_COMM_SUCCESS) {
+        LOG("Fail to serialize the ticket\n");
+        result = MA_COMM_INVALID_STATE;
+        goto FAIL;
+    }
+
+    // a fresh IV for every save, as the cache key does not change
+    if (getRandomBytes(iv, SESSION_CACHE_IV_LENGTH) != SUCCESSFULL_OPERATION) {
+        LOG("Fail to generate the cache IV\n");
+        result = MA_COMM_INVALID_STATE;
+        goto FAIL;
+    }
+    getCacheAad(pKerberosContext, aad);
+    result = deriveCacheKey(pKerberosContext, cacheKey);
+    if (result != MA_COMM_SUCCESS) {
+        goto FAIL;
+    }
+    if (sealWithKey(SESSION_ALGORITHM_AES_GCM, cacheKey, SHARED_KEY_LENGTH, iv, SESSION_CACHE_IV_LENGTH,
+                    pKerberosContext->tagLen, aad, sizeof(aad), plain, plainLength,
+                    &sealed, &sealedLength) != SUCCESSFULL_OPERATION) {
+        LOG("Fail to seal the session\n");
+        result = MA_COMM_INVALID_STATE;
+        goto FAIL;
+    }
+
+    // [ivLength][iv][ciphertext||tag], as the secure channel messages
+    *blob = (uint8_t*) malloc(1 + SESSION_CACHE_IV_LENGTH + sealedLength);
+    if (!*blob) {
+        result = MA_COMM_OUT_OF_MEMORY;
+        goto FAIL;
+    }
+    (*blob)[0] = SESSION_CACHE_IV_LENGTH;
+    memcpy(*blob + 1, iv, SESSION_CACHE_IV_LENGTH);
+    memcpy(*blob + 1 + SESSION_CACHE_IV_LENGTH, sealed, sealedLength);
+    *blobLength = 1 + SESSION_CACHE_IV_LENGTH + sealedLength;
+
+FAIL:
+    memset_s(cacheKey, SHARED_KEY_LENGTH, 0, SHARED_KEY_LENGTH);
+    if (encodedKeys) {
+        memset_s(encodedKeys, encodedKeysLength, 0, encodedKeysLength);
+        free(encodedKeys);
+    }
+    if (plain) {
+        memset_s(plain, plainLength, 0, plainLength);
+        free(plain);
+    }
+    free(sealed);
+    return result;
+}
+
+uint8_t kerberos_protocol_import_session(void* pContext,
+                                         uint8_t* blob,
+                                         size_t blobLength) {
+    KerberosContext *pKerberosContext = NULL;
+    KerberosSession session;
+    uint8_t result = MA_COMM_SUCCESS;
+    uint8_t *plain = NULL;
+    size_t plainLength = 0;
+    size_t offset = 0;
+    size_t length = 0;
+    uint64_t value = 0;
+    uint64_t currServerTime = 0;
+    uint8_t algorithm = 0;
+    uint8_t cacheKey[SHARED_KEY_LENGTH];
+    uint8_t aad[2 * PRINCIPAL_NAME_LENGTH];
+
+    if ( (!pContext) || (!blob) ) {
+        LOG("invalid kerberos context\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+    pKerberosContext = (KerberosContext*) pContext;
+
+    if ( (blobLength < 1) || (blobLength < 1 + (size_t) blob[0]) ) {
+        LOG("Invalid session cache\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+
+    getCacheAad(pKerberosContext, aad);
+    result = deriveCacheKey(pKerberosContext, cacheKey);
+    if (result != MA_COMM_SUCCESS) {
+        return result;
+    }
+    result = openWithKey(SESSION_ALGORITHM_AES_GCM, cacheKey, SHARED_KEY_LENGTH, blob + 1, blob[0],
+                         pKerberosContext->tagLen, aad, sizeof(aad), blob + 1 + blob[0],
+                         blobLength - 1 - blob[0], &plain, &plainLength);
+    memset_s(cacheKey, SHARED_KEY_LENGTH, 0, SHARED_KEY_LENGTH);
+    if (result != SUCCESSFULL_OPERATION) {
+        LOG("Fail to open the session cache\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    session_init(&session);
+    result = MA_COMM_INVALID_STATE;
+    if ( (plainLength < 1 + SESSION_ID_LENGTH + 1 + 2 * sizeof(uint64_t)) ||
+         (plain[0] != SESSION_CACHE_VERSION) ) {
+        LOG("Unknown session cache version\n");
+        goto FAIL;
+    }
+    offset = 1;
+    memcpy(session.sessionId, plain + offset, SESSION_ID_LENGTH);
+    offset += SESSION_ID_LENGTH;
+    algorithm = plain[offset++];
+    memcpy(&value, plain + offset, sizeof(uint64_t));
+    session.offset = be64toh(value);
+    offset += sizeof(uint64_t);
+    memcpy(&value, plain + offset, sizeof(uint64_t));
+    session.expireTimestamp = be64toh(value);
+    offset += sizeof(uint64_t);
+
+    if (setEncodedSessionKeys(&session.sessionKeys, plain + offset, plainLength - offset, &length) != SUCCESSFULL_OPERATION) {
+        LOG("Fail to deserialize the cached session keys\n");
+        goto FAIL;
+    }
+    session.sessionKeys.algorithm = algorithm;
+    offset += length;
+    if ( (checkSessionKeys(&session.sessionKeys) != SUCCESSFULL_OPERATION) ||
+         (session.sessionKeys.keyLength > SESSION_KEY_MAX_LENGTH) ||
+         (setEncodedTicket(&session.ticket, plain + offset, plainLength - offset, &length) != MA_COMM_SUCCESS) ) {
+        LOG("Fail to deserialize the cached session\n");
+        goto FAIL;
+    }
+
+    getAdjustedUTC(session.offset, &currServerTime);
+    if (currServerTime > session.expireTimestamp) {
+        LOG("The cached session has expired\n");
+        goto FAIL;
+    }
+
+    // same end state as commitSession, as if the handshake had just run
+    session.state = ESTABLISHED_CHANNEL;
+    session_erase(&pKerberosContext->session);
+    pKerberosContext->session = session;
+    session_init(&session);
+    session_erase(&pKerberosContext->handshake);
+    pKerberosContext->handshake.state = ESTABLISHED_CHANNEL;
+    result = MA_COMM_SUCCESS;
+
+FAIL:
+    session_erase(&session);
+    memset_s(plain, plainLength, 0, plainLength);
+    free(plain);
+    return result;
+}
+
+uint8_t kerberos_protocol_get_session(void* pContext, SessionSnapshot* pSnapshot) {
+    KerberosContext *pKerberosContext = NULL;
+    SessionKeys *pKeys = NULL;
+
+    if ( (!pContext) || (!pSnapshot) ) {
+        LOG("invalid kerberos context\n");
+        return MA_COMM_INVALID_PARAMETER;
+    }
+    pKerberosContext = (KerberosContext*) pContext;
+    pKeys = &pKerberosContext->session.sessionKeys;
+
+    if ( (pKerberosContext->session.state != ESTABLISHED_CHANNEL) ||
+         (pKeys->keyLength > SESSION_KEY_MAX_LENGTH) ) {
+        LOG("Channel is not established\n");
+        return MA_COMM_INVALID_STATE;
+    }
+
+    pSnapshot->algorithm = pKeys->algorithm;
+    pSnapshot->keyLength = pKeys->keyLength;
+    pSnapshot->tagLen = pKerberosContext->tagLen;
+    memcpy(pSnapshot->keyCS, pKeys->keyCS, pKeys->keyLength);
+    memcpy(pSnapshot->keySC, pKeys->keySC, pKeys->keyLength);
+    memcpy(pSnapshot->sessionId, pKerberosContext->session.sessionId, SESSION_ID_LENGTH);
+    pSnapshot->offset = pKerberosContext->session.offset;
+    pSnapshot->expireTimestamp = pKerberosContext->session.expireTimestamp;
+
+    return MA_COMM_SUCCESS;
+}
+
+uint8_t kerberos_protocol_is_session_valid(const SessionSnapshot* pSnapshot) {
+    uint64_t currServerTime = 0;
+
+    if (!pSnapshot) {
+        return MA_COMM_FALSE;
+    }
+
+    getAdjustedUTC(pSnapshot->offset, &currServerTime);
+    return (currServerTime > pSnapshot->expireTimestamp) ? MA_COMM_FALSE : MA_COMM_TRUE;
+}
+
+uint8_t kerberos_protocol_is_session_rejected(uint8_t* response, size_t responseLength) {
+    size_t offset = 0;
+    uint8_t errorCode = 0;
+    Error error;
+
+    if ( (!response) ||
+         (setEncodedError(&error, response, responseLength, &offset) != SUCCESSFULL_OPERATION) ||
+         (decodeError(&error, &errorCode) != SUCCESSFULL_OPERATION) ) {
+        return MA_COMM_FALSE;
+    }
+
+    LOG("An error response has been received: %s\n", getErrorString(error));
+    if ( (errorCode == KRB_AP_ERR_TKT_EXPIRED) || (errorCode == KRB_AP_ERR_SKEW) ) {
+        return MA_COMM_TRUE;
+    }
+    return MA_COMM_FALSE;
+}
+
 uint8_t kerberos_protocol_get_session_id(void* pContext,
                                          size_t sessionIdSize,
                                          uint8_t* sessionId) {
@@ -385,63 +980,39 @@ uint8_t kerberos_protocol_get_session_id(void* pContext,
         return MA_COMM_INVALID_PARAMETER;
     }
 
-    memcpy(sessionId, pKerberosContext->sessionId, SESSION_ID_LENGTH);
+    memcpy(sessionId, pKerberosContext->session.sessionId, SESSION_ID_LENGTH);
 
     return MA_COMM_SUCCESS;
 }
 
 uint8_t processState(KerberosContext *pContext,
                       uint8_t* encodedInput,
-                      size_t encodedInputLength) {
+                      size_t encodedInputLength,
+                      uint8_t** encodedOutput,
+                      size_t* encodedOutputLength) {
     errno_t result = 0;
-    uint8_t *encodedOutput = NULL;
-    size_t encodedOutputLength = 0;
-    uint8_t* pResponse = NULL;
-    size_t responseSize = 0;
-    uint32_t httpStatusCode = 0;
-    struct curl_slist *pSlist = NULL;
 
-    LOG("Processing state: %s\n", protocolStateToString(pContext->state));
+    *encodedOutput = NULL;
+    *encodedOutputLength = 0;
+
+    LOG("Processing state: %s\n", protocolStateToString(pContext->handshake.state));
 
     // State machine that represents client side of the kerberos protocol
-    switch(pContext->state) {
-        // Secure channel not yet initialized. Creates a requestAS and
-        // send_message it to the kerberos server
+    switch(pContext->handshake.state) {
+        // Secure channel not yet initialized. Creates a requestAS, which
+        // must be sent to the kerberos server
         case NOT_INITIALIZED:
             LOG("Creating requestAS\n");
-            result = doRequestAS(pContext, &encodedOutput, &encodedOutputLength);
+            result = doRequestAS(pContext, encodedOutput, encodedOutputLength);
             if(result != SUCCESSFULL_OPERATION) {
                 result = 1;
                 break;
             }
             goNextState(pContext);
-            LOG("Sending requestAS\n");
-            pSlist = curl_slist_append(pSlist, "Content-Type: application/x-www-form-urlencoded");
-            result = send_message(pContext->urlRequestAS,
-                                  "POST",
-                                  &pSlist,
-                                  encodedOutput,
-                                  encodedOutputLength,
-                                  &httpStatusCode,
-                                  &pResponse,
-                                  &responseSize);
-            free(encodedOutput);
-            if (result != SUCCESSFULL_OPERATION) {
-                result = 1;
-                break;
-            }
-
-            result = processReply(pContext, responseSize, pResponse);
-            free(pResponse);
-            if (result != 0) {
-                result = 1;
-                break;
-            }
-
             result = 0;
             break;
         // After requestAS was sent, the state machine goes to WAIT_REPLY_AS state.
-        // This states expects to receive a valid reply AS and then send_messages a requestAP.
+        // This states expects to receive a valid reply AS and then creates a requestAP.
         case WAIT_REPLY_AS:
             LOG("ReplyAS received. Verifying data received ...\n");
             result = verifyReplyAS(pContext, encodedInput, encodedInputLength);
@@ -451,37 +1022,13 @@ uint8_t processState(KerberosContext *pContext,
                 break;
             }
             LOG("ReplyAS verified. Creating requestAP\n");
-            result = doRequestAP(pContext, &encodedOutput, &encodedOutputLength);
+            result = doRequestAP(pContext, encodedOutput, encodedOutputLength);
             if(result != SUCCESSFULL_OPERATION) {
                 LOG("Fail to create RequestAP\n");
                 result = 1;
                 break;
             }
             goNextState(pContext);
-            pSlist = curl_slist_append(pSlist, "Content-Type: application/x-www-form-urlencoded");
-            LOG("Sending requestAP\n");
-            result = send_message(pContext->urlRequestAP,
-                                  "POST",
-                                  &pSlist,
-                                  encodedOutput,
-                                  encodedOutputLength,
-                                  &httpStatusCode,
-                                  &pResponse,
-                                  &responseSize);
-            free(encodedOutput);
-            if (result != SUCCESSFULL_OPERATION) {
-                LOG("Fail to send RequestAP\n");
-                result = 1;
-                break;
-            }
-
-            result = processReply(pContext, responseSize, pResponse);
-            free(pResponse);
-            if (result != 0) {
-                result = 1;
-                break;
-            }
-
             result = 0;
             break;
 //         After request AP was sent, the state machine goes to WAIT_REPLY_AP.
@@ -497,6 +1044,7 @@ uint8_t processState(KerberosContext *pContext,
             }
             LOG("ReplyAP verified\n");
             goNextState(pContext);
+            commitSession(pContext);
             result = 0;
             break;
         case ESTABLISHED_CHANNEL:
@@ -507,23 +1055,43 @@ uint8_t processState(KerberosContext *pContext,
     }
 
     if (result != 0) {
-        LOG("problem on %s\n", protocolStateToString(pContext->state));
-        pContext->state = NOT_INITIALIZED;
+        LOG("problem on %s\n", protocolStateToString(pContext->handshake.state));
+        if (*encodedOutput) {
+            free(*encodedOutput);
+            *encodedOutput = NULL;
+            *encodedOutputLength = 0;
+        }
+        pContext->handshake.state = NOT_INITIALIZED;
     }
 
     return result;
 }
 
+const char* getRequestUrl(KerberosContext *pContext) {
+    if (pContext->handshake.state == WAIT_REPLY_AS) {
+        return pContext->urlRequestAS;
+    }
+    return pContext->urlRequestAP;
+}
+
+void commitSession(KerberosContext *pContext) {
+    session_erase(&pContext->session);
+    // the negotiated buffers now belong to the established session
+    pContext->session = pContext->handshake;
+    session_init(&pContext->handshake);
+    pContext->handshake.state = ESTABLISHED_CHANNEL;
+}
+
 void goNextState(KerberosContext *pContext) {
-    switch (pContext->state) {
+    switch (pContext->handshake.state) {
         case NOT_INITIALIZED:
-            pContext->state = WAIT_REPLY_AS;
+            pContext->handshake.state = WAIT_REPLY_AS;
             break;
         case WAIT_REPLY_AS:
-            pContext->state = WAIT_REPLY_AP;
+            pContext->handshake.state = WAIT_REPLY_AP;
             break;
         case WAIT_REPLY_AP:
-            pContext->state = ESTABLISHED_CHANNEL;
+            pContext->handshake.state = ESTABLISHED_CHANNEL;
             break;
         case ESTABLISHED_CHANNEL:
             // do nothing
@@ -533,21 +1101,32 @@ void goNextState(KerberosContext *pContext) {
 
 uint8_t processReply(KerberosContext* pContext,
                   size_t encodedInputLength,
-                  uint8_t* encodedInput) {
+                  uint8_t* encodedInput,
+                  uint8_t** encodedOutput,
+                  size_t* encodedOutputLength) {
     uint8_t isError = 0;
     errno_t result = 0;
 
+    *encodedOutput = NULL;
+    *encodedOutputLength = 0;
+
     if ( (!encodedInput) || (encodedInputLength == 0) ) {
+        pContext->handshake.state = NOT_INITIALIZED;
         return 1;
     }
 
     isError = checkIfError(pContext, encodedInput, encodedInputLength);
     if(isError == 0) {
-        result = processState(pContext, encodedInput, encodedInputLength);
+        result = processState(pContext,
+                              encodedInput,
+                              encodedInputLength,
+                              encodedOutput,
+                              encodedOutputLength);
         if (result != 0) {
             result = 1;
         }
     } else {
+        pContext->handshake.state = NOT_INITIALIZED;
         result = 1;
     }
 
@@ -565,7 +1144,7 @@ uint8_t checkIfError(KerberosContext* pContext,
     /* If it properly decodes, then it is an error */
     result = setEncodedError(&error, encodedInput, encodedInputLength, &offset);
     if(result == SUCCESSFULL_OPERATION) {
-        decodeError(&error, &(pContext->errorCode));
+        decodeError(&error, &(pContext->handshake.errorCode));
         LOG("An error response has been received: %s\n", getErrorString(error));
         return 1;
     }
@@ -584,12 +1163,13 @@ uint8_t doRequestAS(KerberosContext *pContext,
                              sizeof(pContext->cname),
                              pContext->sname,
                              sizeof(pContext->sname),
-                             pContext->nonce,
-                             sizeof(pContext->nonce));
+                             pContext->handshake.nonce,
+                             sizeof(pContext->handshake.nonce));
     if(result != MA_COMM_SUCCESS) {
         LOG("Fail to encode requestAS\n");
         return MA_COMM_INVALID_STATE;
     }
+    requestAS.algorithm = pContext->algorithm;
 
     result = getEncodedRequestAS(&requestAS, encodedOutput, encodedLength);
     if (result != MA_COMM_SUCCESS) {
@@ -619,7 +1199,7 @@ uint8_t verifyReplyAS(KerberosContext *pContext,
         LOG("Invalid ReplyAS length\n");
         return MA_COMM_INVALID_PARAMETER;
     }
-    memcpy(pContext->sessionId, encodedInput, SESSION_ID_LENGTH);
+    memcpy(pContext->handshake.sessionId, encodedInput, SESSION_ID_LENGTH);
 
     /* Modify encodedInput to ignore sessionId */
     encodedInput = encodedInput + (SESSION_ID_LENGTH);
@@ -635,7 +1215,7 @@ uint8_t verifyReplyAS(KerberosContext *pContext,
     LOG("SessionId: ");
     uint8_t i = 0;
     for(i = 0; i < SESSION_ID_LENGTH; ++i) {
-        LOG("%02x", pContext->sessionId[i]);
+        LOG("%02x", pContext->handshake.sessionId[i]);
     }
     LOG("\n");
     dumpReplyAS(&replyAS, 0);
@@ -647,31 +1227,23 @@ uint8_t verifyReplyAS(KerberosContext *pContext,
         goto REPLY_AS_CLEAN;
     }
 
-    // It's used only for communication between this component and the Kerberos AS
-    result = initSecureChannel(SHARED_KEY_LENGTH,
-                               replyAS.encPart.ivLength,
-                               TAG_LEN,
-                               pContext->sharedKey,
-                               pContext->sharedKey,
-                               replyAS.encPart.iv,
-                               replyAS.encPart.iv);
-    if(result != SUCCESSFULL_OPERATION) {
-        LOG("Fail to initialize crypto\n");
-        result = MA_COMM_INVALID_STATE;
-        goto REPLY_AS_CLEAN;
-    }
-
-    // Properly decrypts the encrypted part of the replyAS
+    // Properly decrypts the encrypted part of the replyAS with the key
+    // shared with the Kerberos AS
     uint8_t* decEncKdcRep = NULL;
     size_t decEncKdcRepLength = 0;
 
-    result = decryptTo(NULL,
-                       0,
-                       replyAS.encPart.ciphertext,
-                       replyAS.encPart.ciphertextLength,
-                       &decEncKdcRep,
-                       &decEncKdcRepLength);
-    clearSecureChannel();
+    result = openWithKey(SESSION_ALGORITHM_AES_GCM,
+                         pContext->sharedKey,
+                         SHARED_KEY_LENGTH,
+                         replyAS.encPart.iv,
+                         replyAS.encPart.ivLength,
+                         TAG_LEN,
+                         NULL,
+                         0,
+                         replyAS.encPart.ciphertext,
+                         replyAS.encPart.ciphertextLength,
+                         &decEncKdcRep,
+                         &decEncKdcRepLength);
 
     if(result != SUCCESSFULL_OPERATION) {
         LOG("Fail to decrypt ReplyAS enc part\n");
@@ -697,7 +1269,7 @@ uint8_t verifyReplyAS(KerberosContext *pContext,
     calculateOffset(encKdcPart.authtime, &localTimeOffset);
 
     // Check if nonce is equal to the nonce that was sent
-    if (memcmp(pContext->nonce, encKdcPart.nonce, NONCE_LENGTH) != 0) {
+    if (memcmp(pContext->handshake.nonce, encKdcPart.nonce, NONCE_LENGTH) != 0) {
         LOG("ReplyAs nonce does not match\n");
         result = MA_COMM_INVALID_STATE;
         goto REPLY_AS_CLEAN;
@@ -709,21 +1281,29 @@ uint8_t verifyReplyAS(KerberosContext *pContext,
         goto REPLY_AS_CLEAN;
     }
 
+    // The AS may fall back to AES-GCM, but not choose an algorithm that wasn't proposed
+    if (encKdcPart.sk.algorithm != SESSION_ALGORITHM_AES_GCM &&
+        encKdcPart.sk.algorithm != pContext->algorithm) {
+        LOG("ReplyAs algorithm was not proposed\n");
+        result = MA_COMM_INVALID_STATE;
+        goto ENC_KDC_PART_CLEAN;
+    }
+
     // everything is right, so let's commit the data into context
-    result = copyTicket(&replyAS.ticket, &pContext->ticket);
+    result = copyTicket(&replyAS.ticket, &pContext->handshake.ticket);
     if (result != MA_COMM_SUCCESS) {
         LOG("Fail to copy ticket into context\n");
         result = MA_COMM_OUT_OF_MEMORY;
         goto REPLY_AS_CLEAN;
     }
-    result = copySessionKeys(&encKdcPart.sk, &pContext->sessionKeys);
+    result = copySessionKeys(&encKdcPart.sk, &pContext->handshake.sessionKeys);
     if (result != MA_COMM_SUCCESS) {
         LOG("Fail to copy session keys into context\n");
         result = MA_COMM_OUT_OF_MEMORY;
         goto TICKET_CTX_CLEAN;
     }
-    pContext->expireTimestamp = encKdcPart.endtime;
-    pContext->offset = localTimeOffset;
+    pContext->handshake.expireTimestamp = encKdcPart.endtime;
+    pContext->handshake.offset = localTimeOffset;
 
     eraseReplyAS(&replyAS);
     eraseEncKdcPart(&encKdcPart);
@@ -731,13 +1311,13 @@ uint8_t verifyReplyAS(KerberosContext *pContext,
 
 //rollback flow:
 TICKET_CTX_CLEAN:
-    eraseTicket(&pContext->ticket);
+    eraseTicket(&pContext->handshake.ticket);
 ENC_KDC_PART_CLEAN:
     eraseEncKdcPart(&encKdcPart);
 REPLY_AS_CLEAN:
     eraseReplyAS(&replyAS);
 SESSION_ID_CLEAN:
-    memset_s(pContext->sessionId, SESSION_ID_LENGTH, 0, SESSION_ID_LENGTH);
+    memset_s(pContext->handshake.sessionId, SESSION_ID_LENGTH, 0, SESSION_ID_LENGTH);
     return result;
 }
 
@@ -752,7 +1332,7 @@ uint8_t doRequestAP(KerberosContext *pContext,
     Authenticator authenticator;
 
     /* Get the number of milliseconds since midnight January 1, 1970 */
-    getAdjustedUTC(pContext->offset, &pContext->timestamp);
+    getAdjustedUTC(pContext->handshake.offset, &pContext->handshake.timestamp);
 
     /* Create the authenticator part of the request */
     uint8_t* encodedAuth;
@@ -761,7 +1341,7 @@ uint8_t doRequestAP(KerberosContext *pContext,
     result = encodeAuthenticator(&authenticator,
                                  pContext->cname,
                                  PRINCIPAL_NAME_LENGTH,
-                                 pContext->timestamp);
+                                 pContext->handshake.timestamp);
     if(result != MA_COMM_SUCCESS) {
         LOG("Fail to create ReplyAP's authenticator\n");
         return MA_COMM_INVALID_STATE;
@@ -776,31 +1356,21 @@ uint8_t doRequestAP(KerberosContext *pContext,
 
     eraseAuthenticator(&authenticator);
 
-    // Initializes the secure channel
-    // todo: is it the better place to do it? once we will not
-    // close it any more
-    result = initSecureChannel(pContext->sessionKeys.keyLength,
-                               pContext->sessionKeys.ivLength,
-                               pContext->tagLen,
-                               pContext->sessionKeys.keyCS,
-                               pContext->sessionKeys.keySC,
-                               pContext->sessionKeys.ivCS,
-                               pContext->sessionKeys.ivSC);
-    if(result != SUCCESSFULL_OPERATION) {
-        LOG("Fail to initialize crypto\n");
-        free(encodedAuth);
-        return MA_COMM_INVALID_STATE;
-    }
-
     initRequestAP(&requestAP);
 
     /* Encrypts the authenticator using the session key and session iv for the client -> server communication */
-    result = encryptTo(NULL,
-                       0,
-                       encodedAuth,
-                       encodedAuthLength,
-                       &requestAP.encryptedData.ciphertext,
-                       &requestAP.encryptedData.ciphertextLength);
+    result = sealWithKey(pContext->handshake.sessionKeys.algorithm,
+                         pContext->handshake.sessionKeys.keyCS,
+                         pContext->handshake.sessionKeys.keyLength,
+                         pContext->handshake.sessionKeys.ivCS,
+                         pContext->handshake.sessionKeys.ivLength,
+                         pContext->tagLen,
+                         NULL,
+                         0,
+                         encodedAuth,
+                         encodedAuthLength,
+                         &requestAP.encryptedData.ciphertext,
+                         &requestAP.encryptedData.ciphertextLength);
     free(encodedAuth);
     if(result != SUCCESSFULL_OPERATION) {
         LOG("Fail to encrypt RequestAP's authenticator\n");
@@ -808,15 +1378,15 @@ uint8_t doRequestAP(KerberosContext *pContext,
     }
 
     result = copyIVOnEncData(&requestAP.encryptedData,
-                             pContext->sessionKeys.ivCS,
-                             pContext->sessionKeys.ivLength);
+                             pContext->handshake.sessionKeys.ivCS,
+                             pContext->handshake.sessionKeys.ivLength);
     if (result != MA_COMM_SUCCESS) {
         LOG("Fail to copy ticket on RequestAP\n");
         eraseRequestAP(&requestAP);
         return MA_COMM_INVALID_STATE;
     }
 
-    result = copyTicket(&pContext->ticket, &requestAP.ticket);
+    result = copyTicket(&pContext->handshake.ticket, &requestAP.ticket);
     if (result != MA_COMM_SUCCESS) {
         LOG("Fail to copy ticket on RequestAP\n");
         eraseRequestAP(&requestAP);
@@ -829,7 +1399,7 @@ uint8_t doRequestAP(KerberosContext *pContext,
     result = getEncodedRequestAP(&requestAP,
                                  encodedOutput,
                                  encodedLength,
-                                 pContext->sessionId,
+                                 pContext->handshake.sessionId,
                                  SESSION_ID_LENGTH);
     eraseRequestAP(&requestAP);
     if(result != MA_COMM_SUCCESS) {
@@ -869,12 +1439,18 @@ uint8_t verifyReplyAP(KerberosContext *pContext,
     uint8_t *plainData = NULL;
     size_t plainDataLength = 0;
     uint64_t timestamp = 0;
-    result = decryptTo(NULL,
-                       0,
-                       replyAP.encData.ciphertext,
-                       replyAP.encData.ciphertextLength,
-                       &plainData,
-                       &plainDataLength);
+    result = openWithKey(pContext->handshake.sessionKeys.algorithm,
+                         pContext->handshake.sessionKeys.keySC,
+                         pContext->handshake.sessionKeys.keyLength,
+                         pContext->handshake.sessionKeys.ivSC,
+                         pContext->handshake.sessionKeys.ivLength,
+                         pContext->tagLen,
+                         NULL,
+                         0,
+                         replyAP.encData.ciphertext,
+                         replyAP.encData.ciphertextLength,
+                         &plainData,
+                         &plainDataLength);
     eraseReplyAP(&replyAP);
     if(result != SUCCESSFULL_OPERATION) {
         LOG("Fail to decrypt ReplyAP\n");
@@ -892,7 +1468,7 @@ uint8_t verifyReplyAP(KerberosContext *pContext,
     timestamp = be64toh(timestamp);
 
     // Verify if timestamp equals timestamp on the authenticator
-    if(timestamp != pContext->timestamp) {
+    if(timestamp != pContext->handshake.timestamp) {
         LOG("ReplyAP's timestamp does not match with authenticator's timestamp\n");
         return MA_COMM_INVALID_PARAMETER;
     }
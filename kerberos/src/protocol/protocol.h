@@ -8,6 +8,49 @@
 #define SHARED_KEY_LENGTH         32
 #define TAG_LEN                   16
 #define SESSION_ID_LENGTH         32
+#define SESSION_KEY_MAX_LENGTH    32
+
+/* Progress of a handshake */
+typedef enum {
+    NOT_INITIALIZED,
+    WAIT_REPLY_AS,
+    WAIT_REPLY_AP,
+    ESTABLISHED_CHANNEL
+} ProtocolState;
+
+/*
+ * Copy of the established session, for callers that seal and open messages
+ * on their own instead of going through the libaes secure channel.
+ */
+typedef struct {
+    uint8_t algorithm;
+    uint8_t keyLength;
+    uint8_t tagLen;
+    uint8_t keyCS[SESSION_KEY_MAX_LENGTH];    /* Client to server key */
+    uint8_t keySC[SESSION_KEY_MAX_LENGTH];    /* Server to client key */
+    uint8_t sessionId[SESSION_ID_LENGTH];
+    uint64_t offset;                          /* Offset to the server clock */
+    uint64_t expireTimestamp;
+} SessionSnapshot;
+
+/* Admission control defaults of the handshakes */
+#define HANDSHAKE_DEFAULT_MAX_RETRIES       3
+#define HANDSHAKE_DEFAULT_BACKOFF_BASE_MS   100
+#define HANDSHAKE_DEFAULT_BACKOFF_MAX_MS    10000
+
+/*
+ * Limits how hard the handshakes of this process, across every context, hit
+ * the KDC, so that many devices booting together do not bring it down.
+ */
+typedef struct {
+    uint32_t maxRetries;        /* retries after a network error, an HTTP 5xx or KRB_ERR_GENERIC */
+    uint32_t backoffBaseMs;     /* delay before the first retry, doubled by each retry */
+    uint32_t backoffMaxMs;      /* bound of the retry delay */
+    uint32_t startDelayMaxMs;   /* random delay before the first handshake of a context */
+} HandshakeAdmissionConfig;
+
+/* Header of the handshake requests */
+#define HANDSHAKE_CONTENT_TYPE    "Content-Type: application/x-www-form-urlencoded"
 
 
 uint8_t kerberos_protocol_init(const char* urlRequestAS,
@@ -22,10 +65,101 @@ uint8_t kerberos_protocol_init(const char* urlRequestAS,
 
 uint8_t kerberos_protocol_deinit(void** pContext);
 
+/*
+ * Runs the whole handshake, blocking through the RequestAS and RequestAP
+ * round trips, and installs the new session in the secure channel. It waits
+ * the start delay first and retries transient failures with a jittered
+ * exponential backoff (see HandshakeAdmissionConfig).
+ */
 uint8_t kerberos_protocol_execute_handshake(void* pContext);
 
+/* Replaces the admission control settings, effective for the next handshakes */
+void kerberos_protocol_configure_admission(const HandshakeAdmissionConfig* pConfig);
+
+/* Retries done after a transient failure since the process started */
+void kerberos_protocol_get_admission_stats(uint64_t* retried);
+
+/*
+ * Admission control of the step-driven handshakes, whose callers own the
+ * timers. The first handshake of a context begins after the random start
+ * delay this returns, 0 for the next ones.
+ */
+uint32_t kerberos_protocol_get_start_delay(void* pContext);
+
+/*
+ * Tells whether the handshake attempt that just failed, after retry
+ * retries, is retried: it must have failed in a way the KDC may not repeat
+ * (the request could not be sent, an HTTP 5xx or a KRB_ERR_GENERIC reply)
+ * with retries left. Returns MA_COMM_TRUE and the jittered backoff to wait
+ * in *delayMs then, otherwise MA_COMM_FALSE.
+ */
+uint8_t kerberos_protocol_retry_handshake(void* pContext,
+                                          uint32_t retry,
+                                          uint8_t sendFailed,
+                                          uint32_t httpStatusCode,
+                                          uint32_t* delayMs);
+
+/*
+ * Step-driven handshake, for callers that own the transport. No I/O is done
+ * and no global state is touched, so handshakes of different contexts can
+ * run concurrently. begin returns the RequestAS and the URL it must be POSTed
+ * to (with HANDSHAKE_CONTENT_TYPE); continue takes the body of its reply and
+ * returns the next request the same way, or a NULL request once the new
+ * session is established. Requests must be freed by the caller. Any failure
+ * resets the handshake. The previously established session stays usable
+ * while a new one is negotiated and is only replaced when ReplyAP is
+ * verified.
+ */
+uint8_t kerberos_protocol_begin_handshake(void* pContext,
+                                         const char** url,
+                                         uint8_t** request,
+                                         size_t* requestLength);
+
+uint8_t kerberos_protocol_continue_handshake(void* pContext,
+                                            uint8_t* reply,
+                                            size_t replyLength,
+                                            const char** url,
+                                            uint8_t** request,
+                                            size_t* requestLength);
+
+/* Loads the established session keys into the libaes secure channel */
+uint8_t kerberos_protocol_install_secure_channel(void* pContext);
+
+/*
+ * Progress of the last handshake (a ProtocolState): ESTABLISHED_CHANNEL once
+ * it completed, NOT_INITIALIZED if it failed or never started.
+ */
+uint8_t kerberos_protocol_get_handshake_state(void* pContext);
+
 uint8_t kerberos_protocol_is_mutual_authenticated(void* pContext);
 
+/* Copies the established session, MA_COMM_INVALID_STATE if there is none */
+uint8_t kerberos_protocol_get_session(void* pContext, SessionSnapshot* pSnapshot);
+
+/* MA_COMM_TRUE while the copied session has not expired */
+uint8_t kerberos_protocol_is_session_valid(const SessionSnapshot* pSnapshot);
+
+/*
+ * Serializes the established session (ticket, session id, keys, clock offset
+ * and expiration) sealed with AES-GCM under a key derived from the shared
+ * key, so it can be kept on disk. The caller frees *blob.
+ */
+uint8_t kerberos_protocol_export_session(void* pContext, uint8_t** blob, size_t* blobLength);
+
+/*
+ * Restores a session written by kerberos_protocol_export_session for the same
+ * principals. Fails with MA_COMM_INVALID_STATE if it does not authenticate or
+ * has expired. The secure channel must then be installed by the caller.
+ */
+uint8_t kerberos_protocol_import_session(void* pContext, uint8_t* blob, size_t blobLength);
+
+/*
+ * MA_COMM_TRUE if the response is a kerberos error telling that the server
+ * no longer accepts the session (KRB_AP_ERR_TKT_EXPIRED or KRB_AP_ERR_SKEW),
+ * so a new handshake is needed.
+ */
+uint8_t kerberos_protocol_is_session_rejected(uint8_t* response, size_t responseLength);
+
 uint8_t kerberos_protocol_get_session_id(void* pContext,
                                          size_t sessionIdSize,
                                          uint8_t* sessionId);
@@ -0,0 +1,153 @@
+/*
+ * Checks that small synchronous sends over a warm connection make no heap
+ * allocation in this library. The test is linked against the static library
+ * with malloc, calloc, realloc, strdup and free wrapped (-Wl,--wrap), so the
+ * calls of libcurl and libaes, shared libraries, are not counted; neither
+ * are the ones of the stand-in server, which runs on other threads.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "ma_communication.h"
+#include "ma_comm_error_codes.h"
+#include "standin.h"
+
+#define URL_SIZE 64
+#define WARM_UP_SENDS 3
+#define COUNTED_SENDS 100
+#define MESSAGE "small message"
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+char* __real_strdup(const char* string);
+void __real_free(void* pointer);
+
+static __thread int counting = 0;
+static __thread unsigned long allocations = 0;
+static __thread unsigned long releases = 0;
+
+void* __wrap_malloc(size_t size) {
+    allocations += counting;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    allocations += counting;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+    allocations += counting;
+    return __real_realloc(pointer, size);
+}
+
+char* __wrap_strdup(const char* string) {
+    allocations += counting;
+    return __real_strdup(string);
+}
+
+void __wrap_free(void* pointer) {
+    releases += (counting && pointer);
+    __real_free(pointer);
+}
+
+static int failures = 0;
+
+static void check(int condition, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "FAIL %s\n", what);
+        failures++;
+    }
+}
+
+/* Sends with ma_communication_send_to, which writes the response to the caller's buffer */
+static int sendTo(const char* url, uint8_t counted) {
+    unsigned char response[sizeof(MESSAGE)];
+    struct curl_slist* headers = NULL;
+    size_t responseSize = 0;
+    uint32_t httpStatusCode = 0;
+    uint8_t result;
+
+    counting = counted;
+    result = ma_communication_send_to(url, HTTP_METHOD_POST, &headers, (unsigned char*) MESSAGE,
+                                      sizeof(MESSAGE), &httpStatusCode, response, sizeof(response),
+                                      &responseSize);
+    counting = 0;
+    return (result == MA_COMM_SUCCESS) && (httpStatusCode == 200) &&
+           (responseSize == sizeof(MESSAGE)) && (memcmp(response, MESSAGE, responseSize) == 0);
+}
+
+/* Sends with ma_communication_send, whose response is allocated for the caller */
+static int sendAllocated(const char* url, uint8_t counted) {
+    unsigned char* response = NULL;
+    struct curl_slist* headers = NULL;
+    size_t responseSize = 0;
+    uint32_t httpStatusCode = 0;
+    uint8_t result;
+    int echoed;
+
+    counting = counted;
+    result = ma_communication_send(url, HTTP_METHOD_POST, &headers, (unsigned char*) MESSAGE,
+                                   sizeof(MESSAGE), &httpStatusCode, &response, &responseSize);
+    counting = 0;
+    echoed = (result == MA_COMM_SUCCESS) && (httpStatusCode == 200) &&
+             (responseSize == sizeof(MESSAGE)) && (memcmp(response, MESSAGE, responseSize) == 0);
+    free(response);
+    return echoed;
+}
+
+int main() {
+    StandinConfig config = { STANDIN_ANSWER_PROPOSED };
+    char url[URL_SIZE], urlAS[URL_SIZE + 8], urlAP[URL_SIZE + 8], urlEcho[URL_SIZE + 8];
+    int i, echoed = 0;
+
+    if (standin_start(&config, url, sizeof(url)) != 0) {
+        fprintf(stderr, "FAIL cannot start the stand-in server\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(urlAS, sizeof(urlAS), "%s/as", url);
+    snprintf(urlAP, sizeof(urlAP), "%s/ap", url);
+    snprintf(urlEcho, sizeof(urlEcho), "%s/echo", url);
+    if (ma_communication_init(1, 0, 1, urlAS, urlAP, standinAppId, STANDIN_ID_SIZE, standinServerId,
+                              STANDIN_ID_SIZE, standinSharedKey, STANDIN_SHARED_KEY_SIZE) != MA_COMM_SUCCESS) {
+        fprintf(stderr, "FAIL cannot initialize the library\n");
+        return EXIT_FAILURE;
+    }
+
+    // the handshake, the pooled handle, the connection and the thread buffers
+    for (i = 0; i < WARM_UP_SENDS; i++) {
+        sendTo(urlEcho, 0);
+        sendAllocated(urlEcho, 0);
+    }
+
+    allocations = 0;
+    releases = 0;
+    for (i = 0; i < COUNTED_SENDS; i++) {
+        echoed += sendTo(urlEcho, 1);
+    }
+    check(echoed == COUNTED_SENDS, "ma_communication_send_to: message not echoed");
+    check(allocations == 0, "ma_communication_send_to allocated");
+    check(releases == 0, "ma_communication_send_to freed");
+    printf("ma_communication_send_to: %lu allocations, %lu releases in %d sends\n",
+           allocations, releases, COUNTED_SENDS);
+
+    // the response handed to the caller is the only allocation left
+    allocations = 0;
+    releases = 0;
+    echoed = 0;
+    for (i = 0; i < COUNTED_SENDS; i++) {
+        echoed += sendAllocated(urlEcho, 1);
+    }
+    check(echoed == COUNTED_SENDS, "ma_communication_send: message not echoed");
+    check(allocations == COUNTED_SENDS, "ma_communication_send allocated more than the response");
+    check(releases == 0, "ma_communication_send freed");
+    printf("ma_communication_send: %lu allocations, %lu releases in %d sends\n",
+           allocations, releases, COUNTED_SENDS);
+
+    ma_communication_deinit();
+    standin_stop();
+
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+/*
+ * Checks the multiplexing of ma_communication_set_http2 over real HTTP/2
+ * streams: with prior knowledge, the synchronous sends of several threads
+ * and the handshake share a single h2c connection to the stand-in, reused
+ * from one request to the other, and the requests beyond the streams allowed
+ * at once wait for one rather than open another connection. It is skipped when the stand-in was built without nghttp2, or
+ * when the libcurl the process runs with does not take prior knowledge.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ma_communication.h"
+#include "ma_comm_error_codes.h"
+#include "standin.h"
+
+/* Exit code telling automake that the test was skipped */
+#define TEST_SKIPPED 77
+
+#define URL_SIZE 64
+#define THREADS 8
+#define SENDS_PER_THREAD 10
+#define MAX_CONCURRENT_STREAMS 3
+#define MAX_HOST_CONNECTIONS 1
+
+/* The large messages outgrow the stream window, which keeps their streams open long enough to overlap */
+static const size_t messageSizes[] = { 70000, 1, 100000, 1000 };
+
+static char urlEcho[URL_SIZE + 8];
+static int failures = 0;
+
+static void check(int condition, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "FAIL %s\n", what);
+        failures++;
+    }
+}
+
+/* Echoes SENDS_PER_THREAD messages, counting in *pArgument the ones that came back intact */
+static void* echoMessages(void* pArgument) {
+    size_t *pEchoed = (size_t*) pArgument;
+    unsigned char *content, *response;
+    struct curl_slist* headers;
+    size_t i, j, size, responseSize;
+    uint32_t httpStatusCode;
+
+    for (i = 0; i < SENDS_PER_THREAD; i++) {
+        size = messageSizes[i % (sizeof(messageSizes) / sizeof(messageSizes[0]))];
+        content = malloc(size);
+        for (j = 0; j < size; j++) {
+            content[j] = (unsigned char) (i + j * 31);
+        }
+        headers = NULL;
+        response = NULL;
+        responseSize = 0;
+        if ( (ma_communication_send(urlEcho, HTTP_METHOD_POST, &headers, content, size,
+                                    &httpStatusCode, &response, &responseSize) == MA_COMM_SUCCESS) &&
+             (httpStatusCode == 200) && (responseSize == size) &&
+             (memcmp(response, content, responseSize) == 0) ) {
+            (*pEchoed)++;
+        }
+        free(response);
+        free(content);
+    }
+    return NULL;
+}
+
+int main() {
+    StandinConfig config = { STANDIN_ANSWER_PROPOSED };
+    StandinStats stats;
+    char url[URL_SIZE], urlAS[URL_SIZE + 8], urlAP[URL_SIZE + 8];
+    pthread_t threads[THREADS];
+    size_t echoed[THREADS] = { 0 };
+    size_t i, total = 0;
+
+    if (!standin_supports_h2c()) {
+        printf("Stand-in built without nghttp2, no h2c to test\n");
+        return TEST_SKIPPED;
+    }
+    if (standin_start(&config, url, sizeof(url)) != 0) {
+        fprintf(stderr, "FAIL cannot start the stand-in server\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(urlAS, sizeof(urlAS), "%s/as", url);
+    snprintf(urlAP, sizeof(urlAP), "%s/ap", url);
+    snprintf(urlEcho, sizeof(urlEcho), "%s/echo", url);
+    if (ma_communication_init(1, 0, 1, urlAS, urlAP, standinAppId, STANDIN_ID_SIZE, standinServerId,
+                              STANDIN_ID_SIZE, standinSharedKey, STANDIN_SHARED_KEY_SIZE) != MA_COMM_SUCCESS) {
+        fprintf(stderr, "FAIL cannot initialize the library\n");
+        return EXIT_FAILURE;
+    }
+    if (ma_communication_set_http2(1, 1, MAX_CONCURRENT_STREAMS, MAX_HOST_CONNECTIONS) == MA_COMM_INVALID_PARAMETER) {
+        printf("libcurl without HTTP/2 prior knowledge, no h2c to test\n");
+        ma_communication_deinit();
+        standin_stop();
+        return TEST_SKIPPED;
+    }
+
+    for (i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, echoMessages, &echoed[i]);
+    }
+    for (i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        total += echoed[i];
+    }
+    standin_get_stats(&stats);
+
+    check(total == THREADS * SENDS_PER_THREAD, "message not echoed");
+    check(stats.failures == 0, "message rejected by the server");
+    check(stats.requestsAP == 1, "expected a single handshake");
+    check(stats.connections == 1, "the requests did not share one connection");
+    check(stats.peakStreams > 1, "no streams open at once");
+    check(stats.peakStreams <= MAX_CONCURRENT_STREAMS, "more streams open at once than allowed");
+    printf("%zu messages echoed over %u connection(s), at most %u streams at once\n",
+           total, stats.connections, stats.peakStreams);
+
+    ma_communication_deinit();
+    standin_stop();
+
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+/*
+ * Checks the multiplexed mode of ma_communication_set_http2: prior knowledge
+ * is refused with a libcurl that does not support it, and the synchronous
+ * sends of several threads go through the worker thread and are answered.
+ * Without prior knowledge the http:// URLs fall back to HTTP/1.1, which
+ * is what the stand-in is talked here; h2ctest covers the HTTP/2 streams.
+ * The test is linked against the static library
+ * with async_communication_perform_multiplexed wrapped (-Wl,--wrap), to
+ * count the sends it actually took.
+ */
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ma_communication.h"
+#include "ma_comm_error_codes.h"
+#include "standin.h"
+
+#define URL_SIZE 64
+#define THREADS 4
+#define SENDS_PER_THREAD 20
+#define MAX_CONCURRENT_STREAMS 100
+#define MIN_PRIOR_KNOWLEDGE_VERSION 0x080100
+
+static const size_t messageSizes[] = { 1, 100, 1000, 70000 };
+
+uint8_t __real_async_communication_perform_multiplexed(CURL* pCurlHandler, CURLcode* pCode);
+
+static pthread_mutex_t countMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t multiplexed = 0;
+
+uint8_t __wrap_async_communication_perform_multiplexed(CURL* pCurlHandler, CURLcode* pCode) {
+    uint8_t result = __real_async_communication_perform_multiplexed(pCurlHandler, pCode);
+
+    if (result == MA_COMM_SUCCESS) {
+        pthread_mutex_lock(&countMutex);
+        multiplexed++;
+        pthread_mutex_unlock(&countMutex);
+    }
+    return result;
+}
+
+static char urlEcho[URL_SIZE + 8];
+static int failures = 0;
+
+static void check(int condition, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "FAIL %s\n", what);
+        failures++;
+    }
+}
+
+/* Echoes SENDS_PER_THREAD messages, counting in *pArgument the ones that came back intact */
+static void* echoMessages(void* pArgument) {
+    size_t *pEchoed = (size_t*) pArgument;
+    unsigned char *content, *response;
+    struct curl_slist* headers;
+    size_t i, j, size, responseSize;
+    uint32_t httpStatusCode;
+
+    for (i = 0; i < SENDS_PER_THREAD; i++) {
+        size = messageSizes[i % (sizeof(messageSizes) / sizeof(messageSizes[0]))];
+        content = malloc(size);
+        for (j = 0; j < size; j++) {
+            content[j] = (unsigned char) (i + j * 31);
+        }
+        headers = NULL;
+        response = NULL;
+        responseSize = 0;
+        if ( (ma_communication_send(urlEcho, HTTP_METHOD_POST, &headers, content, size,
+                                    &httpStatusCode, &response, &responseSize) == MA_COMM_SUCCESS) &&
+             (httpStatusCode == 200) && (responseSize == size) &&
+             (memcmp(response, content, responseSize) == 0) ) {
+            (*pEchoed)++;
+        }
+        free(response);
+        free(content);
+    }
+    return NULL;
+}
+
+int main() {
+    StandinConfig config = { STANDIN_ANSWER_PROPOSED };
+    StandinStats stats;
+    const curl_version_info_data *pVersion = curl_version_info(CURLVERSION_NOW);
+    char url[URL_SIZE], urlAS[URL_SIZE + 8], urlAP[URL_SIZE + 8];
+    pthread_t threads[THREADS];
+    size_t echoed[THREADS] = { 0 };
+    size_t i, total = 0;
+    uint8_t priorKnowledge;
+
+    if (standin_start(&config, url, sizeof(url)) != 0) {
+        fprintf(stderr, "FAIL cannot start the stand-in server\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(urlAS, sizeof(urlAS), "%s/as", url);
+    snprintf(urlAP, sizeof(urlAP), "%s/ap", url);
+    snprintf(urlEcho, sizeof(urlEcho), "%s/echo", url);
+    if (ma_communication_init(1, 0, 1, urlAS, urlAP, standinAppId, STANDIN_ID_SIZE, standinServerId,
+                              STANDIN_ID_SIZE, standinSharedKey, STANDIN_SHARED_KEY_SIZE) != MA_COMM_SUCCESS) {
+        fprintf(stderr, "FAIL cannot initialize the library\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Prior knowledge is only taken from a libcurl which supports it */
+    priorKnowledge = ma_communication_set_http2(1, 1, MAX_CONCURRENT_STREAMS, 0);
+    if ( (pVersion->features & CURL_VERSION_HTTP2) && (pVersion->version_num >= MIN_PRIOR_KNOWLEDGE_VERSION) ) {
+        check(priorKnowledge == MA_COMM_SUCCESS, "prior knowledge refused");
+    } else {
+        check(priorKnowledge == MA_COMM_INVALID_PARAMETER, "prior knowledge accepted");
+    }
+    check(ma_communication_set_http2(1, 0, 0, 0) == MA_COMM_INVALID_PARAMETER, "no stream accepted");
+
+    check(ma_communication_set_http2(1, 0, MAX_CONCURRENT_STREAMS, 0) == MA_COMM_SUCCESS,
+          "cannot enable the multiplexing");
+    for (i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, echoMessages, &echoed[i]);
+    }
+    for (i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        total += echoed[i];
+    }
+    standin_get_stats(&stats);
+
+    check(total == THREADS * SENDS_PER_THREAD, "message not echoed");
+    check(stats.failures == 0, "message rejected by the server");
+    check(stats.requestsAP == 1, "expected a single handshake");
+    /* the handshake is a buffered exchange too */
+    check(multiplexed >= THREADS * SENDS_PER_THREAD, "send not multiplexed");
+    printf("%zu messages echoed, %u multiplexed exchanges\n", total, multiplexed);
+
+    /* Back to a connection per sending thread */
+    check(ma_communication_set_http2(0, 0, MAX_CONCURRENT_STREAMS, 0) == MA_COMM_SUCCESS,
+          "cannot disable the multiplexing");
+    multiplexed = 0;
+    echoed[0] = 0;
+    echoMessages(&echoed[0]);
+    check(echoed[0] == SENDS_PER_THREAD, "message not echoed once disabled");
+    check(multiplexed == 0, "send multiplexed once disabled");
+
+    ma_communication_deinit();
+    standin_stop();
+
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
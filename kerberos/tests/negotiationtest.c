@@ -0,0 +1,136 @@
+/*
+ * Checks the negotiation of the session algorithm against the stand-in KDC:
+ * the algorithm proposed in RequestAS, the one answered in EncKdcRepPart, and
+ * that messages go through the secure channel with either of them. Every
+ * scenario runs in its own process, as the library is initialized once.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ma_communication.h"
+#include "ma_comm_error_codes.h"
+#include "crypto/SecureChannel.h"
+#include "encoder/sessionKey.h"
+#include "standin.h"
+
+#define URL_SIZE 64
+#define UNKNOWN_ALGORITHM 7
+
+static const size_t messageSizes[] = { 1, 16, 100, 1000, 70000 };
+
+static int failures = 0;
+
+static void check(int condition, const char* scenario, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "FAIL %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+static int initLibrary(const char* url) {
+    char urlAS[URL_SIZE + 8], urlAP[URL_SIZE + 8];
+
+    snprintf(urlAS, sizeof(urlAS), "%s/as", url);
+    snprintf(urlAP, sizeof(urlAP), "%s/ap", url);
+    return ma_communication_init(1, 0, 1, urlAS, urlAP, standinAppId, STANDIN_ID_SIZE,
+                                 standinServerId, STANDIN_ID_SIZE, standinSharedKey, STANDIN_SHARED_KEY_SIZE);
+}
+
+/* Echoes messages of several sizes, returns the number of them that came back intact */
+static size_t echoMessages(const char* url) {
+    char urlEcho[URL_SIZE + 8];
+    unsigned char *content, *response;
+    struct curl_slist* headers;
+    size_t i, j, responseSize, echoed = 0;
+    uint32_t httpStatusCode;
+
+    snprintf(urlEcho, sizeof(urlEcho), "%s/echo", url);
+    for (i = 0; i < sizeof(messageSizes) / sizeof(messageSizes[0]); i++) {
+        content = malloc(messageSizes[i]);
+        for (j = 0; j < messageSizes[i]; j++) {
+            content[j] = (unsigned char) (i + j * 31);
+        }
+        headers = NULL;
+        response = NULL;
+        responseSize = 0;
+        if ( (ma_communication_send(urlEcho, HTTP_METHOD_POST, &headers, content, messageSizes[i],
+                                    &httpStatusCode, &response, &responseSize) == MA_COMM_SUCCESS) &&
+             (httpStatusCode == 200) && (responseSize == messageSizes[i]) &&
+             (memcmp(response, content, responseSize) == 0) ) {
+            echoed++;
+        }
+        free(response);
+        free(content);
+    }
+    return echoed;
+}
+
+/*
+ * Runs one scenario: the stand-in answers answerAlgorithm, and the session
+ * is expected to use expectedAlgorithm, or to be refused when it is -1.
+ */
+static int runScenario(const char* scenario, int answerAlgorithm, int expectedAlgorithm) {
+    StandinConfig config = { answerAlgorithm };
+    StandinStats stats;
+    char url[URL_SIZE];
+    uint8_t preferred = getPreferredCryptoAlgorithm();
+    size_t echoed;
+
+    if ( (standin_start(&config, url, sizeof(url)) != 0) || (initLibrary(url) != MA_COMM_SUCCESS) ) {
+        check(0, scenario, "cannot start");
+        return failures;
+    }
+
+    echoed = echoMessages(url);
+    standin_get_stats(&stats);
+
+    /* AES-GCM is the default and is not proposed */
+    check(stats.requestsAS >= 1, scenario, "no RequestAS");
+    check(stats.proposedAlgorithm == ((preferred == SESSION_ALGORITHM_AES_GCM) ? -1 : preferred),
+          scenario, "unexpected proposal in RequestAS");
+    if (expectedAlgorithm < 0) {
+        check(echoed == 0, scenario, "message sent over a refused session");
+        check(stats.requestsAP == 0, scenario, "RequestAP sent for a refused session");
+    } else {
+        check(stats.sessionAlgorithm == expectedAlgorithm, scenario, "unexpected session algorithm");
+        check(stats.requestsAP == 1, scenario, "expected a single handshake");
+        check(echoed == sizeof(messageSizes) / sizeof(messageSizes[0]), scenario, "message not echoed");
+        check(stats.failures == 0, scenario, "message rejected by the server");
+    }
+
+    ma_communication_deinit();
+    standin_stop();
+    return failures;
+}
+
+static void runInChild(const char* scenario, int answerAlgorithm, int expectedAlgorithm) {
+    pid_t pid = fork();
+    int status;
+
+    if (pid == 0) {
+        exit(runScenario(scenario, answerAlgorithm, expectedAlgorithm) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    if ( (pid < 0) || (waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0) ) {
+        fprintf(stderr, "FAIL %s\n", scenario);
+        failures++;
+    }
+}
+
+int main() {
+    uint8_t preferred = getPreferredCryptoAlgorithm();
+
+    /* The proposal is accepted: ChaCha20-Poly1305 with the native AES, the default backend */
+    runInChild("proposed", STANDIN_ANSWER_PROPOSED, preferred);
+    /* Servers without ChaCha20-Poly1305 answer AES-GCM, which is always accepted */
+    runInChild("aes-gcm", SESSION_ALGORITHM_AES_GCM, SESSION_ALGORITHM_AES_GCM);
+    if (preferred != SESSION_ALGORITHM_CHACHA20_POLY1305) {
+        runInChild("chacha20-poly1305", SESSION_ALGORITHM_CHACHA20_POLY1305, -1);
+    }
+    /* An algorithm that was not proposed is refused */
+    runInChild("unknown", UNKNOWN_ALGORITHM, -1);
+
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+/*
+ * Checks ma_communication_send_record against the stand-in: the records
+ * that concurrent senders share a batch with are handed back to their own
+ * sender, answers reordered in the batch or emptied on the way are
+ * rejected, empty messages included, thanks to the index in their AAD, and
+ * a batch rejected with its session is sent once more under the renewed one.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ma_communication.h"
+#include "ma_comm_error_codes.h"
+#include "standin.h"
+
+#define URL_SIZE 64
+#define THREADS 8
+#define RECORDS_PER_THREAD 25
+#define MAX_RECORD_SIZE 300
+#define BATCH_DELAY_MS 50
+#define TAMPER_BATCH_DELAY_MS 500
+#define MAX_BATCH_SIZE (64 * 1024)
+#define NO_EMPTY_SENDER THREADS
+
+typedef struct {
+    uint32_t thread;
+    uint32_t records;
+    /* sends empty messages only */
+    uint8_t empty;
+    /* records answered with their own content */
+    uint32_t echoed;
+    /* records which failed */
+    uint32_t failed;
+} Sender;
+
+static char urlRecords[URL_SIZE + 16];
+static pthread_barrier_t startBarrier;
+static int failures = 0;
+
+static void check(int condition, const char* scenario, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "FAIL %s: %s\n", scenario, what);
+        failures++;
+    }
+}
+
+/* Sends the records of a thread, each one with content of its own, every tenth one empty */
+static void* sendRecords(void* pArgument) {
+    Sender *pSender = (Sender*) pArgument;
+    unsigned char content[MAX_RECORD_SIZE], *response;
+    size_t i, j, size, responseSize;
+    uint32_t httpStatusCode;
+
+    pthread_barrier_wait(&startBarrier);
+    for (i = 0; i < pSender->records; i++) {
+        size = (pSender->empty || (i % 10 == 9)) ? 0 : 1 + (pSender->thread * 31 + i * 17) % (MAX_RECORD_SIZE - 1);
+        for (j = 0; j < size; j++) {
+            content[j] = (unsigned char) (pSender->thread * 101 + i * 7 + j);
+        }
+        response = NULL;
+        responseSize = 0;
+        if (ma_communication_send_record(urlRecords, content, size, &httpStatusCode,
+                                         &response, &responseSize) != MA_COMM_SUCCESS) {
+            pSender->failed++;
+        } else if ( (httpStatusCode == 200) && (responseSize == size) &&
+                    ((size == 0) || (memcmp(response, content, size) == 0)) ) {
+            pSender->echoed++;
+        }
+        free(response);
+    }
+    return NULL;
+}
+
+/* Runs count senders at once, emptySender sending empty messages, returns the number of records echoed */
+static uint32_t runSenders(uint32_t count, uint32_t records, uint32_t emptySender, uint32_t* pFailed) {
+    pthread_t threads[THREADS];
+    Sender senders[THREADS];
+    uint32_t i, echoed = 0;
+
+    *pFailed = 0;
+    pthread_barrier_init(&startBarrier, NULL, count);
+    for (i = 0; i < count; i++) {
+        memset(&senders[i], 0, sizeof(Sender));
+        senders[i].thread = i;
+        senders[i].records = records;
+        senders[i].empty = (i == emptySender);
+        pthread_create(&threads[i], NULL, sendRecords, &senders[i]);
+    }
+    for (i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+        echoed += senders[i].echoed;
+        *pFailed += senders[i].failed;
+    }
+    pthread_barrier_destroy(&startBarrier);
+    return echoed;
+}
+
+static void checkDemultiplexing() {
+    StandinStats before, after;
+    uint32_t echoed, failed;
+
+    ma_communication_set_record_batching(BATCH_DELAY_MS, MAX_BATCH_SIZE);
+    standin_get_stats(&before);
+    echoed = runSenders(THREADS, RECORDS_PER_THREAD, NO_EMPTY_SENDER, &failed);
+    standin_get_stats(&after);
+
+    check(echoed == THREADS * RECORDS_PER_THREAD, "demultiplexing", "record not handed back to its sender");
+    check(failed == 0, "demultiplexing", "record failed");
+    check(after.records - before.records == THREADS * RECORDS_PER_THREAD, "demultiplexing",
+          "unexpected record count");
+    check(after.batches - before.batches < after.records - before.records, "demultiplexing",
+          "no record shared a batch");
+    check(after.failures == 0, "demultiplexing", "record rejected by the server");
+    printf("demultiplexing: %u records in %u batches\n",
+           after.records - before.records, after.batches - before.batches);
+}
+
+/*
+ * Sends two records in a batch whose answers the stand-in tampers with, the
+ * emptySender one being empty, and expects rejected of them to fail while
+ * the others are echoed.
+ */
+static void checkTamperedRecords(const char* scenario, int mode, uint32_t emptySender, uint32_t rejected) {
+    StandinStats before, after;
+    uint32_t echoed, failed;
+
+    // a window long enough for both records to share the batch
+    ma_communication_set_record_batching(TAMPER_BATCH_DELAY_MS, MAX_BATCH_SIZE);
+    standin_tamper_records(mode);
+    standin_get_stats(&before);
+    echoed = runSenders(2, 1, emptySender, &failed);
+    standin_get_stats(&after);
+    standin_tamper_records(STANDIN_RECORDS_INTACT);
+
+    check(after.batches - before.batches == 1, scenario, "the records did not share a batch");
+    check(failed == rejected, scenario, "tampered record accepted");
+    check(echoed == 2 - rejected, scenario, "intact record not echoed");
+}
+
+static void checkRejectedSession() {
+    StandinStats before, after;
+    uint32_t echoed, failed;
+
+    ma_communication_set_record_batching(BATCH_DELAY_MS, MAX_BATCH_SIZE);
+    standin_get_stats(&before);
+    standin_revoke_sessions();
+    echoed = runSenders(THREADS, RECORDS_PER_THREAD, NO_EMPTY_SENDER, &failed);
+    standin_get_stats(&after);
+
+    check(after.rejections > before.rejections, "rejected session", "session not rejected");
+    check(after.requestsAP - before.requestsAP == 1, "rejected session", "expected a single renewal");
+    check(echoed == THREADS * RECORDS_PER_THREAD, "rejected session", "record not replayed");
+    check(failed == 0, "rejected session", "record failed");
+}
+
+int main() {
+    StandinConfig config = { STANDIN_ANSWER_PROPOSED };
+    StandinStats stats;
+    char url[URL_SIZE], urlAS[URL_SIZE + 8], urlAP[URL_SIZE + 8];
+
+    if (standin_start(&config, url, sizeof(url)) != 0) {
+        fprintf(stderr, "FAIL cannot start the stand-in server\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(urlAS, sizeof(urlAS), "%s/as", url);
+    snprintf(urlAP, sizeof(urlAP), "%s/ap", url);
+    snprintf(urlRecords, sizeof(urlRecords), "%s/records", url);
+    if (ma_communication_init(1, 0, 1, urlAS, urlAP, standinAppId, STANDIN_ID_SIZE, standinServerId,
+                              STANDIN_ID_SIZE, standinSharedKey, STANDIN_SHARED_KEY_SIZE) != MA_COMM_SUCCESS) {
+        fprintf(stderr, "FAIL cannot initialize the library\n");
+        return EXIT_FAILURE;
+    }
+
+    checkDemultiplexing();
+    checkTamperedRecords("swap", STANDIN_RECORDS_SWAPPED, NO_EMPTY_SENDER, 2);
+    checkTamperedRecords("swap with an empty record", STANDIN_RECORDS_SWAPPED, 0, 2);
+    /* whichever record is first in the batch gets an empty answer */
+    checkTamperedRecords("emptied answer", STANDIN_RECORDS_EMPTIED, NO_EMPTY_SENDER, 1);
+    checkTamperedRecords("emptied answer with an empty record", STANDIN_RECORDS_EMPTIED, 0, 1);
+    checkRejectedSession();
+    standin_get_stats(&stats);
+    check(stats.requestsAP == 2, "all", "expected the first handshake and the renewal only");
+
+    ma_communication_deinit();
+    standin_stop();
+
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,789 @@
+#define _GNU_SOURCE
+#include "standin.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef STANDIN_WITH_NGHTTP2
+#include <nghttp2/nghttp2.h>
+#endif
+
+#include "crypto/SecureChannel.h"
+#include "encoder/sessionKey.h"
+
+#define MAX_SESSIONS        256
+#define SESSION_ID_SIZE     32
+#define KEY_SIZE            32
+#define IV_SIZE             12
+#define AEAD_TAG_BITS       128
+#define KDC_TAG_LENGTH      16
+#define SESSION_LIFETIME_MS 3600000
+
+#define CODE_REQUEST_AS     0x0a
+#define CODE_REPLY_AS       0x0b
+#define CODE_REQUEST_AP     0x0e
+#define CODE_REPLY_AP       0x0f
+#define CODE_ERROR          0x1e
+#define KRB_AP_ERR_TKT_EXPIRED 32
+
+#define REQUEST_AS_SIZE     (1 + STANDIN_ID_SIZE + STANDIN_ID_SIZE + 4)
+#define RECORD_LENGTH_SIZE  4
+#define SESSION_HEADER      "ma-session-id: "
+
+#define H2_PREFACE          "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_SESSION_HEADER   "ma-session-id"
+#define H2_MAX_STREAMS      100
+
+const uint8_t standinAppId[STANDIN_ID_SIZE] = "standin-app-id-0";
+const uint8_t standinServerId[STANDIN_ID_SIZE] = "standin-server-0";
+const uint8_t standinSharedKey[STANDIN_SHARED_KEY_SIZE] = "standin-shared-key-of-32-bytes!!";
+
+typedef struct {
+    uint8_t algorithm;
+    uint8_t keyCS[KEY_SIZE];
+    uint8_t ivCS[IV_SIZE];
+    uint8_t keySC[KEY_SIZE];
+    uint8_t ivSC[IV_SIZE];
+    uint8_t revoked;
+} Session;
+
+typedef struct {
+    uint8_t* data;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+static StandinConfig config;
+static StandinStats stats;
+static Session sessions[MAX_SESSIONS];
+static uint32_t sessionCount = 0;
+static uint64_t ivCounter = 0;
+static int tamperRecords = STANDIN_RECORDS_INTACT;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int listenFd = -1;
+static pthread_t acceptThread;
+
+static void count(uint32_t* counter) {
+    pthread_mutex_lock(&mutex);
+    (*counter)++;
+    pthread_mutex_unlock(&mutex);
+}
+
+static void fill(uint8_t* data, size_t length, uint32_t seed) {
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        seed = seed * 1103515245u + 12345u;
+        data[i] = (uint8_t) (seed >> 16);
+    }
+}
+
+/* IVs of the server, unique over the process */
+static void nextIv(uint8_t* iv) {
+    uint64_t counter = __atomic_add_fetch(&ivCounter, 1, __ATOMIC_RELAXED);
+
+    memset(iv, 0, IV_SIZE);
+    memcpy(iv, &counter, sizeof(counter));
+}
+
+static void putBigEndian64(uint8_t* out, uint64_t value) {
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        out[i] = (uint8_t) value;
+        value >>= 8;
+    }
+}
+
+static void putBigEndian32(uint8_t* out, uint32_t value) {
+    out[0] = (uint8_t) (value >> 24);
+    out[1] = (uint8_t) (value >> 16);
+    out[2] = (uint8_t) (value >> 8);
+    out[3] = (uint8_t) value;
+}
+
+static uint32_t getBigEndian32(const uint8_t* in) {
+    return ((uint32_t) in[0] << 24) | ((uint32_t) in[1] << 16) | ((uint32_t) in[2] << 8) | (uint32_t) in[3];
+}
+
+static uint64_t nowMs() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return ((uint64_t) now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+static int append(Buffer* buffer, const uint8_t* data, size_t length) {
+    uint8_t* grown;
+
+    if (buffer->length + length > buffer->capacity) {
+        buffer->capacity = 2 * (buffer->length + length);
+        grown = realloc(buffer->data, buffer->capacity);
+        if (!grown) {
+            return -1;
+        }
+        buffer->data = grown;
+    }
+    if (length) {
+        memcpy(buffer->data + buffer->length, data, length);
+    }
+    buffer->length += length;
+    return 0;
+}
+
+/* EncryptedData: [ivLength][cipherLength][iv][cipher] */
+static int appendEncData(Buffer* out, const uint8_t* iv, const uint8_t* cipher, size_t cipherLength) {
+    uint8_t lengths[2] = { IV_SIZE, (uint8_t) cipherLength };
+
+    if (cipherLength > 255) {
+        return -1;
+    }
+    return append(out, lengths, 2) || append(out, iv, IV_SIZE) || append(out, cipher, cipherLength);
+}
+
+static int handleAS(const uint8_t* body, size_t length, Buffer* out) {
+    uint8_t part[2 + 2 * (KEY_SIZE + IV_SIZE) + STANDIN_ID_SIZE + 4 + 8 + 8 + 1];
+    uint8_t sessionId[SESSION_ID_SIZE] = {0}, iv[IV_SIZE], ticket[16];
+    uint8_t code = CODE_REPLY_AS, *cipher = NULL;
+    size_t cipherLength = 0, offset = 0;
+    int proposed = -1, answer;
+    uint64_t now = nowMs();
+    Session* session;
+    int result;
+
+    if ( (length != REQUEST_AS_SIZE && length != REQUEST_AS_SIZE + 1) || (body[0] != CODE_REQUEST_AS) ) {
+        return -1;
+    }
+    if (length > REQUEST_AS_SIZE) {
+        proposed = body[REQUEST_AS_SIZE];
+    }
+    answer = (config.answerAlgorithm == STANDIN_ANSWER_PROPOSED) ?
+             ((proposed < 0) ? SESSION_ALGORITHM_AES_GCM : proposed) : config.answerAlgorithm;
+
+    pthread_mutex_lock(&mutex);
+    sessionId[0] = (uint8_t) (sessionCount % MAX_SESSIONS);
+    session = &sessions[sessionId[0]];
+    fill(session->keyCS, KEY_SIZE, sessionCount * 4);
+    fill(session->ivCS, IV_SIZE, sessionCount * 4 + 1);
+    fill(session->keySC, KEY_SIZE, sessionCount * 4 + 2);
+    fill(session->ivSC, IV_SIZE, sessionCount * 4 + 3);
+    session->algorithm = (uint8_t) answer;
+    session->revoked = 0;
+    sessionCount++;
+    stats.requestsAS++;
+    stats.proposedAlgorithm = proposed;
+    stats.sessionAlgorithm = answer;
+
+    /* EncKdcRepPart, with the trailing algorithm byte unless it is AES-GCM */
+    part[offset++] = KEY_SIZE;
+    part[offset++] = IV_SIZE;
+    memcpy(part + offset, session->keyCS, KEY_SIZE);
+    offset += KEY_SIZE;
+    memcpy(part + offset, session->ivCS, IV_SIZE);
+    offset += IV_SIZE;
+    memcpy(part + offset, session->keySC, KEY_SIZE);
+    offset += KEY_SIZE;
+    memcpy(part + offset, session->ivSC, IV_SIZE);
+    offset += IV_SIZE;
+    pthread_mutex_unlock(&mutex);
+
+    memcpy(part + offset, body + 1 + STANDIN_ID_SIZE, STANDIN_ID_SIZE + 4);
+    offset += STANDIN_ID_SIZE + 4;
+    putBigEndian64(part + offset, now);
+    offset += 8;
+    putBigEndian64(part + offset, now + SESSION_LIFETIME_MS);
+    offset += 8;
+    if (answer != SESSION_ALGORITHM_AES_GCM) {
+        part[offset++] = (uint8_t) answer;
+    }
+
+    nextIv(iv);
+    if (sealWithKey(SESSION_ALGORITHM_AES_GCM, (uint8_t*) standinSharedKey, STANDIN_SHARED_KEY_SIZE, iv, IV_SIZE,
+                    KDC_TAG_LENGTH, NULL, 0, part, offset, &cipher, &cipherLength) != 0) {
+        return -1;
+    }
+
+    /* The ticket is opaque to the client */
+    fill(ticket, sizeof(ticket), 7);
+    result = append(out, sessionId, SESSION_ID_SIZE) ||
+             append(out, &code, 1) ||
+             append(out, body + 1, STANDIN_ID_SIZE) ||
+             append(out, standinServerId, STANDIN_ID_SIZE) ||
+             appendEncData(out, iv, ticket, sizeof(ticket)) ||
+             appendEncData(out, iv, cipher, cipherLength);
+    free(cipher);
+    return result;
+}
+
+static int handleAP(const uint8_t* body, size_t length, Buffer* out) {
+    uint8_t *plain = NULL, *cipher = NULL, code = CODE_REPLY_AP;
+    size_t plainLength = 0, cipherLength = 0, offset = SESSION_ID_SIZE;
+    Session session;
+    int result;
+
+    if ( (length < SESSION_ID_SIZE + 1 + STANDIN_ID_SIZE + 2) || (body[offset] != CODE_REQUEST_AP) ) {
+        return -1;
+    }
+    pthread_mutex_lock(&mutex);
+    session = sessions[body[0]];
+    pthread_mutex_unlock(&mutex);
+
+    /* Skips the code, the server id and the ticket's EncryptedData */
+    offset += 1 + STANDIN_ID_SIZE;
+    offset += 2 + body[offset] + body[offset + 1];
+    if ( (offset + 2 > length) || (offset + 2 + body[offset] + body[offset + 1] > length) ) {
+        return -1;
+    }
+
+    /* The authenticator is cname and the client time, the reply carries the time back */
+    if ( (openWithKey(session.algorithm, session.keyCS, KEY_SIZE, (uint8_t*) body + offset + 2, body[offset],
+                      AEAD_TAG_BITS, NULL, 0, (uint8_t*) body + offset + 2 + body[offset], body[offset + 1],
+                      &plain, &plainLength) != 0) ||
+         (plainLength < STANDIN_ID_SIZE + 8) ) {
+        free(plain);
+        return -1;
+    }
+    result = sealWithKey(session.algorithm, session.keySC, KEY_SIZE, session.ivSC, IV_SIZE, AEAD_TAG_BITS,
+                         NULL, 0, plain + STANDIN_ID_SIZE, 8, &cipher, &cipherLength);
+    free(plain);
+    if (result != 0) {
+        return -1;
+    }
+    count(&stats.requestsAP);
+
+    result = append(out, &code, 1) || appendEncData(out, session.ivSC, cipher, cipherLength);
+    free(cipher);
+    return result;
+}
+
+/*
+ * Takes the session of a request, or answers KRB_AP_ERR_TKT_EXPIRED when it
+ * was revoked: returns 0 to go on, 1 when answered, -1 on error.
+ */
+static int takeSession(int sessionIndex, Session* session, Buffer* out) {
+    uint8_t rejection[2] = { CODE_ERROR, KRB_AP_ERR_TKT_EXPIRED };
+
+    if (sessionIndex < 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&mutex);
+    *session = sessions[sessionIndex];
+    if (session->revoked) {
+        stats.rejections++;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    if (session->revoked) {
+        return append(out, rejection, sizeof(rejection)) ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Opens [ivLength][iv][cipher] and appends the echo sealed the same way, both with the given AAD */
+static int echoSealed(const Session* session, const uint8_t* body, size_t length,
+                      const uint8_t* aad, size_t aadLength, Buffer* out) {
+    uint8_t *plain = NULL, *cipher = NULL, iv[IV_SIZE], ivLength = IV_SIZE;
+    size_t plainLength = 0, cipherLength = 0;
+    int result;
+
+    if ( (length < 1) || (length < 1u + body[0]) ||
+         (openWithKey(session->algorithm, (uint8_t*) session->keyCS, KEY_SIZE, (uint8_t*) body + 1, body[0],
+                      AEAD_TAG_BITS, (uint8_t*) aad, aadLength, (uint8_t*) body + 1 + body[0],
+                      length - 1 - body[0], &plain, &plainLength) != 0) ) {
+        count(&stats.failures);
+        return -1;
+    }
+    nextIv(iv);
+    result = sealWithKey(session->algorithm, (uint8_t*) session->keySC, KEY_SIZE, iv, IV_SIZE, AEAD_TAG_BITS,
+                         (uint8_t*) aad, aadLength, plain, plainLength, &cipher, &cipherLength);
+    free(plain);
+    if (result != 0) {
+        return -1;
+    }
+
+    result = append(out, &ivLength, 1) || append(out, iv, IV_SIZE) || append(out, cipher, cipherLength);
+    free(cipher);
+    return result;
+}
+
+/* Messages are [ivLength][iv][cipher], the echo is sealed the same way */
+static int handleMessage(int sessionIndex, const uint8_t* body, size_t length, Buffer* out) {
+    Session session;
+    int result = takeSession(sessionIndex, &session, out);
+
+    if (result != 0) {
+        return (result > 0) ? 0 : -1;
+    }
+    if (length == 0) {
+        return 0;
+    }
+    if (echoSealed(&session, body, length, NULL, 0, out) != 0) {
+        return -1;
+    }
+    count(&stats.messages);
+    return 0;
+}
+
+/*
+ * Appends the echo of a record: its length, then the message sealed with the
+ * index of the record in the batch, 4 bytes big endian, as AAD. Over the
+ * secure channel even an empty message is sealed, so the body is never empty.
+ */
+static int echoRecord(const Session* session, uint32_t index, const uint8_t* record, size_t length, Buffer* out) {
+    uint8_t aad[RECORD_LENGTH_SIZE], recordLength[RECORD_LENGTH_SIZE] = {0};
+    size_t start = out->length;
+
+    putBigEndian32(aad, index);
+    if ( (append(out, recordLength, RECORD_LENGTH_SIZE) != 0) ||
+         (echoSealed(session, record, length, aad, RECORD_LENGTH_SIZE, out) != 0) ) {
+        return -1;
+    }
+    putBigEndian32(out->data + start, (uint32_t) (out->length - start - RECORD_LENGTH_SIZE));
+    return 0;
+}
+
+/*
+ * Batches are records back to back, each one [length][ivLength][iv][cipher],
+ * answered one by one in the same order. When tampering, the answers of the
+ * first two records are exchanged as they are, or the first one is replaced
+ * by an empty record, as a network in the middle could.
+ */
+static int handleRecords(int sessionIndex, const uint8_t* body, size_t length, Buffer* out) {
+    uint8_t emptyRecord[RECORD_LENGTH_SIZE] = {0};
+    Buffer first = {0};
+    Session session;
+    size_t offset = 0;
+    uint32_t index = 0, recordLength;
+    int tamper, result = takeSession(sessionIndex, &session, out);
+
+    if (result != 0) {
+        return (result > 0) ? 0 : -1;
+    }
+    pthread_mutex_lock(&mutex);
+    tamper = tamperRecords;
+    pthread_mutex_unlock(&mutex);
+
+    while ( (result == 0) && (offset < length) ) {
+        if (length - offset < RECORD_LENGTH_SIZE) {
+            result = -1;
+            break;
+        }
+        recordLength = getBigEndian32(body + offset);
+        offset += RECORD_LENGTH_SIZE;
+        if (length - offset < recordLength) {
+            result = -1;
+            break;
+        }
+        if ( (tamper == STANDIN_RECORDS_EMPTIED) && (index == 0) ) {
+            result = append(out, emptyRecord, RECORD_LENGTH_SIZE);
+        } else if ( (tamper == STANDIN_RECORDS_SWAPPED) && (index == 0) ) {
+            result = echoRecord(&session, index, body + offset, recordLength, &first);
+        } else if ( (tamper == STANDIN_RECORDS_SWAPPED) && (index == 1) ) {
+            result = echoRecord(&session, index, body + offset, recordLength, out) ||
+                     append(out, first.data, first.length);
+            first.length = 0;
+        } else {
+            result = echoRecord(&session, index, body + offset, recordLength, out);
+        }
+        offset += recordLength;
+        index++;
+    }
+    if ( (result == 0) && (first.length > 0) ) {
+        result = append(out, first.data, first.length);
+    }
+    free(first.data);
+    if (result != 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&mutex);
+    stats.batches++;
+    stats.records += index;
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+static int receiveMore(int fd, Buffer* in) {
+    uint8_t chunk[16384];
+    ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+
+    if (received <= 0) {
+        return -1;
+    }
+    return append(in, chunk, received);
+}
+
+/* Answers a request, returns 0 when it is valid */
+static int dispatch(const char* path, int sessionIndex, const uint8_t* body, size_t length, Buffer* out) {
+    out->length = 0;
+    if (strcmp(path, "/as") == 0) {
+        return handleAS(body, length, out);
+    } else if (strcmp(path, "/ap") == 0) {
+        return handleAP(body, length, out);
+    } else if (strcmp(path, "/records") == 0) {
+        return handleRecords(sessionIndex, body, length, out);
+    }
+    return handleMessage(sessionIndex, body, length, out);
+}
+
+#ifdef STANDIN_WITH_NGHTTP2
+/*
+ * HTTP/2 over cleartext for the clients with prior knowledge: the requests
+ * are the streams of the connection, each one answered once it has ended.
+ */
+typedef struct {
+    char path[256];
+    int sessionIndex;
+    Buffer body;
+    Buffer out;
+    size_t sent;
+} H2Stream;
+
+typedef struct {
+    int fd;
+    uint32_t openStreams;
+} H2Connection;
+
+static ssize_t h2Send(nghttp2_session* session, const uint8_t* data, size_t length, int flags, void* userData) {
+    H2Connection* connection = (H2Connection*) userData;
+    ssize_t sent = send(connection->fd, data, length, MSG_NOSIGNAL);
+
+    (void) session;
+    (void) flags;
+    return (sent < 0) ? NGHTTP2_ERR_CALLBACK_FAILURE : sent;
+}
+
+static int h2BeginHeaders(nghttp2_session* session, const nghttp2_frame* frame, void* userData) {
+    H2Connection* connection = (H2Connection*) userData;
+    H2Stream* stream;
+
+    if ( (frame->hd.type != NGHTTP2_HEADERS) || (frame->headers.cat != NGHTTP2_HCAT_REQUEST) ) {
+        return 0;
+    }
+    stream = calloc(1, sizeof(H2Stream));
+    if (!stream) {
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    stream->sessionIndex = -1;
+    nghttp2_session_set_stream_user_data(session, frame->hd.stream_id, stream);
+
+    connection->openStreams++;
+    pthread_mutex_lock(&mutex);
+    if (connection->openStreams > stats.peakStreams) {
+        stats.peakStreams = connection->openStreams;
+    }
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+static int h2Header(nghttp2_session* session, const nghttp2_frame* frame, const uint8_t* name, size_t nameLength,
+                    const uint8_t* value, size_t valueLength, uint8_t flags, void* userData) {
+    H2Stream* stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    char sessionHex[3] = {0};
+    unsigned int sessionByte;
+
+    (void) flags;
+    (void) userData;
+    if (!stream) {
+        return 0;
+    }
+    if ( (nameLength == strlen(":path")) && (memcmp(name, ":path", nameLength) == 0) ) {
+        snprintf(stream->path, sizeof(stream->path), "%.*s", (int) valueLength, (const char*) value);
+    } else if ( (nameLength == strlen(H2_SESSION_HEADER)) && (memcmp(name, H2_SESSION_HEADER, nameLength) == 0) &&
+                (valueLength >= 2) ) {
+        memcpy(sessionHex, value, 2);
+        if (sscanf(sessionHex, "%2x", &sessionByte) == 1) {
+            stream->sessionIndex = (int) sessionByte;
+        }
+    }
+    return 0;
+}
+
+static int h2DataChunk(nghttp2_session* session, uint8_t flags, int32_t streamId, const uint8_t* data,
+                       size_t length, void* userData) {
+    H2Stream* stream = nghttp2_session_get_stream_user_data(session, streamId);
+
+    (void) flags;
+    (void) userData;
+    if ( (stream) && (append(&stream->body, data, length) != 0) ) {
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    return 0;
+}
+
+static ssize_t h2Read(nghttp2_session* session, int32_t streamId, uint8_t* buffer, size_t length,
+                      uint32_t* flags, nghttp2_data_source* source, void* userData) {
+    H2Stream* stream = (H2Stream*) source->ptr;
+    size_t left = stream->out.length - stream->sent;
+
+    (void) session;
+    (void) streamId;
+    (void) userData;
+    if (length > left) {
+        length = left;
+    }
+    if (length) {
+        memcpy(buffer, stream->out.data + stream->sent, length);
+    }
+    stream->sent += length;
+    if (stream->sent == stream->out.length) {
+        *flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    return (ssize_t) length;
+}
+
+static int h2FrameReceived(nghttp2_session* session, const nghttp2_frame* frame, void* userData) {
+    H2Stream* stream;
+    nghttp2_data_provider provider;
+    nghttp2_nv headers[2];
+    char contentLength[24];
+    const char* status;
+
+    (void) userData;
+    if ( ((frame->hd.type != NGHTTP2_DATA) && (frame->hd.type != NGHTTP2_HEADERS)) ||
+         !(frame->hd.flags & NGHTTP2_FLAG_END_STREAM) ) {
+        return 0;
+    }
+    stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (!stream) {
+        return 0;
+    }
+
+    status = "200";
+    if (dispatch(stream->path, stream->sessionIndex, stream->body.data, stream->body.length, &stream->out) != 0) {
+        status = "400";
+        stream->out.length = 0;
+    }
+    snprintf(contentLength, sizeof(contentLength), "%zu", stream->out.length);
+    headers[0] = (nghttp2_nv) { (uint8_t*) ":status", (uint8_t*) status, 7, 3, NGHTTP2_NV_FLAG_NONE };
+    headers[1] = (nghttp2_nv) { (uint8_t*) "content-length", (uint8_t*) contentLength, 14, strlen(contentLength),
+                                NGHTTP2_NV_FLAG_NONE };
+    provider.source.ptr = stream;
+    provider.read_callback = h2Read;
+    if (nghttp2_submit_response(session, frame->hd.stream_id, headers, 2, &provider) != 0) {
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    return 0;
+}
+
+static int h2StreamClosed(nghttp2_session* session, int32_t streamId, uint32_t errorCode, void* userData) {
+    H2Connection* connection = (H2Connection*) userData;
+    H2Stream* stream = nghttp2_session_get_stream_user_data(session, streamId);
+
+    (void) errorCode;
+    if (stream) {
+        connection->openStreams--;
+        free(stream->body.data);
+        free(stream->out.data);
+        free(stream);
+    }
+    return 0;
+}
+
+/* Serves an HTTP/2 connection, whose first bytes were received into in */
+static void serveHttp2(int fd, Buffer* in) {
+    nghttp2_settings_entry settings[] = { { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, H2_MAX_STREAMS } };
+    H2Connection connection = { fd, 0 };
+    nghttp2_session_callbacks* callbacks;
+    nghttp2_session* session;
+    uint8_t chunk[16384];
+    ssize_t received;
+    int result;
+
+    if (nghttp2_session_callbacks_new(&callbacks) != 0) {
+        return;
+    }
+    nghttp2_session_callbacks_set_send_callback(callbacks, h2Send);
+    nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, h2BeginHeaders);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, h2Header);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, h2DataChunk);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, h2FrameReceived);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, h2StreamClosed);
+    result = nghttp2_session_server_new(&session, callbacks, &connection);
+    nghttp2_session_callbacks_del(callbacks);
+    if (result != 0) {
+        return;
+    }
+
+    if ( (nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, settings, 1) == 0) &&
+         (nghttp2_session_mem_recv(session, in->data, in->length) >= 0) ) {
+        while ( (nghttp2_session_send(session) == 0) &&
+                (nghttp2_session_want_read(session) || nghttp2_session_want_write(session)) ) {
+            received = recv(fd, chunk, sizeof(chunk), 0);
+            if ( (received <= 0) || (nghttp2_session_mem_recv(session, chunk, (size_t) received) < 0) ) {
+                break;
+            }
+        }
+    }
+    nghttp2_session_del(session);
+}
+#endif
+
+static void* serveConnection(void* arg) {
+    int fd = (int) (intptr_t) arg;
+    Buffer in = {0}, out = {0};
+    char header[128], path[256];
+    const char *end, *field;
+    size_t headerLength, bodyLength;
+    int sessionIndex, result, headerSize;
+    unsigned int sessionByte;
+
+#ifdef STANDIN_WITH_NGHTTP2
+    /* Clients with prior knowledge open with the HTTP/2 preface, no HTTP/1.1 method starts the same */
+    while (in.length < 3) {
+        if (receiveMore(fd, &in) != 0) {
+            goto CLEAN_UP;
+        }
+    }
+    if (memcmp(in.data, H2_PREFACE, 3) == 0) {
+        serveHttp2(fd, &in);
+        goto CLEAN_UP;
+    }
+#endif
+
+    for (;;) {
+        while ( (in.length == 0) || !(end = memmem(in.data, in.length, "\r\n\r\n", 4)) ) {
+            if (receiveMore(fd, &in) != 0) {
+                goto CLEAN_UP;
+            }
+        }
+        headerLength = (end - (char*) in.data) + 4;
+
+        /* The header is searched as a C string up to its blank line */
+        in.data[headerLength - 1] = '\0';
+        path[0] = '\0';
+        sscanf((char*) in.data, "%*s %255s", path);
+        field = strcasestr((char*) in.data, "content-length:");
+        bodyLength = field ? strtoul(field + strlen("content-length:"), NULL, 10) : 0;
+        field = strcasestr((char*) in.data, "expect: 100-continue");
+        if (field && (in.length < headerLength + bodyLength)) {
+            send(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25, MSG_NOSIGNAL);
+        }
+        sessionIndex = -1;
+        field = strcasestr((char*) in.data, SESSION_HEADER);
+        if (field && (sscanf(field + strlen(SESSION_HEADER), "%2x", &sessionByte) == 1)) {
+            sessionIndex = (int) sessionByte;
+        }
+
+        while (in.length < headerLength + bodyLength) {
+            if (receiveMore(fd, &in) != 0) {
+                goto CLEAN_UP;
+            }
+        }
+
+        result = dispatch(path, sessionIndex, in.data + headerLength, bodyLength, &out);
+
+        headerSize = (result == 0) ?
+                     snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", out.length) :
+                     snprintf(header, sizeof(header), "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n");
+        if ( (send(fd, header, headerSize, MSG_NOSIGNAL) != headerSize) ||
+             ( (result == 0) && (out.length) && (send(fd, out.data, out.length, MSG_NOSIGNAL) != (ssize_t) out.length) ) ) {
+            goto CLEAN_UP;
+        }
+
+        memmove(in.data, in.data + headerLength + bodyLength, in.length - headerLength - bodyLength);
+        in.length -= headerLength + bodyLength;
+    }
+
+CLEAN_UP:
+    free(in.data);
+    free(out.data);
+    close(fd);
+    return NULL;
+}
+
+static void* acceptConnections(void* arg) {
+    pthread_t thread;
+    int fd, one = 1;
+
+    (void) arg;
+    while ( (fd = accept(listenFd, NULL, NULL)) >= 0 ) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        count(&stats.connections);
+        if (pthread_create(&thread, NULL, serveConnection, (void*) (intptr_t) fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+int standin_start(const StandinConfig* standinConfig, char* url, size_t urlSize) {
+    struct sockaddr_in address;
+    socklen_t addressLength = sizeof(address);
+
+    config = *standinConfig;
+    tamperRecords = STANDIN_RECORDS_INTACT;
+    memset(&stats, 0, sizeof(stats));
+    stats.proposedAlgorithm = -1;
+    stats.sessionAlgorithm = -1;
+
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    if ( (bind(listenFd, (struct sockaddr*) &address, sizeof(address)) != 0) ||
+         (listen(listenFd, 128) != 0) ||
+         (getsockname(listenFd, (struct sockaddr*) &address, &addressLength) != 0) ||
+         (pthread_create(&acceptThread, NULL, acceptConnections, NULL) != 0) ) {
+        close(listenFd);
+        listenFd = -1;
+        return -1;
+    }
+
+    snprintf(url, urlSize, "http://127.0.0.1:%u", ntohs(address.sin_port));
+    return 0;
+}
+
+void standin_stop() {
+    if (listenFd < 0) {
+        return;
+    }
+    shutdown(listenFd, SHUT_RDWR);
+    pthread_join(acceptThread, NULL);
+    close(listenFd);
+    listenFd = -1;
+}
+
+int standin_supports_h2c() {
+#ifdef STANDIN_WITH_NGHTTP2
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void standin_get_stats(StandinStats* standinStats) {
+    pthread_mutex_lock(&mutex);
+    *standinStats = stats;
+    pthread_mutex_unlock(&mutex);
+}
+
+void standin_tamper_records(int mode) {
+    pthread_mutex_lock(&mutex);
+    tamperRecords = mode;
+    pthread_mutex_unlock(&mutex);
+}
+
+void standin_revoke_sessions() {
+    uint32_t i;
+
+    pthread_mutex_lock(&mutex);
+    for (i = 0; i < MAX_SESSIONS; i++) {
+        sessions[i].revoked = 1;
+    }
+    pthread_mutex_unlock(&mutex);
+}
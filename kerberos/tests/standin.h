@@ -0,0 +1,72 @@
+#ifndef STANDIN_H_
+#define STANDIN_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Stand-in for the KDC (/as, /ap) and for an application server echoing the
+ * records of a batch (/records) or the messages of a session (any other
+ * path). It runs on threads of the test process, on an ephemeral port of the
+ * loopback, with the keys and ids below. It speaks HTTP/1.1, and HTTP/2 over
+ * cleartext to the clients with prior knowledge when built with
+ * STANDIN_WITH_NGHTTP2.
+ */
+
+#define STANDIN_ID_SIZE         16
+#define STANDIN_SHARED_KEY_SIZE 32
+
+/* Answers the session algorithm proposed in RequestAS, AES-GCM when none */
+#define STANDIN_ANSWER_PROPOSED -1
+
+typedef struct {
+    /* STANDIN_ANSWER_PROPOSED, or the algorithm put in EncKdcRepPart */
+    int answerAlgorithm;
+} StandinConfig;
+
+typedef struct {
+    uint32_t connections;
+    /* most HTTP/2 streams open at once on a connection */
+    uint32_t peakStreams;
+    uint32_t requestsAS;
+    uint32_t requestsAP;
+    uint32_t messages;
+    uint32_t batches;
+    uint32_t records;
+    uint32_t failures;
+    /* requests answered KRB_AP_ERR_TKT_EXPIRED, their session being revoked */
+    uint32_t rejections;
+    /* algorithm byte of the last RequestAS, -1 when it had none */
+    int proposedAlgorithm;
+    /* algorithm of the last session handed out */
+    int sessionAlgorithm;
+} StandinStats;
+
+extern const uint8_t standinAppId[STANDIN_ID_SIZE];
+extern const uint8_t standinServerId[STANDIN_ID_SIZE];
+extern const uint8_t standinSharedKey[STANDIN_SHARED_KEY_SIZE];
+
+/* Starts the server, writing its base URL ("http://127.0.0.1:<port>") to url */
+int standin_start(const StandinConfig* /* config */, char* /* url */, size_t /* urlSize */);
+
+void standin_stop();
+
+void standin_get_stats(StandinStats* /* stats */);
+
+/* Non-zero when built with HTTP/2 over cleartext */
+int standin_supports_h2c();
+
+/* Answers the records of the batches as they came */
+#define STANDIN_RECORDS_INTACT  0
+/* Exchanges the answers to the first two records of the batches */
+#define STANDIN_RECORDS_SWAPPED 1
+/* Replaces the answer to the first record of the batches by an empty record */
+#define STANDIN_RECORDS_EMPTIED 2
+
+/* Tampers with the answers to the batches as mode says */
+void standin_tamper_records(int /* mode */);
+
+/* Rejects the sessions handed out so far, as expired */
+void standin_revoke_sessions();
+
+#endif
@@ -1,10 +1,20 @@
 #include "CryptoAPI.h"
 
-/* Secure channel states */
-static aes_ctx_st aesLocal;
-static aes_ctx_st aesExtern;
-static gcm_ctx_st writeChannel;
-static gcm_ctx_st readChannel;
+#include <pthread.h>
+
+#include "backend/nativebackend.h"
+#include "backend/chachapolybackend.h"
+#ifdef LIBAES_WITH_OPENSSL
+#include "backend/opensslbackend.h"
+#endif
+
+/* AES-GCM implementation used by the channels, native unless selected otherwise */
+static AeadBackend backend;
+static AeadBackend chachaPoly;
+static pthread_once_t backendsOnce = PTHREAD_ONCE_INIT;
+
+/* AEAD negotiated for the current channel */
+static uint8_t channelAlgorithm = CRYPTO_ALGORITHM_AES_GCM;
 
 /* Local copies of parameters */
 uint8_t* keyLocal = NULL;
@@ -15,6 +25,9 @@ uint8_t keyLength = 0;
 uint8_t ivLength = 0;
 uint8_t tagLength = 0;
 
+/* Number of messages already encrypted under keyLocal */
+static uint64_t writeInvocations = 0;
+
 errno_t initSecureChannel(uint8_t kLength,
                           uint8_t iLength,
                           uint8_t tLen,
@@ -22,19 +35,37 @@ errno_t initSecureChannel(uint8_t kLength,
                           uint8_t* kExtern,
                           uint8_t* iLocal,
                           uint8_t* iExtern) {
+    return initSecureChannelWithAlgorithm(CRYPTO_ALGORITHM_AES_GCM, kLength, iLength, tLen,
+                                          kLocal, kExtern, iLocal, iExtern);
+}
+
+errno_t initSecureChannelWithAlgorithm(uint8_t algorithm,
+                                       uint8_t kLength,
+                                       uint8_t iLength,
+                                       uint8_t tLen,
+                                       uint8_t* kLocal,
+                                       uint8_t* kExtern,
+                                       uint8_t* iLocal,
+                                       uint8_t* iExtern) {
     errno_t result;
 
     if(!kLocal || !kExtern || !iLocal || !iExtern) {
         return INVALID_PARAMETER;
     }
 
+    if(algorithm != CRYPTO_ALGORITHM_AES_GCM && algorithm != CRYPTO_ALGORITHM_CHACHA20_POLY1305) {
+        return INVALID_PARAMETER;
+    }
+
     /* Clear previous values */
     result = clearSecureChannel();
     if(result != SUCCESSFULL_OPERATION) {
         return INVALID_STATE;
     }
 
+    channelAlgorithm = algorithm;
     tagLength = tLen;
+    writeInvocations = 0;
 
     keyLength = kLength;
     keyLocal = (uint8_t*) malloc(sizeof(uint8_t) * keyLength);
@@ -83,139 +114,650 @@ errno_t clearSecureChannel() {
     return SUCCESSFULL_OPERATION;
 }
 
-errno_t initChannel()
+errno_t selectCryptoBackend(uint8_t backendId)
 {
     errno_t result;
 
-    result = initWriteChannel();
-    if(result != SUCCESSFULL_OPERATION) {
+    switch(backendId) {
+    case CRYPTO_BACKEND_NATIVE:
+        nativeInit(&backend);
+        break;
+#ifdef LIBAES_WITH_OPENSSL
+    case CRYPTO_BACKEND_OPENSSL:
+        opensslInit(&backend);
+        break;
+#endif
+    default:
+        result = INVALID_PARAMETER;
         goto FAIL;
     }
+    result = SUCCESSFULL_OPERATION;
+FAIL:
+    return result;
+}
+
+/* Native AES-GCM unless selectCryptoBackend chose another implementation first */
+static void initDefaultBackends()
+{
+    if(backend.seal == NULL) {
+        nativeInit(&backend);
+    }
+    chachaPolyInit(&chachaPoly);
+}
 
-    result = initReadChannel();
-    if(result != SUCCESSFULL_OPERATION) {
+const char* getCryptoBackendName()
+{
+    pthread_once(&backendsOnce, initDefaultBackends);
+    return backend.name;
+}
+
+static AeadBackend* algorithmBackend(uint8_t algorithm);
+
+/* Implementation of the AEAD negotiated for the channel */
+static AeadBackend* channelBackend()
+{
+    return algorithmBackend(channelAlgorithm);
+}
+
+uint8_t getPreferredCryptoAlgorithm()
+{
+    /* The native AES is table based: whatever the CPU, it is slower than ChaCha20-Poly1305 */
+    pthread_once(&backendsOnce, initDefaultBackends);
+    if(backend.seal == nativeSeal) {
+        return CRYPTO_ALGORITHM_CHACHA20_POLY1305;
+    }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    /* Without AES-NI and carry-less multiplication, ChaCha20-Poly1305 is several times faster */
+    __builtin_cpu_init();
+    if(!__builtin_cpu_supports("aes") || !__builtin_cpu_supports("pclmul")) {
+        return CRYPTO_ALGORITHM_CHACHA20_POLY1305;
+    }
+#endif
+    return CRYPTO_ALGORITHM_AES_GCM;
+}
+
+/*
+ * Counts one more message sealed under the key whose counter is given, NULL
+ * when not counted. The key must be renewed before the GCM invocation limit
+ * is reached, so the message is refused past it. The counter is updated
+ * atomically, as a key may be shared by concurrent senders.
+ */
+static errno_t countInvocation(uint64_t* invocations)
+{
+    if(invocations == NULL) {
+        return SUCCESSFULL_OPERATION;
+    }
+    if(__atomic_fetch_add(invocations, 1, __ATOMIC_RELAXED) >= GCM_MAX_INVOCATIONS) {
+        return INVALID_STATE;
+    }
+    return SUCCESSFULL_OPERATION;
+}
+
+/* Initializes client to server communication */
+errno_t initWriteChannel() 
+{
+    errno_t result;
+
+    if(keyLocal == NULL || ivLocal == NULL) {
+        result = INVALID_STATE;
         goto FAIL;
     }
-    result |= aesClearContext(&aesLocal);
-    result |= gcmClearContext(&writeChannel);
-    result |= aesClearContext(&aesExtern);
-    result |= gcmClearContext(&readChannel);
+
+    result = countInvocation(&writeInvocations);
 FAIL:
     return result;
 }
 
-/* Initializes client to server communication */
-errno_t initWriteChannel() 
+/* Initializes server to client communication */
+errno_t initReadChannel() 
 {
     errno_t result;
 
-    result = aesInit(keyLocal, keyLength, DIR_ENCRYPTION, &aesLocal);
-    if(result != SUCCESSFULL_OPERATION) {
+    if(keyExtern == NULL || ivExtern == NULL) {
+        result = INVALID_STATE;
         goto FAIL;
     }
 
-    result = gcmInit(&writeChannel, 16, DIR_ENCRYPTION, ivLocal, ivLength, tagLength, &aesLocal, aesProcessBlock);
+    result = SUCCESSFULL_OPERATION;
+FAIL:
+    return result;
+}
+
+/* Encrypts through the given AEAD. Output is ciphertext || tag */
+static errno_t sealWith(AeadBackend* aead, uint8_t* key, uint8_t kLength, uint8_t* iv, uint8_t iLength, uint8_t tLength,
+                        uint8_t* aad, size_t aadLength, uint8_t* plaintext, size_t plaintextLength,
+                        uint8_t** ciphertext, size_t* ciphertextLength)
+{
+    errno_t result;
+    uint8_t* output;
+    size_t outputLength, outputOffset = 0;
+
+    /* Estimates the maximum size of the ciphertext considering the tag */
+    result = add_s(plaintextLength, MAX_TAG_SIZE, &outputLength);
     if(result != SUCCESSFULL_OPERATION) {
         goto FAIL;
     }
+    output = (uint8_t*) malloc(sizeof(uint8_t) * outputLength);
+    if(output == NULL) {
+        result = INVALID_STATE;
+        goto FAIL;
+    }
 
-    result = SUCCESSFULL_OPERATION;
+    /* Authenticates the AAD, encrypts the plaintext and appends the tag */
+    result = aead->seal(key, kLength, iv, iLength, tLength, aad, aadLength,
+                        plaintext, plaintextLength, output, outputLength, &outputOffset);
+    if(result != SUCCESSFULL_OPERATION) {
+        goto FAIL_FREE;
+    }
+
+    result = resize_s(&output, outputLength, outputOffset);
+    if(result != SUCCESSFULL_OPERATION) {
+        goto FAIL_FREE;
+    }
+
+    *ciphertext = output;
+    *ciphertextLength = outputOffset;
     goto SUCCESS;
+
+FAIL_FREE:
+    result |= memset_s(output, outputLength, 0, outputLength);
+    free(output);
 FAIL:
-    result |= aesClearContext(&aesLocal);
-    result |= gcmClearContext(&writeChannel);
 SUCCESS:
     return result;
 }
 
-/* Initializes server to client communication */
-errno_t initReadChannel() 
+/* Checks the tag and decrypts through the given AEAD */
+static errno_t openWith(AeadBackend* aead, uint8_t* key, uint8_t kLength, uint8_t* iv, uint8_t iLength, uint8_t tLength,
+                        uint8_t* aad, size_t aadLength, uint8_t* ciphertext, size_t ciphertextLength,
+                        uint8_t** plaintext, size_t* plaintextLength)
 {
     errno_t result;
+    uint8_t* output;
+    size_t outputLength, outputOffset = 0;
 
-    /* Only using DIR_ENCRYPTION because of gcm mode */
-    result = aesInit(keyExtern, keyLength, DIR_ENCRYPTION, &aesExtern);
-    if(result != SUCCESSFULL_OPERATION) {
+    /* The plaintext is never bigger than the ciphertext */
+    outputLength = (ciphertextLength > 0) ? ciphertextLength : 1;
+    output = (uint8_t*) malloc(sizeof(uint8_t) * outputLength);
+    if(output == NULL) {
+        result = INVALID_STATE;
         goto FAIL;
     }
 
-    result = gcmInit(&readChannel, 16, DIR_DECRYPTION, ivExtern, ivLength, tagLength, &aesExtern, aesProcessBlock);
+    /* Authenticates the AAD, checks the tag and decrypts the ciphertext */
+    result = aead->open(key, kLength, iv, iLength, tLength, aad, (aad != NULL) ? aadLength : 0,
+                        ciphertext, ciphertextLength, output, outputLength, &outputOffset);
     if(result != SUCCESSFULL_OPERATION) {
-        goto FAIL;
+        goto FAIL_FREE;
     }
-    result = SUCCESSFULL_OPERATION;
+
+    result = resize_s(&output, outputLength, outputOffset);
+    if(result != SUCCESSFULL_OPERATION) {
+        goto FAIL_FREE;
+    }
+
+    *plaintext = output;
+    *plaintextLength = outputOffset;
     goto SUCCESS;
+
+FAIL_FREE:
+    result |= memset_s(output, outputLength, 0, outputLength);
+    free(output);
 FAIL:
-    result |= aesClearContext(&aesExtern);
-    result |= gcmClearContext(&readChannel);
 SUCCESS:
     return result;
 }
 
-errno_t encryptToJS(uint8_t* aad, uint32_t aadLength, uint8_t* plaintext, uint32_t plaintextLength, uint8_t* ciphertext)
+/* Encrypts with the local key and IV through the channel AEAD. Output is ciphertext || tag */
+static errno_t sealMessage(uint8_t* aad, size_t aadLength, uint8_t* plaintext, size_t plaintextLength,
+                           uint8_t** ciphertext, size_t* ciphertextLength)
 {
     errno_t result;
-        int i;
-        uint8_t* output;
-        uint32_t outputLength, outputOffset = 0;
 
-        if(ciphertext == NULL) {
-                result = INVALID_PARAMETER;
-                goto FAIL;
-        }
-        result = initWriteChannel();
+    result = initWriteChannel();
+    if(result != SUCCESSFULL_OPERATION) {
+        return result;
+    }
+
+    return sealWith(channelBackend(), keyLocal, keyLength, ivLocal, ivLength, tagLength, aad, aadLength,
+                    plaintext, plaintextLength, ciphertext, ciphertextLength);
+}
+
+/* Checks the tag and decrypts with the extern key and IV through the channel AEAD */
+static errno_t openMessage(uint8_t* aad, size_t aadLength, uint8_t* ciphertext, size_t ciphertextLength,
+                           uint8_t** plaintext, size_t* plaintextLength)
+{
+    errno_t result;
+
+    result = initReadChannel();
+    if(result != SUCCESSFULL_OPERATION) {
+        return result;
+    }
+
+    return openWith(channelBackend(), keyExtern, keyLength, ivExtern, ivLength, tagLength, aad, aadLength,
+                    ciphertext, ciphertextLength, plaintext, plaintextLength);
+}
+
+/* Implementation of an AEAD, independently of the channel */
+static AeadBackend* algorithmBackend(uint8_t algorithm)
+{
+    /* Keyed seal and open run concurrently, so the defaults are set up once */
+    pthread_once(&backendsOnce, initDefaultBackends);
+
+    if(algorithm == CRYPTO_ALGORITHM_CHACHA20_POLY1305) {
+        return &chachaPoly;
+    }
+    if(algorithm != CRYPTO_ALGORITHM_AES_GCM) {
+        return NULL;
+    }
+    return &backend;
+}
+
+errno_t sealWithKey(uint8_t algorithm, uint8_t* key, uint8_t kLength, uint8_t* iv, uint8_t iLength, uint8_t tLength,
+                    uint8_t* aad, size_t aadLength, uint8_t* plaintext, size_t plaintextLength,
+                    uint8_t** ciphertext, size_t* ciphertextLength)
+{
+    AeadBackend* aead = algorithmBackend(algorithm);
+
+    if(aead == NULL || key == NULL || iv == NULL || ciphertext == NULL || ciphertextLength == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    return sealWith(aead, key, kLength, iv, iLength, tLength, aad, aadLength,
+                    plaintext, plaintextLength, ciphertext, ciphertextLength);
+}
+
+errno_t openWithKey(uint8_t algorithm, uint8_t* key, uint8_t kLength, uint8_t* iv, uint8_t iLength, uint8_t tLength,
+                    uint8_t* aad, size_t aadLength, uint8_t* ciphertext, size_t ciphertextLength,
+                    uint8_t** plaintext, size_t* plaintextLength)
+{
+    AeadBackend* aead = algorithmBackend(algorithm);
+
+    if(aead == NULL || key == NULL || iv == NULL || plaintext == NULL || plaintextLength == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    return openWith(aead, key, kLength, iv, iLength, tLength, aad, aadLength,
+                    ciphertext, ciphertextLength, plaintext, plaintextLength);
+}
+
+errno_t sealWithKeyTo(uint8_t algorithm, uint8_t* key, uint8_t kLength, uint8_t* iv, uint8_t iLength, uint8_t tLength,
+                      uint8_t* aad, size_t aadLength, uint8_t* plaintext, size_t plaintextLength,
+                      uint8_t* ciphertext, size_t ciphertextCapacity, size_t* ciphertextLength,
+                      uint64_t* invocations)
+{
+    errno_t result;
+    AeadBackend* aead = algorithmBackend(algorithm);
+    size_t outputOffset = 0;
+
+    if(aead == NULL || key == NULL || iv == NULL || ciphertext == NULL || ciphertextLength == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    result = countInvocation(invocations);
+    if(result != SUCCESSFULL_OPERATION) {
+        return result;
+    }
+
+    /* Authenticates the AAD, encrypts the plaintext and appends the tag */
+    result = aead->seal(key, kLength, iv, iLength, tLength, aad, (aad != NULL) ? aadLength : 0,
+                        plaintext, plaintextLength, ciphertext, ciphertextCapacity, &outputOffset);
+    if(result != SUCCESSFULL_OPERATION) {
+        result |= memset_s(ciphertext, ciphertextCapacity, 0, ciphertextCapacity);
+        return result;
+    }
+
+    *ciphertextLength = outputOffset;
+    return SUCCESSFULL_OPERATION;
+}
+
+errno_t openWithKeyTo(uint8_t algorithm, uint8_t* key, uint8_t kLength, uint8_t* iv, uint8_t iLength, uint8_t tLength,
+                      uint8_t* aad, size_t aadLength, uint8_t* ciphertext, size_t ciphertextLength,
+                      uint8_t* plaintext, size_t plaintextCapacity, size_t* plaintextLength)
+{
+    errno_t result;
+    AeadBackend* aead = algorithmBackend(algorithm);
+    size_t outputOffset = 0;
+
+    if(aead == NULL || key == NULL || iv == NULL || plaintext == NULL || plaintextLength == NULL) {
+        return INVALID_PARAMETER;
+    }
+
+    /* Authenticates the AAD, checks the tag and decrypts the ciphertext */
+    result = aead->open(key, kLength, iv, iLength, tLength, aad, (aad != NULL) ? aadLength : 0,
+                        ciphertext, ciphertextLength, plaintext, plaintextCapacity, &outputOffset);
+    if(result != SUCCESSFULL_OPERATION) {
+        result |= memset_s(plaintext, plaintextCapacity, 0, plaintextCapacity);
+        return result;
+    }
+
+    *plaintextLength = outputOffset;
+    return SUCCESSFULL_OPERATION;
+}
+
+struct SOpenStream {
+    aes_ctx_st aes;
+    gcm_ctx_st gcm;
+    uint8_t tagSize;
+    /* Last bytes received, which may be the tag */
+    uint8_t pending[MAX_TAG_SIZE];
+    uint8_t pendingLength;
+};
+
+errno_t openStreamInit(uint8_t algorithm, uint8_t* key, uint8_t kLength, uint8_t* iv, uint8_t iLength, uint8_t tLength,
+                       uint8_t* aad, size_t aadLength, OpenStream** stream)
+{
+    errno_t result;
+    OpenStream* s;
+
+    if(key == NULL || iv == NULL || stream == NULL || (aad == NULL && aadLength != 0)) {
+        return INVALID_PARAMETER;
+    }
+    /* Only GCM can release the plaintext before the whole message is there */
+    if(algorithm != CRYPTO_ALGORITHM_AES_GCM) {
+        return INVALID_PARAMETER;
+    }
+
+    s = (OpenStream*) calloc(1, sizeof(OpenStream));
+    if(s == NULL) {
+        return INVALID_STATE;
+    }
+
+    /* Only using DIR_ENCRYPTION because of gcm mode */
+    result = aesInit(key, kLength, DIR_ENCRYPTION, &s->aes);
+    if(result != SUCCESSFULL_OPERATION) {
+        goto FAIL;
+    }
+    result = gcmInit(&s->gcm, 16, DIR_DECRYPTION, iv, iLength, tLength, &s->aes, aesProcessBlock);
+    if(result != SUCCESSFULL_OPERATION) {
+        goto FAIL_AES;
+    }
+    if(aadLength > 0) {
+        result = gcmUpdateAAD(&s->gcm, aad, aadLength, 0);
         if(result != SUCCESSFULL_OPERATION) {
-                goto FAIL;
+            goto FAIL_GCM;
         }
+    }
+    s->tagSize = s->gcm.tagSize;
 
-        /* Estimates the maximum size of the ciphertext considering the tag */
-        result = gcmCalculateOutputSize(&writeChannel, plaintextLength, &outputLength);
-        output = (uint8_t*) malloc(sizeof(uint8_t) * outputLength);
-        if(output == NULL && outputLength != 0) {
-                result = INVALID_STATE;
-                goto FAIL;
-        }
+    *stream = s;
+    return SUCCESSFULL_OPERATION;
+
+FAIL_GCM:
+    result |= gcmClearContext(&s->gcm);
+FAIL_AES:
+    result |= aesClearContext(&s->aes);
+FAIL:
+    free(s);
+    return result;
+}
+
+errno_t openStreamUpdate(OpenStream* stream, const uint8_t* input, size_t inputLength,
+                         uint8_t* output, size_t outputCapacity, size_t* outputLength)
+{
+    errno_t result = SUCCESSFULL_OPERATION;
+    size_t release, fromPending, fromInput;
 
-        /* Authenticates the AAD */
-        if(aadLength > 0) {
-                result = gcmUpdateAAD(&writeChannel, aad, aadLength, 0);
-                if(result != SUCCESSFULL_OPERATION) {
-                        goto FAIL_FREE;
-                }
+    if(stream == NULL || (input == NULL && inputLength != 0) || output == NULL || outputLength == NULL) {
+        return INVALID_PARAMETER;
+    }
+    *outputLength = 0;
+
+    /* Everything but the last tagSize bytes seen so far is ciphertext */
+    if(stream->pendingLength + inputLength <= stream->tagSize) {
+        memcpy(stream->pending + stream->pendingLength, input, inputLength);
+        stream->pendingLength += inputLength;
+        return SUCCESSFULL_OPERATION;
+    }
+    release = stream->pendingLength + inputLength - stream->tagSize;
+    fromPending = (release < stream->pendingLength) ? release : stream->pendingLength;
+    fromInput = release - fromPending;
+
+    if(fromPending > 0) {
+        result = gcmUpdate(&stream->gcm, stream->pending, fromPending, 0, output, outputCapacity, outputLength);
+        if(result != SUCCESSFULL_OPERATION) {
+            return result;
         }
+    }
+    if(fromInput > 0) {
+        result = gcmUpdate(&stream->gcm, input, fromInput, 0, output, outputCapacity, outputLength);
+        if(result != SUCCESSFULL_OPERATION) {
+            return result;
+        }
+    }
+
+    memmove(stream->pending, stream->pending + fromPending, stream->pendingLength - fromPending);
+    stream->pendingLength -= fromPending;
+    memcpy(stream->pending + stream->pendingLength, input + fromInput, inputLength - fromInput);
+    stream->pendingLength += inputLength - fromInput;
+
+    return result;
+}
+
+errno_t openStreamFinal(OpenStream* stream, uint8_t* output, size_t outputCapacity, size_t* outputLength)
+{
+    errno_t result;
+
+    if(stream == NULL) {
+        return INVALID_PARAMETER;
+    }
+    if(output == NULL || outputLength == NULL) {
+        openStreamAbort(stream);
+        return INVALID_PARAMETER;
+    }
+    *outputLength = 0;
+
+    /* A message shorter than a tag cannot be authentic */
+    if(stream->pendingLength != stream->tagSize) {
+        openStreamAbort(stream);
+        return INVALID_INPUT_SIZE;
+    }
+
+    /* Checks the tag and clears the gcm context */
+    result = gcmFinal(&stream->gcm, stream->pending, stream->pendingLength, 0, output, outputCapacity, outputLength);
+    if(result != SUCCESSFULL_OPERATION) {
+        result |= memset_s(output, outputCapacity, 0, outputCapacity);
+        *outputLength = 0;
+    }
+    result |= aesClearContext(&stream->aes);
+    result |= memset_s(stream, sizeof(OpenStream), 0, sizeof(OpenStream));
+    free(stream);
+    return result;
+}
+
+void openStreamAbort(OpenStream* stream)
+{
+    if(stream == NULL) {
+        return;
+    }
+    gcmClearContext(&stream->gcm);
+    aesClearContext(&stream->aes);
+    memset_s(stream, sizeof(OpenStream), 0, sizeof(OpenStream));
+    free(stream);
+}
+
+struct SSealStream {
+    aes_ctx_st aes;
+    gcm_ctx_st gcm;
+};
+
+errno_t sealStreamInit(uint8_t algorithm, uint8_t* key, uint8_t kLength, uint8_t* iv, uint8_t iLength, uint8_t tLength,
+                       uint8_t* aad, size_t aadLength, SealStream** stream, uint64_t* invocations)
+{
+    errno_t result;
+    SealStream* s;
+
+    if(key == NULL || iv == NULL || stream == NULL || (aad == NULL && aadLength != 0)) {
+        return INVALID_PARAMETER;
+    }
+    /* Only GCM can release the ciphertext before the whole message is there */
+    if(algorithm != CRYPTO_ALGORITHM_AES_GCM) {
+        return INVALID_PARAMETER;
+    }
+
+    result = countInvocation(invocations);
+    if(result != SUCCESSFULL_OPERATION) {
+        return result;
+    }
+
+    s = (SealStream*) calloc(1, sizeof(SealStream));
+    if(s == NULL) {
+        return INVALID_STATE;
+    }
 
-        /* Encrypts the plaintext and appends the tag */
-        result = gcmFinal(&writeChannel, plaintext, plaintextLength, 0, output, outputLength, &outputOffset);
+    result = aesInit(key, kLength, DIR_ENCRYPTION, &s->aes);
+    if(result != SUCCESSFULL_OPERATION) {
+        goto FAIL;
+    }
+    result = gcmInit(&s->gcm, 16, DIR_ENCRYPTION, iv, iLength, tLength, &s->aes, aesProcessBlock);
+    if(result != SUCCESSFULL_OPERATION) {
+        goto FAIL_AES;
+    }
+    if(aadLength > 0) {
+        result = gcmUpdateAAD(&s->gcm, aad, aadLength, 0);
         if(result != SUCCESSFULL_OPERATION) {
-                goto FAIL_FREE;
+            goto FAIL_GCM;
         }
+    }
+
+    *stream = s;
+    return SUCCESSFULL_OPERATION;
 
-        result = resize_s(&output, outputLength, outputOffset);
+FAIL_GCM:
+    result |= gcmClearContext(&s->gcm);
+FAIL_AES:
+    result |= aesClearContext(&s->aes);
+FAIL:
+    free(s);
+    return result;
+}
+
+errno_t sealStreamUpdate(SealStream* stream, const uint8_t* input, size_t inputLength,
+                         uint8_t* output, size_t outputCapacity, size_t* outputLength)
+{
+    if(stream == NULL || (input == NULL && inputLength != 0) || output == NULL || outputLength == NULL) {
+        return INVALID_PARAMETER;
+    }
+    *outputLength = 0;
+    if(inputLength == 0) {
+        return SUCCESSFULL_OPERATION;
+    }
+
+    return gcmUpdate(&stream->gcm, input, inputLength, 0, output, outputCapacity, outputLength);
+}
+
+errno_t sealStreamFinal(SealStream* stream, uint8_t* output, size_t outputCapacity, size_t* outputLength)
+{
+    errno_t result;
+    uint8_t empty = 0;
+
+    if(stream == NULL) {
+        return INVALID_PARAMETER;
+    }
+    if(output == NULL || outputLength == NULL) {
+        sealStreamAbort(stream);
+        return INVALID_PARAMETER;
+    }
+    *outputLength = 0;
+
+    /* Flushes the last partial block, appends the tag and clears the gcm context */
+    result = gcmFinal(&stream->gcm, &empty, 0, 0, output, outputCapacity, outputLength);
+    if(result != SUCCESSFULL_OPERATION) {
+        *outputLength = 0;
+    }
+    result |= aesClearContext(&stream->aes);
+    result |= memset_s(stream, sizeof(SealStream), 0, sizeof(SealStream));
+    free(stream);
+    return result;
+}
+
+void sealStreamAbort(SealStream* stream)
+{
+    if(stream == NULL) {
+        return;
+    }
+    gcmClearContext(&stream->gcm);
+    aesClearContext(&stream->aes);
+    memset_s(stream, sizeof(SealStream), 0, sizeof(SealStream));
+    free(stream);
+}
+
+errno_t deriveKey(uint8_t* key, uint8_t kLength, const uint8_t* label, uint8_t labelLength,
+                  uint8_t* derived, size_t derivedLength)
+{
+    errno_t result;
+    aes_ctx_st aes;
+    uint8_t block[DERIVE_KEY_BLOCK_SIZE];
+    uint8_t output[DERIVE_KEY_BLOCK_SIZE];
+    size_t offset, chunk;
+    uint8_t counter = 0;
+
+    if(key == NULL || derived == NULL || (label == NULL && labelLength != 0)) {
+        return INVALID_PARAMETER;
+    }
+    if(labelLength > DERIVE_KEY_MAX_LABEL_LENGTH ||
+       derivedLength > DERIVE_KEY_MAX_BLOCKS * DERIVE_KEY_BLOCK_SIZE) {
+        return INVALID_PARAMETER;
+    }
+
+    result = aesInit(key, kLength, DIR_ENCRYPTION, &aes);
+    if(result != SUCCESSFULL_OPERATION) {
+        goto FAIL;
+    }
+
+    /* Counter mode KDF with AES as the PRF: block i = AES(key, i || label || 0...) */
+    memset(block, 0, sizeof(block));
+    memcpy(block + 1, label, labelLength);
+    for(offset = 0; offset < derivedLength; offset += chunk) {
+        block[0] = ++counter;
+        result = aesProcessBlock(block, output, &aes);
         if(result != SUCCESSFULL_OPERATION) {
-                goto FAIL_FREE;
+            goto FAIL_CLEAN;
         }
-        memcpy(ciphertext, output, outputOffset);
-        inc(ivLocal, ivLength);
-        result = SUCCESSFULL_OPERATION;
-        goto SUCCESS;
+        chunk = derivedLength - offset < DERIVE_KEY_BLOCK_SIZE ? derivedLength - offset : DERIVE_KEY_BLOCK_SIZE;
+        memcpy(derived + offset, output, chunk);
+    }
 
-FAIL_FREE:
-        result |= memset_s(output, outputOffset, 0, outputOffset);
-        free(output);
+FAIL_CLEAN:
+    result |= memset_s(output, sizeof(output), 0, sizeof(output));
+    result |= aesClearContext(&aes);
+FAIL:
+    return result;
+}
+
+errno_t encryptToJS(uint8_t* aad, size_t aadLength, uint8_t* plaintext, size_t plaintextLength, uint8_t* ciphertext)
+{
+    errno_t result;
+    uint8_t* output = NULL;
+    size_t outputLength = 0;
+
+    if(ciphertext == NULL) {
+        result = INVALID_PARAMETER;
+        goto FAIL;
+    }
 
+    result = sealMessage(aad, aadLength, plaintext, plaintextLength, &output, &outputLength);
+    if(result != SUCCESSFULL_OPERATION) {
+        goto FAIL;
+    }
+
+    memcpy(ciphertext, output, outputLength);
+    result |= memset_s(output, outputLength, 0, outputLength);
+    free(output);
+    inc(ivLocal, ivLength);
 FAIL:
-SUCCESS:
-        result |= memset_s(plaintext, plaintextLength, 0, plaintextLength);
-        result |= memset_s(aad, aadLength, 0, aadLength);
-        return result;
+    result |= memset_s(plaintext, plaintextLength, 0, plaintextLength);
+    result |= memset_s(aad, aadLength, 0, aadLength);
+    return result;
 }
 
 errno_t changeIvAndEncryptTo(uint8_t* newLocalIv,
                              uint8_t newLocalIvLength,
                              uint8_t* aad,
-                             uint32_t aadLength,
+                             size_t aadLength,
                              uint8_t* plaintext,
-                             uint32_t plaintextLength,
+                             size_t plaintextLength,
                              uint8_t** ciphertext,
                              size_t* ciphertextLength) {
     if (ivLength == newLocalIvLength) {
@@ -234,61 +776,17 @@ errno_t changeIvAndEncryptTo(uint8_t* newLocalIv,
 }
 
 
-errno_t encryptTo(uint8_t* aad, uint32_t aadLength, uint8_t* plaintext, uint32_t plaintextLength, uint8_t** ciphertext, size_t* ciphertextLength)
+errno_t encryptTo(uint8_t* aad, size_t aadLength, uint8_t* plaintext, size_t plaintextLength, uint8_t** ciphertext, size_t* ciphertextLength)
 {
     errno_t result;
-    int i;
-    uint8_t* output;
-    uint32_t outputLength, outputOffset = 0;
 
     if(ciphertext == NULL || ciphertextLength == NULL) {
         result = INVALID_PARAMETER;
         goto FAIL;
     }
-    result = initWriteChannel();
-    if(result != SUCCESSFULL_OPERATION) {
-        goto FAIL;
-    }
-
-    /* Estimates the maximum size of the ciphertext considering the tag */
-    result = gcmCalculateOutputSize(&writeChannel, plaintextLength, &outputLength);
-    output = (uint8_t*) malloc(sizeof(uint8_t) * outputLength);
-    if(output == NULL && outputLength != 0) {
-        result = INVALID_STATE;
-        goto FAIL;
-    }
-
-    /* Authenticates the AAD */
-    if(aadLength > 0) {
-        result = gcmUpdateAAD(&writeChannel, aad, aadLength, 0);
-        if(result != SUCCESSFULL_OPERATION) {
-            goto FAIL_FREE;
-        }
-    }
-
-    /* Encrypts the plaintext and appends the tag */
-    result = gcmFinal(&writeChannel, plaintext, plaintextLength, 0, output, outputLength, &outputOffset);
-    if(result != SUCCESSFULL_OPERATION) {
-        goto FAIL_FREE;
-    }
-
-    result = resize_s(&output, outputLength, outputOffset);
-    if(result != SUCCESSFULL_OPERATION) {
-        goto FAIL_FREE;
-    }
-
-    *ciphertext = output;
-    *ciphertextLength = outputOffset;
-
-    result = SUCCESSFULL_OPERATION;
-    goto SUCCESS;
-
-FAIL_FREE:
-    result |= memset_s(output, outputOffset, 0, outputOffset);
-    free(output);
 
+    result = sealMessage(aad, aadLength, plaintext, plaintextLength, ciphertext, ciphertextLength);
 FAIL:
-SUCCESS:
     result |= memset_s(plaintext, plaintextLength, 0, plaintextLength);
     result |= memset_s(aad, aadLength, 0, aadLength);
     return result;
@@ -297,9 +795,9 @@ SUCCESS:
 errno_t changeIvAndDecryptTo(uint8_t* newExternalIv,
                              uint8_t newExternalIvLength,
                              uint8_t* aad,
-                             uint32_t aadLength,
+                             size_t aadLength,
                              uint8_t* ciphertext,
-                             uint32_t ciphertextLength,
+                             size_t ciphertextLength,
                              uint8_t** plaintext,
                              size_t* plaintextLength) {
     if (ivLength == newExternalIvLength) {
@@ -317,112 +815,46 @@ errno_t changeIvAndDecryptTo(uint8_t* newExternalIv,
                      plaintextLength);
 }
 
-errno_t decryptTo(uint8_t* aad, uint32_t aadLength, uint8_t* ciphertext, uint32_t ciphertextLength, uint8_t** plaintext, size_t* plaintextLength)
+errno_t decryptTo(uint8_t* aad, size_t aadLength, uint8_t* ciphertext, size_t ciphertextLength, uint8_t** plaintext, size_t* plaintextLength)
 {
-    uint8_t *output;
-    uint32_t outputLength, outputOffset = 0;
     errno_t result;
 
-    result = initReadChannel();
-    if(result != SUCCESSFULL_OPERATION) {
-        goto FAIL;
-    }
-
-    /* Estimates the maximum size of the ciphertext considering the tag */
-    result = gcmCalculateOutputSize(&readChannel, ciphertextLength, &outputLength);
-
-    output = (uint8_t*) malloc(sizeof(uint8_t) * outputLength);
-    if(output == NULL && outputLength != 0) {
-        result = INVALID_STATE;
+    if(plaintext == NULL || plaintextLength == NULL) {
+        result = INVALID_PARAMETER;
         goto FAIL;
     }
 
-    /* Authenticates the AAD */
-    if(aad != NULL && aadLength > 0) {
-        result = gcmUpdateAAD(&readChannel, aad, aadLength, 0);
-        if(result != SUCCESSFULL_OPERATION) {
-            goto FAIL_FREE;
-        }
-    }
-
-    /* Decrypts the ciphertext and removes the tag */
-    result = gcmFinal(&readChannel, ciphertext, ciphertextLength, 0, output, outputLength, &outputOffset);
-    if(result != SUCCESSFULL_OPERATION) {
-        goto FAIL_FREE;
-    }
-
-    result = resize_s(&output, outputLength, outputOffset);
-    if(result != SUCCESSFULL_OPERATION) {
-        goto FAIL_FREE;
-    }
-
-    *plaintext = output;
-    *plaintextLength = outputOffset;
+    result = openMessage(aad, aadLength, ciphertext, ciphertextLength, plaintext, plaintextLength);
     /* Initializes the server to client channel */
     //inc(ivExtern, ivLength);
-    goto SUCCESS;
-
-FAIL_FREE:
-    result |= memset_s(output, outputOffset, 0, outputOffset);
-    free(output);
-
 FAIL:
-SUCCESS:
     result |= memset_s(ciphertext, ciphertextLength, 0, ciphertextLength);
     result |= memset_s(aad, aadLength, 0, aadLength);
     return result;
 }
 
-errno_t decryptToJS(uint8_t* aad, uint32_t aadLength, uint8_t* ciphertext, uint32_t ciphertextLength, uint8_t* plaintext)
+errno_t decryptToJS(uint8_t* aad, size_t aadLength, uint8_t* ciphertext, size_t ciphertextLength, uint8_t* plaintext)
 {
-    uint8_t *output;
-    uint32_t outputLength, outputOffset = 0;
     errno_t result;
+    uint8_t* output = NULL;
+    size_t outputLength = 0;
 
-    result = initReadChannel();
-    if(result != SUCCESSFULL_OPERATION) {
-        goto FAIL;
-    }
-
-    /* Estimates the maximum size of the ciphertext considering the tag */
-    result = gcmCalculateOutputSize(&readChannel, ciphertextLength, &outputLength);
-
-    output = (uint8_t*) malloc(sizeof(uint8_t) * outputLength);
-    if(output == NULL && outputLength != 0) {
-        result = INVALID_STATE;
+    if(plaintext == NULL) {
+        result = INVALID_PARAMETER;
         goto FAIL;
     }
 
-    /* Authenticates the AAD */
-    if(aad != NULL && aadLength > 0) {
-        result = gcmUpdateAAD(&readChannel, aad, aadLength, 0);
-        if(result != SUCCESSFULL_OPERATION) {
-            goto FAIL_FREE;
-        }
-    }
-
-    /* Decrypts the ciphertext and removes the tag */
-    result = gcmFinal(&readChannel, ciphertext, ciphertextLength, 0, output, outputLength, &outputOffset);
-    if(result != SUCCESSFULL_OPERATION) {
-        goto FAIL_FREE;
-    }
-
-    result = resize_s(&output, outputLength, outputOffset);
+    result = openMessage(aad, aadLength, ciphertext, ciphertextLength, &output, &outputLength);
     if(result != SUCCESSFULL_OPERATION) {
-        goto FAIL_FREE;
+        goto FAIL;
     }
 
-    memcpy(plaintext, output, outputOffset);
+    memcpy(plaintext, output, outputLength);
+    result |= memset_s(output, outputLength, 0, outputLength);
+    free(output);
     /* Initializes the server to client channel */
     //inc(ivExtern, ivLength);
-    goto SUCCESS;
-
-FAIL_FREE:
-    result |= memset_s(output, outputOffset, 0, outputOffset);
-    free(output);
-
 FAIL:
-SUCCESS:
     result |= memset_s(ciphertext, ciphertextLength, 0, ciphertextLength);
     result |= memset_s(aad, aadLength, 0, aadLength);
     return result;
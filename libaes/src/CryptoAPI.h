@@ -6,10 +6,18 @@
 
 #include "util/cryptoutil.h"
 #include "symmetric/aes.h"
+#include "backend/backend.h"
 
 // Using the biggest length possible for the tag
 #define TAG_LEN 128
 
+/*
+ * Selects the AES-GCM implementation used by the channels. CRYPTO_BACKEND_OPENSSL
+ * is only accepted when the library was configured with --with-openssl.
+ */
+errno_t selectCryptoBackend(uint8_t /* backendId */);
+const char* getCryptoBackendName();
+
 errno_t initReadChannel();
 errno_t initWriteChannel();
 errno_t initSecureChannel(uint8_t keyLength,
@@ -19,45 +27,237 @@ errno_t initSecureChannel(uint8_t keyLength,
                           uint8_t* kExtern,
                           uint8_t* iLocal,
                           uint8_t* iExtern);
+
+/*
+ * Same as initSecureChannel, for the AEAD negotiated with the peer. ChaCha20-Poly1305
+ * takes 32 byte keys, 12 byte IVs and 128 bit tags.
+ */
+errno_t initSecureChannelWithAlgorithm(uint8_t /* algorithm */,
+                                       uint8_t /* keyLength */,
+                                       uint8_t /* ivLength */,
+                                       uint8_t /* tagLen */,
+                                       uint8_t* /* kLocal */,
+                                       uint8_t* /* kExtern */,
+                                       uint8_t* /* iLocal */,
+                                       uint8_t* /* iExtern */);
 errno_t clearSecureChannel();
 
+/*
+ * AEAD this host runs fastest, to be proposed to the peer: AES-GCM only when
+ * the selected backend is hardware accelerated, ChaCha20-Poly1305 otherwise
+ */
+uint8_t getPreferredCryptoAlgorithm();
+
+/*
+ * One shot AEAD under explicit parameters, independent of the channel state,
+ * so it can be used concurrently with the channel or from several threads.
+ * tagLen is given in bits, as for initSecureChannel.
+ */
+errno_t sealWithKey(uint8_t /* algorithm */,
+                    uint8_t* /* key */,
+                    uint8_t /* keyLength */,
+                    uint8_t* /* iv */,
+                    uint8_t /* ivLength */,
+                    uint8_t /* tagLen */,
+                    uint8_t* /* aad */,
+                    size_t /* aadLength */,
+                    uint8_t* /* plaintext */,
+                    size_t /* plaintextLength */,
+                    uint8_t** /* ciphertext */,
+                    size_t* /* ciphertextLength */);
+errno_t openWithKey(uint8_t /* algorithm */,
+                    uint8_t* /* key */,
+                    uint8_t /* keyLength */,
+                    uint8_t* /* iv */,
+                    uint8_t /* ivLength */,
+                    uint8_t /* tagLen */,
+                    uint8_t* /* aad */,
+                    size_t /* aadLength */,
+                    uint8_t* /* ciphertext */,
+                    size_t /* ciphertextLength */,
+                    uint8_t** /* plaintext */,
+                    size_t* /* plaintextLength */);
+
+/*
+ * As sealWithKey, but writes ciphertext || tag to the caller's buffer, which
+ * must hold plaintextLength + tagLen / 8 bytes, instead of allocating it.
+ * invocations, if not NULL, counts the messages sealed under key: it is
+ * incremented atomically, and INVALID_STATE is returned once
+ * GCM_MAX_INVOCATIONS messages were sealed, meaning the key must be renewed.
+ */
+errno_t sealWithKeyTo(uint8_t /* algorithm */,
+                      uint8_t* /* key */,
+                      uint8_t /* keyLength */,
+                      uint8_t* /* iv */,
+                      uint8_t /* ivLength */,
+                      uint8_t /* tagLen */,
+                      uint8_t* /* aad */,
+                      size_t /* aadLength */,
+                      uint8_t* /* plaintext */,
+                      size_t /* plaintextLength */,
+                      uint8_t* /* ciphertext */,
+                      size_t /* ciphertextCapacity */,
+                      size_t* /* ciphertextLength */,
+                      uint64_t* /* invocations */);
+
+/*
+ * As openWithKey, but writes the plaintext to the caller's buffer instead of
+ * allocating it. The plaintext is never bigger than the ciphertext minus the
+ * tag; INVALID_OUTPUT_SIZE is returned if plaintextCapacity is smaller.
+ * plaintext may be ciphertext itself, to decrypt in place.
+ */
+errno_t openWithKeyTo(uint8_t /* algorithm */,
+                      uint8_t* /* key */,
+                      uint8_t /* keyLength */,
+                      uint8_t* /* iv */,
+                      uint8_t /* ivLength */,
+                      uint8_t /* tagLen */,
+                      uint8_t* /* aad */,
+                      size_t /* aadLength */,
+                      uint8_t* /* ciphertext */,
+                      size_t /* ciphertextLength */,
+                      uint8_t* /* plaintext */,
+                      size_t /* plaintextCapacity */,
+                      size_t* /* plaintextLength */);
+
+/* Room openStreamUpdate and openStreamFinal may need beyond their input */
+#define OPEN_STREAM_OUTPUT_OVERHEAD (MAX_TAG_SIZE + MAX_BLOCK_SIZE)
+
+typedef struct SOpenStream OpenStream;
+
+/*
+ * Incremental open of an AES-GCM ciphertext || tag too big to be held in
+ * memory. The plaintext is released as the ciphertext arrives, before the
+ * tag is checked, so it must not be trusted until openStreamFinal succeeds.
+ * The stream does not need to know the length in advance: the last
+ * tagLen / 8 bytes given to openStreamUpdate are taken as the tag.
+ */
+errno_t openStreamInit(uint8_t /* algorithm */,
+                       uint8_t* /* key */,
+                       uint8_t /* keyLength */,
+                       uint8_t* /* iv */,
+                       uint8_t /* ivLength */,
+                       uint8_t /* tagLen */,
+                       uint8_t* /* aad */,
+                       size_t /* aadLength */,
+                       OpenStream** /* stream */);
+
+/* output must hold inputLength + OPEN_STREAM_OUTPUT_OVERHEAD bytes */
+errno_t openStreamUpdate(OpenStream* /* stream */,
+                         const uint8_t* /* input */,
+                         size_t /* inputLength */,
+                         uint8_t* /* output */,
+                         size_t /* outputCapacity */,
+                         size_t* /* outputLength */);
+
+/*
+ * Writes the last plaintext bytes, at most OPEN_STREAM_OUTPUT_OVERHEAD, and
+ * checks the tag. The stream is released, whatever the result.
+ */
+errno_t openStreamFinal(OpenStream* /* stream */,
+                        uint8_t* /* output */,
+                        size_t /* outputCapacity */,
+                        size_t* /* outputLength */);
+
+/* Releases a stream that will not be finished */
+void openStreamAbort(OpenStream* /* stream */);
+
+/* Room sealStreamUpdate and sealStreamFinal may need beyond their input */
+#define SEAL_STREAM_OUTPUT_OVERHEAD (MAX_TAG_SIZE + MAX_BLOCK_SIZE)
+
+typedef struct SSealStream SealStream;
+
+/*
+ * Incremental AES-GCM seal of a plaintext too big to be held in memory.
+ * The ciphertext is released as the plaintext comes in, and the tag is
+ * appended by sealStreamFinal, so the result can be opened by openWithKey
+ * or openStreamInit alike. invocations counts the messages sealed under key,
+ * as for sealWithKeyTo.
+ */
+errno_t sealStreamInit(uint8_t /* algorithm */,
+                       uint8_t* /* key */,
+                       uint8_t /* keyLength */,
+                       uint8_t* /* iv */,
+                       uint8_t /* ivLength */,
+                       uint8_t /* tagLen */,
+                       uint8_t* /* aad */,
+                       size_t /* aadLength */,
+                       SealStream** /* stream */,
+                       uint64_t* /* invocations */);
+
+/* output must hold inputLength + SEAL_STREAM_OUTPUT_OVERHEAD bytes */
+errno_t sealStreamUpdate(SealStream* /* stream */,
+                         const uint8_t* /* input */,
+                         size_t /* inputLength */,
+                         uint8_t* /* output */,
+                         size_t /* outputCapacity */,
+                         size_t* /* outputLength */);
+
+/*
+ * Writes the last ciphertext bytes followed by the tag, at most
+ * SEAL_STREAM_OUTPUT_OVERHEAD. The stream is released, whatever the result.
+ */
+errno_t sealStreamFinal(SealStream* /* stream */,
+                        uint8_t* /* output */,
+                        size_t /* outputCapacity */,
+                        size_t* /* outputLength */);
+
+/* Releases a stream that will not be finished */
+void sealStreamAbort(SealStream* /* stream */);
+
+#define DERIVE_KEY_BLOCK_SIZE       16
+#define DERIVE_KEY_MAX_LABEL_LENGTH 15
+#define DERIVE_KEY_MAX_BLOCKS       255
+
+/*
+ * Derives derivedLength bytes (at most DERIVE_KEY_MAX_BLOCKS blocks) from key
+ * for the purpose named by label, so that a key is never used directly for
+ * two purposes. label holds at most DERIVE_KEY_MAX_LABEL_LENGTH bytes.
+ */
+errno_t deriveKey(uint8_t* /* key */,
+                  uint8_t /* keyLength */,
+                  const uint8_t* /* label */,
+                  uint8_t /* labelLength */,
+                  uint8_t* /* derived */,
+                  size_t /* derivedLength */);
+
 errno_t encryptTo(uint8_t* aad,
-                  uint32_t aadLength,
+                  size_t aadLength,
                   uint8_t* plaintext,
-                  uint32_t plaintextLength,
+                  size_t plaintextLength,
                   uint8_t** ciphertext,
                   size_t* ciphertextLength );
 errno_t changeIvAndEncryptTo(uint8_t* ivExternal,
                              uint8_t ivExternalLength,
                              uint8_t* aad,
-                             uint32_t aadLength,
+                             size_t aadLength,
                              uint8_t* plaintext,
-                             uint32_t plaintextLength,
+                             size_t plaintextLength,
                              uint8_t** ciphertext,
                              size_t* ciphertextLength);
 errno_t encryptToJS(uint8_t* aad,
-                    uint32_t aadLength,
+                    size_t aadLength,
                     uint8_t* plaintext,
-                    uint32_t plaintextLength,
+                    size_t plaintextLength,
                     uint8_t* ciphertext);
 
 errno_t decryptTo(uint8_t* aad,
-                 uint32_t aadLength,
+                 size_t aadLength,
                  uint8_t* ciphertext,
-                 uint32_t ciphertextLength,
+                 size_t ciphertextLength,
                  uint8_t** plaintext,
                  size_t* plaintextLength);
 errno_t changeIvAndDecryptTo(uint8_t* ivInternal,
                              uint8_t ivInternalLength,
                              uint8_t* aad,
-                             uint32_t aadLength,
+                             size_t aadLength,
                              uint8_t* ciphertext,
-                             uint32_t ciphertextLength,
+                             size_t ciphertextLength,
                              uint8_t** plaintext,
                              size_t* plaintextLength);
 errno_t decryptToJS(uint8_t* aad,
-                    uint32_t aadLength,
+                    size_t aadLength,
                     uint8_t* ciphertext,
-                    uint32_t ciphertextLength,
+                    size_t ciphertextLength,
                     uint8_t* plaintext);
 #endif //CRYPTO_
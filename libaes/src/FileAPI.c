@@ -0,0 +1,554 @@
+#include "FileAPI.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Segment indexes are serialized in 32 bits */
+#define FILE_MAX_SEGMENTS	4294967296ULL
+
+/* Work shared by all the threads processing a file */
+typedef struct {
+	uint8_t dir;
+	uint8_t* key;
+	uint8_t keyLength;
+	const uint8_t* header;
+	uint32_t segmentSize;
+	uint64_t segments;
+	uint64_t plaintextLength;
+	const uint8_t* input;
+	uint8_t* output;
+} segment_job_st;
+
+/* Each worker takes the segments first, first + stride, first + 2 * stride, ... */
+typedef struct {
+	segment_job_st* job;
+	uint64_t first;
+	uint64_t stride;
+	errno_t result;
+} segment_worker_st;
+
+/* A read only view of a whole file */
+typedef struct {
+	int fd;
+	uint8_t* data;
+	size_t length;
+} mapped_file_st;
+
+static void buildSegmentNonce(const uint8_t* header, uint64_t index, uint8_t isLast, uint8_t* nonce)
+{
+	memcpy(nonce, header + FILE_HEADER_MAGIC_LENGTH + 1, FILE_NONCE_PREFIX_LENGTH);
+	unpackWordBigEndian((uint32_t) index, nonce, FILE_NONCE_PREFIX_LENGTH);
+	nonce[FILE_SEGMENT_NONCE_LENGTH - 1] = isLast ? 1 : 0;
+}
+
+/* Length of the plaintext held by segment index */
+static size_t segmentPlaintextLength(segment_job_st* job, uint64_t index)
+{
+	if(index == job->segments - 1) {
+		return (size_t) (job->plaintextLength - index * job->segmentSize);
+	}
+	return job->segmentSize;
+}
+
+/*
+ * Encrypts or decrypts a single segment with its own GCM context. The block
+ * cipher context is shared by the segments processed by the same thread.
+ */
+static errno_t processSegment(segment_job_st* job, aes_ctx_st* aes, uint64_t index,
+	const uint8_t* input, size_t inputLen, uint8_t* output, size_t outputLen)
+{
+	errno_t result;
+	gcm_ctx_st gcm;
+	uint8_t nonce[FILE_SEGMENT_NONCE_LENGTH];
+	size_t outputOffset = 0;
+
+	buildSegmentNonce(job->header, index, index == job->segments - 1, nonce);
+
+	result = gcmInit(&gcm, 16, job->dir, nonce, FILE_SEGMENT_NONCE_LENGTH, FILE_SEGMENT_TAG_LENGTH, aes, aesProcessBlock);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL;
+	}
+
+	/* Every segment authenticates the header */
+	result = gcmUpdateAAD(&gcm, job->header, FILE_HEADER_LENGTH, 0);
+	if(result != SUCCESSFULL_OPERATION) {
+		gcmClearContext(&gcm);
+		goto FAIL;
+	}
+
+	/* gcmFinal clears the context, even on failure */
+	result = gcmFinal(&gcm, input, inputLen, 0, output, outputLen, &outputOffset);
+	if(result == SUCCESSFULL_OPERATION && outputOffset != outputLen) {
+		result = INVALID_STATE;
+	}
+FAIL:
+	memset_s(nonce, sizeof(nonce), 0, sizeof(nonce));
+	return result;
+}
+
+static void* segmentWorker(void* arg)
+{
+	segment_worker_st* worker = (segment_worker_st*) arg;
+	segment_job_st* job = worker->job;
+	aes_ctx_st aes;
+	uint64_t index;
+	size_t plaintextLen;
+	const uint8_t* input;
+	uint8_t* output;
+	size_t inputLen, outputLen;
+
+	worker->result = aesInit(job->key, job->keyLength, DIR_ENCRYPTION, &aes);
+	if(worker->result != SUCCESSFULL_OPERATION) {
+		goto FAIL;
+	}
+
+	for(index = worker->first; index < job->segments; index += worker->stride) {
+		plaintextLen = segmentPlaintextLength(job, index);
+
+		if(job->dir == DIR_ENCRYPTION) {
+			input = job->input + index * job->segmentSize;
+			inputLen = plaintextLen;
+			output = job->output + FILE_HEADER_LENGTH + index * ((uint64_t) job->segmentSize + FILE_SEGMENT_TAG_LENGTH);
+			outputLen = plaintextLen + FILE_SEGMENT_TAG_LENGTH;
+		} else {
+			input = job->input + FILE_HEADER_LENGTH + index * ((uint64_t) job->segmentSize + FILE_SEGMENT_TAG_LENGTH);
+			inputLen = plaintextLen + FILE_SEGMENT_TAG_LENGTH;
+			output = job->output + index * job->segmentSize;
+			outputLen = plaintextLen;
+		}
+
+		worker->result = processSegment(job, &aes, index, input, inputLen, output, outputLen);
+		if(worker->result != SUCCESSFULL_OPERATION) {
+			break;
+		}
+	}
+	aesClearContext(&aes);
+FAIL:
+	return NULL;
+}
+
+/* Spreads the segments of the job over the requested number of threads */
+static errno_t runSegmentJob(segment_job_st* job, uint32_t threads)
+{
+	errno_t result = SUCCESSFULL_OPERATION;
+	segment_worker_st* workers;
+	pthread_t* handles;
+	uint32_t i, started;
+	long cpus;
+
+	if(threads == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 0) ? (uint32_t) cpus : 1;
+	}
+	if(threads > job->segments) {
+		threads = (uint32_t) job->segments;
+	}
+
+	workers = (segment_worker_st*) calloc(threads, sizeof(segment_worker_st));
+	handles = (pthread_t*) calloc(threads, sizeof(pthread_t));
+	if(workers == NULL || handles == NULL) {
+		result = INVALID_STATE;
+		goto FAIL;
+	}
+
+	for(i = 0; i < threads; i++) {
+		workers[i].job = job;
+		workers[i].first = i;
+		workers[i].stride = threads;
+		workers[i].result = SUCCESSFULL_OPERATION;
+	}
+
+	/* The calling thread takes the first share of the work */
+	for(started = 1; started < threads; started++) {
+		if(pthread_create(&handles[started], NULL, segmentWorker, &workers[started]) != 0) {
+			break;
+		}
+	}
+	segmentWorker(&workers[0]);
+	/* Shares of workers that could not be started are run here */
+	for(i = started; i < threads; i++) {
+		segmentWorker(&workers[i]);
+	}
+
+	for(i = 1; i < started; i++) {
+		pthread_join(handles[i], NULL);
+	}
+	for(i = 0; i < threads; i++) {
+		result |= workers[i].result;
+	}
+FAIL:
+	free(workers);
+	free(handles);
+	return result;
+}
+
+static errno_t mapInputFile(const char* path, mapped_file_st* file)
+{
+	errno_t result;
+	struct stat st;
+
+	file->data = NULL;
+	file->length = 0;
+	file->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(file->fd < 0) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	if(fstat(file->fd, &st) != 0 || st.st_size < 0 || (uint64_t) st.st_size > SIZE_MAX) {
+		result = INVALID_STATE;
+		goto FAIL_CLOSE;
+	}
+	file->length = (size_t) st.st_size;
+
+	/* Empty files can't be mapped */
+	if(file->length > 0) {
+		file->data = (uint8_t*) mmap(NULL, file->length, PROT_READ, MAP_PRIVATE, file->fd, 0);
+		if(file->data == MAP_FAILED) {
+			file->data = NULL;
+			result = INVALID_STATE;
+			goto FAIL_CLOSE;
+		}
+	}
+	result = SUCCESSFULL_OPERATION;
+	goto SUCCESS;
+FAIL_CLOSE:
+	close(file->fd);
+	file->fd = -1;
+FAIL:
+SUCCESS:
+	return result;
+}
+
+static errno_t mapOutputFile(const char* path, size_t length, mapped_file_st* file)
+{
+	errno_t result;
+
+	file->data = NULL;
+	file->length = length;
+	file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if(file->fd < 0) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	if(ftruncate(file->fd, (off_t) length) != 0) {
+		result = INVALID_STATE;
+		goto FAIL_CLOSE;
+	}
+
+	if(length > 0) {
+		file->data = (uint8_t*) mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+		if(file->data == MAP_FAILED) {
+			file->data = NULL;
+			result = INVALID_STATE;
+			goto FAIL_CLOSE;
+		}
+	}
+	result = SUCCESSFULL_OPERATION;
+	goto SUCCESS;
+FAIL_CLOSE:
+	close(file->fd);
+	file->fd = -1;
+	unlink(path);
+FAIL:
+SUCCESS:
+	return result;
+}
+
+static errno_t unmapFile(mapped_file_st* file, uint8_t sync)
+{
+	errno_t result = SUCCESSFULL_OPERATION;
+
+	if(file->data != NULL) {
+		if(sync && msync(file->data, file->length, MS_SYNC) != 0) {
+			result = INVALID_STATE;
+		}
+		munmap(file->data, file->length);
+		file->data = NULL;
+	}
+	if(file->fd >= 0) {
+		close(file->fd);
+		file->fd = -1;
+	}
+	return result;
+}
+
+/* Validates the header and computes the segment layout of a ciphertext */
+static errno_t parseFileLayout(const uint8_t* data, size_t length, uint32_t* segmentSize,
+	uint64_t* segments, uint64_t* plaintextLength)
+{
+	errno_t result;
+	uint64_t body, stride, lastLength;
+
+	if(data == NULL || length < FILE_HEADER_LENGTH + FILE_SEGMENT_TAG_LENGTH) {
+		result = INVALID_INPUT_SIZE;
+		goto FAIL;
+	}
+
+	if(memcmp(data, FILE_HEADER_MAGIC, FILE_HEADER_MAGIC_LENGTH) != 0 ||
+		data[FILE_HEADER_MAGIC_LENGTH] != FILE_FORMAT_VERSION) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	*segmentSize = packWordBigEndian(data, FILE_HEADER_LENGTH - 4);
+	if(*segmentSize < FILE_MIN_SEGMENT_SIZE) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	body = length - FILE_HEADER_LENGTH;
+	stride = (uint64_t) *segmentSize + FILE_SEGMENT_TAG_LENGTH;
+	*segments = longDivisionCeil(body, stride);
+	lastLength = body - (*segments - 1) * stride;
+	if(lastLength < FILE_SEGMENT_TAG_LENGTH || *segments > FILE_MAX_SEGMENTS) {
+		result = INVALID_INPUT_SIZE;
+		goto FAIL;
+	}
+
+	*plaintextLength = body - *segments * FILE_SEGMENT_TAG_LENGTH;
+	result = SUCCESSFULL_OPERATION;
+FAIL:
+	return result;
+}
+
+errno_t encryptFile(const char* inputPath, const char* outputPath, uint8_t* key, uint8_t keyLength,
+	uint32_t segmentSize, uint32_t threads)
+{
+	errno_t result;
+	mapped_file_st input, output;
+	segment_job_st job;
+	uint8_t header[FILE_HEADER_LENGTH];
+	uint64_t segments, outputLength;
+
+	if(inputPath == NULL || outputPath == NULL || key == NULL) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	if(segmentSize == 0) {
+		segmentSize = FILE_DEFAULT_SEGMENT_SIZE;
+	}
+	if(segmentSize < FILE_MIN_SEGMENT_SIZE) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	/* A random nonce prefix per file, the segment index and flag complete the nonce */
+	memcpy(header, FILE_HEADER_MAGIC, FILE_HEADER_MAGIC_LENGTH);
+	header[FILE_HEADER_MAGIC_LENGTH] = FILE_FORMAT_VERSION;
+	result = getRandomBytes(header + FILE_HEADER_MAGIC_LENGTH + 1, FILE_NONCE_PREFIX_LENGTH);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL;
+	}
+	unpackWordBigEndian(segmentSize, header, FILE_HEADER_LENGTH - 4);
+
+	result = mapInputFile(inputPath, &input);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL;
+	}
+	madvise(input.data, input.length, MADV_SEQUENTIAL);
+
+	/* An empty file still has one (empty) final segment */
+	segments = (input.length == 0) ? 1 : longDivisionCeil(input.length, segmentSize);
+	if(segments > FILE_MAX_SEGMENTS) {
+		result = INVALID_INPUT_SIZE;
+		goto FAIL_INPUT;
+	}
+	outputLength = FILE_HEADER_LENGTH + (uint64_t) input.length + segments * FILE_SEGMENT_TAG_LENGTH;
+	if(outputLength > SIZE_MAX) {
+		result = INVALID_INPUT_SIZE;
+		goto FAIL_INPUT;
+	}
+
+	result = mapOutputFile(outputPath, (size_t) outputLength, &output);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL_INPUT;
+	}
+	memcpy(output.data, header, FILE_HEADER_LENGTH);
+
+	job.dir = DIR_ENCRYPTION;
+	job.key = key;
+	job.keyLength = keyLength;
+	job.header = header;
+	job.segmentSize = segmentSize;
+	job.segments = segments;
+	job.plaintextLength = input.length;
+	/* Any valid pointer will do for the empty segment */
+	job.input = (input.data != NULL) ? input.data : header;
+	job.output = output.data;
+
+	result = runSegmentJob(&job, threads);
+	result |= unmapFile(&output, TRUE);
+	if(result != SUCCESSFULL_OPERATION) {
+		unlink(outputPath);
+	}
+FAIL_INPUT:
+	unmapFile(&input, FALSE);
+FAIL:
+	return result;
+}
+
+errno_t decryptFile(const char* inputPath, const char* outputPath, uint8_t* key, uint8_t keyLength, uint32_t threads)
+{
+	errno_t result;
+	mapped_file_st input, output;
+	segment_job_st job;
+	uint32_t segmentSize;
+	uint64_t segments, plaintextLength;
+	uint8_t empty;
+
+	if(inputPath == NULL || outputPath == NULL || key == NULL) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	result = mapInputFile(inputPath, &input);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL;
+	}
+	madvise(input.data, input.length, MADV_SEQUENTIAL);
+
+	result = parseFileLayout(input.data, input.length, &segmentSize, &segments, &plaintextLength);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL_INPUT;
+	}
+
+	result = mapOutputFile(outputPath, (size_t) plaintextLength, &output);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL_INPUT;
+	}
+
+	job.dir = DIR_DECRYPTION;
+	job.key = key;
+	job.keyLength = keyLength;
+	job.header = input.data;
+	job.segmentSize = segmentSize;
+	job.segments = segments;
+	job.plaintextLength = plaintextLength;
+	job.input = input.data;
+	/* Any valid pointer will do for the empty segment */
+	job.output = (output.data != NULL) ? output.data : &empty;
+
+	result = runSegmentJob(&job, threads);
+	if(result != SUCCESSFULL_OPERATION && output.data != NULL) {
+		/* Don't leave unauthenticated plaintext behind */
+		memset_s(output.data, output.length, 0, output.length);
+	}
+	result |= unmapFile(&output, result == SUCCESSFULL_OPERATION);
+	if(result != SUCCESSFULL_OPERATION) {
+		unlink(outputPath);
+	}
+FAIL_INPUT:
+	unmapFile(&input, FALSE);
+FAIL:
+	return result;
+}
+
+errno_t decryptFileRange(const char* inputPath, uint8_t* key, uint8_t keyLength, uint64_t offset, size_t length,
+	uint8_t* output, size_t* outputLength)
+{
+	errno_t result;
+	mapped_file_st input;
+	segment_job_st job;
+	aes_ctx_st aes;
+	uint8_t* segment = NULL;
+	uint32_t segmentSize;
+	uint64_t segments, plaintextLength, index, end, segmentStart;
+	size_t plaintextLen, from, count;
+
+	if(inputPath == NULL || key == NULL || outputLength == NULL || (output == NULL && length != 0)) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+	*outputLength = 0;
+
+	result = mapInputFile(inputPath, &input);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL;
+	}
+	madvise(input.data, input.length, MADV_RANDOM);
+
+	result = parseFileLayout(input.data, input.length, &segmentSize, &segments, &plaintextLength);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL_INPUT;
+	}
+
+	if(offset >= plaintextLength || length == 0) {
+		result = SUCCESSFULL_OPERATION;
+		goto FAIL_INPUT;
+	}
+	end = (plaintextLength - offset < length) ? plaintextLength : offset + length;
+
+	/* Segments are decrypted to a scratch buffer, so only authenticated bytes reach the caller */
+	segment = (uint8_t*) malloc(segmentSize);
+	if(segment == NULL) {
+		result = INVALID_STATE;
+		goto FAIL_INPUT;
+	}
+
+	result = aesInit(key, keyLength, DIR_ENCRYPTION, &aes);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL_SEGMENT;
+	}
+
+	job.dir = DIR_DECRYPTION;
+	job.header = input.data;
+	job.segmentSize = segmentSize;
+	job.segments = segments;
+	job.plaintextLength = plaintextLength;
+
+	for(index = offset / segmentSize; index * segmentSize < end; index++) {
+		segmentStart = index * segmentSize;
+		plaintextLen = segmentPlaintextLength(&job, index);
+
+		result = processSegment(&job, &aes, index,
+			input.data + FILE_HEADER_LENGTH + index * ((uint64_t) segmentSize + FILE_SEGMENT_TAG_LENGTH),
+			plaintextLen + FILE_SEGMENT_TAG_LENGTH, segment, plaintextLen);
+		if(result != SUCCESSFULL_OPERATION) {
+			memset_s(output, *outputLength, 0, *outputLength);
+			*outputLength = 0;
+			break;
+		}
+
+		from = (offset > segmentStart) ? (size_t) (offset - segmentStart) : 0;
+		count = ((end - segmentStart < plaintextLen) ? (size_t) (end - segmentStart) : plaintextLen) - from;
+		memcpy(output + *outputLength, segment + from, count);
+		*outputLength += count;
+	}
+	aesClearContext(&aes);
+FAIL_SEGMENT:
+	memset_s(segment, segmentSize, 0, segmentSize);
+	free(segment);
+FAIL_INPUT:
+	unmapFile(&input, FALSE);
+FAIL:
+	return result;
+}
+
+errno_t getFilePlaintextLength(const char* inputPath, uint64_t* plaintextLength)
+{
+	errno_t result;
+	mapped_file_st input;
+	uint32_t segmentSize;
+	uint64_t segments;
+
+	if(inputPath == NULL || plaintextLength == NULL) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	result = mapInputFile(inputPath, &input);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL;
+	}
+
+	result = parseFileLayout(input.data, input.length, &segmentSize, &segments, plaintextLength);
+	unmapFile(&input, FALSE);
+FAIL:
+	return result;
+}
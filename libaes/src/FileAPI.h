@@ -0,0 +1,71 @@
+#ifndef FILE_API_
+#define FILE_API_
+
+#include "mode/gcm.h"
+#include "util/codes.h"
+
+#include "util/cryptoutil.h"
+#include "symmetric/aes.h"
+
+/*
+ * Segmented AES-GCM file format.
+ *
+ * header    = magic (4) || version (1) || noncePrefix (7) || segmentSize (4, big endian)
+ * segment i = GCM(key, noncePrefix || i (4, big endian) || lastSegment (1), header, plaintext_i) || tag
+ *
+ * Every segment holds segmentSize bytes of plaintext, except the last one,
+ * which may be shorter (or empty, for an empty file). The last segment flag
+ * is part of the nonce, so truncating the file at a segment boundary is
+ * detected. Since every segment has its own nonce and tag, segments can be
+ * encrypted in parallel and decrypted independently.
+ */
+#define FILE_HEADER_MAGIC			"AESG"
+#define FILE_HEADER_MAGIC_LENGTH	4
+#define FILE_FORMAT_VERSION			1
+#define FILE_NONCE_PREFIX_LENGTH	7
+#define FILE_HEADER_LENGTH			16
+#define FILE_SEGMENT_NONCE_LENGTH	12
+#define FILE_SEGMENT_TAG_LENGTH		16
+
+#define FILE_DEFAULT_SEGMENT_SIZE	1048576
+#define FILE_MIN_SEGMENT_SIZE		4096
+
+/*
+ * Encrypts inputPath into outputPath. A segmentSize of 0 selects
+ * FILE_DEFAULT_SEGMENT_SIZE and threads 0 uses every online CPU.
+ */
+errno_t encryptFile(const char* /* inputPath */,
+                    const char* /* outputPath */,
+                    uint8_t* /* key */,
+                    uint8_t /* keyLength */,
+                    uint32_t /* segmentSize */,
+                    uint32_t /* threads */);
+
+/*
+ * Decrypts a whole file created by encryptFile. The output file is removed
+ * if any segment fails authentication.
+ */
+errno_t decryptFile(const char* /* inputPath */,
+                    const char* /* outputPath */,
+                    uint8_t* /* key */,
+                    uint8_t /* keyLength */,
+                    uint32_t /* threads */);
+
+/*
+ * Decrypts plaintext bytes [offset, offset + length) of a file created by
+ * encryptFile, touching only the segments that cover the range. The range is
+ * clamped to the end of the plaintext; *outputLength receives the number of
+ * bytes written to output.
+ */
+errno_t decryptFileRange(const char* /* inputPath */,
+                         uint8_t* /* key */,
+                         uint8_t /* keyLength */,
+                         uint64_t /* offset */,
+                         size_t /* length */,
+                         uint8_t* /* output */,
+                         size_t* /* outputLength */);
+
+/* Plaintext length of a file created by encryptFile */
+errno_t getFilePlaintextLength(const char* /* inputPath */, uint64_t* /* plaintextLength */);
+
+#endif /* FILE_API_ */
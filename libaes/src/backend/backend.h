@@ -0,0 +1,41 @@
+#ifndef AEAD_BACKEND_
+#define AEAD_BACKEND_
+
+#include "../util/codes.h"
+#include "../util/secureutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef errno
+	#include <errno.h>
+#else
+	#include "../util/errno.h"
+#endif
+
+/* AES-GCM implementations that can be selected by the CryptoAPI channels */
+#define CRYPTO_BACKEND_NATIVE	0
+#define CRYPTO_BACKEND_OPENSSL	1
+
+/* AEAD algorithms a secure channel can be established with */
+#define CRYPTO_ALGORITHM_AES_GCM			0
+#define CRYPTO_ALGORITHM_CHACHA20_POLY1305	1
+
+/*
+ * One shot AEAD. tagLength is given in bits. seal writes ciphertext || tag
+ * to output, open takes ciphertext || tag as input and writes the plaintext
+ * only if the tag is valid.
+ */
+typedef struct {
+	const char* name;
+
+	errno_t (*seal)(const uint8_t* /* key */, uint8_t /* keyLength */, const uint8_t* /* iv */, uint8_t /* ivLength */,
+					uint8_t /* tagLength */, const uint8_t* /* aad */, size_t /* aadLength */, const uint8_t* /* input */,
+					size_t /* inputLength */, uint8_t* /* output */, size_t /* outputLength */, size_t* /* outputOffset */);
+
+	errno_t (*open)(const uint8_t* /* key */, uint8_t /* keyLength */, const uint8_t* /* iv */, uint8_t /* ivLength */,
+					uint8_t /* tagLength */, const uint8_t* /* aad */, size_t /* aadLength */, const uint8_t* /* input */,
+					size_t /* inputLength */, uint8_t* /* output */, size_t /* outputLength */, size_t* /* outputOffset */);
+} AeadBackend;
+
+#endif /* AEAD_BACKEND_ */
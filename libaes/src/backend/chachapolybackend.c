@@ -0,0 +1,144 @@
+#include "chachapolybackend.h"
+#include "../symmetric/chacha20.h"
+#include "../mac/poly1305.h"
+
+void chachaPolyInit(AeadBackend* backend)
+{
+	backend->name = "chacha20-poly1305";
+	backend->seal = chachaPolySeal;
+	backend->open = chachaPolyOpen;
+}
+
+/* Authenticates aad || pad16(aad) || ciphertext || pad16(ciphertext) || len(aad) || len(ciphertext) */
+static errno_t chachaPolyTag(const uint8_t* polyKey, const uint8_t* aad, size_t aadLength,
+	const uint8_t* ciphertext, size_t ciphertextLength, uint8_t* tag)
+{
+	errno_t result;
+	poly1305_ctx_st poly;
+	uint8_t zeros[POLY1305_BLOCK_SIZE] = { 0 };
+	uint8_t lengths[16];
+
+	result = poly1305Init(&poly, polyKey, POLY1305_KEY_SIZE);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL;
+	}
+
+	unpackWordLittleEndian((uint32_t) aadLength, lengths, 0);
+	unpackWordLittleEndian((uint32_t) ((uint64_t) aadLength >> 32), lengths, 4);
+	unpackWordLittleEndian((uint32_t) ciphertextLength, lengths, 8);
+	unpackWordLittleEndian((uint32_t) ((uint64_t) ciphertextLength >> 32), lengths, 12);
+
+	result = poly1305Update(&poly, aad, aadLength);
+	result |= poly1305Update(&poly, zeros, (POLY1305_BLOCK_SIZE - aadLength % POLY1305_BLOCK_SIZE) % POLY1305_BLOCK_SIZE);
+	result |= poly1305Update(&poly, ciphertext, ciphertextLength);
+	result |= poly1305Update(&poly, zeros, (POLY1305_BLOCK_SIZE - ciphertextLength % POLY1305_BLOCK_SIZE) % POLY1305_BLOCK_SIZE);
+	result |= poly1305Update(&poly, lengths, sizeof(lengths));
+	if(result != SUCCESSFULL_OPERATION) {
+		poly1305ClearContext(&poly);
+		goto FAIL;
+	}
+
+	result = poly1305Final(&poly, tag, POLY1305_TAG_SIZE);
+FAIL:
+	return result;
+}
+
+static errno_t chachaPolyProcess(uint8_t dir, const uint8_t* key, uint8_t keyLength, const uint8_t* iv, uint8_t ivLength,
+	uint8_t tagLength, const uint8_t* aad, size_t aadLength, const uint8_t* input, size_t inputLength,
+	uint8_t* output, size_t outputLength, size_t* outputOffset)
+{
+	errno_t result;
+	chacha20_ctx_st chacha;
+	uint8_t polyKey[CHACHA20_BLOCK_SIZE];
+	uint8_t tag[POLY1305_TAG_SIZE];
+	size_t textLength, required;
+
+	if(key == NULL || iv == NULL || outputOffset == NULL || output == NULL ||
+		(aad == NULL && aadLength != 0) || (input == NULL && inputLength != 0)) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	/* Only the full 128 bit tag is defined */
+	if(tagLength != 128 && tagLength != POLY1305_TAG_SIZE) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	if(dir == DIR_DECRYPTION) {
+		if(inputLength < POLY1305_TAG_SIZE) {
+			result = INVALID_PARAMETER;
+			goto FAIL;
+		}
+		textLength = inputLength - POLY1305_TAG_SIZE;
+		required = textLength;
+	} else {
+		textLength = inputLength;
+		result = add_s(textLength, POLY1305_TAG_SIZE, &required);
+		if(result != SUCCESSFULL_OPERATION) {
+			goto FAIL;
+		}
+	}
+	if(*outputOffset > outputLength || outputLength - *outputOffset < required) {
+		result = INVALID_OUTPUT_SIZE;
+		goto FAIL;
+	}
+	output += *outputOffset;
+
+	/* The Poly1305 key is the first half of key stream block 0 */
+	result = chacha20Init(&chacha, key, keyLength, iv, ivLength, 0);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL;
+	}
+	memset(polyKey, 0, sizeof(polyKey));
+	result = chacha20Xor(&chacha, polyKey, sizeof(polyKey), polyKey);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL_CLEAN;
+	}
+
+	if(dir == DIR_DECRYPTION) {
+		/* Nothing is decrypted before the tag is checked */
+		result = chachaPolyTag(polyKey, aad, aadLength, input, textLength, tag);
+		if(result != SUCCESSFULL_OPERATION) {
+			goto FAIL_CLEAN;
+		}
+		if(compareConstantTime(tag, input + textLength, POLY1305_TAG_SIZE) != 0x00) {
+			result = INVALID_TAG;
+			goto FAIL_CLEAN;
+		}
+		result = chacha20Xor(&chacha, input, textLength, output);
+	} else {
+		result = chacha20Xor(&chacha, input, textLength, output);
+		if(result != SUCCESSFULL_OPERATION) {
+			goto FAIL_CLEAN;
+		}
+		result = chachaPolyTag(polyKey, aad, aadLength, output, textLength, output + textLength);
+	}
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL_CLEAN;
+	}
+
+	*outputOffset += required;
+FAIL_CLEAN:
+	result |= memset_s(polyKey, sizeof(polyKey), 0, sizeof(polyKey));
+	result |= memset_s(tag, sizeof(tag), 0, sizeof(tag));
+	result |= chacha20ClearContext(&chacha);
+FAIL:
+	return result;
+}
+
+errno_t chachaPolySeal(const uint8_t* key, uint8_t keyLength, const uint8_t* iv, uint8_t ivLength, uint8_t tagLength,
+	const uint8_t* aad, size_t aadLength, const uint8_t* input, size_t inputLength,
+	uint8_t* output, size_t outputLength, size_t* outputOffset)
+{
+	return chachaPolyProcess(DIR_ENCRYPTION, key, keyLength, iv, ivLength, tagLength, aad, aadLength,
+		input, inputLength, output, outputLength, outputOffset);
+}
+
+errno_t chachaPolyOpen(const uint8_t* key, uint8_t keyLength, const uint8_t* iv, uint8_t ivLength, uint8_t tagLength,
+	const uint8_t* aad, size_t aadLength, const uint8_t* input, size_t inputLength,
+	uint8_t* output, size_t outputLength, size_t* outputOffset)
+{
+	return chachaPolyProcess(DIR_DECRYPTION, key, keyLength, iv, ivLength, tagLength, aad, aadLength,
+		input, inputLength, output, outputLength, outputOffset);
+}
@@ -0,0 +1,17 @@
+#ifndef CHACHA_POLY_BACKEND_
+#define CHACHA_POLY_BACKEND_
+
+#include "backend.h"
+
+/* ChaCha20-Poly1305 (RFC 8439). Keys are 32 bytes, IVs 12 bytes and tags 128 bits */
+void chachaPolyInit(AeadBackend* /* backend */);
+
+errno_t chachaPolySeal(const uint8_t* /* key */, uint8_t /* keyLength */, const uint8_t* /* iv */, uint8_t /* ivLength */,
+					   uint8_t /* tagLength */, const uint8_t* /* aad */, size_t /* aadLength */, const uint8_t* /* input */,
+					   size_t /* inputLength */, uint8_t* /* output */, size_t /* outputLength */, size_t* /* outputOffset */);
+
+errno_t chachaPolyOpen(const uint8_t* /* key */, uint8_t /* keyLength */, const uint8_t* /* iv */, uint8_t /* ivLength */,
+					   uint8_t /* tagLength */, const uint8_t* /* aad */, size_t /* aadLength */, const uint8_t* /* input */,
+					   size_t /* inputLength */, uint8_t* /* output */, size_t /* outputLength */, size_t* /* outputOffset */);
+
+#endif /* CHACHA_POLY_BACKEND_ */
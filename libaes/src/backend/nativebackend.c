@@ -0,0 +1,70 @@
+#include "nativebackend.h"
+#include "../mode/gcm.h"
+#include "../symmetric/aes.h"
+
+void nativeInit(AeadBackend* backend)
+{
+	backend->name = "native";
+	backend->seal = nativeSeal;
+	backend->open = nativeOpen;
+}
+
+static errno_t nativeProcess(uint8_t dir, const uint8_t* key, uint8_t keyLength, const uint8_t* iv, uint8_t ivLength,
+	uint8_t tagLength, const uint8_t* aad, size_t aadLength, const uint8_t* input, size_t inputLength,
+	uint8_t* output, size_t outputLength, size_t* outputOffset)
+{
+	errno_t result;
+	aes_ctx_st aes;
+	gcm_ctx_st gcm;
+
+	if(key == NULL || iv == NULL || ivLength == 0 || (aad == NULL && aadLength != 0)) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	/* Only using DIR_ENCRYPTION because of gcm mode */
+	result = aesInit((uint8_t*) key, keyLength, DIR_ENCRYPTION, &aes);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL;
+	}
+
+	/* gcmInit may fail before touching the context, which is cleared anyway */
+	memset(&gcm, 0, sizeof(gcm));
+	result = gcmInit(&gcm, 16, dir, (uint8_t*) iv, ivLength, tagLength, &aes, aesProcessBlock);
+	if(result != SUCCESSFULL_OPERATION) {
+		gcmClearContext(&gcm);
+		goto FAIL_AES;
+	}
+
+	/* Authenticates the AAD */
+	if(aadLength > 0) {
+		result = gcmUpdateAAD(&gcm, aad, aadLength, 0);
+		if(result != SUCCESSFULL_OPERATION) {
+			gcmClearContext(&gcm);
+			goto FAIL_AES;
+		}
+	}
+
+	/* Encrypts and appends the tag, or checks the tag and decrypts. Clears the gcm context */
+	result = gcmFinal(&gcm, input, inputLength, 0, output, outputLength, outputOffset);
+FAIL_AES:
+	result |= aesClearContext(&aes);
+FAIL:
+	return result;
+}
+
+errno_t nativeSeal(const uint8_t* key, uint8_t keyLength, const uint8_t* iv, uint8_t ivLength, uint8_t tagLength,
+	const uint8_t* aad, size_t aadLength, const uint8_t* input, size_t inputLength,
+	uint8_t* output, size_t outputLength, size_t* outputOffset)
+{
+	return nativeProcess(DIR_ENCRYPTION, key, keyLength, iv, ivLength, tagLength, aad, aadLength,
+		input, inputLength, output, outputLength, outputOffset);
+}
+
+errno_t nativeOpen(const uint8_t* key, uint8_t keyLength, const uint8_t* iv, uint8_t ivLength, uint8_t tagLength,
+	const uint8_t* aad, size_t aadLength, const uint8_t* input, size_t inputLength,
+	uint8_t* output, size_t outputLength, size_t* outputOffset)
+{
+	return nativeProcess(DIR_DECRYPTION, key, keyLength, iv, ivLength, tagLength, aad, aadLength,
+		input, inputLength, output, outputLength, outputOffset);
+}
@@ -0,0 +1,16 @@
+#ifndef NATIVE_BACKEND_
+#define NATIVE_BACKEND_
+
+#include "backend.h"
+
+void nativeInit(AeadBackend* /* backend */);
+
+errno_t nativeSeal(const uint8_t* /* key */, uint8_t /* keyLength */, const uint8_t* /* iv */, uint8_t /* ivLength */,
+				   uint8_t /* tagLength */, const uint8_t* /* aad */, size_t /* aadLength */, const uint8_t* /* input */,
+				   size_t /* inputLength */, uint8_t* /* output */, size_t /* outputLength */, size_t* /* outputOffset */);
+
+errno_t nativeOpen(const uint8_t* /* key */, uint8_t /* keyLength */, const uint8_t* /* iv */, uint8_t /* ivLength */,
+				   uint8_t /* tagLength */, const uint8_t* /* aad */, size_t /* aadLength */, const uint8_t* /* input */,
+				   size_t /* inputLength */, uint8_t* /* output */, size_t /* outputLength */, size_t* /* outputOffset */);
+
+#endif /* NATIVE_BACKEND_ */
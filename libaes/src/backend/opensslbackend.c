@@ -0,0 +1,172 @@
+#include "opensslbackend.h"
+
+#include "../mode/gcm.h"
+#include "../symmetric/aes.h"
+
+#include <limits.h>
+#include <openssl/evp.h>
+
+void opensslInit(AeadBackend* backend)
+{
+	backend->name = "openssl";
+	backend->seal = opensslSeal;
+	backend->open = opensslOpen;
+}
+
+/* Validated by the native implementation's own checks, so both backends accept the same sizes */
+static const EVP_CIPHER* opensslCipher(uint8_t keyLength)
+{
+	uint16_t keyBits;
+
+	if(aesKeySize(keyLength, &keyBits) != SUCCESSFULL_OPERATION) {
+		return NULL;
+	}
+	switch(keyBits) {
+	case 128:
+		return EVP_aes_128_gcm();
+	case 192:
+		return EVP_aes_192_gcm();
+	default:
+		return EVP_aes_256_gcm();
+	}
+}
+
+static uint8_t opensslTagLength(uint8_t tagLength)
+{
+	uint8_t tagSize;
+
+	if(gcmTagSize(tagLength, &tagSize) != SUCCESSFULL_OPERATION) {
+		return 0;
+	}
+	return tagSize;
+}
+
+/* EVP takes int lengths, so larger inputs are fed in chunks */
+static errno_t opensslUpdate(EVP_CIPHER_CTX* ctx, uint8_t* output, const uint8_t* input, size_t inputLength)
+{
+	int chunk, written;
+
+	while(inputLength > 0) {
+		chunk = (inputLength > INT_MAX) ? INT_MAX : (int) inputLength;
+		if(EVP_CipherUpdate(ctx, output, &written, input, chunk) != 1 || written != chunk) {
+			return INVALID_STATE;
+		}
+		if(output != NULL) {
+			output += chunk;
+		}
+		input += chunk;
+		inputLength -= (size_t) chunk;
+	}
+	return SUCCESSFULL_OPERATION;
+}
+
+static errno_t opensslProcess(uint8_t dir, const uint8_t* key, uint8_t keyLength, const uint8_t* iv, uint8_t ivLength,
+	uint8_t tagLength, const uint8_t* aad, size_t aadLength, const uint8_t* input, size_t inputLength,
+	uint8_t* output, size_t outputLength, size_t* outputOffset)
+{
+	errno_t result;
+	EVP_CIPHER_CTX* ctx = NULL;
+	const EVP_CIPHER* cipher;
+	uint8_t tag[16];
+	uint8_t tagSize;
+	size_t textLength, required;
+	int written;
+
+	cipher = opensslCipher(keyLength);
+	tagSize = opensslTagLength(tagLength);
+	if(cipher == NULL || tagSize == 0 || key == NULL || iv == NULL || ivLength == 0 || outputOffset == NULL ||
+		output == NULL || (aad == NULL && aadLength != 0) || (input == NULL && inputLength != 0)) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	if(dir == DIR_DECRYPTION) {
+		if(inputLength < tagSize) {
+			result = INVALID_PARAMETER;
+			goto FAIL;
+		}
+		textLength = inputLength - tagSize;
+		required = textLength;
+	} else {
+		textLength = inputLength;
+		result = add_s(textLength, tagSize, &required);
+		if(result != SUCCESSFULL_OPERATION) {
+			goto FAIL;
+		}
+	}
+	if(*outputOffset > outputLength || outputLength - *outputOffset < required) {
+		result = INVALID_OUTPUT_SIZE;
+		goto FAIL;
+	}
+	output += *outputOffset;
+
+	ctx = EVP_CIPHER_CTX_new();
+	if(ctx == NULL) {
+		result = INVALID_STATE;
+		goto FAIL;
+	}
+
+	if(EVP_CipherInit_ex(ctx, cipher, NULL, NULL, NULL, dir == DIR_ENCRYPTION) != 1 ||
+		EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, ivLength, NULL) != 1 ||
+		EVP_CipherInit_ex(ctx, NULL, NULL, key, iv, -1) != 1) {
+		result = INVALID_STATE;
+		goto FAIL_CTX;
+	}
+
+	/* Authenticates the AAD */
+	result = opensslUpdate(ctx, NULL, aad, aadLength);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL_CTX;
+	}
+
+	result = opensslUpdate(ctx, output, input, textLength);
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL_CTX;
+	}
+
+	if(dir == DIR_DECRYPTION) {
+		memcpy(tag, input + textLength, tagSize);
+		if(EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, tagSize, tag) != 1) {
+			result = INVALID_STATE;
+			goto FAIL_CLEAN;
+		}
+		if(EVP_CipherFinal_ex(ctx, tag, &written) != 1) {
+			/* Same as the native implementation, nothing is released on a bad tag */
+			memset_s(output, textLength, 0, textLength);
+			result = INVALID_TAG;
+			goto FAIL_CLEAN;
+		}
+	} else {
+		if(EVP_CipherFinal_ex(ctx, tag, &written) != 1 ||
+			EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, tagSize, tag) != 1) {
+			result = INVALID_STATE;
+			goto FAIL_CLEAN;
+		}
+		memcpy(output + textLength, tag, tagSize);
+	}
+
+	*outputOffset += required;
+	result = SUCCESSFULL_OPERATION;
+FAIL_CLEAN:
+	result |= memset_s(tag, sizeof(tag), 0, sizeof(tag));
+FAIL_CTX:
+	EVP_CIPHER_CTX_free(ctx);
+FAIL:
+	return result;
+}
+
+errno_t opensslSeal(const uint8_t* key, uint8_t keyLength, const uint8_t* iv, uint8_t ivLength, uint8_t tagLength,
+	const uint8_t* aad, size_t aadLength, const uint8_t* input, size_t inputLength,
+	uint8_t* output, size_t outputLength, size_t* outputOffset)
+{
+	return opensslProcess(DIR_ENCRYPTION, key, keyLength, iv, ivLength, tagLength, aad, aadLength,
+		input, inputLength, output, outputLength, outputOffset);
+}
+
+errno_t opensslOpen(const uint8_t* key, uint8_t keyLength, const uint8_t* iv, uint8_t ivLength, uint8_t tagLength,
+	const uint8_t* aad, size_t aadLength, const uint8_t* input, size_t inputLength,
+	uint8_t* output, size_t outputLength, size_t* outputOffset)
+{
+	return opensslProcess(DIR_DECRYPTION, key, keyLength, iv, ivLength, tagLength, aad, aadLength,
+		input, inputLength, output, outputLength, outputOffset);
+}
@@ -0,0 +1,17 @@
+#ifndef OPENSSL_BACKEND_
+#define OPENSSL_BACKEND_
+
+#include "backend.h"
+
+/* Only available when configured with --with-openssl */
+void opensslInit(AeadBackend* /* backend */);
+
+errno_t opensslSeal(const uint8_t* /* key */, uint8_t /* keyLength */, const uint8_t* /* iv */, uint8_t /* ivLength */,
+					uint8_t /* tagLength */, const uint8_t* /* aad */, size_t /* aadLength */, const uint8_t* /* input */,
+					size_t /* inputLength */, uint8_t* /* output */, size_t /* outputLength */, size_t* /* outputOffset */);
+
+errno_t opensslOpen(const uint8_t* /* key */, uint8_t /* keyLength */, const uint8_t* /* iv */, uint8_t /* ivLength */,
+					uint8_t /* tagLength */, const uint8_t* /* aad */, size_t /* aadLength */, const uint8_t* /* input */,
+					size_t /* inputLength */, uint8_t* /* output */, size_t /* outputLength */, size_t* /* outputOffset */);
+
+#endif /* OPENSSL_BACKEND_ */
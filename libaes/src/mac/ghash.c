@@ -123,22 +123,29 @@ void ghashInitState(ghash_ctx_st* ctx) {
  * @param   m   its length in bytes
  * @param   aad whether the message chunk is part of the AAD (or else the ciphertext)
  */
-errno_t ghashUpdate(ghash_ctx_st* ctx, const uint8_t *input, uint32_t inputLen, uint8_t isAAD) {
+errno_t ghashUpdate(ghash_ctx_st* ctx, const uint8_t *input, size_t inputLen, uint8_t isAAD) {
 	errno_t result;
-	uint32_t i, process;
-	uint64_t aadLen, messageLen;
+	size_t process;
+	uint64_t inputBits, aadLen, messageLen;
+
+	/* Lengths are accounted in bits, so the conversion itself must not overflow */
+	result = mul64_s((uint64_t)inputLen, 8, &inputBits);
+	if(result != SUCCESSFULL_OPERATION) {
+		result = INVALID_STATE;
+		goto FAIL;
+	}
 
     if (isAAD == TRUE) {
 		if (ctx->state != GHASH_A) {
 			result = INVALID_STATE;
 			goto FAIL;
 		}
-		messageLen = ctx->lenA + (inputLen << 3);
-		if(messageLen < ctx->lenA || messageLen > GCM_MAX_INPUT) {
+		result = add64_s(ctx->lenA, inputBits, &aadLen);
+		if(result != SUCCESSFULL_OPERATION || aadLen > GCM_MAX_AAD) {
 			result = INVALID_STATE;
 			goto FAIL;
 		}
-		ctx->lenA = messageLen;
+		ctx->lenA = aadLen;
 	} else {
 		if (ctx->state == GHASH_A) {
 			ghashFinish(ctx, TRUE);
@@ -147,12 +154,12 @@ errno_t ghashUpdate(ghash_ctx_st* ctx, const uint8_t *input, uint32_t inputLen,
 			goto FAIL;
 		}
 		
-		aadLen = ctx->lenC + (inputLen << 3);
-		if(aadLen < ctx->lenC || aadLen > GCM_MAX_AAD) {
+		result = add64_s(ctx->lenC, inputBits, &messageLen);
+		if(result != SUCCESSFULL_OPERATION || messageLen > GCM_MAX_INPUT) {
 			result = INVALID_STATE;
 			goto FAIL;
 		}
-		ctx->lenC = aadLen;
+		ctx->lenC = messageLen;
 	}
 
 	/* 
@@ -162,9 +169,7 @@ errno_t ghashUpdate(ghash_ctx_st* ctx, const uint8_t *input, uint32_t inputLen,
 	 */
 	while(inputLen > 0) {
 		process = (inputLen >= (ctx->blockSize - ctx->rem)) ? (ctx->blockSize - ctx->rem) : inputLen;
-		for(i = 0; i < process; i++) {
-			ctx->X[ctx->rem + i] ^= input[i];
-		}
+		xorBytes(ctx->X + ctx->rem, ctx->X + ctx->rem, input, process);
 		ctx->rem += (uint8_t)process;
 		inputLen -= process;
 		input += process;
@@ -225,7 +230,7 @@ FAIL:
 	return result;	
 }
 
-errno_t ghashFinal(ghash_ctx_st* ctx, uint8_t* output, uint32_t outputLen, uint32_t* outputOffset) {
+errno_t ghashFinal(ghash_ctx_st* ctx, uint8_t* output, size_t outputLen, size_t* outputOffset) {
 	errno_t result;
 	result = ghashCheckContext(ctx);
 	if(result != SUCCESSFULL_OPERATION) {
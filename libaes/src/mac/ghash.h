@@ -24,11 +24,12 @@
 #define FALSE 0
 
 /*
- * Limits the quantity of AAD and plaintext that can be processed. Actually,
- * the maximum values defined by the standard are a little bigger than the
- * values used here.
+ * Limits the quantity of AAD and plaintext that can be processed, in bits.
+ * The plaintext limit is the one defined by SP800-38D (2^39 - 256 bits), which
+ * keeps the 32-bit block counter from wrapping into the tag mask. The AAD and
+ * IV limits are a little smaller than the ones defined by the standard.
  */
-#define GCM_MAX_INPUT	68719476736ULL			//(2 << 35)
+#define GCM_MAX_INPUT	549755813632ULL			//(2 << 38) - 256
 #define GCM_MAX_IV		2305843009213693952ULL	//(2 << 60)
 #define GCM_MAX_AAD		2305843009213693952ULL		//(2 << 60)
 
@@ -60,9 +61,9 @@ void ghashInitState(ghash_ctx_st* /* ctx */);
 
 errno_t ghashClearCtx(ghash_ctx_st* /* ctx */);
 
-errno_t ghashUpdate(ghash_ctx_st* /* ctx */, const uint8_t* /* input */, uint32_t /* inputLen */, uint8_t /* isAAD */);
+errno_t ghashUpdate(ghash_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */, uint8_t /* isAAD */);
 
-errno_t ghashFinal(ghash_ctx_st* /* ctx */, uint8_t* /* output */, uint32_t /* outputLen */, uint32_t* /* outputOffset */);
+errno_t ghashFinal(ghash_ctx_st* /* ctx */, uint8_t* /* output */, size_t /* outputLen */, size_t* /* outputOffset */);
 
 void ghashMultXH(ghash_ctx_st* /* ctx */);
 
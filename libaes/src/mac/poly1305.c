@@ -0,0 +1,193 @@
+#include "poly1305.h"
+
+#define LIMB_MASK	0x3ffffff
+
+errno_t poly1305Init(poly1305_ctx_st* ctx, const uint8_t* key, size_t keyLength)
+{
+	errno_t result;
+
+	if(ctx == NULL || key == NULL || keyLength != POLY1305_KEY_SIZE) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+	ctx->r[0] = (packWordLittleEndian(key,  0)     ) & 0x3ffffff;
+	ctx->r[1] = (packWordLittleEndian(key,  3) >> 2) & 0x3ffff03;
+	ctx->r[2] = (packWordLittleEndian(key,  6) >> 4) & 0x3ffc0ff;
+	ctx->r[3] = (packWordLittleEndian(key,  9) >> 6) & 0x3f03fff;
+	ctx->r[4] = (packWordLittleEndian(key, 12) >> 8) & 0x00fffff;
+
+	memset(ctx->h, 0, sizeof(ctx->h));
+
+	ctx->pad[0] = packWordLittleEndian(key, 16);
+	ctx->pad[1] = packWordLittleEndian(key, 20);
+	ctx->pad[2] = packWordLittleEndian(key, 24);
+	ctx->pad[3] = packWordLittleEndian(key, 28);
+
+	ctx->bufferOffset = 0;
+	result = SUCCESSFULL_OPERATION;
+FAIL:
+	return result;
+}
+
+/* h = (h + m) * r mod 2^130 - 5, hibit is 2^128 for full blocks and 0 for the padded last one */
+static void poly1305Blocks(poly1305_ctx_st* ctx, const uint8_t* input, size_t inputLen, uint32_t hibit)
+{
+	uint32_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2], r3 = ctx->r[3], r4 = ctx->r[4];
+	uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+	uint32_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2], h3 = ctx->h[3], h4 = ctx->h[4];
+	uint64_t d0, d1, d2, d3, d4;
+	uint32_t c;
+
+	while(inputLen >= POLY1305_BLOCK_SIZE) {
+		h0 += (packWordLittleEndian(input,  0)     ) & LIMB_MASK;
+		h1 += (packWordLittleEndian(input,  3) >> 2) & LIMB_MASK;
+		h2 += (packWordLittleEndian(input,  6) >> 4) & LIMB_MASK;
+		h3 += (packWordLittleEndian(input,  9) >> 6) & LIMB_MASK;
+		h4 += (packWordLittleEndian(input, 12) >> 8) | hibit;
+
+		d0 = ((uint64_t) h0 * r0) + ((uint64_t) h1 * s4) + ((uint64_t) h2 * s3) + ((uint64_t) h3 * s2) + ((uint64_t) h4 * s1);
+		d1 = ((uint64_t) h0 * r1) + ((uint64_t) h1 * r0) + ((uint64_t) h2 * s4) + ((uint64_t) h3 * s3) + ((uint64_t) h4 * s2);
+		d2 = ((uint64_t) h0 * r2) + ((uint64_t) h1 * r1) + ((uint64_t) h2 * r0) + ((uint64_t) h3 * s4) + ((uint64_t) h4 * s3);
+		d3 = ((uint64_t) h0 * r3) + ((uint64_t) h1 * r2) + ((uint64_t) h2 * r1) + ((uint64_t) h3 * r0) + ((uint64_t) h4 * s4);
+		d4 = ((uint64_t) h0 * r4) + ((uint64_t) h1 * r3) + ((uint64_t) h2 * r2) + ((uint64_t) h3 * r1) + ((uint64_t) h4 * r0);
+
+		/* Partial carry propagation */
+		c = (uint32_t) (d0 >> 26); h0 = (uint32_t) d0 & LIMB_MASK;
+		d1 += c; c = (uint32_t) (d1 >> 26); h1 = (uint32_t) d1 & LIMB_MASK;
+		d2 += c; c = (uint32_t) (d2 >> 26); h2 = (uint32_t) d2 & LIMB_MASK;
+		d3 += c; c = (uint32_t) (d3 >> 26); h3 = (uint32_t) d3 & LIMB_MASK;
+		d4 += c; c = (uint32_t) (d4 >> 26); h4 = (uint32_t) d4 & LIMB_MASK;
+		h0 += c * 5; c = h0 >> 26; h0 &= LIMB_MASK;
+		h1 += c;
+
+		input += POLY1305_BLOCK_SIZE;
+		inputLen -= POLY1305_BLOCK_SIZE;
+	}
+
+	ctx->h[0] = h0;
+	ctx->h[1] = h1;
+	ctx->h[2] = h2;
+	ctx->h[3] = h3;
+	ctx->h[4] = h4;
+}
+
+errno_t poly1305Update(poly1305_ctx_st* ctx, const uint8_t* input, size_t inputLen)
+{
+	errno_t result;
+	size_t want, fullBlocks;
+
+	if(ctx == NULL || (input == NULL && inputLen != 0)) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	/* Completes a buffered block first */
+	if(ctx->bufferOffset > 0) {
+		want = POLY1305_BLOCK_SIZE - ctx->bufferOffset;
+		if(want > inputLen) {
+			want = inputLen;
+		}
+		memcpy(ctx->buffer + ctx->bufferOffset, input, want);
+		ctx->bufferOffset += (uint8_t) want;
+		input += want;
+		inputLen -= want;
+		if(ctx->bufferOffset < POLY1305_BLOCK_SIZE) {
+			result = SUCCESSFULL_OPERATION;
+			goto SUCCESS;
+		}
+		poly1305Blocks(ctx, ctx->buffer, POLY1305_BLOCK_SIZE, 1 << 24);
+		ctx->bufferOffset = 0;
+	}
+
+	fullBlocks = inputLen & ~((size_t) POLY1305_BLOCK_SIZE - 1);
+	poly1305Blocks(ctx, input, fullBlocks, 1 << 24);
+	input += fullBlocks;
+	inputLen -= fullBlocks;
+
+	if(inputLen > 0) {
+		memcpy(ctx->buffer, input, inputLen);
+		ctx->bufferOffset = (uint8_t) inputLen;
+	}
+	result = SUCCESSFULL_OPERATION;
+FAIL:
+SUCCESS:
+	return result;
+}
+
+errno_t poly1305Final(poly1305_ctx_st* ctx, uint8_t* output, size_t outputLen)
+{
+	errno_t result;
+	uint32_t h0, h1, h2, h3, h4, c;
+	uint32_t g0, g1, g2, g3, g4;
+	uint32_t mask;
+	uint64_t f;
+
+	if(ctx == NULL || output == NULL || outputLen < POLY1305_TAG_SIZE) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	/* The last partial block is padded with 1 and zeros, without the 2^128 bit */
+	if(ctx->bufferOffset > 0) {
+		ctx->buffer[ctx->bufferOffset] = 1;
+		memset(ctx->buffer + ctx->bufferOffset + 1, 0, POLY1305_BLOCK_SIZE - ctx->bufferOffset - 1);
+		poly1305Blocks(ctx, ctx->buffer, POLY1305_BLOCK_SIZE, 0);
+	}
+
+	/* Full carry propagation */
+	h0 = ctx->h[0]; h1 = ctx->h[1]; h2 = ctx->h[2]; h3 = ctx->h[3]; h4 = ctx->h[4];
+	             c = h1 >> 26; h1 &= LIMB_MASK;
+	h2 += c;     c = h2 >> 26; h2 &= LIMB_MASK;
+	h3 += c;     c = h3 >> 26; h3 &= LIMB_MASK;
+	h4 += c;     c = h4 >> 26; h4 &= LIMB_MASK;
+	h0 += c * 5; c = h0 >> 26; h0 &= LIMB_MASK;
+	h1 += c;
+
+	/* g = h + -p, selected in constant time if h >= p */
+	g0 = h0 + 5; c = g0 >> 26; g0 &= LIMB_MASK;
+	g1 = h1 + c; c = g1 >> 26; g1 &= LIMB_MASK;
+	g2 = h2 + c; c = g2 >> 26; g2 &= LIMB_MASK;
+	g3 = h3 + c; c = g3 >> 26; g3 &= LIMB_MASK;
+	g4 = h4 + c - (1UL << 26);
+
+	mask = (g4 >> 31) - 1;
+	g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+	mask = ~mask;
+	h0 = (h0 & mask) | g0;
+	h1 = (h1 & mask) | g1;
+	h2 = (h2 & mask) | g2;
+	h3 = (h3 & mask) | g3;
+	h4 = (h4 & mask) | g4;
+
+	/* h = h % 2^128 */
+	h0 = ((h0      ) | (h1 << 26));
+	h1 = ((h1 >>  6) | (h2 << 20));
+	h2 = ((h2 >> 12) | (h3 << 14));
+	h3 = ((h3 >> 18) | (h4 <<  8));
+
+	/* tag = (h + pad) % 2^128 */
+	f = (uint64_t) h0 + ctx->pad[0];             h0 = (uint32_t) f;
+	f = (uint64_t) h1 + ctx->pad[1] + (f >> 32); h1 = (uint32_t) f;
+	f = (uint64_t) h2 + ctx->pad[2] + (f >> 32); h2 = (uint32_t) f;
+	f = (uint64_t) h3 + ctx->pad[3] + (f >> 32); h3 = (uint32_t) f;
+
+	unpackWordLittleEndian(h0, output,  0);
+	unpackWordLittleEndian(h1, output,  4);
+	unpackWordLittleEndian(h2, output,  8);
+	unpackWordLittleEndian(h3, output, 12);
+
+	result = SUCCESSFULL_OPERATION;
+FAIL:
+	result |= poly1305ClearContext(ctx);
+	return result;
+}
+
+errno_t poly1305ClearContext(poly1305_ctx_st* ctx)
+{
+	if(ctx == NULL) {
+		return INVALID_PARAMETER;
+	}
+	return memset_s(ctx, sizeof(poly1305_ctx_st), 0, sizeof(poly1305_ctx_st));
+}
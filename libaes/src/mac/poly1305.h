@@ -0,0 +1,33 @@
+#ifndef POLY1305_H_
+#define POLY1305_H_
+
+#include "../util/codes.h"
+#include "../util/cryptoutil.h"
+#include "../util/secureutil.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POLY1305_KEY_SIZE	32
+#define POLY1305_BLOCK_SIZE	16
+#define POLY1305_TAG_SIZE	16
+
+/* Accumulator and key are kept in 26 bit limbs so products fit in 64 bits */
+typedef struct {
+	uint32_t r[5];
+	uint32_t h[5];
+	uint32_t pad[4];
+	uint8_t buffer[POLY1305_BLOCK_SIZE];
+	uint8_t bufferOffset;
+} poly1305_ctx_st;
+
+errno_t poly1305Init(poly1305_ctx_st* /* ctx */, const uint8_t* /* key */, size_t /* keyLength */);
+
+errno_t poly1305Update(poly1305_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */);
+
+/* Writes the 16 byte tag and clears the context */
+errno_t poly1305Final(poly1305_ctx_st* /* ctx */, uint8_t* /* output */, size_t /* outputLen */);
+
+errno_t poly1305ClearContext(poly1305_ctx_st* /* ctx */);
+
+#endif /* POLY1305_H_ */
@@ -26,6 +26,7 @@ errno_t ctrInit(ctr_ctx_st* ctx, uint8_t blockSize, uint8_t dir, uint8_t* iv, vo
 	ctx->blockCipherCtx = blockCipherCtx;
 	ctx->blockCipher = blockCipher;
 	ctx->bufferOffset = 0;
+	ctx->blockCount = 0;
 	result = SUCCESSFULL_OPERATION;
 FAIL:
 	return result;
@@ -41,11 +42,12 @@ FAIL:
 * outputOffset - Start index
 * ctx - Context variable
 */
-errno_t ctrUpdate(ctr_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint32_t inputOffset, uint8_t* output, uint32_t outputLen, uint32_t* outputOffset)
+errno_t ctrUpdate(ctr_ctx_st* ctx, const uint8_t* input, size_t inputLen, size_t inputOffset, uint8_t* output, size_t outputLen, size_t* outputOffset)
 {
 	errno_t result;
-	uint32_t fullBlocks, remainingBytes;
-	uint32_t availableSpace, necessarySpace;
+	size_t fullBlocks, remainingBytes;
+	size_t availableSpace, necessarySpace;
+	uint64_t blockCount;
 
 	/* Check if context is valid */
 	result = ctrCheckContext(ctx);
@@ -87,6 +89,13 @@ errno_t ctrUpdate(ctr_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint
 		result = INVALID_OUTPUT_SIZE;
 		goto FAIL;
 	}
+
+	/* The counter must never wrap around, otherwise the key stream would repeat */
+	result = add64_s(ctx->blockCount, fullBlocks, &blockCount);
+	if(result != SUCCESSFULL_OPERATION || blockCount > CTR_MAX_BLOCKS) {
+		result = INVALID_INPUT_SIZE;
+		goto FAIL;
+	}
 	
 	if(fullBlocks == 0) {
 		/* There isn't enough bytes to be processed. Copy the available bytes to the context buffer */
@@ -95,7 +104,9 @@ errno_t ctrUpdate(ctr_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint
 		result = SUCCESSFULL_OPERATION;
 		goto SUCCESS;
 	} else {
-		uint8_t *encryptedIV = NULL;
+		uint8_t counters[CTR_BATCH_BLOCKS * MAX_BLOCK_SIZE];
+		uint8_t keyStream[CTR_BATCH_BLOCKS * MAX_BLOCK_SIZE];
+		size_t batch, batchBytes, i;
 
 		/* First block goes to buffer, remaining blocks are kept in input */
 		memcpy(ctx->buffer + ctx->bufferOffset, input + inputOffset, ctx->blockSize - ctx->bufferOffset);
@@ -103,43 +114,42 @@ errno_t ctrUpdate(ctr_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint
 		inputOffset += ctx->blockSize - ctx->bufferOffset;
 
 		/* Encrypts first block */
-		encryptedIV = (uint8_t*) malloc(ctx->blockSize);
-		if(encryptedIV == NULL) {
-			result = INVALID_STATE;
-			goto FAIL;
-		}
-
-		result = ctx->blockCipher(ctx->iv, encryptedIV, ctx->blockCipherCtx);
+		result = ctx->blockCipher(ctx->iv, keyStream, ctx->blockCipherCtx);
 		if(result != SUCCESSFULL_OPERATION) {
 			goto FAIL_CLEAN;
 		}
 
 		inc32(ctx->iv, ctx->blockSize);
-		xor(encryptedIV, 0, ctx->buffer, 0, output + *outputOffset, 0, ctx->blockSize);
+		xorBytes(output + *outputOffset, keyStream, ctx->buffer, ctx->blockSize);
 		*outputOffset += ctx->blockSize;
 		fullBlocks--;
 
-		/* Encrypts remaining blocks */
+		/* Encrypts remaining blocks, a batch of counter blocks at a time */
 		while(fullBlocks > 0) {
-			result = ctx->blockCipher(ctx->iv, encryptedIV, ctx->blockCipherCtx);
-			if(result != SUCCESSFULL_OPERATION) {
-				goto FAIL_CLEAN;
+			batch = (fullBlocks < CTR_BATCH_BLOCKS) ? fullBlocks : CTR_BATCH_BLOCKS;
+			batchBytes = batch * ctx->blockSize;
+
+			inc32Blocks(ctx->iv, ctx->blockSize, counters, batch);
+			for(i = 0; i < batchBytes; i += ctx->blockSize) {
+				result = ctx->blockCipher(counters + i, keyStream + i, ctx->blockCipherCtx);
+				if(result != SUCCESSFULL_OPERATION) {
+					goto FAIL_CLEAN;
+				}
 			}
 
-			inc32(ctx->iv, ctx->blockSize);
-			xor(encryptedIV, 0, input + inputOffset, 0, output + *outputOffset, 0, ctx->blockSize);
-			*outputOffset += ctx->blockSize;
-			inputOffset += ctx->blockSize;
-			fullBlocks--;
+			xorBytes(output + *outputOffset, keyStream, input + inputOffset, batchBytes);
+			*outputOffset += batchBytes;
+			inputOffset += batchBytes;
+			fullBlocks -= batch;
 		}
 
 		/* Copy remaining bytes to buffer */
 		memcpy(ctx->buffer, input + inputOffset, remainingBytes);
 		ctx->bufferOffset = (uint8_t) remainingBytes;
+		ctx->blockCount = blockCount;
 		result = SUCCESSFULL_OPERATION;
 FAIL_CLEAN:
-		result |= memset_s(encryptedIV, sizeof(uint8_t) * ctx->blockSize, 0, sizeof(uint8_t) * ctx->blockSize);
-		free(encryptedIV);
+		secureWipe(keyStream, 0, sizeof(keyStream));
 	}
 FAIL:
 SUCCESS:
@@ -156,11 +166,11 @@ SUCCESS:
 * outputOffset - Start index
 * ctx - Context variable
 */
-errno_t ctrFinal(ctr_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint32_t inputOffset, uint8_t* output, uint32_t outputLen, uint32_t* outputOffset)
+errno_t ctrFinal(ctr_ctx_st* ctx, const uint8_t* input, size_t inputLen, size_t inputOffset, uint8_t* output, size_t outputLen, size_t* outputOffset)
 {
 	errno_t result;
-	uint32_t necessarySpace;
-	uint8_t *encryptedIV = NULL;
+	size_t necessarySpace;
+	uint8_t encryptedIV[MAX_BLOCK_SIZE];
 
 	/* Check if context is valid */
 	result = ctrCheckContext(ctx);
@@ -191,9 +201,8 @@ errno_t ctrFinal(ctr_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint3
 		goto FAIL;
 	}
 
-	encryptedIV = (uint8_t*)malloc(sizeof(uint8_t) * ctx->blockSize);
-	if(encryptedIV == NULL) {
-		result = INVALID_STATE;
+	if(ctx->bufferOffset != 0 && ctx->blockCount >= CTR_MAX_BLOCKS) {
+		result = INVALID_INPUT_SIZE;
 		goto FAIL;
 	}
 
@@ -203,11 +212,10 @@ errno_t ctrFinal(ctr_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint3
 		goto FAIL_IV;
 	}
 	inc32(ctx->iv, ctx->blockSize);
-	xor(encryptedIV, 0, ctx->buffer, 0, output + *outputOffset, 0, ctx->bufferOffset);
+	xorBytes(output + *outputOffset, encryptedIV, ctx->buffer, ctx->bufferOffset);
 	*outputOffset += ctx->bufferOffset;
 FAIL_IV:
-	result |= memset_s(encryptedIV, sizeof(uint8_t) * ctx->blockSize, 0,  sizeof(uint8_t) * ctx->blockSize);
-	free(encryptedIV);
+	secureWipe(encryptedIV, 0, sizeof(encryptedIV));
 FAIL:
 	result |= memset_s(ctx->buffer, sizeof(uint8_t) *ctx->blockSize, 0, sizeof(uint8_t) *ctx->blockSize);
 	result |= ctrClearContext(ctx);
@@ -228,10 +236,10 @@ FAIL:
 	return result;
 }
 
-errno_t ctrCalculateOutputSize(ctr_ctx_st *ctx, uint32_t inputLen, uint32_t *outputLen)
+errno_t ctrCalculateOutputSize(ctr_ctx_st *ctx, size_t inputLen, size_t *outputLen)
 {
 	errno_t result;
-	uint32_t fullBlocks;
+	size_t fullBlocks;
 
 	/* Check if context is valid */
 	result = ctrCheckContext(ctx);
@@ -16,6 +16,12 @@
 /* Supports cipher with block size not bigger than 16 bytes */
 #define MAX_BLOCK_SIZE	16	
 
+/* Counter blocks generated and encrypted per pass before being xored with the input */
+#define CTR_BATCH_BLOCKS	16
+
+/* inc32 only walks the low 32 bits of the counter block, so one IV covers at most 2^32 blocks */
+#define CTR_MAX_BLOCKS	4294967296ULL
+
 /* All values inside the structure are modified during execution */
 typedef struct {
 	/* Block cipher is the one who determines the size of the block in bytes */
@@ -30,21 +36,23 @@ typedef struct {
 	/* Counter mode needs a buffer */
 	uint8_t buffer[MAX_BLOCK_SIZE];
 	uint8_t bufferOffset;
+	/* Number of counter blocks already consumed under the current IV */
+	uint64_t blockCount;
 } ctr_ctx_st;
 
 errno_t ctrInit(ctr_ctx_st* /* ctx */, uint8_t /* blockSize */, uint8_t /* dir */, uint8_t* /* iv */,
 										void* /* blockCipherCtx */, errno_t /*blockCipher*/(const uint8_t*, uint8_t *, void*));
 
 
-errno_t ctrUpdate(ctr_ctx_st* /* ctx */, const uint8_t* /* input */, uint32_t /* inputLen */, uint32_t /* inputOffset */, uint8_t* /* output */, 
-										uint32_t /* outputLen */, uint32_t* /* outputOffset */);
+errno_t ctrUpdate(ctr_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */, size_t /* inputOffset */, uint8_t* /* output */, 
+										size_t /* outputLen */, size_t* /* outputOffset */);
 
-errno_t ctrFinal(ctr_ctx_st* /* ctx */, const uint8_t* /* input */, uint32_t /* inputLen */, uint32_t /* inputOffset */, uint8_t* /* output */, 
-									   uint32_t /* outputLen */, uint32_t* /* outputOffset */);
+errno_t ctrFinal(ctr_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */, size_t /* inputOffset */, uint8_t* /* output */, 
+									   size_t /* outputLen */, size_t* /* outputOffset */);
 
 errno_t ctrClearContext(ctr_ctx_st* /* ctx */);
 
-errno_t ctrCalculateOutputSize(ctr_ctx_st* /* ctx */, uint32_t /* inputLen */, uint32_t* /* outputLen */);
+errno_t ctrCalculateOutputSize(ctr_ctx_st* /* ctx */, size_t /* inputLen */, size_t* /* outputLen */);
 
 errno_t ctrCheckContext(ctr_ctx_st* /* ctx */);
 
@@ -45,11 +45,11 @@ FAIL:
 * outputOffset - Output start index
 * ctx - Context variable
 */
-errno_t ecbUpdate(ecb_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint32_t inputOffset, uint8_t* output, uint32_t outputLen, uint32_t* outputOffset)
+errno_t ecbUpdate(ecb_ctx_st* ctx, const uint8_t* input, size_t inputLen, size_t inputOffset, uint8_t* output, size_t outputLen, size_t* outputOffset)
 {
 	errno_t result;
-	uint32_t availableSpace, necessarySpace;
-	uint32_t fullBlocks, remainingBytes;
+	size_t availableSpace, necessarySpace;
+	size_t fullBlocks, remainingBytes;
 
 	/* Check if context is valid */
 	result = ecbCheckContext(ctx);
@@ -143,7 +143,7 @@ FAIL:
 * outputOffset - Output start index
 * ctx - Context variable
 */
-errno_t ecbFinal(ecb_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint32_t inputOffset, uint8_t* output, uint32_t outputLen, uint32_t* outputOffset)
+errno_t ecbFinal(ecb_ctx_st* ctx, const uint8_t* input, size_t inputLen, size_t inputOffset, uint8_t* output, size_t outputLen, size_t* outputOffset)
 {
 	errno_t result;
 
@@ -167,7 +167,7 @@ errno_t ecbFinal(ecb_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint3
 
 	/* Process last block */
 	if(ctx->dir == DIR_ENCRYPTION) {
-		uint32_t lastBlockSize = 0;
+		size_t lastBlockSize = 0;
 		uint8_t* lastBlock;
 
 		result = ctx->ps.addPadding(ctx->blockSize, ctx->buffer, ctx->bufferOffset, &lastBlock, &lastBlockSize);	
@@ -192,10 +192,10 @@ FAIL:
 }
 
 
-errno_t ecbCalculateOutputSize(ecb_ctx_st *ctx, uint32_t inputLen, uint32_t* outputLen) 
+errno_t ecbCalculateOutputSize(ecb_ctx_st *ctx, size_t inputLen, size_t* outputLen) 
 {
 	errno_t result;
-	uint32_t fullBlocks;
+	size_t fullBlocks;
 
 	/* Check if context is valid */
 	result = ecbCheckContext(ctx);
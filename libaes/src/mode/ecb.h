@@ -30,20 +30,20 @@ typedef struct {
 	uint32_t dir;
 	/* Counter mode needs a buffer */
 	uint8_t buffer[MAX_BLOCK_SIZE];
-	uint32_t bufferOffset;
+	size_t bufferOffset;
 } ecb_ctx_st;
 
 errno_t ecbInit(ecb_ctx_st* /* ctx */, uint32_t /* blockSize */, uint32_t /* dir */, 
 									void* /* blockCipherCtx */, errno_t /*blockCipher*/(const uint8_t*, uint8_t *, void*), 
 									PaddingScheme /* ps */);
 
-errno_t ecbUpdate(ecb_ctx_st* /* ctx */, const uint8_t* /* input */, uint32_t /* inputLen */, uint32_t /* inputOffset */, uint8_t* /* output */, 
-										uint32_t /* outputLen */, uint32_t* /* outputOffset */);
+errno_t ecbUpdate(ecb_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */, size_t /* inputOffset */, uint8_t* /* output */, 
+										size_t /* outputLen */, size_t* /* outputOffset */);
 
-errno_t ecbFinal(ecb_ctx_st* /* ctx */, const uint8_t* /* input */, uint32_t /* inputLen */, uint32_t /* inputOffset */, uint8_t* /* output */, 
-									   uint32_t /* outputLen */, uint32_t* /* outputOffset */);
+errno_t ecbFinal(ecb_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */, size_t /* inputOffset */, uint8_t* /* output */, 
+									   size_t /* outputLen */, size_t* /* outputOffset */);
 
-errno_t ecbCalculateOutputSize(ecb_ctx_st* /* ctx */, uint32_t /* inputLen */, uint32_t* /* outputLen */);
+errno_t ecbCalculateOutputSize(ecb_ctx_st* /* ctx */, size_t /* inputLen */, size_t* /* outputLen */);
 
 errno_t ecbClearContext(ecb_ctx_st* /* ctx */);
 
@@ -1,7 +1,34 @@
 #include "gcm.h"
 
+errno_t gcmTagSize(uint8_t tagLength, uint8_t* tagSize)
+{
+	/* Nist recommended tag sizes Ref.: SP800-38D */
+	switch(tagLength) {
+	case 128:
+	case 120:
+	case 112:
+	case 104:
+	case 96:
+	case 64:
+	case 32:
+		*tagSize = tagLength / 8;
+		return SUCCESSFULL_OPERATION;
+	case 16:
+	case 15:
+	case 14:
+	case 13:
+	case 12: 
+	case 8:
+	case 4:
+		*tagSize = tagLength;
+		return SUCCESSFULL_OPERATION;
+	default:
+		return INVALID_PARAMETER;
+	}
+}
+
 errno_t gcmInit(gcm_ctx_st* ctx, uint8_t blockSize, uint8_t dir, uint8_t *nonce, 
-	uint32_t nonceLength, uint8_t tagSize, void* blockCipherCtx, errno_t blockCipher(const uint8_t*, uint8_t *, void*))
+	size_t nonceLength, uint8_t tagSize, void* blockCipherCtx, errno_t blockCipher(const uint8_t*, uint8_t *, void*))
 {
 	errno_t result;
 	uint32_t Y0[4];
@@ -22,33 +49,12 @@ errno_t gcmInit(gcm_ctx_st* ctx, uint8_t blockSize, uint8_t dir, uint8_t *nonce,
 		goto FAIL;
 	}
 	
-	/* It isn't necessary, because nonceLength is 32 bits only
-	if(nonceLength >= GCM_MAX_IV) {
+	if((uint64_t)nonceLength >= GCM_MAX_IV / 8) {
 		result = INVALID_PARAMETER;
 		goto FAIL;
 	}
-	*/
-	/* Nist recommended tag sizes Ref.: SP800-38D */
-	switch(tagSize) {
-	case 128:
-	case 120:
-	case 112:
-	case 104:
-	case 96:
-	case 64:
-	case 32:
-		tagSize /= 8;
-		break;
-	case 16:
-	case 15:
-	case 14:
-	case 13:
-	case 12: 
-	case 8:
-	case 4:
-		break;
-	default:
-		result = INVALID_PARAMETER;
+	result = gcmTagSize(tagSize, &tagSize);
+	if(result != SUCCESSFULL_OPERATION) {
 		goto FAIL;
 	}
 	
@@ -89,10 +95,10 @@ FAIL:
 }
 
 
-errno_t gcmInitNonce(gcm_ctx_st* ctx, uint8_t *nonce, uint32_t nonceLength)
+errno_t gcmInitNonce(gcm_ctx_st* ctx, uint8_t *nonce, size_t nonceLength)
 {
 	errno_t result;
-	uint32_t outputOffset = 0;
+	size_t outputOffset = 0;
 	if(nonceLength != 0) {
 		if(ctx->blockSize == 16) {
 			if(nonceLength == 12) {
@@ -144,10 +150,10 @@ FAIL:
 * outputOffset - Start index
 * ctx - Context variable
 */
-errno_t gcmUpdate(gcm_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint32_t inputOffset, uint8_t* output, uint32_t outputLen, uint32_t* outputOffset)
+errno_t gcmUpdate(gcm_ctx_st* ctx, const uint8_t* input, size_t inputLen, size_t inputOffset, uint8_t* output, size_t outputLen, size_t* outputOffset)
 {
 	errno_t result;
-	uint32_t outputOffsetBefore, outputOffsetAfter;
+	size_t outputOffsetBefore, outputOffsetAfter;
 
 	result = gcmCheckContext(ctx);
 	if(result != SUCCESSFULL_OPERATION) {
@@ -159,6 +165,14 @@ errno_t gcmUpdate(gcm_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint
 		goto FAIL;
 	}
 
+	/* The ciphertext is hashed before it is decrypted, so output may be input */
+	if(ctx->dir == DIR_DECRYPTION) {
+		result = ghashUpdate(&ctx->ghash_ctx, input + inputOffset, inputLen, FALSE);
+		if(result != SUCCESSFULL_OPERATION) {
+			goto FAIL;
+		}
+	}
+
 	outputOffsetBefore = *outputOffset;
 	result = ctrUpdate(&ctx->ctr_ctx, input, inputLen, inputOffset, output, outputLen, outputOffset);
 	outputOffsetAfter = *outputOffset;
@@ -171,11 +185,6 @@ errno_t gcmUpdate(gcm_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint
 		if(result != SUCCESSFULL_OPERATION) {
 			goto FAIL;
 		}
-	} else if(ctx->dir == DIR_DECRYPTION) {
-		result = ghashUpdate(&ctx->ghash_ctx, input + inputOffset, inputLen, FALSE);
-		if(result != SUCCESSFULL_OPERATION) {
-			goto FAIL;
-		}
 	}
 FAIL:
 	return result;
@@ -191,12 +200,12 @@ FAIL:
 * outputOffset - Start index
 * ctx - Context variable
 */
-errno_t gcmFinal(gcm_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint32_t inputOffset, uint8_t* output, uint32_t outputLen, uint32_t* outputOffset)
+errno_t gcmFinal(gcm_ctx_st* ctx, const uint8_t* input, size_t inputLen, size_t inputOffset, uint8_t* output, size_t outputLen, size_t* outputOffset)
 {
 	errno_t result;
-	uint32_t outputOffsetBefore, outputOffsetAfter, i;
-	uint32_t tagOffset = 0;
-	uint8_t* tag = NULL;
+	size_t outputOffsetBefore, outputOffsetAfter;
+	size_t tagOffset = 0;
+	uint8_t tag[MAX_BLOCK_SIZE];
 
 	result = gcmCheckContext(ctx);
 	if(result != SUCCESSFULL_OPERATION) {
@@ -217,6 +226,14 @@ errno_t gcmFinal(gcm_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint3
 		inputLen = inputLen - ctx->tagSize;
 	}
 
+	/* The ciphertext is hashed before it is decrypted, so output may be input */
+	if(ctx->dir == DIR_DECRYPTION) {
+		result = ghashUpdate(&ctx->ghash_ctx, input + inputOffset, inputLen, FALSE);
+		if(result != SUCCESSFULL_OPERATION) {
+			goto FAIL;
+		}
+	}
+
 	/* 
 	 * The parameters used in here will be validated by ctrFinal, so there is no need to recalculate the necessary
 	 * and the available space in the output buffer.
@@ -231,12 +248,6 @@ errno_t gcmFinal(gcm_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint3
 	outputOffsetAfter = *outputOffset;
 	
 	/* Calcultates TAG */
-	tag = (uint8_t*)malloc(sizeof(uint8_t) * ctx->blockSize);
-	if(tag == NULL) {
-		result = INVALID_STATE;
-		goto FAIL;
-	}
-	
 	if(ctx->dir == DIR_ENCRYPTION) {
 		/* Finish the ghash calculation */
 		result = ghashUpdate(&ctx->ghash_ctx, output + outputOffsetBefore, outputOffsetAfter - outputOffsetBefore, FALSE);
@@ -250,23 +261,17 @@ errno_t gcmFinal(gcm_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint3
 		
 	} else if(ctx->dir == DIR_DECRYPTION) {
 		/* Finish the ghash calculation */
-		result = ghashUpdate(&ctx->ghash_ctx, input + inputOffset, inputLen, FALSE);
-		if(result != SUCCESSFULL_OPERATION) {
-			goto FAIL_CLEAN;
-		}
 		result = ghashFinal(&ctx->ghash_ctx, tag, ctx->blockSize, &tagOffset);
 		if(result != SUCCESSFULL_OPERATION) {
 			goto FAIL_CLEAN;
 		}
 	}
 	/* Calculating the tag */
-	for (i = 0; i < ctx->tagSize; i++) {
-		tag[i] ^= ctx->E0[i];
-	}
+	xorBytes(tag, tag, ctx->E0, ctx->tagSize);
 
 	/* Verifying the tag */
 	if(ctx->dir == DIR_DECRYPTION) {
-		if(compareArrayToArrayDiffConstant(tag, ctx->tagSize, input + inputOffset + inputLen, ctx->tagSize) != 0x00) {
+		if(compareConstantTime(tag, input + inputOffset + inputLen, ctx->tagSize) != 0x00) {
 			result = INVALID_TAG;
 			goto FAIL_CLEAN;
 		}
@@ -277,14 +282,13 @@ errno_t gcmFinal(gcm_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint3
 	}
 	result = SUCCESSFULL_OPERATION;
 FAIL_CLEAN:
-	result |= memset_s(tag, sizeof(uint8_t) * ctx->blockSize, 0, sizeof(uint8_t) * ctx->blockSize);
-	free(tag);
+	secureWipe(tag, 0, sizeof(tag));
 FAIL:
 	result |= gcmClearContext(ctx);
 	return result;
 }
 
-errno_t gcmUpdateAAD(gcm_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, uint32_t inputOffset)
+errno_t gcmUpdateAAD(gcm_ctx_st* ctx, const uint8_t* input, size_t inputLen, size_t inputOffset)
 {
 	errno_t result;
 	result = ghashUpdate(&ctx->ghash_ctx, input + inputOffset, inputLen, TRUE);
@@ -292,7 +296,7 @@ errno_t gcmUpdateAAD(gcm_ctx_st* ctx, const uint8_t* input, uint32_t inputLen, u
 }
 
 
-errno_t gcmCalculateOutputSize(gcm_ctx_st* ctx, uint32_t inputLen, uint32_t *outputLen) 
+errno_t gcmCalculateOutputSize(gcm_ctx_st* ctx, size_t inputLen, size_t *outputLen) 
 {
 	errno_t result;
 
@@ -306,8 +310,7 @@ errno_t gcmCalculateOutputSize(gcm_ctx_st* ctx, uint32_t inputLen, uint32_t *out
 	if(result != SUCCESSFULL_OPERATION)
 		goto FAIL;
 
-	*outputLen += ctx->blockSize;
-	result = SUCCESSFULL_OPERATION;
+	result = add_s(*outputLen, ctx->blockSize, outputLen);
 FAIL:
 	return result;
 }
@@ -14,6 +14,12 @@
 #define MAX_BLOCK_SIZE	16	
 #define MAX_TAG_SIZE	16
 
+/*
+ * Maximum number of invocations of the authenticated encryption function
+ * under a single key when IVs are random (SP800-38D, section 8.3).
+ */
+#define GCM_MAX_INVOCATIONS	4294967296ULL
+
 /* All values inside the structure are modified during execution */
 typedef struct {
 	/* Block cipher is the one who determines the size of the block in bytes */
@@ -45,21 +51,24 @@ typedef struct {
 
 } gcm_ctx_st;
 
+/* Size in bytes of a tag given in bits or bytes, if recommended by SP800-38D */
+errno_t gcmTagSize(uint8_t /* tagLength */, uint8_t* /* tagSize */);
+
 errno_t gcmInit(gcm_ctx_st* /* ctx */, uint8_t /* blockSize */, uint8_t /* dir */, uint8_t* /* nonce */, 
-									uint32_t /* nonceLength */, uint8_t /* tagSize */, void* /* blockCipherCtx */, 
+									size_t /* nonceLength */, uint8_t /* tagSize */, void* /* blockCipherCtx */, 
 									errno_t /*blockCipher*/(const uint8_t*, uint8_t *, void*));
 
-errno_t gcmUpdateAAD(gcm_ctx_st* /* ctx */, const uint8_t* /* input */, uint32_t /* inputLen */, uint32_t /* inputOffset */);
+errno_t gcmUpdateAAD(gcm_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */, size_t /* inputOffset */);
 
-errno_t gcmUpdate(gcm_ctx_st* /* ctx */, const uint8_t* /* input */, uint32_t /* inputLen */, uint32_t /* inputOffset */, uint8_t* /* output */, 
-										uint32_t /* outputLen */, uint32_t* /* outputOffset */);
+errno_t gcmUpdate(gcm_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */, size_t /* inputOffset */, uint8_t* /* output */, 
+										size_t /* outputLen */, size_t* /* outputOffset */);
 
-errno_t gcmFinal(gcm_ctx_st* /* ctx */, const uint8_t* /* input */, uint32_t /* inputLen */, uint32_t /* inputOffset */, uint8_t* /* output */, 
-									   uint32_t /* outputLen */, uint32_t* /* outputOffset */);
+errno_t gcmFinal(gcm_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */, size_t /* inputOffset */, uint8_t* /* output */, 
+									   size_t /* outputLen */, size_t* /* outputOffset */);
 
-errno_t gcmCalculateOutputSize(gcm_ctx_st* /* ctx */, uint32_t /* inputLen */, uint32_t* /* outputLen */);
+errno_t gcmCalculateOutputSize(gcm_ctx_st* /* ctx */, size_t /* inputLen */, size_t* /* outputLen */);
 
-errno_t gcmInitNonce(gcm_ctx_st* /* ctx */, uint8_t* /* nonce */, uint32_t /* nonceLength */);
+errno_t gcmInitNonce(gcm_ctx_st* /* ctx */, uint8_t* /* nonce */, size_t /* nonceLength */);
 
 errno_t gcmClearContext(gcm_ctx_st* /* ctx */);
 
@@ -5,7 +5,7 @@ void nullInit(PaddingScheme* ps) {
 	ps->checkPadding = checkNullPadding;
 }
 
-errno_t addNullPadding(uint32_t blockSize, uint8_t* input, uint32_t inputLen, uint8_t** output, uint32_t* outputLen) 
+errno_t addNullPadding(uint32_t blockSize, uint8_t* input, size_t inputLen, uint8_t** output, size_t* outputLen) 
 {
 	errno_t result;
 	uint8_t *paddedData = NULL;
@@ -29,7 +29,7 @@ FAIL:
 	return result;
 }
 
-errno_t checkNullPadding(uint32_t blockSize, uint8_t* output, uint32_t* outputLen)
+errno_t checkNullPadding(uint32_t blockSize, uint8_t* output, size_t* outputLen)
 {
 	errno_t error = SUCCESSFULL_OPERATION;
 	return error;
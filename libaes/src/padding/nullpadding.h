@@ -4,7 +4,7 @@
 #include "padding.h"
 
 void nullInit(PaddingScheme* /* ps */);
-errno_t checkNullPadding(uint32_t /* blockSize */, uint8_t* /* output */, uint32_t* /* outputLen */);
-errno_t addNullPadding(uint32_t /* blockSize */, uint8_t* /* input */, uint32_t /* inputLen */, uint8_t** /* output*/, uint32_t* /* outputLen */);
+errno_t checkNullPadding(uint32_t /* blockSize */, uint8_t* /* output */, size_t* /* outputLen */);
+errno_t addNullPadding(uint32_t /* blockSize */, uint8_t* /* input */, size_t /* inputLen */, uint8_t** /* output*/, size_t* /* outputLen */);
 
 #endif /* NULL_PADDING_ */
\ No newline at end of file
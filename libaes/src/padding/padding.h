@@ -15,10 +15,10 @@
 
 
 typedef struct {
-	errno_t (*addPadding)(uint32_t /* blockSize */, uint8_t* /* input */, uint32_t /* inputLen */, 
-												uint8_t** /* output */, uint32_t* /* outputLen */);
+	errno_t (*addPadding)(uint32_t /* blockSize */, uint8_t* /* input */, size_t /* inputLen */, 
+												uint8_t** /* output */, size_t* /* outputLen */);
 
-	errno_t (*checkPadding)(uint32_t /* blockSize */, uint8_t* /* output */, uint32_t* /* outputLen */);
+	errno_t (*checkPadding)(uint32_t /* blockSize */, uint8_t* /* output */, size_t* /* outputLen */);
 } PaddingScheme;
 
 #endif /* PADDING_ */
\ No newline at end of file
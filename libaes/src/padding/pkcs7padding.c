@@ -5,10 +5,10 @@ void pkcs7Init(PaddingScheme* ps) {
 	ps->checkPadding = checkPKCS7Padding;
 }
 
-errno_t addPKCS7Padding(uint32_t blockSize, uint8_t* input, uint32_t inputLen, uint8_t** output, uint32_t* outputLen) 
+errno_t addPKCS7Padding(uint32_t blockSize, uint8_t* input, size_t inputLen, uint8_t** output, size_t* outputLen) 
 {
 	errno_t result;
-	uint32_t paddingValue;
+	size_t paddingValue;
 	uint8_t *paddedData = NULL;
 
 	/* Calculates the padding value */
@@ -34,10 +34,10 @@ FAIL:
 	return result;
 }
 
-errno_t checkPKCS7Padding(uint32_t blockSize, uint8_t* output, uint32_t* outputLen)
+errno_t checkPKCS7Padding(uint32_t blockSize, uint8_t* output, size_t* outputLen)
 {
 	errno_t result;
-	uint32_t i, limit, paddingValue;
+	size_t i, limit, paddingValue;
 	uint8_t res = 0x00;
 
 	/* Calculates the padding value */
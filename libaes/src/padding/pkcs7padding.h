@@ -4,8 +4,8 @@
 #include "padding.h"
 
 void pkcs7Init(PaddingScheme* /* ps */);
-errno_t addPKCS7Padding(uint32_t /* blockSize */, uint8_t* /* input */, uint32_t /* inputLen */, 
-											uint8_t** /* output */,uint32_t* /* outputLen */);
-errno_t checkPKCS7Padding(uint32_t /* blockSize */, uint8_t* /* output */, uint32_t* /* outputLen */);
+errno_t addPKCS7Padding(uint32_t /* blockSize */, uint8_t* /* input */, size_t /* inputLen */, 
+											uint8_t** /* output */,size_t* /* outputLen */);
+errno_t checkPKCS7Padding(uint32_t /* blockSize */, uint8_t* /* output */, size_t* /* outputLen */);
 
 #endif /* PKCS5_PADDING_ */
\ No newline at end of file
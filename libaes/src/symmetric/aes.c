@@ -775,29 +775,34 @@ void InvertKey(aes_ctx_st *ctx) {
 	memcpy(rdk, rek, 16);
 }
 
-errno_t makeKey(const uint8_t *cipherKey, uint16_t keySize, uint8_t dir, aes_ctx_st *ctx) {
-	errno_t result;
-
-	if(cipherKey == NULL || ctx == NULL) {
-		result = INVALID_PARAMETER;
-		goto FAIL;
-	}
-
+errno_t aesKeySize(uint16_t keySize, uint16_t* keyBits) {
 	switch (keySize) {
 	case 16:
 	case 24:
 	case 32:
-		keySize <<= 3; // key size is now in bits
-		break;
+		*keyBits = keySize << 3;
+		return SUCCESSFULL_OPERATION;
 	case 128:
 	case 192:
 	case 256:
-		break;
+		*keyBits = keySize;
+		return SUCCESSFULL_OPERATION;
 	default:
+		return INVALID_PARAMETER;
+	}
+}
+
+errno_t makeKey(const uint8_t *cipherKey, uint16_t keySize, uint8_t dir, aes_ctx_st *ctx) {
+	errno_t result;
+
+	if(cipherKey == NULL || ctx == NULL) {
 		result = INVALID_PARAMETER;
 		goto FAIL;
-		break;
-		//throw "Invalid AES key size";
+	}
+
+	result = aesKeySize(keySize, &keySize); // key size is now in bits
+	if(result != SUCCESSFULL_OPERATION) {
+		goto FAIL;
 	}
 	ctx->keysize = keySize;
 	ctx->direction = dir;
@@ -18,6 +18,8 @@ typedef struct aes_ctx_st {
 	uint8_t direction;
 } aes_ctx_st;
 
+/* Size in bits of a key given in bits or bytes, if AES supports it */
+errno_t aesKeySize(uint16_t /* keySize */, uint16_t* /* keyBits */);
 errno_t aesInit(uint8_t* /* key */, uint16_t /* keySize */, uint8_t /* dir */, aes_ctx_st* /* ctx */);
 errno_t aesClearContext(aes_ctx_st* /* ctx */);
 errno_t aesProcessBlock(const uint8_t* /* input */, uint8_t* /* output */, void* /* ctx */);
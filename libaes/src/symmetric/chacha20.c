@@ -0,0 +1,225 @@
+#include "chacha20.h"
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#elif defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
+
+/* "expand 32-byte k" */
+#define CHACHA20_SIGMA0	0x61707865
+#define CHACHA20_SIGMA1	0x3320646e
+#define CHACHA20_SIGMA2	0x79622d32
+#define CHACHA20_SIGMA3	0x6b206574
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d) \
+	a += b; d ^= a; d = ROTL32(d, 16); \
+	c += d; b ^= c; b = ROTL32(b, 12); \
+	a += b; d ^= a; d = ROTL32(d, 8); \
+	c += d; b ^= c; b = ROTL32(b, 7);
+
+errno_t chacha20Init(chacha20_ctx_st* ctx, const uint8_t* key, size_t keyLength, const uint8_t* nonce,
+	size_t nonceLength, uint32_t counter)
+{
+	errno_t result;
+	uint8_t i;
+
+	if(ctx == NULL || key == NULL || nonce == NULL) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	if(keyLength != CHACHA20_KEY_SIZE || nonceLength != CHACHA20_NONCE_SIZE) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	ctx->state[0] = CHACHA20_SIGMA0;
+	ctx->state[1] = CHACHA20_SIGMA1;
+	ctx->state[2] = CHACHA20_SIGMA2;
+	ctx->state[3] = CHACHA20_SIGMA3;
+	for(i = 0; i < 8; i++) {
+		ctx->state[4 + i] = packWordLittleEndian(key, 4 * i);
+	}
+	ctx->state[12] = counter;
+	ctx->state[13] = packWordLittleEndian(nonce, 0);
+	ctx->state[14] = packWordLittleEndian(nonce, 4);
+	ctx->state[15] = packWordLittleEndian(nonce, 8);
+
+	result = SUCCESSFULL_OPERATION;
+FAIL:
+	return result;
+}
+
+/* Computes one key stream block and advances the block counter */
+static void chacha20Block(chacha20_ctx_st* ctx, uint8_t* output)
+{
+	uint32_t x[16];
+	uint8_t i;
+
+	memcpy(x, ctx->state, sizeof(x));
+	for(i = 0; i < 10; i++) {
+		QUARTER_ROUND(x[0], x[4], x[ 8], x[12]);
+		QUARTER_ROUND(x[1], x[5], x[ 9], x[13]);
+		QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+		QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+		QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+		QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+		QUARTER_ROUND(x[2], x[7], x[ 8], x[13]);
+		QUARTER_ROUND(x[3], x[4], x[ 9], x[14]);
+	}
+	for(i = 0; i < 16; i++) {
+		unpackWordLittleEndian(x[i] + ctx->state[i], output, 4 * i);
+	}
+	ctx->state[12]++;
+	memset_s(x, sizeof(x), 0, sizeof(x));
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#if defined(__AVX2__)
+	/* Eight blocks at once, one per 32 bit lane */
+	#define CHACHA20_LANES		8
+	typedef __m256i vec_t;
+	#define VEC_ADD(a, b)		_mm256_add_epi32(a, b)
+	#define VEC_XOR(a, b)		_mm256_xor_si256(a, b)
+	#define VEC_ROTL(a, n)		_mm256_or_si256(_mm256_slli_epi32(a, n), _mm256_srli_epi32(a, 32 - (n)))
+	#define VEC_SET1(w)			_mm256_set1_epi32((int) (w))
+	#define VEC_LANE_COUNTERS	_mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0)
+	#define VEC_UNPACKLO32(a, b)	_mm256_unpacklo_epi32(a, b)
+	#define VEC_UNPACKHI32(a, b)	_mm256_unpackhi_epi32(a, b)
+	#define VEC_UNPACKLO64(a, b)	_mm256_unpacklo_epi64(a, b)
+	#define VEC_UNPACKHI64(a, b)	_mm256_unpackhi_epi64(a, b)
+#else
+	/* Four blocks at once, one per 32 bit lane */
+	#define CHACHA20_LANES		4
+	typedef __m128i vec_t;
+	#define VEC_ADD(a, b)		_mm_add_epi32(a, b)
+	#define VEC_XOR(a, b)		_mm_xor_si128(a, b)
+	#define VEC_ROTL(a, n)		_mm_or_si128(_mm_slli_epi32(a, n), _mm_srli_epi32(a, 32 - (n)))
+	#define VEC_SET1(w)			_mm_set1_epi32((int) (w))
+	#define VEC_LANE_COUNTERS	_mm_set_epi32(3, 2, 1, 0)
+	#define VEC_UNPACKLO32(a, b)	_mm_unpacklo_epi32(a, b)
+	#define VEC_UNPACKHI32(a, b)	_mm_unpackhi_epi32(a, b)
+	#define VEC_UNPACKLO64(a, b)	_mm_unpacklo_epi64(a, b)
+	#define VEC_UNPACKHI64(a, b)	_mm_unpackhi_epi64(a, b)
+#endif
+
+#define VEC_QUARTER_ROUND(a, b, c, d) \
+	a = VEC_ADD(a, b); d = VEC_XOR(d, a); d = VEC_ROTL(d, 16); \
+	c = VEC_ADD(c, d); b = VEC_XOR(b, c); b = VEC_ROTL(b, 12); \
+	a = VEC_ADD(a, b); d = VEC_XOR(d, a); d = VEC_ROTL(d, 8); \
+	c = VEC_ADD(c, d); b = VEC_XOR(b, c); b = VEC_ROTL(b, 7);
+
+/* Store 16 bytes of key stream xor input, the vector code assumes a little endian host */
+static void xor128(const uint8_t* input, uint8_t* output, __m128i keyStream)
+{
+	_mm_storeu_si128((__m128i*) output, _mm_xor_si128(_mm_loadu_si128((const __m128i*) input), keyStream));
+}
+
+/*
+ * Processes CHACHA20_LANES consecutive blocks. Lane i of x[w] holds word w of
+ * block i, so a 4x4 transposition turns four words of every block into
+ * contiguous key stream.
+ */
+static void chacha20XorBlocksVector(chacha20_ctx_st* ctx, const uint8_t* input, uint8_t* output)
+{
+	vec_t x[16], s[16];
+	vec_t t0, t1, t2, t3, r[4];
+	uint8_t i, g, b;
+
+	for(i = 0; i < 16; i++) {
+		s[i] = VEC_SET1(ctx->state[i]);
+	}
+	s[12] = VEC_ADD(s[12], VEC_LANE_COUNTERS);
+	memcpy(x, s, sizeof(x));
+
+	for(i = 0; i < 10; i++) {
+		VEC_QUARTER_ROUND(x[0], x[4], x[ 8], x[12]);
+		VEC_QUARTER_ROUND(x[1], x[5], x[ 9], x[13]);
+		VEC_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+		VEC_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+		VEC_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+		VEC_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+		VEC_QUARTER_ROUND(x[2], x[7], x[ 8], x[13]);
+		VEC_QUARTER_ROUND(x[3], x[4], x[ 9], x[14]);
+	}
+	for(i = 0; i < 16; i++) {
+		x[i] = VEC_ADD(x[i], s[i]);
+	}
+
+	/* Group g holds the words 4g .. 4g + 3 of every block */
+	for(g = 0; g < 4; g++) {
+		t0 = VEC_UNPACKLO32(x[4 * g + 0], x[4 * g + 1]);
+		t1 = VEC_UNPACKLO32(x[4 * g + 2], x[4 * g + 3]);
+		t2 = VEC_UNPACKHI32(x[4 * g + 0], x[4 * g + 1]);
+		t3 = VEC_UNPACKHI32(x[4 * g + 2], x[4 * g + 3]);
+		r[0] = VEC_UNPACKLO64(t0, t1);
+		r[1] = VEC_UNPACKHI64(t0, t1);
+		r[2] = VEC_UNPACKLO64(t2, t3);
+		r[3] = VEC_UNPACKHI64(t2, t3);
+
+		for(b = 0; b < 4; b++) {
+#if defined(__AVX2__)
+			/* The low 128 bits hold block b, the high 128 bits block b + 4 */
+			xor128(input + 64 * b + 16 * g, output + 64 * b + 16 * g, _mm256_castsi256_si128(r[b]));
+			xor128(input + 64 * (b + 4) + 16 * g, output + 64 * (b + 4) + 16 * g, _mm256_extracti128_si256(r[b], 1));
+#else
+			xor128(input + 64 * b + 16 * g, output + 64 * b + 16 * g, r[b]);
+#endif
+		}
+	}
+	ctx->state[12] += CHACHA20_LANES;
+
+	memset_s(x, sizeof(x), 0, sizeof(x));
+	memset_s(r, sizeof(r), 0, sizeof(r));
+}
+#endif /* __AVX2__ || __SSE2__ */
+
+errno_t chacha20Xor(chacha20_ctx_st* ctx, const uint8_t* input, size_t inputLen, uint8_t* output)
+{
+	errno_t result;
+	uint8_t keyStream[CHACHA20_BLOCK_SIZE];
+	size_t offset = 0, i;
+	uint64_t blocks;
+
+	if(ctx == NULL || ((input == NULL || output == NULL) && inputLen != 0)) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	/* The 32 bit block counter must not wrap */
+	blocks = longDivisionCeil(inputLen, CHACHA20_BLOCK_SIZE);
+	if(blocks > 4294967296ULL - ctx->state[12]) {
+		result = INVALID_INPUT_SIZE;
+		goto FAIL;
+	}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+	while(inputLen - offset >= CHACHA20_LANES * CHACHA20_BLOCK_SIZE) {
+		chacha20XorBlocksVector(ctx, input + offset, output + offset);
+		offset += CHACHA20_LANES * CHACHA20_BLOCK_SIZE;
+	}
+#endif
+
+	while(offset < inputLen) {
+		chacha20Block(ctx, keyStream);
+		for(i = 0; i < CHACHA20_BLOCK_SIZE && offset < inputLen; i++, offset++) {
+			output[offset] = input[offset] ^ keyStream[i];
+		}
+	}
+
+	result = memset_s(keyStream, sizeof(keyStream), 0, sizeof(keyStream));
+FAIL:
+	return result;
+}
+
+errno_t chacha20ClearContext(chacha20_ctx_st* ctx)
+{
+	if(ctx == NULL) {
+		return INVALID_PARAMETER;
+	}
+	return memset_s(ctx, sizeof(chacha20_ctx_st), 0, sizeof(chacha20_ctx_st));
+}
@@ -0,0 +1,31 @@
+#ifndef CHACHA20_
+#define CHACHA20_
+
+#include "../util/cryptoutil.h"
+#include "../util/secureutil.h"
+#include "../util/codes.h"
+#include "../util/errno.h"
+#include <stdint.h>
+
+/* ChaCha20 as specified by RFC 8439: 256 bit key, 96 bit nonce and 32 bit block counter */
+#define CHACHA20_KEY_SIZE	32
+#define CHACHA20_NONCE_SIZE	12
+#define CHACHA20_BLOCK_SIZE	64
+
+typedef struct {
+	uint32_t state[16];
+} chacha20_ctx_st;
+
+errno_t chacha20Init(chacha20_ctx_st* /* ctx */, const uint8_t* /* key */, size_t /* keyLength */,
+					 const uint8_t* /* nonce */, size_t /* nonceLength */, uint32_t /* counter */);
+
+/*
+ * Xors input with the key stream, starting at the current block counter.
+ * Every call starts on a block boundary, so only the last call of a message
+ * may have a length that isn't a multiple of CHACHA20_BLOCK_SIZE.
+ */
+errno_t chacha20Xor(chacha20_ctx_st* /* ctx */, const uint8_t* /* input */, size_t /* inputLen */, uint8_t* /* output */);
+
+errno_t chacha20ClearContext(chacha20_ctx_st* /* ctx */);
+
+#endif /* CHACHA20_ */
@@ -1,5 +1,9 @@
 #include "cryptoutil.h"
 
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
 /**
 * Cryptographic utility functions.
 * 
@@ -58,6 +62,21 @@ uint32_t packWordBigEndian(const uint8_t* in, uint32_t inOffset) {
 		|  ((in[inOffset + 3] & 0x000000FF));
 }
 
+/**
+* Pack the first 4 elements of 'in', starting at index 'inOffset', into a
+* 32-bit word in little endian order and return that word.
+* 
+* @param in
+* @param inOffset
+* @return
+*/
+uint32_t packWordLittleEndian(const uint8_t* in, uint32_t inOffset) {
+	return ((in[inOffset + 0] & 0x000000FF))
+		|  ((in[inOffset + 1] & 0x000000FF) << 8)
+		|  ((in[inOffset + 2] & 0x000000FF) << 16)
+		|  ((uint32_t) (in[inOffset + 3] & 0x000000FF) << 24);
+}
+
 /**
 * left-rotate x by n bits, 0 <= n <= 32
 * 
@@ -104,9 +123,44 @@ uint8_t rotR(uint8_t x, uint8_t n) {
 */
 void xor(const uint8_t* a, uint32_t offsetA, const uint8_t* b, uint32_t offsetB, uint8_t* output, uint32_t offsetOutput, uint32_t length) 
 {
-	uint8_t i;
-	for(i = 0; i < length; i++)
-		output[i + offsetOutput] = (uint8_t) (((a[i + offsetA] & 0xFF) ^ (b[i + offsetB] & 0xFF)) & 0xFF);
+	xorBytes(output + offsetOutput, a + offsetA, b + offsetB, length);
+}
+
+/**
+* Xor 'length' bytes of 'a' and 'b' into 'output', 16 bytes at a time when
+* SSE2 is available and 8 bytes at a time otherwise. 'output' may alias
+* either operand.
+* 
+* @param output
+*            destination
+* @param a
+*            first operand
+* @param b
+*            second operand
+* @param length
+*            number of bytes to operate
+*/
+void xorBytes(uint8_t* output, const uint8_t* a, const uint8_t* b, size_t length)
+{
+	size_t i = 0;
+	uint64_t wordA, wordB;
+
+#ifdef __SSE2__
+	for(; i + 16 <= length; i += 16) {
+		_mm_storeu_si128((__m128i*) (output + i),
+			_mm_xor_si128(_mm_loadu_si128((const __m128i*) (a + i)), _mm_loadu_si128((const __m128i*) (b + i))));
+	}
+#endif
+	/* memcpy keeps the unaligned word accesses well defined */
+	for(; i + 8 <= length; i += 8) {
+		memcpy(&wordA, a + i, 8);
+		memcpy(&wordB, b + i, 8);
+		wordA ^= wordB;
+		memcpy(output + i, &wordA, 8);
+	}
+	for(; i < length; i++) {
+		output[i] = a[i] ^ b[i];
+	}
 }
 
 /**
@@ -313,22 +367,70 @@ uint64_t longDivisionCeil(uint64_t a, uint64_t b) {
 *         different
 */
 uint8_t compareArrayToArrayDiffConstant(const uint8_t* arr, uint32_t lenA, const uint8_t* arrB, uint32_t lenB) {
-		uint8_t res = 0x00;
-		uint8_t i;
-
-		if (lenA == lenB) {
-			for (i = 0; i < lenA; i++) {
-				res |= (arrB[i] ^ arr[i]);
-			}
-		} else {
-			res = 0x01;
+		if (lenA != lenB) {
+			return 0x01;
 		}
-		return res;
+		return compareConstantTime(arr, arrB, lenA);
+}
+
+/**
+* Compare 'length' bytes of 'a' and 'b' in time that depends only on
+* 'length', a word at a time.
+* 
+* @return 0x00 if the arrays are equal and 0x01 otherwise
+*/
+uint8_t compareConstantTime(const uint8_t* a, const uint8_t* b, size_t length)
+{
+	size_t i = 0;
+	uint64_t wordA, wordB, diff = 0;
+
+	for(; i + 8 <= length; i += 8) {
+		memcpy(&wordA, a + i, 8);
+		memcpy(&wordB, b + i, 8);
+		diff |= wordA ^ wordB;
+	}
+	for(; i < length; i++) {
+		diff |= (uint64_t) (a[i] ^ b[i]);
+	}
+
+	/* Folds to 0 or 1 without branching on the data */
+	return (uint8_t) (((diff | (0 - diff)) >> 63) & 0x01);
 }
 
 void inc32(uint8_t* X, uint32_t length) {
+	/* Ripple the carry through the low 32 bits, big endian */
+	uint8_t* p = X + length;
+	uint8_t* low = X + length - 4;
+
+	while(p > low) {
+		if(++(*--p) != 0) {
+			break;
+		}
+	}
+}
+
+/**
+* Write 'blocks' consecutive counter blocks, starting at 'X', to 'output' and
+* advance 'X' past them. Only the low 32 bits are incremented, as in inc32.
+* 
+* @param X
+*            counter block, updated on return
+* @param length
+*            size of the counter block
+* @param output
+*            destination of blocks * length bytes
+* @param blocks
+*            number of counter blocks to generate
+*/
+void inc32Blocks(uint8_t* X, uint32_t length, uint8_t* output, size_t blocks)
+{
 	uint32_t word = packWordBigEndian(X, length - 4);
-	word += 1;
+	size_t i;
+
+	for(i = 0; i < blocks; i++) {
+		memcpy(output + i * length, X, length - 4);
+		unpackWordBigEndian(word++, output + i * length, length - 4);
+	}
 	unpackWordBigEndian(word, X, length - 4);
 }
 
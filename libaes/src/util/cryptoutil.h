@@ -52,6 +52,16 @@ void unpackWordBigEndian(uint32_t word, uint8_t* out, uint32_t outOffset);
 */
 uint32_t packWordBigEndian(const uint8_t* in, uint32_t inOffset);
 
+/**
+* Pack the first 4 elements of 'in', starting at index 'inOffset', into a
+* 32-bit word in little endian order and return that word.
+* 
+* @param in
+* @param inOffset
+* @return
+*/
+uint32_t packWordLittleEndian(const uint8_t* in, uint32_t inOffset);
+
 /**
 * left-rotate x by n bits, 0 <= n <= 32
 * 
@@ -92,6 +102,21 @@ uint8_t rotR(uint8_t x, uint8_t n);
 */
 void xor(const uint8_t* a, uint32_t offsetA, const uint8_t* b, uint32_t offsetB, uint8_t* output, uint32_t offsetOutput, uint32_t length);
 
+/**
+* Xor 'length' bytes of 'a' and 'b' into 'output', a word or a SIMD register at
+* a time. 'output' may alias either operand.
+* 
+* @param output
+*            destination
+* @param a
+*            first operand
+* @param b
+*            second operand
+* @param length
+*            number of bytes to operate
+*/
+void xorBytes(uint8_t* output, const uint8_t* a, const uint8_t* b, size_t length);
+
 /**
 * Shift uint8_t 'a' one bit to the right
 * 
@@ -190,8 +215,18 @@ uint64_t longDivisionCeil(uint64_t a, uint64_t b);
 */
 uint8_t compareArrayToArrayDiffConstant(const uint8_t* arr, uint32_t lenA, const uint8_t* arrB, uint32_t lenB);
 
+/**
+* Compare 'length' bytes of 'a' and 'b' in time that depends only on 'length'.
+* 
+* @return 0x00 if the arrays are equal and 0x01 otherwise
+*/
+uint8_t compareConstantTime(const uint8_t* a, const uint8_t* b, size_t length);
+
 void inc32(uint8_t* X, uint32_t length);
 
+/* Writes 'blocks' consecutive inc32 counter blocks starting at X to output and advances X past them */
+void inc32Blocks(uint8_t* X, uint32_t length, uint8_t* output, size_t blocks);
+
 /* Used to increment the IV by 1 */
 errno_t inc(uint8_t* X, uint32_t length);
 
@@ -1,7 +1,10 @@
 #include "secureutil.h"
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 
-errno_t add_s(uint32_t op1, uint32_t op2, uint32_t* res) {
+errno_t add_s(size_t op1, size_t op2, size_t* res) {
 	errno_t result;
 
 	if(res == NULL) {
@@ -9,7 +12,7 @@ errno_t add_s(uint32_t op1, uint32_t op2, uint32_t* res) {
 		goto FAIL;
 	}
 
-	if(UINT_MAX - op1 < op2) {
+	if(SIZE_MAX - op1 < op2) {
 		result = INVALID_PARAMETER;
 		goto FAIL;
 	}
@@ -20,7 +23,7 @@ FAIL:
 	return result;
 }
 
-errno_t sub_s(uint32_t op1, uint32_t op2, uint32_t* res)
+errno_t sub_s(size_t op1, size_t op2, size_t* res)
 {
 	errno_t result;
 
@@ -39,7 +42,7 @@ FAIL:
 	return result;
 }
 
-errno_t mul_s(uint32_t op1, uint32_t op2, uint32_t* res)
+errno_t mul_s(size_t op1, size_t op2, size_t* res)
 {
 	errno_t result;
 	if(res == NULL) {
@@ -47,7 +50,7 @@ errno_t mul_s(uint32_t op1, uint32_t op2, uint32_t* res)
 		goto FAIL;
 	}
 
-	if(op2 != 0 && op1 > UINT_MAX/op2) {
+	if(op2 != 0 && op1 > SIZE_MAX/op2) {
 		result = INVALID_PARAMETER;
 		goto FAIL;
 	}
@@ -58,7 +61,7 @@ FAIL:
 	return result;
 }
 
-errno_t div_s(uint32_t op1, uint32_t op2, uint32_t* res)
+errno_t div_s(size_t op1, size_t op2, size_t* res)
 {
 	errno_t result;
 
@@ -78,9 +81,48 @@ FAIL:
 	return result;
 }
 
+errno_t add64_s(uint64_t op1, uint64_t op2, uint64_t* res)
+{
+	errno_t result;
+
+	if(res == NULL) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	if(UINT64_MAX - op1 < op2) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	*res = op1 + op2;
+	result = SUCCESSFULL_OPERATION;
+FAIL:
+	return result;
+}
+
+errno_t mul64_s(uint64_t op1, uint64_t op2, uint64_t* res)
+{
+	errno_t result;
+
+	if(res == NULL) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	if(op2 != 0 && op1 > UINT64_MAX/op2) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	*res = op1 * op2;
+	result = SUCCESSFULL_OPERATION;
+FAIL:
+	return result;
+}
 
 /* Secure parameters check */
-errno_t checkIfValidParameters(const uint8_t* input, uint8_t* output, uint32_t* outputOffset)
+errno_t checkIfValidParameters(const uint8_t* input, uint8_t* output, size_t* outputOffset)
 {
 	errno_t result;
 	if(input == NULL || output == NULL || outputOffset == NULL) {
@@ -91,7 +133,7 @@ errno_t checkIfValidParameters(const uint8_t* input, uint8_t* output, uint32_t*
 	return result;
 }
 
-errno_t calculateFullBlocks(uint32_t blockSize, uint32_t bufferOffset, uint32_t inputLen, uint32_t* fullBlocks)
+errno_t calculateFullBlocks(size_t blockSize, size_t bufferOffset, size_t inputLen, size_t* fullBlocks)
 {
 	errno_t result;
 
@@ -106,10 +148,10 @@ errno_t calculateFullBlocks(uint32_t blockSize, uint32_t bufferOffset, uint32_t
 FAIL:
 	return result;
 }
-errno_t calculateRemainingBytes(uint32_t blockSize, uint32_t bufferOffset, uint32_t inputLen, uint32_t fullBlocks, uint32_t* remainingBytes)
+errno_t calculateRemainingBytes(size_t blockSize, size_t bufferOffset, size_t inputLen, size_t fullBlocks, size_t* remainingBytes)
 {
 	errno_t result;
-	uint32_t aux;
+	size_t aux;
 
 	result = mul_s(blockSize, fullBlocks, remainingBytes);
 	if(result != SUCCESSFULL_OPERATION) {
@@ -129,20 +171,38 @@ FAIL:
 	return result;
 }
 
-/* CERT Solution for memory sanitization. It should prevent compiler optimizations, but it isn't guaranteed to work. */
+/*
+ * The empty asm takes the buffer as an input and clobbers memory, so the
+ * compiler must assume the stores are read and can't drop them as dead.
+ */
+void secureWipe(void* v, uint8_t c, size_t n)
+{
+	if(v == NULL || n == 0) {
+		return;
+	}
+	memset(v, c, n);
+#if defined(__GNUC__)
+	__asm__ __volatile__("" : : "r"(v) : "memory");
+#else
+	{
+		volatile uint8_t *p = (volatile uint8_t*) v;
+		while (n--) {
+			*p++ = c;
+		}
+	}
+#endif
+}
+
 errno_t memset_s(void* v, size_t smax, uint8_t c, size_t n)
 {
 	errno_t result;
-	volatile uint8_t *p = (uint8_t*) v;
 	
-	if((v == NULL && (n != 0 || smax != 0))|| smax > UINT_MAX || n > smax) {
+	if((v == NULL && (n != 0 || smax != 0))|| smax > RSIZE_MAX || n > smax) {
 		result = INVALID_PARAMETER;
 		goto FAIL;
 	}
 
-	while (smax-- && n--) {
-		*p++ = c;
-	}
+	secureWipe(v, c, n);
 	result = SUCCESSFULL_OPERATION;
 
 FAIL:
@@ -150,10 +210,10 @@ FAIL:
 }
 
 /* Secure resize */
-errno_t resize_s(uint8_t** data, uint32_t currentSize, uint32_t newSize)
+errno_t resize_s(uint8_t** data, size_t currentSize, size_t newSize)
 {
 	errno_t result;
-	uint32_t numberOfBytes;
+	size_t numberOfBytes;
 	
 	if(data == NULL) {
 		result = INVALID_PARAMETER;
@@ -189,3 +249,39 @@ FAIL:
 SUCCESS:
 	return result;
 }
+
+/* Reads random bytes from the OS entropy pool */
+errno_t getRandomBytes(uint8_t* output, size_t outputLength)
+{
+	errno_t result;
+	int fd;
+	ssize_t bytesRead;
+	size_t offset = 0;
+
+	if(output == NULL && outputLength != 0) {
+		result = INVALID_PARAMETER;
+		goto FAIL;
+	}
+
+	fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		result = INVALID_STATE;
+		goto FAIL;
+	}
+
+	while(offset < outputLength) {
+		bytesRead = read(fd, output + offset, outputLength - offset);
+		if(bytesRead < 0 && errno == EINTR) {
+			continue;
+		}
+		if(bytesRead <= 0) {
+			break;
+		}
+		offset += (size_t) bytesRead;
+	}
+	close(fd);
+
+	result = (offset == outputLength) ? SUCCESSFULL_OPERATION : INVALID_STATE;
+FAIL:
+	return result;
+}
@@ -13,18 +13,32 @@
 	#include "../util/errno.h"
 #endif
 
+/* Largest object size accepted by the secure functions (C11 Annex K) */
+#ifndef RSIZE_MAX
+	#define RSIZE_MAX (SIZE_MAX >> 1)
+#endif
+
 /* Secure arithmetic operations for unsigned values */
-errno_t add_s(uint32_t /* op1 */, uint32_t /* op2 */, uint32_t* /* res */);
-errno_t sub_s(uint32_t /* op1 */, uint32_t /* op2 */, uint32_t* /* res */);
-errno_t mul_s(uint32_t /* op1 */, uint32_t /* op2 */, uint32_t* /* res */);
-errno_t div_s(uint32_t /* op1 */, uint32_t /* op2 */, uint32_t* /* res */);
+errno_t add_s(size_t /* op1 */, size_t /* op2 */, size_t* /* res */);
+errno_t sub_s(size_t /* op1 */, size_t /* op2 */, size_t* /* res */);
+errno_t mul_s(size_t /* op1 */, size_t /* op2 */, size_t* /* res */);
+errno_t div_s(size_t /* op1 */, size_t /* op2 */, size_t* /* res */);
+
+/* Secure arithmetic operations for 64-bit counters, independent of size_t width */
+errno_t add64_s(uint64_t /* op1 */, uint64_t /* op2 */, uint64_t* /* res */);
+errno_t mul64_s(uint64_t /* op1 */, uint64_t /* op2 */, uint64_t* /* res */);
 
 /* Secure parameters check */
-errno_t checkIfValidParameters(const uint8_t* /* input */, uint8_t* /* output */, uint32_t* /* outputOffset */);
+errno_t checkIfValidParameters(const uint8_t* /* input */, uint8_t* /* output */, size_t* /* outputOffset */);
 
-errno_t calculateFullBlocks(uint32_t /* blockSize */, uint32_t /* bufferOffset */, uint32_t /* inputLen */, uint32_t* /* fullBlocks */);
-errno_t calculateRemainingBytes(uint32_t /* blockSize */, uint32_t /* bufferOffset */, uint32_t /* inputLen */, uint32_t /* fullBlocks */, uint32_t* /* remainingBytes */);
+errno_t calculateFullBlocks(size_t /* blockSize */, size_t /* bufferOffset */, size_t /* inputLen */, size_t* /* fullBlocks */);
+errno_t calculateRemainingBytes(size_t /* blockSize */, size_t /* bufferOffset */, size_t /* inputLen */, size_t /* fullBlocks */, size_t* /* remainingBytes */);
 
 errno_t memset_s(void* /* v */, size_t /* smax */, uint8_t /* c */, size_t /* n */);
-errno_t resize_s(uint8_t** /* data */, uint32_t /* currentSize */, uint32_t /* newSize */);
+/* Bulk memset the compiler can't elide, in the spirit of explicit_bzero */
+void secureWipe(void* /* v */, uint8_t /* c */, size_t /* n */);
+errno_t resize_s(uint8_t** /* data */, size_t /* currentSize */, size_t /* newSize */);
+
+/* Fills the buffer with random bytes gathered from the OS entropy pool */
+errno_t getRandomBytes(uint8_t* /* output */, size_t /* outputLength */);
 #endif /* SECUREUTIL_ */
\ No newline at end of file
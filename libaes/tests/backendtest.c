@@ -0,0 +1,166 @@
+/*
+ * Checks that the OpenSSL backend and the native AES-GCM produce byte
+ * identical ciphertexts and tags, open each other's output, reject the same
+ * tampered messages and accept the same key and tag sizes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend/nativebackend.h"
+#ifdef LIBAES_WITH_OPENSSL
+#include "backend/opensslbackend.h"
+#endif
+
+/* Exit code telling automake that the test was skipped */
+#define TEST_SKIPPED 77
+
+#ifdef LIBAES_WITH_OPENSSL
+#define MAX_TEXT_LENGTH 4099
+#define MAX_AAD_LENGTH  80
+#define MAX_IV_LENGTH   64
+
+static const uint8_t keyLengths[] = { 16, 24, 32, 128, 192 };
+static const uint8_t tagLengths[] = { 128, 120, 112, 104, 96, 64, 32, 16, 12, 4 };
+static const uint8_t ivLengths[] = { 12, 1, 8, 16, 60 };
+static const size_t aadLengths[] = { 0, 1, 13, 16, 17, MAX_AAD_LENGTH };
+static const size_t textLengths[] = { 0, 1, 15, 16, 17, 31, 32, 33, 64, 255, 1000, 4096, MAX_TEXT_LENGTH };
+
+static unsigned long failures = 0;
+static unsigned long checks = 0;
+
+static void fill(uint8_t* data, size_t length, uint32_t seed)
+{
+	size_t i;
+
+	for(i = 0; i < length; i++) {
+		seed = seed * 1103515245u + 12345u;
+		data[i] = (uint8_t) (seed >> 16);
+	}
+}
+
+static void check(int condition, const char* what, uint8_t keyLength, uint8_t tagLength, uint8_t ivLength,
+	size_t aadLength, size_t textLength)
+{
+	checks++;
+	if(!condition) {
+		failures++;
+		if(failures <= 10) {
+			fprintf(stderr, "FAIL %s: key %u tag %u iv %u aad %zu text %zu\n",
+				what, keyLength, tagLength, ivLength, aadLength, textLength);
+		}
+	}
+}
+
+/* Seals with both backends, compares, and opens each output with the other backend */
+static void compare(AeadBackend* native, AeadBackend* other, uint8_t keyLength, uint8_t tagLength,
+	uint8_t ivLength, size_t aadLength, size_t textLength)
+{
+	static uint8_t key[32], iv[MAX_IV_LENGTH], aad[MAX_AAD_LENGTH], text[MAX_TEXT_LENGTH];
+	static uint8_t sealedNative[MAX_TEXT_LENGTH + 16], sealedOther[MAX_TEXT_LENGTH + 16];
+	static uint8_t opened[MAX_TEXT_LENGTH + 16];
+	size_t nativeLength = 0, otherLength = 0, openedLength = 0;
+	errno_t nativeResult, otherResult;
+
+	fill(key, sizeof(key), keyLength);
+	fill(iv, ivLength, ivLength * 7u + tagLength);
+	fill(aad, aadLength, (uint32_t) aadLength * 31u);
+	fill(text, textLength, (uint32_t) textLength * 17u + keyLength);
+
+	nativeResult = native->seal(key, keyLength, iv, ivLength, tagLength, aad, aadLength, text, textLength,
+		sealedNative, sizeof(sealedNative), &nativeLength);
+	otherResult = other->seal(key, keyLength, iv, ivLength, tagLength, aad, aadLength, text, textLength,
+		sealedOther, sizeof(sealedOther), &otherLength);
+	check(nativeResult == SUCCESSFULL_OPERATION && otherResult == SUCCESSFULL_OPERATION,
+		"seal", keyLength, tagLength, ivLength, aadLength, textLength);
+	if(nativeResult != SUCCESSFULL_OPERATION || otherResult != SUCCESSFULL_OPERATION) {
+		return;
+	}
+	check(nativeLength == otherLength && memcmp(sealedNative, sealedOther, nativeLength) == 0,
+		"identical output", keyLength, tagLength, ivLength, aadLength, textLength);
+
+	openedLength = 0;
+	check(other->open(key, keyLength, iv, ivLength, tagLength, aad, aadLength, sealedNative, nativeLength,
+			opened, sizeof(opened), &openedLength) == SUCCESSFULL_OPERATION &&
+		openedLength == textLength && memcmp(opened, text, textLength) == 0,
+		"open native output", keyLength, tagLength, ivLength, aadLength, textLength);
+
+	openedLength = 0;
+	check(native->open(key, keyLength, iv, ivLength, tagLength, aad, aadLength, sealedOther, otherLength,
+			opened, sizeof(opened), &openedLength) == SUCCESSFULL_OPERATION &&
+		openedLength == textLength && memcmp(opened, text, textLength) == 0,
+		"open other output", keyLength, tagLength, ivLength, aadLength, textLength);
+
+	/* A flipped tag bit must be refused by both */
+	sealedNative[nativeLength - 1] ^= 1;
+	openedLength = 0;
+	check(native->open(key, keyLength, iv, ivLength, tagLength, aad, aadLength, sealedNative, nativeLength,
+			opened, sizeof(opened), &openedLength) != SUCCESSFULL_OPERATION,
+		"native rejects tampered", keyLength, tagLength, ivLength, aadLength, textLength);
+	openedLength = 0;
+	check(other->open(key, keyLength, iv, ivLength, tagLength, aad, aadLength, sealedNative, nativeLength,
+			opened, sizeof(opened), &openedLength) != SUCCESSFULL_OPERATION,
+		"other rejects tampered", keyLength, tagLength, ivLength, aadLength, textLength);
+}
+
+/* Every key and tag length must be accepted, or refused, by both backends alike */
+static void compareAccepted(AeadBackend* native, AeadBackend* other)
+{
+	uint8_t key[32], iv[12], text[16], output[64];
+	size_t nativeLength, otherLength;
+	errno_t nativeResult, otherResult;
+	unsigned int length;
+
+	fill(key, sizeof(key), 1);
+	fill(iv, sizeof(iv), 2);
+	fill(text, sizeof(text), 3);
+	for(length = 0; length <= UINT8_MAX; length++) {
+		nativeLength = otherLength = 0;
+		nativeResult = native->seal(key, (uint8_t) length, iv, sizeof(iv), 128, NULL, 0, text, sizeof(text),
+			output, sizeof(output), &nativeLength);
+		otherResult = other->seal(key, (uint8_t) length, iv, sizeof(iv), 128, NULL, 0, text, sizeof(text),
+			output, sizeof(output), &otherLength);
+		check((nativeResult == SUCCESSFULL_OPERATION) == (otherResult == SUCCESSFULL_OPERATION),
+			"same key lengths", (uint8_t) length, 128, sizeof(iv), 0, sizeof(text));
+
+		nativeLength = otherLength = 0;
+		nativeResult = native->seal(key, 16, iv, sizeof(iv), (uint8_t) length, NULL, 0, text, sizeof(text),
+			output, sizeof(output), &nativeLength);
+		otherResult = other->seal(key, 16, iv, sizeof(iv), (uint8_t) length, NULL, 0, text, sizeof(text),
+			output, sizeof(output), &otherLength);
+		check((nativeResult == SUCCESSFULL_OPERATION) == (otherResult == SUCCESSFULL_OPERATION),
+			"same tag lengths", 16, (uint8_t) length, sizeof(iv), 0, sizeof(text));
+	}
+}
+#endif
+
+int main()
+{
+#ifdef LIBAES_WITH_OPENSSL
+	AeadBackend native, openssl;
+	size_t k, t, i, a, l;
+
+	nativeInit(&native);
+	opensslInit(&openssl);
+
+	compareAccepted(&native, &openssl);
+	for(k = 0; k < sizeof(keyLengths); k++) {
+		for(t = 0; t < sizeof(tagLengths); t++) {
+			for(i = 0; i < sizeof(ivLengths); i++) {
+				for(a = 0; a < sizeof(aadLengths) / sizeof(aadLengths[0]); a++) {
+					for(l = 0; l < sizeof(textLengths) / sizeof(textLengths[0]); l++) {
+						compare(&native, &openssl, keyLengths[k], tagLengths[t], ivLengths[i],
+							aadLengths[a], textLengths[l]);
+					}
+				}
+			}
+		}
+	}
+
+	printf("%lu checks, %lu failures\n", checks, failures);
+	return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+#else
+	printf("Configured without --with-openssl, nothing to compare\n");
+	return TEST_SKIPPED;
+#endif
+}
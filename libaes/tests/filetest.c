@@ -0,0 +1,277 @@
+/*
+ * Checks the segmented file format of FileAPI: files of no segment content,
+ * of exactly one segment and of several segments and a byte round trip, the
+ * threads do not change the output, and a truncated file, swapped segments,
+ * a flipped tag byte or a cleared last segment flag are refused. The test
+ * is linked against the static library with getRandomBytes wrapped
+ * (-Wl,--wrap), so that the nonce prefix, and then the output, is the same
+ * from one encryption to the other.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "CryptoAPI.h"
+#include "FileAPI.h"
+#include "backend/backend.h"
+
+#define KEY_LENGTH		32
+#define SEGMENT_SIZE	FILE_MIN_SEGMENT_SIZE
+#define SEGMENTS		5
+#define THREADS			4
+#define PATH_LENGTH		64
+
+#define SEGMENT_STRIDE	(SEGMENT_SIZE + FILE_SEGMENT_TAG_LENGTH)
+
+static const size_t fileLengths[] = { 0, SEGMENT_SIZE, SEGMENTS * SEGMENT_SIZE + 1 };
+
+static uint8_t key[KEY_LENGTH];
+static char directory[] = "filetest.XXXXXX";
+static char plainPath[PATH_LENGTH], sealedPath[PATH_LENGTH], sealedThreadsPath[PATH_LENGTH];
+static char tamperedPath[PATH_LENGTH], openedPath[PATH_LENGTH];
+static unsigned long failures = 0;
+
+errno_t __wrap_getRandomBytes(uint8_t* output, size_t outputLength)
+{
+	size_t i;
+
+	for(i = 0; i < outputLength; i++) {
+		output[i] = (uint8_t) (0xa5 ^ i);
+	}
+	return SUCCESSFULL_OPERATION;
+}
+
+static void fill(uint8_t* data, size_t length, uint32_t seed)
+{
+	size_t i;
+
+	for(i = 0; i < length; i++) {
+		seed = seed * 1103515245u + 12345u;
+		data[i] = (uint8_t) (seed >> 16);
+	}
+}
+
+static void check(int condition, const char* what, size_t length)
+{
+	if(!condition) {
+		failures++;
+		fprintf(stderr, "FAIL %s: file of %zu bytes\n", what, length);
+	}
+}
+
+static int writeFile(const char* path, const uint8_t* data, size_t length)
+{
+	FILE* file = fopen(path, "wb");
+	int result;
+
+	if(file == NULL) {
+		return -1;
+	}
+	result = (length > 0 && fwrite(data, 1, length, file) != length) ? -1 : 0;
+	return (fclose(file) != 0) ? -1 : result;
+}
+
+/* Reads a whole file into an allocation the caller frees, NULL on error */
+static uint8_t* readFile(const char* path, size_t* length)
+{
+	FILE* file = fopen(path, "rb");
+	uint8_t* data = NULL;
+	long end;
+
+	if(file == NULL) {
+		return NULL;
+	}
+	if(fseek(file, 0, SEEK_END) == 0 && (end = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+		data = malloc((size_t) end + 1);
+		if(data != NULL && fread(data, 1, (size_t) end, file) != (size_t) end) {
+			free(data);
+			data = NULL;
+		}
+		*length = (size_t) end;
+	}
+	fclose(file);
+	return data;
+}
+
+/* Opens path with one and several threads, both must give back plain */
+static int opensTo(const char* path, const uint8_t* plain, size_t length)
+{
+	uint32_t threads[] = { 1, THREADS };
+	uint8_t* opened;
+	size_t i, openedLength = 0;
+	int result = 1;
+
+	for(i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+		if(decryptFile(path, openedPath, key, KEY_LENGTH, threads[i]) != SUCCESSFULL_OPERATION) {
+			return 0;
+		}
+		opened = readFile(openedPath, &openedLength);
+		result &= (opened != NULL && openedLength == length && memcmp(opened, plain, length) == 0);
+		free(opened);
+		unlink(openedPath);
+	}
+	return result;
+}
+
+/* Opening must fail with one and several threads, leaving no output behind */
+static int isRefused(const char* path)
+{
+	uint32_t threads[] = { 1, THREADS };
+	size_t i;
+	int result = 1;
+
+	for(i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+		result &= (decryptFile(path, openedPath, key, KEY_LENGTH, threads[i]) != SUCCESSFULL_OPERATION);
+		result &= (access(openedPath, F_OK) != 0);
+		unlink(openedPath);
+	}
+	return result;
+}
+
+static void checkRoundTrip(size_t length)
+{
+	uint8_t *plain, *sealed = NULL, *sealedThreads = NULL;
+	size_t sealedLength = 0, sealedThreadsLength = 0;
+	size_t segments = (length == 0) ? 1 : (length + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+	uint64_t plaintextLength = 0;
+
+	plain = malloc(length + 1);
+	fill(plain, length, (uint32_t) length);
+	check(writeFile(plainPath, plain, length) == 0, "write", length);
+
+	check(encryptFile(plainPath, sealedPath, key, KEY_LENGTH, SEGMENT_SIZE, 1) == SUCCESSFULL_OPERATION,
+		"encrypt with one thread", length);
+	check(encryptFile(plainPath, sealedThreadsPath, key, KEY_LENGTH, SEGMENT_SIZE, THREADS) == SUCCESSFULL_OPERATION,
+		"encrypt with several threads", length);
+	sealed = readFile(sealedPath, &sealedLength);
+	sealedThreads = readFile(sealedThreadsPath, &sealedThreadsLength);
+	check(sealed != NULL && sealedLength == FILE_HEADER_LENGTH + length + segments * FILE_SEGMENT_TAG_LENGTH,
+		"encrypted length", length);
+	check(sealed != NULL && sealedThreads != NULL && sealedLength == sealedThreadsLength &&
+		memcmp(sealed, sealedThreads, sealedLength) == 0, "same output whatever the threads", length);
+
+	check(getFilePlaintextLength(sealedPath, &plaintextLength) == SUCCESSFULL_OPERATION &&
+		plaintextLength == length, "plaintext length", length);
+	check(opensTo(sealedPath, plain, length), "round trip", length);
+
+	free(sealedThreads);
+	free(sealed);
+	free(plain);
+}
+
+/* Seals again the segment index of sealed, with the given last segment flag */
+static int resealSegment(uint8_t* sealed, size_t sealedLength, size_t index, uint8_t isLast)
+{
+	uint8_t nonce[FILE_SEGMENT_NONCE_LENGTH], *plain = NULL, *cipher = NULL;
+	uint8_t* segment = sealed + FILE_HEADER_LENGTH + index * SEGMENT_STRIDE;
+	size_t segmentLength = sealedLength - FILE_HEADER_LENGTH - index * SEGMENT_STRIDE;
+	size_t plainLength = 0, cipherLength = 0;
+	int result;
+
+	if(segmentLength > SEGMENT_STRIDE) {
+		segmentLength = SEGMENT_STRIDE;
+	}
+	memcpy(nonce, sealed + FILE_HEADER_MAGIC_LENGTH + 1, FILE_NONCE_PREFIX_LENGTH);
+	nonce[FILE_NONCE_PREFIX_LENGTH] = (uint8_t) (index >> 24);
+	nonce[FILE_NONCE_PREFIX_LENGTH + 1] = (uint8_t) (index >> 16);
+	nonce[FILE_NONCE_PREFIX_LENGTH + 2] = (uint8_t) (index >> 8);
+	nonce[FILE_NONCE_PREFIX_LENGTH + 3] = (uint8_t) index;
+
+	nonce[FILE_SEGMENT_NONCE_LENGTH - 1] = (index == (sealedLength - FILE_HEADER_LENGTH - 1) / SEGMENT_STRIDE);
+	if(openWithKey(CRYPTO_ALGORITHM_AES_GCM, key, KEY_LENGTH, nonce, sizeof(nonce), FILE_SEGMENT_TAG_LENGTH * 8,
+		sealed, FILE_HEADER_LENGTH, segment, segmentLength, &plain, &plainLength) != SUCCESSFULL_OPERATION) {
+		return -1;
+	}
+	nonce[FILE_SEGMENT_NONCE_LENGTH - 1] = isLast;
+	result = sealWithKey(CRYPTO_ALGORITHM_AES_GCM, key, KEY_LENGTH, nonce, sizeof(nonce),
+		FILE_SEGMENT_TAG_LENGTH * 8, sealed, FILE_HEADER_LENGTH, plain, plainLength, &cipher, &cipherLength);
+	if(result == SUCCESSFULL_OPERATION && cipherLength == segmentLength) {
+		memcpy(segment, cipher, cipherLength);
+	} else {
+		result = -1;
+	}
+	free(cipher);
+	free(plain);
+	return result;
+}
+
+static void checkTampering()
+{
+	size_t length = SEGMENTS * SEGMENT_SIZE + 1, sealedLength = 0;
+	size_t last = SEGMENTS;
+	uint8_t *plain, *sealed, *tampered;
+	uint8_t swap[SEGMENT_STRIDE];
+
+	plain = malloc(length);
+	fill(plain, length, (uint32_t) length);
+	writeFile(plainPath, plain, length);
+	encryptFile(plainPath, sealedPath, key, KEY_LENGTH, SEGMENT_SIZE, THREADS);
+	sealed = readFile(sealedPath, &sealedLength);
+	tampered = malloc(sealedLength);
+	if(sealed == NULL || tampered == NULL) {
+		check(0, "cannot read the encrypted file", length);
+		goto CLEAN_UP;
+	}
+
+	/* Truncated inside the last segment, then at a segment boundary */
+	writeFile(tamperedPath, sealed, sealedLength - 1);
+	check(isRefused(tamperedPath), "truncated file accepted", length);
+	writeFile(tamperedPath, sealed, FILE_HEADER_LENGTH + last * SEGMENT_STRIDE);
+	check(isRefused(tamperedPath), "file truncated at a segment boundary accepted", length);
+
+	memcpy(tampered, sealed, sealedLength);
+	memcpy(swap, tampered + FILE_HEADER_LENGTH, SEGMENT_STRIDE);
+	memcpy(tampered + FILE_HEADER_LENGTH, tampered + FILE_HEADER_LENGTH + SEGMENT_STRIDE, SEGMENT_STRIDE);
+	memcpy(tampered + FILE_HEADER_LENGTH + SEGMENT_STRIDE, swap, SEGMENT_STRIDE);
+	writeFile(tamperedPath, tampered, sealedLength);
+	check(isRefused(tamperedPath), "swapped segments accepted", length);
+
+	memcpy(tampered, sealed, sealedLength);
+	tampered[FILE_HEADER_LENGTH + SEGMENT_STRIDE - 1] ^= 1;
+	writeFile(tamperedPath, tampered, sealedLength);
+	check(isRefused(tamperedPath), "flipped tag byte accepted", length);
+
+	/* Sealing the last segment again under its own flag must keep the file valid */
+	memcpy(tampered, sealed, sealedLength);
+	check(resealSegment(tampered, sealedLength, last, 1) == SUCCESSFULL_OPERATION &&
+		memcmp(tampered, sealed, sealedLength) == 0, "cannot seal the last segment again", length);
+	check(resealSegment(tampered, sealedLength, last, 0) == SUCCESSFULL_OPERATION, "cannot clear the flag", length);
+	writeFile(tamperedPath, tampered, sealedLength);
+	check(isRefused(tamperedPath), "cleared last segment flag accepted", length);
+
+CLEAN_UP:
+	unlink(tamperedPath);
+	free(tampered);
+	free(sealed);
+	free(plain);
+}
+
+int main()
+{
+	size_t i;
+
+	if(mkdtemp(directory) == NULL) {
+		fprintf(stderr, "FAIL cannot create the working directory\n");
+		return EXIT_FAILURE;
+	}
+	snprintf(plainPath, sizeof(plainPath), "%s/plain", directory);
+	snprintf(sealedPath, sizeof(sealedPath), "%s/sealed", directory);
+	snprintf(sealedThreadsPath, sizeof(sealedThreadsPath), "%s/sealed-threads", directory);
+	snprintf(tamperedPath, sizeof(tamperedPath), "%s/tampered", directory);
+	snprintf(openedPath, sizeof(openedPath), "%s/opened", directory);
+	fill(key, sizeof(key), 42);
+
+	for(i = 0; i < sizeof(fileLengths) / sizeof(fileLengths[0]); i++) {
+		checkRoundTrip(fileLengths[i]);
+	}
+	checkTampering();
+
+	unlink(plainPath);
+	unlink(sealedPath);
+	unlink(sealedThreadsPath);
+	rmdir(directory);
+
+	printf("%s\n", (failures == 0) ? "passed" : "FAILED");
+	return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}